@@ -136,6 +136,89 @@ inline float CosineSampleHemispherePdf(float cos_theta)
     return cos_theta * M_1_PI_F;
 }
 
+/*
+ * Octahedral normal encoding used by the compact intersection storage
+ */
+inline float SignNotZero(float v)
+{
+    return v >= 0.f ? 1.f : -1.f;
+}
+
+inline Vector2 EncodeOctahedral(Vector3 n)
+{
+    // Project on the octahedron and fold the lower hemisphere over the upper one
+    const float inv_l1_norm = 1.f / (fabs(n.x) + fabs(n.y) + fabs(n.z));
+    const float u = n.x * inv_l1_norm;
+    const float v = n.y * inv_l1_norm;
+    if (n.z < 0.f)
+    {
+        return NewVector2((1.f - fabs(v)) * SignNotZero(u), (1.f - fabs(u)) * SignNotZero(v));
+    }
+
+    return NewVector2(u, v);
+}
+
+inline Vector3 DecodeOctahedral(float u, float v)
+{
+    const float z = 1.f - fabs(u) - fabs(v);
+    float x = u;
+    float y = v;
+    if (z < 0.f)
+    {
+        x = (1.f - fabs(v)) * SignNotZero(u);
+        y = (1.f - fabs(u)) * SignNotZero(v);
+    }
+    const float inv_norm = 1.f / sqrt(x * x + y * y + z * z);
+
+    return NewVector3(x * inv_norm, y * inv_norm, z * inv_norm);
+}
+
+/*
+ * Specialisation, when the program is built for a single configuration the runtime arguments are replaced by the
+ * SPEC_* build-time constants so the compiler can turn the divisions into shifts and unroll the sphere loop
+ */
+#ifdef SPEC_TILE_WIDTH
+#define TILE_WIDTH(value) SPEC_TILE_WIDTH
+#else
+#define TILE_WIDTH(value) (value)
+#endif
+
+#ifdef SPEC_TILE_HEIGHT
+#define TILE_HEIGHT(value) SPEC_TILE_HEIGHT
+#else
+#define TILE_HEIGHT(value) (value)
+#endif
+
+#ifdef SPEC_PIXEL_SAMPLES
+#define PIXEL_SAMPLES(value) SPEC_PIXEL_SAMPLES
+#else
+#define PIXEL_SAMPLES(value) (value)
+#endif
+
+#ifdef SPEC_TOTAL_SAMPLES
+#define TOTAL_SAMPLES(value) SPEC_TOTAL_SAMPLES
+#else
+#define TOTAL_SAMPLES(value) (value)
+#endif
+
+#ifdef SPEC_IMAGE_WIDTH
+#define IMAGE_WIDTH(value) SPEC_IMAGE_WIDTH
+#else
+#define IMAGE_WIDTH(value) (value)
+#endif
+
+#ifdef SPEC_IMAGE_HEIGHT
+#define IMAGE_HEIGHT(value) SPEC_IMAGE_HEIGHT
+#else
+#define IMAGE_HEIGHT(value) (value)
+#endif
+
+#ifdef SPEC_NUM_SPHERES
+#define NUM_SPHERES(value) SPEC_NUM_SPHERES
+#else
+#define NUM_SPHERES(value) (value)
+#endif
+
 /*
  * Camera struct and function to generate a ray for a given pixel
  */
@@ -149,18 +232,21 @@ typedef struct
     float w_x, w_y, w_z;
     // FOV
     float bottom, left;
-    // Image size
+    // Size of the film, the window of the image that is rendered
     const unsigned int image_width, image_height;
-    // Inverse of the size of the image
+    // Inverse of the size of the whole image
     const float inv_width, inv_height;
+    // Bottom left corner of the film in the image
+    const unsigned int film_x, film_y;
 } Camera;
 
 inline Vector3 GenerateRayDirection(__constant const Camera* camera,
                                     unsigned int px, unsigned int py,
                                     float sx, float sy)
 {
-    const float vp_x = camera->left * (1.f - 2.f * (px + sx) * camera->inv_width);
-    const float vp_y = camera->bottom * (1.f - 2.f * (py + sy) * camera->inv_height);
+    // The pixel is in the film, the film is a window of the image
+    const float vp_x = camera->left * (1.f - 2.f * (camera->film_x + px + sx) * camera->inv_width);
+    const float vp_y = camera->bottom * (1.f - 2.f * (camera->film_y + py + sy) * camera->inv_height);
 
     // Compute direction
     const float dir_x = vp_x * camera->u_x + vp_y * camera->v_x - camera->w_x;
@@ -291,6 +377,590 @@ inline Intersection FillIntersection(const Sphere sphere,
     return isect;
 }
 
+/*
+ * Triangles are stored in an indexed buffer, three vertex indices for each triangle. The intersection is the
+ * watertight test of Woop et al., rays through an edge or a vertex shared by two triangles always hit one of them
+ */
+inline Vector3 LoadVertex(__global const float* vertices, unsigned int vertex)
+{
+    return NewVector3(vertices[3 * vertex], vertices[3 * vertex + 1], vertices[3 * vertex + 2]);
+}
+
+inline float Component(Vector3 v, unsigned int axis)
+{
+    return axis == 0 ? v.x : (axis == 1 ? v.y : v.z);
+}
+
+inline bool IntersectRayTriangle(Vector3 p0, Vector3 p1, Vector3 p2, Vector3 o, Vector3 d,
+                                 float* ray_extent, float* b1, float* b2)
+{
+    // Permute the axes so the largest component of the direction is z, keep the winding if it is negative
+    const float abs_x = fabs(d.x);
+    const float abs_y = fabs(d.y);
+    const float abs_z = fabs(d.z);
+    const unsigned int kz = abs_x > abs_y ? (abs_x > abs_z ? 0 : 2) : (abs_y > abs_z ? 1 : 2);
+    unsigned int kx = kz == 2 ? 0 : kz + 1;
+    unsigned int ky = kx == 2 ? 0 : kx + 1;
+    if (Component(d, kz) < 0.f)
+    {
+        const unsigned int k = kx;
+        kx = ky;
+        ky = k;
+    }
+
+    // Shear so the ray goes along z from the origin
+    const float d_z = Component(d, kz);
+    const float s_x = Component(d, kx) / d_z;
+    const float s_y = Component(d, ky) / d_z;
+    const float s_z = 1.f / d_z;
+    const Vector3 a = NewVector3(p0.x - o.x, p0.y - o.y, p0.z - o.z);
+    const Vector3 b = NewVector3(p1.x - o.x, p1.y - o.y, p1.z - o.z);
+    const Vector3 c = NewVector3(p2.x - o.x, p2.y - o.y, p2.z - o.z);
+    const float a_x = Component(a, kx) - s_x * Component(a, kz);
+    const float a_y = Component(a, ky) - s_y * Component(a, kz);
+    const float b_x = Component(b, kx) - s_x * Component(b, kz);
+    const float b_y = Component(b, ky) - s_y * Component(b, kz);
+    const float c_x = Component(c, kx) - s_x * Component(c, kz);
+    const float c_y = Component(c, ky) - s_y * Component(c, kz);
+
+    // Scaled barycentric coordinates, the ray misses if they do not all have the same sign
+    const float u = c_x * b_y - c_y * b_x;
+    const float v = a_x * c_y - a_y * c_x;
+    const float w = b_x * a_y - b_y * a_x;
+    if ((u < 0.f || v < 0.f || w < 0.f) && (u > 0.f || v > 0.f || w > 0.f))
+    {
+        return false;
+    }
+    const float det = u + v + w;
+    if (det == 0.f)
+    {
+        return false;
+    }
+
+    // Hit distance
+    const float t = (u * s_z * Component(a, kz) + v * s_z * Component(b, kz) + w * s_z * Component(c, kz)) / det;
+    if (t <= 0.f || t >= *ray_extent)
+    {
+        return false;
+    }
+
+    *ray_extent = t;
+    *b1 = v / det;
+    *b2 = w / det;
+
+    return true;
+}
+
+inline Intersection FillTriangleIntersection(Vector3 p0, Vector3 p1, Vector3 p2,
+                                             float ray_origin_x, float ray_origin_y, float ray_origin_z,
+                                             float ray_direction_x, float ray_direction_y, float ray_direction_z,
+                                             float t_hit, float b1, float b2)
+{
+    Intersection isect;
+
+    isect.hit_point_x = ray_origin_x + t_hit * ray_direction_x;
+    isect.hit_point_y = ray_origin_y + t_hit * ray_direction_y;
+    isect.hit_point_z = ray_origin_z + t_hit * ray_direction_z;
+
+    // Geometric normal, triangles are two sided so it always faces the ray
+    const float e1_x = p1.x - p0.x, e1_y = p1.y - p0.y, e1_z = p1.z - p0.z;
+    const float e2_x = p2.x - p0.x, e2_y = p2.y - p0.y, e2_z = p2.z - p0.z;
+    float n_x = e1_y * e2_z - e1_z * e2_y;
+    float n_y = e1_z * e2_x - e1_x * e2_z;
+    float n_z = e1_x * e2_y - e1_y * e2_x;
+    float inv_norm = 1.f / sqrt(n_x * n_x + n_y * n_y + n_z * n_z);
+    if (n_x * ray_direction_x + n_y * ray_direction_y + n_z * ray_direction_z > 0.f)
+    {
+        inv_norm = -inv_norm;
+    }
+    isect.normal_x = n_x * inv_norm;
+    isect.normal_y = n_y * inv_norm;
+    isect.normal_z = n_z * inv_norm;
+
+    // Barycentric coordinates as UVs
+    isect.uv_s = b1;
+    isect.uv_t = b2;
+
+    return isect;
+}
+
+#ifdef USE_BVH
+/*
+ * Two level acceleration structure: the top level hierarchy is built over the instances and each instance places the
+ * bottom level hierarchy of a prototype in the world. Interior nodes have count 0 and the two children at left_first
+ * and left_first + 1, leaves reference count instances or primitives starting at left_first. Primitives are the
+ * spheres followed by the triangles
+ */
+typedef struct
+{
+    float min_x, min_y, min_z;
+    unsigned int left_first;
+    float max_x, max_y, max_z;
+    unsigned int count;
+} BVHNode;
+
+#ifdef BVH_WIDTH
+/*
+ * Compressed bottom level nodes with BVH_WIDTH children. The children bounds are quantised to 8 bits per axis on a
+ * grid placed at the origin with cell size 2^exponent, the bounds of all the children are tested at once with
+ * vector operations. Children are packed at the front, interior children have count 0 and child is the index of
+ * their node, leaves reference count primitives starting at child
+ */
+typedef struct
+{
+    float origin_x, origin_y, origin_z;
+    char exponent_x, exponent_y, exponent_z;
+    uchar num_children;
+    unsigned int child[BVH_WIDTH];
+    ushort count[BVH_WIDTH];
+    uchar min_x[BVH_WIDTH], min_y[BVH_WIDTH], min_z[BVH_WIDTH];
+    uchar max_x[BVH_WIDTH], max_y[BVH_WIDTH], max_z[BVH_WIDTH];
+} WideBVHNode;
+
+#if BVH_WIDTH == 4
+typedef float4 floatW;
+typedef int4 intW;
+#define VLOAD_W         vload4
+#define VSTORE_W        vstore4
+#define CONVERT_FLOAT_W convert_float4
+#elif BVH_WIDTH == 8
+typedef float8 floatW;
+typedef int8 intW;
+#define VLOAD_W         vload8
+#define VSTORE_W        vstore8
+#define CONVERT_FLOAT_W convert_float8
+#else
+#error "BVH_WIDTH must be 4 or 8"
+#endif
+
+typedef WideBVHNode BLASNode;
+
+// Matches the stack size the hierarchies are checked against on the host
+#define WIDE_BVH_STACK_SIZE     64
+#else
+typedef BVHNode BLASNode;
+#endif
+
+typedef struct
+{
+    // World to prototype transform, rows of a 3x4 matrix
+    float world_to_object[12];
+    // Root of the bottom level hierarchy of the prototype
+    unsigned int root_node;
+    unsigned int padding[3];
+} Instance;
+
+/*
+ * With COST_HEATMAP the primitives tested and the nodes visited by each ray are counted for the cost of the pixels
+ */
+#ifdef COST_HEATMAP
+#define COUNT_TESTS(counter, count) (*(counter) += (count))
+#else
+#define COUNT_TESTS(counter, count)
+#endif
+
+// Geometry of the prototypes
+typedef struct
+{
+    __global const Sphere* spheres;
+    unsigned int num_spheres;
+    __global const float* vertices;
+    __global const unsigned int* triangles;
+    __global const BLASNode* blas_nodes;
+    __global const unsigned int* primitive_indices;
+#ifdef COST_HEATMAP
+    // Tests done by the ray
+    unsigned int* tests;
+#endif
+} PrototypeGeometry;
+
+// Matches the maximum depth of the hierarchies built on the host
+#define BVH_STACK_SIZE          32
+
+// Distance where the ray enters the box, MAXFLOAT if it misses the box or enters it after the extent
+inline float IntersectRayBox(__global const BVHNode* node, Vector3 o, Vector3 inv_d, float extent)
+{
+    const float tx0 = (node->min_x - o.x) * inv_d.x;
+    const float tx1 = (node->max_x - o.x) * inv_d.x;
+    const float ty0 = (node->min_y - o.y) * inv_d.y;
+    const float ty1 = (node->max_y - o.y) * inv_d.y;
+    const float tz0 = (node->min_z - o.z) * inv_d.z;
+    const float tz1 = (node->max_z - o.z) * inv_d.z;
+    const float t_min = fmax(fmax(fmin(tx0, tx1), fmin(ty0, ty1)), fmin(tz0, tz1));
+    const float t_max = fmin(fmin(fmax(tx0, tx1), fmax(ty0, ty1)), fmax(tz0, tz1));
+
+    return (t_max >= fmax(t_min, 0.f) && t_min < extent) ? t_min : MAXFLOAT;
+}
+
+inline Vector3 TransformPoint(__global const float* m, Vector3 p)
+{
+    return NewVector3(m[0] * p.x + m[1] * p.y + m[2] * p.z + m[3],
+                      m[4] * p.x + m[5] * p.y + m[6] * p.z + m[7],
+                      m[8] * p.x + m[9] * p.y + m[10] * p.z + m[11]);
+}
+
+inline Vector3 TransformDirection(__global const float* m, Vector3 d)
+{
+    return NewVector3(m[0] * d.x + m[1] * d.y + m[2] * d.z,
+                      m[4] * d.x + m[5] * d.y + m[6] * d.z,
+                      m[8] * d.x + m[9] * d.y + m[10] * d.z);
+}
+
+// Move a prototype normal to the world with the transpose of the world to prototype transform
+inline Vector3 TransformNormal(__global const float* m, Vector3 n)
+{
+    const float n_x = m[0] * n.x + m[4] * n.y + m[8] * n.z;
+    const float n_y = m[1] * n.x + m[5] * n.y + m[9] * n.z;
+    const float n_z = m[2] * n.x + m[6] * n.y + m[10] * n.z;
+    const float inv_norm = 1.f / sqrt(n_x * n_x + n_y * n_y + n_z * n_z);
+
+    return NewVector3(n_x * inv_norm, n_y * inv_norm, n_z * inv_norm);
+}
+
+// Select the child to visit next and push the other one if the ray enters it, returns false if both are missed
+inline bool SelectChild(__global const BVHNode* nodes, unsigned int left, Vector3 o, Vector3 inv_d, float extent,
+                        unsigned int* stack, unsigned int* stack_size, unsigned int* node_index)
+{
+    const float t_left = IntersectRayBox(nodes + left, o, inv_d, extent);
+    const float t_right = IntersectRayBox(nodes + left + 1, o, inv_d, extent);
+    if (t_left == MAXFLOAT && t_right == MAXFLOAT)
+    {
+        return false;
+    }
+
+    // Visit the closest child first
+    const bool left_first = t_left <= t_right;
+    *node_index = left_first ? left : left + 1;
+    if ((left_first ? t_right : t_left) != MAXFLOAT)
+    {
+        stack[(*stack_size)++] = left_first ? left + 1 : left;
+    }
+
+    return true;
+}
+
+// Intersect a primitive, the ray is in prototype space. Updates the extent and the barycentric coordinates of
+// triangles if the primitive is closer
+inline bool IntersectPrimitive(const PrototypeGeometry* geometry, unsigned int primitive, Vector3 o, Vector3 d,
+                               float* extent, float* b1, float* b2)
+{
+    COUNT_TESTS(geometry->tests, 1);
+    if (primitive < geometry->num_spheres)
+    {
+        return IntersectRaySphere(geometry->spheres[primitive], o.x, o.y, o.z, d.x, d.y, d.z, extent);
+    }
+
+    __global const unsigned int* triangle = geometry->triangles + 3 * (primitive - geometry->num_spheres);
+    return IntersectRayTriangle(LoadVertex(geometry->vertices, triangle[0]),
+                                LoadVertex(geometry->vertices, triangle[1]),
+                                LoadVertex(geometry->vertices, triangle[2]),
+                                o, d, extent, b1, b2);
+}
+
+// Intersection data of the primitive hit, the ray is in prototype space
+inline Intersection FillPrimitiveIntersection(const PrototypeGeometry* geometry, unsigned int primitive,
+                                              Vector3 o, Vector3 d, float t_hit, float b1, float b2)
+{
+    if (primitive < geometry->num_spheres)
+    {
+        return FillIntersection(geometry->spheres[primitive], o.x, o.y, o.z, d.x, d.y, d.z, t_hit);
+    }
+
+    __global const unsigned int* triangle = geometry->triangles + 3 * (primitive - geometry->num_spheres);
+    return FillTriangleIntersection(LoadVertex(geometry->vertices, triangle[0]),
+                                    LoadVertex(geometry->vertices, triangle[1]),
+                                    LoadVertex(geometry->vertices, triangle[2]),
+                                    o.x, o.y, o.z, d.x, d.y, d.z, t_hit, b1, b2);
+}
+
+#ifdef BVH_WIDTH
+// Cell size of the quantisation grid, the exponent is in the range of normal floats
+inline float ExponentScale(char exponent)
+{
+    return as_float((unsigned int)(exponent + 127) << 23);
+}
+
+// Distance where the ray enters each child of the node, MAXFLOAT for the children missed or entered after the
+// extent. The decoded bounds are exact since the quantised coordinates are small integers times a power of two
+inline void IntersectRayChildren(__global const WideBVHNode* node, Vector3 o, Vector3 inv_d, float extent,
+                                 float* t_children)
+{
+    const float scale_x = ExponentScale(node->exponent_x);
+    const float scale_y = ExponentScale(node->exponent_y);
+    const float scale_z = ExponentScale(node->exponent_z);
+    const floatW tx0 = (node->origin_x + CONVERT_FLOAT_W(VLOAD_W(0, node->min_x)) * scale_x - o.x) * inv_d.x;
+    const floatW tx1 = (node->origin_x + CONVERT_FLOAT_W(VLOAD_W(0, node->max_x)) * scale_x - o.x) * inv_d.x;
+    const floatW ty0 = (node->origin_y + CONVERT_FLOAT_W(VLOAD_W(0, node->min_y)) * scale_y - o.y) * inv_d.y;
+    const floatW ty1 = (node->origin_y + CONVERT_FLOAT_W(VLOAD_W(0, node->max_y)) * scale_y - o.y) * inv_d.y;
+    const floatW tz0 = (node->origin_z + CONVERT_FLOAT_W(VLOAD_W(0, node->min_z)) * scale_z - o.z) * inv_d.z;
+    const floatW tz1 = (node->origin_z + CONVERT_FLOAT_W(VLOAD_W(0, node->max_z)) * scale_z - o.z) * inv_d.z;
+    const floatW t_min = fmax(fmax(fmin(tx0, tx1), fmin(ty0, ty1)), fmin(tz0, tz1));
+    const floatW t_max = fmin(fmin(fmax(tx0, tx1), fmax(ty0, ty1)), fmax(tz0, tz1));
+
+    const intW hit = isgreaterequal(t_max, fmax(t_min, (floatW)(0.f))) & isless(t_min, (floatW)(extent));
+    VSTORE_W(select((floatW)(MAXFLOAT), t_min, hit), 0, t_children);
+}
+
+// Closest hit with the primitives of a prototype, the ray is in prototype space. Updates the extent, the index of
+// the primitive and its barycentric coordinates if a closer hit is found
+inline bool IntersectPrototype(const PrototypeGeometry* geometry, unsigned int root_node, Vector3 o, Vector3 d,
+                               float* extent, unsigned int* closest_primitive, float* b1, float* b2)
+{
+    const Vector3 inv_d = NewVector3(1.f / d.x, 1.f / d.y, 1.f / d.z);
+    unsigned int stack[WIDE_BVH_STACK_SIZE];
+    unsigned int stack_size = 0;
+    unsigned int node_index = root_node;
+    bool hit = false;
+
+    while (true)
+    {
+        __global const WideBVHNode* node = geometry->blas_nodes + node_index;
+        COUNT_TESTS(geometry->tests, 1);
+        float t_children[BVH_WIDTH];
+        IntersectRayChildren(node, o, inv_d, *extent, t_children);
+
+        // Leaves are intersected right away, the interior children hit are sorted by distance
+        unsigned int hit_nodes[BVH_WIDTH];
+        float hit_t[BVH_WIDTH];
+        unsigned int num_hit = 0;
+        for (unsigned int c = 0; c != node->num_children; c++)
+        {
+            if (t_children[c] == MAXFLOAT)
+            {
+                continue;
+            }
+            if (node->count[c] != 0)
+            {
+                for (unsigned int p = node->child[c]; p != node->child[c] + node->count[c]; p++)
+                {
+                    const unsigned int primitive = geometry->primitive_indices[p];
+                    if (IntersectPrimitive(geometry, primitive, o, d, extent, b1, b2))
+                    {
+                        *closest_primitive = primitive;
+                        hit = true;
+                    }
+                }
+            }
+            else
+            {
+                unsigned int i = num_hit++;
+                for (; i != 0 && hit_t[i - 1] > t_children[c]; i--)
+                {
+                    hit_t[i] = hit_t[i - 1];
+                    hit_nodes[i] = hit_nodes[i - 1];
+                }
+                hit_t[i] = t_children[c];
+                hit_nodes[i] = node->child[c];
+            }
+        }
+
+        // Visit the closest child next and push the others from the farthest, skipping the ones the leaves
+        // intersected above moved beyond the extent
+        if (num_hit != 0 && hit_t[0] < *extent)
+        {
+            for (unsigned int i = num_hit - 1; i != 0; i--)
+            {
+                if (hit_t[i] < *extent)
+                {
+                    stack[stack_size++] = hit_nodes[i];
+                }
+            }
+            node_index = hit_nodes[0];
+            continue;
+        }
+
+        if (stack_size == 0)
+        {
+            break;
+        }
+        node_index = stack[--stack_size];
+    }
+
+    return hit;
+}
+#else
+// Closest hit with the primitives of a prototype, the ray is in prototype space. Updates the extent, the index of
+// the primitive and its barycentric coordinates if a closer hit is found
+inline bool IntersectPrototype(const PrototypeGeometry* geometry, unsigned int root_node, Vector3 o, Vector3 d,
+                               float* extent, unsigned int* closest_primitive, float* b1, float* b2)
+{
+    const Vector3 inv_d = NewVector3(1.f / d.x, 1.f / d.y, 1.f / d.z);
+    unsigned int stack[BVH_STACK_SIZE];
+    unsigned int stack_size = 0;
+    unsigned int node_index = root_node;
+    bool hit = false;
+
+    while (true)
+    {
+        __global const BVHNode* node = geometry->blas_nodes + node_index;
+        COUNT_TESTS(geometry->tests, 1);
+        if (node->count != 0)
+        {
+            for (unsigned int p = node->left_first; p != node->left_first + node->count; p++)
+            {
+                const unsigned int primitive = geometry->primitive_indices[p];
+                if (IntersectPrimitive(geometry, primitive, o, d, extent, b1, b2))
+                {
+                    *closest_primitive = primitive;
+                    hit = true;
+                }
+            }
+        }
+        else if (SelectChild(geometry->blas_nodes, node->left_first, o, inv_d, *extent,
+                             stack, &stack_size, &node_index))
+        {
+            continue;
+        }
+
+        if (stack_size == 0)
+        {
+            break;
+        }
+        node_index = stack[--stack_size];
+    }
+
+    return hit;
+}
+#endif
+
+// Closest hit in the scene, returns the index of the primitive hit or INVALID_PRIM_INDEX
+inline unsigned int IntersectScene(__global const BVHNode* tlas_nodes, __global const Instance* instances,
+                                   const PrototypeGeometry* geometry, Vector3 o, Vector3 d,
+                                   float* extent, unsigned int* hit_instance, float* b1, float* b2)
+{
+    const Vector3 inv_d = NewVector3(1.f / d.x, 1.f / d.y, 1.f / d.z);
+    unsigned int stack[BVH_STACK_SIZE];
+    unsigned int stack_size = 0;
+    unsigned int node_index = 0;
+    unsigned int closest_primitive = INVALID_PRIM_INDEX;
+
+    while (true)
+    {
+        __global const BVHNode* node = tlas_nodes + node_index;
+        COUNT_TESTS(geometry->tests, 1);
+        if (node->count != 0)
+        {
+            for (unsigned int i = node->left_first; i != node->left_first + node->count; i++)
+            {
+                // Move the ray to the space of the prototype, the direction is not normalised so the extent is
+                // the same in both spaces
+                __global const Instance* instance = instances + i;
+                if (IntersectPrototype(geometry, instance->root_node,
+                                       TransformPoint(instance->world_to_object, o),
+                                       TransformDirection(instance->world_to_object, d),
+                                       extent, &closest_primitive, b1, b2))
+                {
+                    *hit_instance = i;
+                }
+            }
+        }
+        else if (SelectChild(tlas_nodes, node->left_first, o, inv_d, *extent, stack, &stack_size, &node_index))
+        {
+            continue;
+        }
+
+        if (stack_size == 0)
+        {
+            break;
+        }
+        node_index = stack[--stack_size];
+    }
+
+    return closest_primitive;
+}
+#endif
+
+/*
+ * Storage layout of the rays, intersections and samples streams, each stream is a single buffer of 32 bit elements.
+ * The layout is selected when building the program:
+ * - LAYOUT_SOA: each field is stored contiguously for all the samples
+ * - LAYOUT_AOS: all the fields of a sample are stored contiguously
+ * - LAYOUT_AOSOA: blocks of LAYOUT_BLOCK samples are stored in SoA layout
+ */
+#if defined(LAYOUT_AOSOA) && !defined(LAYOUT_BLOCK)
+#define LAYOUT_BLOCK            8
+#endif
+
+// Rays stream
+#define RAY_ORIGIN              0
+#define RAY_DIRECTION           3
+#define RAY_FIELDS              6
+
+// Intersections stream
+#define ISECT_HIT_POINT         0
+#ifdef COMPACT_INTERSECTIONS
+// Octahedral encoded normal and uv are stored as two packed half, wo is not stored
+#define ISECT_NORMAL_OCT        3
+#define ISECT_UV                4
+#define ISECT_FIELDS            5
+#else
+#define ISECT_NORMAL            3
+#define ISECT_UV                6
+#define ISECT_WO                8
+#define ISECT_FIELDS            11
+#endif
+
+// Samples stream, pixel coordinates are stored as unsigned int
+#define SAMPLE_LI               0
+#define SAMPLE_BETA             3
+#define SAMPLE_PIXEL            6
+#define SAMPLE_OFFSET           8
+#define SAMPLE_FIELDS           10
+
+// Compute the index of a sample field in a stream with the given number of fields and count of samples
+inline unsigned int StreamIndex(unsigned int tid, unsigned int field, unsigned int num_fields, unsigned int count)
+{
+#if defined(LAYOUT_AOS)
+    return tid * num_fields + field;
+#elif defined(LAYOUT_AOSOA)
+    return (tid / LAYOUT_BLOCK) * (num_fields * LAYOUT_BLOCK) + field * LAYOUT_BLOCK + (tid % LAYOUT_BLOCK);
+#else
+    return field * count + tid;
+#endif
+}
+
+#define RAY_INDEX(tid, field, count)        StreamIndex(tid, field, RAY_FIELDS, count)
+#define ISECT_INDEX(tid, field, count)      StreamIndex(tid, field, ISECT_FIELDS, count)
+#define SAMPLE_INDEX(tid, field, count)     StreamIndex(tid, field, SAMPLE_FIELDS, count)
+
+inline Vector3 LoadVector3(__global const float* stream, unsigned int tid, unsigned int field,
+                           unsigned int num_fields, unsigned int count)
+{
+    return NewVector3(stream[StreamIndex(tid, field, num_fields, count)],
+                      stream[StreamIndex(tid, field + 1, num_fields, count)],
+                      stream[StreamIndex(tid, field + 2, num_fields, count)]);
+}
+
+inline void StoreVector3(__global float* stream, unsigned int tid, unsigned int field,
+                         unsigned int num_fields, unsigned int count, Vector3 v)
+{
+    stream[StreamIndex(tid, field, num_fields, count)] = v.x;
+    stream[StreamIndex(tid, field + 1, num_fields, count)] = v.y;
+    stream[StreamIndex(tid, field + 2, num_fields, count)] = v.z;
+}
+
+inline void StoreHalf2(__global float* stream, unsigned int index, float a, float b)
+{
+    vstore_half2((float2)(a, b), 0, (__global half*)&stream[index]);
+}
+
+inline Vector2 LoadHalf2(__global const float* stream, unsigned int index)
+{
+    const float2 v = vload_half2(0, (__global const half*)&stream[index]);
+    return NewVector2(v.x, v.y);
+}
+
+// Load the intersection normal from the intersection stream
+inline Vector3 LoadNormal(__global const float* intersections, unsigned int tid, unsigned int count)
+{
+#ifdef COMPACT_INTERSECTIONS
+    const Vector2 e = LoadHalf2(intersections, ISECT_INDEX(tid, ISECT_NORMAL_OCT, count));
+    return DecodeOctahedral(e.x, e.y);
+#else
+    return LoadVector3(intersections, tid, ISECT_NORMAL, ISECT_FIELDS, count);
+#endif
+}
+
 /*
  * Random number generation
  */
@@ -343,6 +1013,57 @@ inline void AtomicAddGF(volatile __global float *addr, float val)
     } while(current.u32 != expected.u32);
 }
 
+/*
+ * Statistics of the wavefront, only compiled with ENABLE_STATS. The counters are 64 bit values stored as low and high
+ * 32 bit words, each work-group sums its counts in local memory and adds them to the global counters once. The
+ * layout must match RenderStatistics on the host
+ */
+#ifdef ENABLE_STATS
+// Rays traced and rays that hit something at each depth
+#define STAT_RAYS               0
+#define STAT_HITS               (STAT_RAYS + MAX_DEPTH)
+// Paths terminated by leaving the scene, hitting an emitter, a black material or the maximum depth
+#define STAT_ESCAPED            (STAT_HITS + MAX_DEPTH)
+#define STAT_EMITTER            (STAT_ESCAPED + 1)
+#define STAT_ABSORBED           (STAT_EMITTER + 1)
+#define STAT_MAX_DEPTH          (STAT_ABSORBED + 1)
+// Work-items of Intersect with a ray to trace and launched
+#define STAT_ACTIVE_LANES       (STAT_MAX_DEPTH + 1)
+#define STAT_LAUNCHED_LANES     (STAT_ACTIVE_LANES + 1)
+#define NUM_STATS               (STAT_LAUNCHED_LANES + 1)
+
+#define STAT_ADD(counter, value) (void)atomic_add(&group_stats[(counter)], (value))
+
+inline void BeginStats(__local unsigned int* group_stats)
+{
+    for (unsigned int i = get_local_id(0); i < NUM_STATS; i += get_local_size(0))
+    {
+        group_stats[i] = 0;
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+}
+
+inline void EndStats(__local unsigned int* group_stats, __global unsigned int* stats)
+{
+    barrier(CLK_LOCAL_MEM_FENCE);
+    for (unsigned int i = get_local_id(0); i < NUM_STATS; i += get_local_size(0))
+    {
+        const unsigned int count = group_stats[i];
+        if (count != 0)
+        {
+            // The add that wraps the low word around carries into the high one
+            const unsigned int low = atomic_add(&stats[2 * i], count);
+            if (low + count < low)
+            {
+                (void)atomic_inc(&stats[2 * i + 1]);
+            }
+        }
+    }
+}
+#else
+#define STAT_ADD(counter, value)
+#endif
+
 /*
  * Initialise kernel only sets the ray depth to DONE and the seed for the random number generation
  */
@@ -350,10 +1071,14 @@ __kernel void Initialise(// The ray depth is set to RAY_FIRST_TILE_DEPTH so the
                          __global unsigned int* ray_depth,
                          // XOrsShift state
                          __global unsigned int* xorshift_state,
+                         // Band of rows of tiles and sample pass rendered, the generators of each one start from
+                         // different states
+                         unsigned int generator_stream,
                          // Total number of samples
-                         unsigned int total_samples)
+                         unsigned int total_samples_arg)
 {
     const unsigned int tid = get_global_id(0);
+    const unsigned int total_samples = TOTAL_SAMPLES(total_samples_arg);
     if (tid < total_samples)
     {
         // Ray depth is set such that the first Restart sets them up
@@ -364,7 +1089,8 @@ __kernel void Initialise(// The ray depth is set to RAY_FIRST_TILE_DEPTH so the
         unsigned int xorshift_init_state = 0;
         do
         {
-            xorshift_init_state = XORSHIFT_STATE_START + mult++ * XORSHIFT_STATE_MULT * tid;
+            xorshift_init_state = XORSHIFT_STATE_START +
+                                  mult++ * XORSHIFT_STATE_MULT * (tid + generator_stream * total_samples);
         } while (xorshift_init_state == 0);
         xorshift_state[tid] = xorshift_init_state;
         (void)NextUInt32(&xorshift_state[tid]);
@@ -375,54 +1101,70 @@ __kernel void Initialise(// The ray depth is set to RAY_FIRST_TILE_DEPTH so the
  * Restart samples kernel, last flag is used to tell the kernel if this is the first tile or not
  */
 __kernel void RestartSample(__constant const Camera* camera,
-                            // Rays description
-                            __global float* ray_origin_x, __global float* ray_origin_y, __global float* ray_origin_z,
-                            __global float* ray_direction_x, __global float* ray_direction_y, __global float* ray_direction_z, 
+                            // Rays stream and depth
+                            __global float* rays,
                             __global unsigned int* ray_depth,
                             // Index of the primitive hit
                             __global unsigned int* primitive_index,
-                            // Samples description
-                            __global float* Li_r, __global float* Li_g, __global float* Li_b,
-                            __global float* beta_r, __global float* beta_g, __global float* beta_b,
-                            __global unsigned int* pixel_x, __global unsigned int* pixel_y,
-                            __global float* sample_offset_x, __global float* sample_offset_y,
+                            // Samples stream
+                            __global float* samples,
                             // Pixel where the sample deposit their computed radiance value
                             __global float* pixel_r, __global float* pixel_g, __global float* pixel_b,
                             __global float* filter_weight,
                             // Random number generator state
                             __global unsigned int* xorshift_state,
                             // Description of the tile
-                            unsigned int tile_width, unsigned int tile_height,
-                            unsigned int samples_per_pixel,
+                            unsigned int tile_width_arg, unsigned int tile_height_arg,
+                            unsigned int samples_per_pixel_arg,
+                            // Rows of tiles [first, end) the samples walk through
+                            unsigned int first_tile_row, unsigned int end_tile_row,
                             // Number of samples done
-                            __global unsigned int* samples_done)
+                            __global unsigned int* samples_done,
+                            // Number of samples that left each row of tiles
+                            __global unsigned int* tile_rows_done)
 {
     const unsigned int tid = get_global_id(0);
+    const unsigned int tile_width = TILE_WIDTH(tile_width_arg);
+    const unsigned int tile_height = TILE_HEIGHT(tile_height_arg);
+    const unsigned int samples_per_pixel = PIXEL_SAMPLES(samples_per_pixel_arg);
+    const unsigned int image_width = IMAGE_WIDTH(camera->image_width);
+    const unsigned int image_height = IMAGE_HEIGHT(camera->image_height);
+    const unsigned int total_samples = tile_width * tile_height * samples_per_pixel;
+    // Samples stop at the end of the last row of tiles or of the image
+    const unsigned int end_y = min(image_height, end_tile_row * tile_height);
     // Check if we need to restart this ray or not
-    if (tid < tile_width * tile_height * samples_per_pixel)
+    if (tid < total_samples)
     {
         const unsigned int current_ray_depth = ray_depth[tid];
         if (current_ray_depth != RAY_DONE_DEPTH &&
             (current_ray_depth == RAY_TO_RESTART_DEPTH || current_ray_depth == RAY_FIRST_TILE_DEPTH))
         {
+            // Pixel coordinates are stored as unsigned int in the samples stream
+            __global unsigned int* sample_pixel = (__global unsigned int*)samples;
+            const unsigned int pixel_x_index = SAMPLE_INDEX(tid, SAMPLE_PIXEL, total_samples);
+            const unsigned int pixel_y_index = SAMPLE_INDEX(tid, SAMPLE_PIXEL + 1, total_samples);
+
             // Compute the coordinates of the pixel in the tile for the sample
             const unsigned int linear_pixel_index = tid / samples_per_pixel;
             const unsigned int tile_y = linear_pixel_index / tile_width;
             const unsigned int tile_x = linear_pixel_index - tile_y * tile_width;
 
             unsigned int px, py;
+            // Row of tiles the sample is leaving, all samples start in the first one
+            unsigned int current_tile_row = first_tile_row;
             // Check if this is the first tile or not
             if (current_ray_depth == RAY_FIRST_TILE_DEPTH) 
             {
                 px = tile_x;
-                py = tile_y;
+                py = tile_y + first_tile_row * tile_height;
             }
             else 
             {
-                const unsigned int current_pixel_x = pixel_x[tid];
-                const unsigned int current_pixel_y = pixel_y[tid];
+                const unsigned int current_pixel_x = sample_pixel[pixel_x_index];
+                const unsigned int current_pixel_y = sample_pixel[pixel_y_index];
+                current_tile_row = current_pixel_y / tile_height;
                 // Check if the sample's pixel is in the right next tile
-                if (current_pixel_x + tile_width < camera->image_width)
+                if (current_pixel_x + tile_width < image_width)
                 {
                     // Only update pixel x coordinate
                     px = current_pixel_x + tile_width;
@@ -431,7 +1173,7 @@ __kernel void RestartSample(__constant const Camera* camera,
                 else 
                 {
                     // Check if we can go up
-                    if (current_pixel_y + tile_height < camera->image_height)
+                    if (current_pixel_y + tile_height < end_y)
                     {
                         // We went up, update pixel y and x
                         px = tile_x;
@@ -440,27 +1182,30 @@ __kernel void RestartSample(__constant const Camera* camera,
                     else
                     {
                         // The sample is done, we set the pixel coordinate to the image size so we take it into account
-                        px = camera->image_width;
-                        py = camera->image_height;
+                        px = image_width;
+                        py = image_height;
                     }
                 }
             }
 
+            // Count the sample out of the rows of tiles it left, a done sample leaves all the remaining ones
+            const bool inside_image = px < image_width && py < end_y;
+            const unsigned int next_tile_row = inside_image ? py / tile_height : end_tile_row;
+            for (unsigned int row = current_tile_row; row < next_tile_row; row++)
+            {
+                (void)atomic_inc(&tile_rows_done[row]);
+            }
+
             // Check we are inside the image
-            if (px < camera->image_width && py < camera->image_height)
+            if (inside_image)
             {
                 // Reset samples' accumulated value
-                Li_r[tid] = 0.f;
-                Li_g[tid] = 0.f;
-                Li_b[tid] = 0.f;
-
-                beta_r[tid] = 1.f;
-                beta_g[tid] = 1.f;
-                beta_b[tid] = 1.f;
+                StoreVector3(samples, tid, SAMPLE_LI, SAMPLE_FIELDS, total_samples, NewVector3(0.f, 0.f, 0.f));
+                StoreVector3(samples, tid, SAMPLE_BETA, SAMPLE_FIELDS, total_samples, NewVector3(1.f, 1.f, 1.f));
 
                 // Store
-                pixel_x[tid] = px;
-                pixel_y[tid] = py;
+                sample_pixel[pixel_x_index] = px;
+                sample_pixel[pixel_y_index] = py;
 
                 // Generate a random offset in the pixel for each sample
                 // This is pure random now, next would be to stratify the samples
@@ -468,19 +1213,16 @@ __kernel void RestartSample(__constant const Camera* camera,
                 const float sy = GenerateFloat(&xorshift_state[tid]);
 
                 // Store
-                sample_offset_x[tid] = sx;
-                sample_offset_y[tid] = sy;
+                samples[SAMPLE_INDEX(tid, SAMPLE_OFFSET, total_samples)] = sx;
+                samples[SAMPLE_INDEX(tid, SAMPLE_OFFSET + 1, total_samples)] = sy;
 
                 // Setup the rays for each sample
-                ray_origin_x[tid] = camera->eye_x;
-                ray_origin_y[tid] = camera->eye_y;
-                ray_origin_z[tid] = camera->eye_z;
+                StoreVector3(rays, tid, RAY_ORIGIN, RAY_FIELDS, total_samples,
+                             NewVector3(camera->eye_x, camera->eye_y, camera->eye_z));
 
                 // Generate direction and store
-                const Vector3 ray_direction = GenerateRayDirection(camera, px, py, sx, sy);
-                ray_direction_x[tid] = ray_direction.x;
-                ray_direction_y[tid] = ray_direction.y;
-                ray_direction_z[tid] = ray_direction.z;
+                StoreVector3(rays, tid, RAY_DIRECTION, RAY_FIELDS, total_samples,
+                             GenerateRayDirection(camera, px, py, sx, sy));
 
                 // Reset depth
                 ray_depth[tid] = 0;
@@ -498,96 +1240,268 @@ __kernel void RestartSample(__constant const Camera* camera,
     }
 }
 
+/*
+ * Without acceleration structure the rays are tested against all the spheres. Tiny scenes are read from constant
+ * memory, all the work-items read the same sphere at the same time so the constant cache broadcasts it. Larger
+ * scenes are copied to local memory by each work-group one tile of SPHERE_TILE_SIZE spheres at a time
+ */
+#if defined(CONSTANT_SPHERES) && !defined(USE_BVH)
+#define SPHERES_ADDRESS_SPACE __constant
+#else
+#define SPHERES_ADDRESS_SPACE __global
+#endif
+
+#if defined(SPHERE_TILE_SIZE) && !defined(USE_BVH)
+#define SPHERE_TILES
+#endif
+
+#ifdef SPHERE_TILES
+/*
+ * Find the closest sphere hit by the ray of the work-item, num_spheres if none. All the work-items of the group must
+ * call it because of the barriers, inactive ones only help with the copies
+ */
+inline unsigned int IntersectSphereTiles(__global const Sphere* spheres, unsigned int num_spheres,
+                                         __local Sphere* sphere_tile, bool active,
+                                         __global const float* rays, unsigned int tid, unsigned int total_samples,
+                                         float* extent)
+{
+    const unsigned int local_id = get_local_id(0);
+    const unsigned int local_size = get_local_size(0);
+    const Vector3 zero = NewVector3(0.f, 0.f, 0.f);
+    const Vector3 o = active ? LoadVector3(rays, tid, RAY_ORIGIN, RAY_FIELDS, total_samples) : zero;
+    const Vector3 d = active ? LoadVector3(rays, tid, RAY_DIRECTION, RAY_FIELDS, total_samples) : zero;
+
+    unsigned int closest_primitive = num_spheres;
+    for (unsigned int tile_start = 0; tile_start < num_spheres; tile_start += SPHERE_TILE_SIZE)
+    {
+        const unsigned int tile_spheres = min(num_spheres - tile_start, (unsigned int)SPHERE_TILE_SIZE);
+        // The previous tile must be tested by all the work-items before it is replaced
+        barrier(CLK_LOCAL_MEM_FENCE);
+        for (unsigned int s = local_id; s < tile_spheres; s += local_size)
+        {
+            sphere_tile[s] = spheres[tile_start + s];
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+
+        if (active)
+        {
+            for (unsigned int s = 0; s != tile_spheres; s++)
+            {
+                if (IntersectRaySphere(sphere_tile[s], o.x, o.y, o.z, d.x, d.y, d.z, extent))
+                {
+                    closest_primitive = tile_start + s;
+                }
+            }
+        }
+    }
+
+    return closest_primitive;
+}
+#endif
+
 /*
  * Intersect kernel
  */
 __kernel void Intersect(// Spheres in the scene
-                        __global const Sphere* spheres, unsigned int num_spheres,
-                        // Ray origin and direction
-                        __global const float* ray_origin_x, __global const float* ray_origin_y, __global const float* ray_origin_z,
-                        __global const float* ray_direction_x, __global const float* ray_direction_y, __global const float* ray_direction_z,
+                        SPHERES_ADDRESS_SPACE const Sphere* spheres, unsigned int num_spheres_arg,
+#ifdef USE_BVH
+                        // Top level hierarchy and instances, bottom level hierarchies of the prototypes
+                        __global const BVHNode* tlas_nodes,
+                        __global const Instance* instances,
+                        __global const BLASNode* blas_nodes,
+                        __global const unsigned int* primitive_indices,
+                        // Triangles
+                        __global const float* vertices,
+                        __global const unsigned int* triangles,
+#endif
+                        // Rays stream and depth
+                        __global const float* rays,
                         __global unsigned int* ray_depth,
-                        // Intersection information
-                        __global float* hit_point_x, __global float* hit_point_y, __global float* hit_point_z,
-                        __global float* normal_x, __global float* normal_y, __global float* normal_z,
-                        __global float* uv_s, __global float* uv_t, 
-                        __global float* wo_x, __global float* wo_y, __global float* wo_z,
+                        // Intersections stream
+                        __global float* intersections,
                         __global unsigned int* primitive_index,
+#ifdef COST_HEATMAP
+                        // Samples stream with the pixel of each sample, rays traced and tests done for each pixel
+                        __constant const Camera* camera,
+                        __global const float* samples,
+                        __global unsigned int* pixel_rays, __global unsigned int* pixel_tests,
+#endif
+#ifdef ENABLE_STATS
+                        // Statistics counters
+                        __global unsigned int* stats,
+#endif
                         // Total number of samples
-                        unsigned int total_samples)
+                        unsigned int total_samples_arg)
 {
     const unsigned int tid = get_global_id(0);
+    const unsigned int total_samples = TOTAL_SAMPLES(total_samples_arg);
+    const unsigned int num_spheres = NUM_SPHERES(num_spheres_arg);
+#ifdef ENABLE_STATS
+    __local unsigned int group_stats[NUM_STATS];
+    BeginStats(group_stats);
+    STAT_ADD(STAT_LAUNCHED_LANES, 1);
+#endif
+#ifdef SPHERE_TILES
+    // The work-items without a ray take part in the copies of the tiles anyway
+    __local Sphere sphere_tile[SPHERE_TILE_SIZE];
+    float tile_extent = MAXFLOAT;
+    const unsigned int tile_closest_primitive = IntersectSphereTiles(spheres, num_spheres, sphere_tile,
+                                                                     tid < total_samples &&
+                                                                     ray_depth[tid] != RAY_DONE_DEPTH,
+                                                                     rays, tid, total_samples, &tile_extent);
+#endif
     if (tid < total_samples && ray_depth[tid] != RAY_DONE_DEPTH)
     {
         // Load ray data
-        const float ox = ray_origin_x[tid];
-        const float oy = ray_origin_y[tid];
-        const float oz = ray_origin_z[tid];
-        const float dx = ray_direction_x[tid];
-        const float dy = ray_direction_y[tid];
-        const float dz = ray_direction_z[tid];
+        const Vector3 o = LoadVector3(rays, tid, RAY_ORIGIN, RAY_FIELDS, total_samples);
+        const Vector3 d = LoadVector3(rays, tid, RAY_DIRECTION, RAY_FIELDS, total_samples);
         float extent = MAXFLOAT;
-
+#ifdef ENABLE_STATS
+        const unsigned int stat_depth = min(ray_depth[tid], MAX_DEPTH - 1u);
+        STAT_ADD(STAT_ACTIVE_LANES, 1);
+        STAT_ADD(STAT_RAYS + stat_depth, 1);
+#endif
+
+#ifdef USE_BVH
+        // Traverse the acceleration structure
+#ifdef COST_HEATMAP
+        unsigned int cost_tests = 0;
+#endif
+        const PrototypeGeometry geometry = { .spheres = spheres, .num_spheres = num_spheres,
+                                             .vertices = vertices, .triangles = triangles,
+                                             .blas_nodes = blas_nodes, .primitive_indices = primitive_indices,
+#ifdef COST_HEATMAP
+                                             .tests = &cost_tests
+#endif
+                                           };
+        unsigned int hit_instance = 0;
+        float b1 = 0.f;
+        float b2 = 0.f;
+        const unsigned int closest_primitive = IntersectScene(tlas_nodes, instances, &geometry, o, d,
+                                                              &extent, &hit_instance, &b1, &b2);
+        const bool hit = closest_primitive != INVALID_PRIM_INDEX;
+#elif defined(SPHERE_TILES)
+        extent = tile_extent;
+        const unsigned int closest_primitive = tile_closest_primitive;
+        const bool hit = closest_primitive != num_spheres;
+        Sphere closest_sphere;
+        if (hit)
+        {
+            closest_sphere = spheres[closest_primitive];
+        }
+#else
         // Intersect ray with spheres
-        unsigned int closest_sphere_index = num_spheres;
+        unsigned int closest_primitive = num_spheres;
         Sphere closest_sphere;
+#if defined(SPEC_NUM_SPHERES) && SPEC_NUM_SPHERES <= 16
+        #pragma unroll
+#endif
         for (unsigned int s = 0; s != num_spheres; s++)
         {
-            if (IntersectRaySphere(spheres[s], ox, oy, oz, dx, dy, dz, &extent))
+            if (IntersectRaySphere(spheres[s], o.x, o.y, o.z, d.x, d.y, d.z, &extent))
             {
-                closest_sphere_index = s;
-                closest_sphere = spheres[closest_sphere_index];
+                closest_primitive = s;
+                closest_sphere = spheres[closest_primitive];
             }
         }
+        const bool hit = closest_primitive != num_spheres;
+#endif
 
-        if (closest_sphere_index != num_spheres)
+        if (hit)
         {
             // Compute intersection and store
-            const Intersection intersection = FillIntersection(closest_sphere, ox, oy, oz, dx, dy, dz, extent);
-            hit_point_x[tid] = intersection.hit_point_x;
-            hit_point_y[tid] = intersection.hit_point_y;
-            hit_point_z[tid] = intersection.hit_point_z;
-            normal_x[tid] = intersection.normal_x;
-            normal_y[tid] = intersection.normal_y;
-            normal_z[tid] = intersection.normal_z;
-            uv_s[tid] = intersection.uv_s;
-            uv_t[tid] = intersection.uv_t;
-            wo_x[tid] = -dx;
-            wo_y[tid] = -dy;
-            wo_z[tid] = -dz;
+#ifdef USE_BVH
+            // The primitive is intersected in the space of the prototype, hit point and normal are moved to the world
+            __global const float* world_to_object = instances[hit_instance].world_to_object;
+            Intersection intersection = FillPrimitiveIntersection(&geometry, closest_primitive,
+                                                                  TransformPoint(world_to_object, o),
+                                                                  TransformDirection(world_to_object, d),
+                                                                  extent, b1, b2);
+            intersection.hit_point_x = o.x + extent * d.x;
+            intersection.hit_point_y = o.y + extent * d.y;
+            intersection.hit_point_z = o.z + extent * d.z;
+            const Vector3 normal = TransformNormal(world_to_object, NewVector3(intersection.normal_x,
+                                                                               intersection.normal_y,
+                                                                               intersection.normal_z));
+            intersection.normal_x = normal.x;
+            intersection.normal_y = normal.y;
+            intersection.normal_z = normal.z;
+#else
+            const Intersection intersection = FillIntersection(closest_sphere, o.x, o.y, o.z, d.x, d.y, d.z, extent);
+#endif
+            StoreVector3(intersections, tid, ISECT_HIT_POINT, ISECT_FIELDS, total_samples,
+                         NewVector3(intersection.hit_point_x, intersection.hit_point_y, intersection.hit_point_z));
+#ifdef COMPACT_INTERSECTIONS
+            // wo is not stored, it's the opposite of the ray direction that generated the intersection
+            const Vector2 normal_oct = EncodeOctahedral(NewVector3(intersection.normal_x,
+                                                                   intersection.normal_y,
+                                                                   intersection.normal_z));
+            StoreHalf2(intersections, ISECT_INDEX(tid, ISECT_NORMAL_OCT, total_samples), normal_oct.x, normal_oct.y);
+            StoreHalf2(intersections, ISECT_INDEX(tid, ISECT_UV, total_samples), intersection.uv_s, intersection.uv_t);
+#else
+            StoreVector3(intersections, tid, ISECT_NORMAL, ISECT_FIELDS, total_samples,
+                         NewVector3(intersection.normal_x, intersection.normal_y, intersection.normal_z));
+            intersections[ISECT_INDEX(tid, ISECT_UV, total_samples)] = intersection.uv_s;
+            intersections[ISECT_INDEX(tid, ISECT_UV + 1, total_samples)] = intersection.uv_t;
+            StoreVector3(intersections, tid, ISECT_WO, ISECT_FIELDS, total_samples, NewVector3(-d.x, -d.y, -d.z));
+#endif
 
             // Save index of primitive hit
-            primitive_index[tid] = closest_sphere_index;
+            primitive_index[tid] = closest_primitive;
+            STAT_ADD(STAT_HITS + stat_depth, 1);
         }
         else
         {
             // Ray did not intersect, set for restart
             ray_depth[tid] = RAY_TO_RESTART_DEPTH;
+            STAT_ADD(STAT_ESCAPED, 1);
         }
+
+#ifdef COST_HEATMAP
+#ifndef USE_BVH
+        // Without acceleration structure every sphere is tested
+        const unsigned int cost_tests = num_spheres;
+#endif
+        __global const unsigned int* sample_pixel = (__global const unsigned int*)samples;
+        const unsigned int cost_pixel = sample_pixel[SAMPLE_INDEX(tid, SAMPLE_PIXEL, total_samples)] +
+                                        sample_pixel[SAMPLE_INDEX(tid, SAMPLE_PIXEL + 1, total_samples)] *
+                                        IMAGE_WIDTH(camera->image_width);
+        (void)atomic_inc(&pixel_rays[cost_pixel]);
+        (void)atomic_add(&pixel_tests[cost_pixel], cost_tests);
+#endif
     }
+#ifdef ENABLE_STATS
+    EndStats(group_stats, stats);
+#endif
 }
 
 /*
  * This kernel checks if the ray is not done abd sets up a new ray forthe next bounce
  */
-__kernel void SampleBRDF(// Rays description
-                         __global float* ray_origin_x, __global float* ray_origin_y, __global float* ray_origin_z,
-                         __global float* ray_direction_x, __global float* ray_direction_y, __global float* ray_direction_z, 
+__kernel void SampleBRDF(// Rays stream and depth
+                         __global float* rays,
                          __global unsigned int* ray_depth,
-                         // Intersection information
-                         __global const float* hit_point_x, __global const float* hit_point_y, __global const float* hit_point_z,
-                         __global const float* normal_x, __global const float* normal_y, __global const float* normal_z,
-                         __global const float* wo_x, __global const float* wo_y, __global const float* wo_z,
+                         // Intersections stream
+                         __global const float* intersections,
                          // Random number generator state
                          __global unsigned int* xorshift_state,
+#ifdef ENABLE_STATS
+                         // Statistics counters
+                         __global unsigned int* stats,
+#endif
                          // Total number of samples
-                         unsigned int total_samples)
+                         unsigned int total_samples_arg)
 {
     const unsigned int tid = get_global_id(0);
+    const unsigned int total_samples = TOTAL_SAMPLES(total_samples_arg);
+#ifdef ENABLE_STATS
+    __local unsigned int group_stats[NUM_STATS];
+    BeginStats(group_stats);
+#endif
     if (tid < total_samples && ray_depth[tid] != RAY_TO_RESTART_DEPTH && ray_depth[tid] != RAY_DONE_DEPTH)
     {
         // Create local base around normal
-        const Vector3 n = NewVector3(normal_x[tid], normal_y[tid], normal_z[tid]);
+        const Vector3 n = LoadNormal(intersections, tid, total_samples);
         Vector3 s, t;
         CreateLocalBase(n, &s, &t);
 
@@ -602,14 +1516,14 @@ __kernel void SampleBRDF(// Rays description
                                             wi.x * s.z + wi.y * n.z + wi.z * t.z);
 
         // Set new ray start
-        ray_origin_x[tid] = hit_point_x[tid] + RAY_OFFSET * wi_world.x;
-        ray_origin_y[tid] = hit_point_y[tid] + RAY_OFFSET * wi_world.y;
-        ray_origin_z[tid] = hit_point_z[tid] + RAY_OFFSET * wi_world.z;
+        const Vector3 hit_point = LoadVector3(intersections, tid, ISECT_HIT_POINT, ISECT_FIELDS, total_samples);
+        StoreVector3(rays, tid, RAY_ORIGIN, RAY_FIELDS, total_samples,
+                     NewVector3(hit_point.x + RAY_OFFSET * wi_world.x,
+                                hit_point.y + RAY_OFFSET * wi_world.y,
+                                hit_point.z + RAY_OFFSET * wi_world.z));
 
         // Set new ray direction
-        ray_direction_x[tid] = wi_world.x;
-        ray_direction_y[tid] = wi_world.y;
-        ray_direction_z[tid] = wi_world.z;
+        StoreVector3(rays, tid, RAY_DIRECTION, RAY_FIELDS, total_samples, wi_world);
 
         // Increase depth
         if (ray_depth[tid] + 1 < MAX_DEPTH)
@@ -619,113 +1533,321 @@ __kernel void SampleBRDF(// Rays description
         else
         {
             ray_depth[tid] = RAY_TO_RESTART_DEPTH;
+            STAT_ADD(STAT_MAX_DEPTH, 1);
         }
     }
+#ifdef ENABLE_STATS
+    EndStats(group_stats, stats);
+#endif
 }
 
 /*
  * Update sample radiance
  */
-__kernel void UpdateRadiance(// Current radiance along the ray and masking term
-                             __global float* Li_r, __global float* Li_g, __global float* Li_b,
-                             __global float* beta_r, __global float* beta_g, __global float* beta_b,
+__kernel void UpdateRadiance(// Samples stream with current radiance along the ray and masking term
+                             __global float* samples,
                              // Intersection information
-                             __global const float* hit_point_x, __global const float* hit_point_y, __global const float* hit_point_z,
-                             __global const float* normal_x, __global const float* normal_y, __global const float* normal_z,
-                             __global const float* uv_s, __global const float* uv_t,
-                             __global const float* wo_x, __global const float* wo_y, __global const float* wo_z,
+                             __global const float* intersections,
                              __global const unsigned int* primitive_index,
-                             // Next ray direction
-                             __global const float* ray_direction_x, __global const float* ray_direction_y, __global const float* ray_direction_z,
+                             // Rays stream with the next ray direction and depth
+                             __global const float* rays,
                              __global unsigned int* ray_depth,
                              // Materials
                              __global const DiffuseMaterial* materials, __global const unsigned int* materials_indices,
+#ifdef AUXILIARY_BUFFERS
+                             // First hit albedo and normal accumulated for each pixel
+                             __constant const Camera* camera,
+                             __global float* albedo_r, __global float* albedo_g, __global float* albedo_b,
+                             __global float* normal_x, __global float* normal_y, __global float* normal_z,
+#endif
+#ifdef ENABLE_STATS
+                             // Statistics counters
+                             __global unsigned int* stats,
+#endif
                              // Total number of samples
-                             unsigned int total_samples)
+                             unsigned int total_samples_arg)
 {
     const unsigned int tid = get_global_id(0);
+    const unsigned int total_samples = TOTAL_SAMPLES(total_samples_arg);
+#ifdef ENABLE_STATS
+    __local unsigned int group_stats[NUM_STATS];
+    BeginStats(group_stats);
+#endif
     if (tid < total_samples && ray_depth[tid] != RAY_DONE_DEPTH && ray_depth[tid] != RAY_TO_RESTART_DEPTH)
     {
         // Load material for the hit shape
         const DiffuseMaterial material = materials[materials_indices[primitive_index[tid]]];
 
+#ifdef AUXILIARY_BUFFERS
+        // The features are summed like the radiance, primary rays that miss leave them at zero. SampleBRDF ran before
+        // and moved the depth of primary hits to 1, MAX_DEPTH is over 1 so no restart depth is set for them
+        if (ray_depth[tid] == 1)
+        {
+            __global const unsigned int* sample_pixel = (__global const unsigned int*)samples;
+            const unsigned int target_pixel_linear = sample_pixel[SAMPLE_INDEX(tid, SAMPLE_PIXEL, total_samples)] +
+                                                     sample_pixel[SAMPLE_INDEX(tid, SAMPLE_PIXEL + 1, total_samples)] *
+                                                     IMAGE_WIDTH(camera->image_width);
+            const Vector3 n = LoadNormal(intersections, tid, total_samples);
+            // Lights without reflectance use their emission as albedo so they stay apart from black surfaces
+            const bool emitter_only = IsBlack(material.rho_r, material.rho_g, material.rho_b);
+            AtomicAddGF(&albedo_r[target_pixel_linear], emitter_only ? fmin(material.emission_r, 1.f) : material.rho_r);
+            AtomicAddGF(&albedo_g[target_pixel_linear], emitter_only ? fmin(material.emission_g, 1.f) : material.rho_g);
+            AtomicAddGF(&albedo_b[target_pixel_linear], emitter_only ? fmin(material.emission_b, 1.f) : material.rho_b);
+            AtomicAddGF(&normal_x[target_pixel_linear], n.x);
+            AtomicAddGF(&normal_y[target_pixel_linear], n.y);
+            AtomicAddGF(&normal_z[target_pixel_linear], n.z);
+        }
+#endif
+
         // Check if material is emitting
         if (!IsBlack(material.emission_r, material.emission_g, material.emission_b))
         {
             // If the ray is primary, we store the emission
             if (ray_depth[tid] == 0)
             {
-                Li_r[tid] = material.emission_r;
-                Li_g[tid] = material.emission_g;
-                Li_b[tid] = material.emission_b;
+                StoreVector3(samples, tid, SAMPLE_LI, SAMPLE_FIELDS, total_samples,
+                             NewVector3(material.emission_r, material.emission_g, material.emission_b));
             }
             else
             {
                 // Add emission contribution
-                Li_r[tid] = beta_r[tid] * material.emission_r;
-                Li_g[tid] = beta_g[tid] * material.emission_g;
-                Li_b[tid] = beta_b[tid] * material.emission_b;
+                const Vector3 beta = LoadVector3(samples, tid, SAMPLE_BETA, SAMPLE_FIELDS, total_samples);
+                StoreVector3(samples, tid, SAMPLE_LI, SAMPLE_FIELDS, total_samples,
+                             NewVector3(beta.x * material.emission_r,
+                                        beta.y * material.emission_g,
+                                        beta.z * material.emission_b));
             }
             // The sample can now be stored
             ray_depth[tid] = RAY_TO_RESTART_DEPTH;
+            STAT_ADD(STAT_EMITTER, 1);
         }
         else
         {
             // Compute dot product of normal and light direction
-            const float n_dot_wi =  normal_x[tid] * ray_direction_x[tid] +
-                                    normal_y[tid] * ray_direction_y[tid] +
-                                    normal_z[tid] * ray_direction_z[tid];
+            const Vector3 n = LoadNormal(intersections, tid, total_samples);
+            const Vector3 wi = LoadVector3(rays, tid, RAY_DIRECTION, RAY_FIELDS, total_samples);
+            const float n_dot_wi = n.x * wi.x + n.y * wi.y + n.z * wi.z;
             // Compute the 1 / PDF for the next direction
             const float pdf = CosineSampleHemispherePdf(n_dot_wi);
-            if (pdf == 0.f)
-            {
-                ray_depth[tid] = RAY_TO_RESTART_DEPTH;
-                return;
-            }
             // Evaluate the BRDF value
             const float brdf_r = material.rho_r * M_1_PI_F;
             const float brdf_g = material.rho_g * M_1_PI_F;
             const float brdf_b = material.rho_b * M_1_PI_F;
-            if (IsBlack(brdf_r, brdf_g, brdf_b))
+            // No early return, all the work-items must reach the end of the kernel when collecting statistics
+            if (pdf == 0.f || IsBlack(brdf_r, brdf_g, brdf_b))
             {
                 ray_depth[tid] = RAY_TO_RESTART_DEPTH;
-                return;
+                STAT_ADD(STAT_ABSORBED, 1);
+            }
+            else
+            {
+                // Accumulate the value of beta
+                const float inv_pdf = 1.f / pdf;
+                const Vector3 beta = LoadVector3(samples, tid, SAMPLE_BETA, SAMPLE_FIELDS, total_samples);
+                StoreVector3(samples, tid, SAMPLE_BETA, SAMPLE_FIELDS, total_samples,
+                             NewVector3(beta.x * brdf_r * n_dot_wi * inv_pdf,
+                                        beta.y * brdf_g * n_dot_wi * inv_pdf,
+                                        beta.z * brdf_b * n_dot_wi * inv_pdf));
             }
-
-            // Accumulate the value of beta
-            const float inv_pdf = 1.f / pdf;
-            beta_r[tid] *= brdf_r * n_dot_wi * inv_pdf;
-            beta_g[tid] *= brdf_g * n_dot_wi * inv_pdf;
-            beta_b[tid] *= brdf_b * n_dot_wi * inv_pdf;
         }
     }
+#ifdef ENABLE_STATS
+    EndStats(group_stats, stats);
+#endif
 }
 
 /*
  * Deposit samples on raster kernel
  */
 __kernel void DepositSamples(__constant const Camera* camera,
-                             // Samples description
-                             __global const float* Li_r, __global const float* Li_g, __global const float* Li_b,
-                             __global const unsigned int* pixel_x, __global const unsigned int* pixel_y,
-                             __global const float* sample_offset_x, __global const float* sample_offset_y,
+                             // Samples stream
+                             __global const float* samples,
                              // Ray depth
                              __global const unsigned int* ray_depth,
                              // Target image pixels
                              __global float* pixel_r, __global float* pixel_g, __global float* pixel_b,
                              __global float* filter_weight,
                              // Total number of samples
-                             unsigned int total_samples)
+                             unsigned int total_samples_arg)
 {
     const unsigned int tid = get_global_id(0);
+    const unsigned int total_samples = TOTAL_SAMPLES(total_samples_arg);
     if (tid < total_samples && ray_depth[tid] != RAY_DONE_DEPTH && ray_depth[tid] == RAY_TO_RESTART_DEPTH)
     {
         // Get coordinates of the pixel the thread worked on
-        const unsigned int target_pixel_linear = pixel_x[tid] + pixel_y[tid] * camera->image_width;
+        __global const unsigned int* sample_pixel = (__global const unsigned int*)samples;
+        const unsigned int target_pixel_linear = sample_pixel[SAMPLE_INDEX(tid, SAMPLE_PIXEL, total_samples)] +
+                                                 sample_pixel[SAMPLE_INDEX(tid, SAMPLE_PIXEL + 1, total_samples)] *
+                                                 IMAGE_WIDTH(camera->image_width);
         // Atomically add the radiance values to the pixel
-        AtomicAddGF(&pixel_r[target_pixel_linear], Li_r[tid]);
-        AtomicAddGF(&pixel_g[target_pixel_linear], Li_g[tid]);
-        AtomicAddGF(&pixel_b[target_pixel_linear], Li_b[tid]);
+        const Vector3 Li = LoadVector3(samples, tid, SAMPLE_LI, SAMPLE_FIELDS, total_samples);
+        AtomicAddGF(&pixel_r[target_pixel_linear], Li.x);
+        AtomicAddGF(&pixel_g[target_pixel_linear], Li.y);
+        AtomicAddGF(&pixel_b[target_pixel_linear], Li.z);
         AtomicAddGF(&filter_weight[target_pixel_linear], 1.f);
     }
-}
\ No newline at end of file
+}
+
+#if defined(USE_BVH) && !defined(BVH_WIDTH)
+/*
+ * Refit of the acceleration structure after the spheres moved, each launch recomputes the bounds of one level of
+ * nodes from the primitives or from the children refit by the previous launch
+ */
+inline void SetNodeBounds(__global BVHNode* node, Vector3 bounds_min, Vector3 bounds_max)
+{
+    node->min_x = bounds_min.x;
+    node->min_y = bounds_min.y;
+    node->min_z = bounds_min.z;
+    node->max_x = bounds_max.x;
+    node->max_y = bounds_max.y;
+    node->max_z = bounds_max.z;
+}
+
+inline void ExtendBounds(Vector3* bounds_min, Vector3* bounds_max, Vector3 p)
+{
+    *bounds_min = NewVector3(fmin(bounds_min->x, p.x), fmin(bounds_min->y, p.y), fmin(bounds_min->z, p.z));
+    *bounds_max = NewVector3(fmax(bounds_max->x, p.x), fmax(bounds_max->y, p.y), fmax(bounds_max->z, p.z));
+}
+
+inline void ExtendBoundsNode(Vector3* bounds_min, Vector3* bounds_max, __global const BVHNode* node)
+{
+    ExtendBounds(bounds_min, bounds_max, NewVector3(node->min_x, node->min_y, node->min_z));
+    ExtendBounds(bounds_min, bounds_max, NewVector3(node->max_x, node->max_y, node->max_z));
+}
+
+__kernel void RefitPrototypes(// Prototypes geometry and hierarchies
+                              __global BVHNode* blas_nodes,
+                              __global const unsigned int* primitive_indices,
+                              __global const Sphere* spheres, unsigned int num_spheres_arg,
+                              __global const float* vertices,
+                              __global const unsigned int* triangles,
+                              // Nodes in refit order and their prototype
+                              __global const unsigned int* refit_nodes,
+                              __global const unsigned int* refit_prototypes,
+                              __global const unsigned int* prototype_roots,
+                              // Surface area heuristic cost and root area of each prototype
+                              __global float* prototype_costs,
+                              // Range of the level in the refit order
+                              unsigned int level_begin, unsigned int level_end)
+{
+    const unsigned int refit_index = level_begin + get_global_id(0);
+    if (refit_index < level_end)
+    {
+        const unsigned int node_index = refit_nodes[refit_index];
+        __global BVHNode* node = blas_nodes + node_index;
+        Vector3 bounds_min = NewVector3(MAXFLOAT, MAXFLOAT, MAXFLOAT);
+        Vector3 bounds_max = NewVector3(-MAXFLOAT, -MAXFLOAT, -MAXFLOAT);
+        if (node->count != 0)
+        {
+            const unsigned int num_spheres = NUM_SPHERES(num_spheres_arg);
+            for (unsigned int p = node->left_first; p != node->left_first + node->count; p++)
+            {
+                const unsigned int primitive = primitive_indices[p];
+                if (primitive < num_spheres)
+                {
+                    const Sphere sphere = spheres[primitive];
+                    ExtendBounds(&bounds_min, &bounds_max, NewVector3(sphere.center_x - sphere.radius,
+                                                                      sphere.center_y - sphere.radius,
+                                                                      sphere.center_z - sphere.radius));
+                    ExtendBounds(&bounds_min, &bounds_max, NewVector3(sphere.center_x + sphere.radius,
+                                                                      sphere.center_y + sphere.radius,
+                                                                      sphere.center_z + sphere.radius));
+                }
+                else
+                {
+                    __global const unsigned int* triangle = triangles + 3 * (primitive - num_spheres);
+                    ExtendBounds(&bounds_min, &bounds_max, LoadVertex(vertices, triangle[0]));
+                    ExtendBounds(&bounds_min, &bounds_max, LoadVertex(vertices, triangle[1]));
+                    ExtendBounds(&bounds_min, &bounds_max, LoadVertex(vertices, triangle[2]));
+                }
+            }
+        }
+        else
+        {
+            ExtendBoundsNode(&bounds_min, &bounds_max, blas_nodes + node->left_first);
+            ExtendBoundsNode(&bounds_min, &bounds_max, blas_nodes + node->left_first + 1);
+        }
+        SetNodeBounds(node, bounds_min, bounds_max);
+
+        // Accumulate the cost of the node, the host divides it by the area of the root
+        const float extent_x = bounds_max.x - bounds_min.x;
+        const float extent_y = bounds_max.y - bounds_min.y;
+        const float extent_z = bounds_max.z - bounds_min.z;
+        const float area = 2.f * (extent_x * extent_y + extent_x * extent_z + extent_y * extent_z);
+        const unsigned int prototype = refit_prototypes[refit_index];
+        AtomicAddGF(&prototype_costs[2 * prototype], area * (node->count != 0 ? (float)node->count : 1.f));
+        if (node_index == prototype_roots[prototype])
+        {
+            prototype_costs[2 * prototype + 1] = area;
+        }
+    }
+}
+
+__kernel void RefitInstances(// Top level hierarchy and instances
+                             __global BVHNode* tlas_nodes,
+                             __global const Instance* instances,
+                             // Bottom level hierarchies, already refit
+                             __global const BVHNode* blas_nodes,
+                             // Nodes in refit order
+                             __global const unsigned int* refit_nodes,
+                             // Range of the level in the refit order
+                             unsigned int level_begin, unsigned int level_end)
+{
+    const unsigned int refit_index = level_begin + get_global_id(0);
+    if (refit_index < level_end)
+    {
+        __global BVHNode* node = tlas_nodes + refit_nodes[refit_index];
+        Vector3 bounds_min = NewVector3(MAXFLOAT, MAXFLOAT, MAXFLOAT);
+        Vector3 bounds_max = NewVector3(-MAXFLOAT, -MAXFLOAT, -MAXFLOAT);
+        if (node->count != 0)
+        {
+            for (unsigned int i = node->left_first; i != node->left_first + node->count; i++)
+            {
+                // Invert the world to prototype transform to place the corners of the prototype bounds
+                __global const float* m = instances[i].world_to_object;
+                const float c00 = m[5] * m[10] - m[6] * m[9];
+                const float c01 = m[6] * m[8] - m[4] * m[10];
+                const float c02 = m[4] * m[9] - m[5] * m[8];
+                const float inv_det = 1.f / (m[0] * c00 + m[1] * c01 + m[2] * c02);
+                float object_to_world[12];
+                object_to_world[0] = c00 * inv_det;
+                object_to_world[1] = (m[2] * m[9] - m[1] * m[10]) * inv_det;
+                object_to_world[2] = (m[1] * m[6] - m[2] * m[5]) * inv_det;
+                object_to_world[4] = c01 * inv_det;
+                object_to_world[5] = (m[0] * m[10] - m[2] * m[8]) * inv_det;
+                object_to_world[6] = (m[2] * m[4] - m[0] * m[6]) * inv_det;
+                object_to_world[8] = c02 * inv_det;
+                object_to_world[9] = (m[1] * m[8] - m[0] * m[9]) * inv_det;
+                object_to_world[10] = (m[0] * m[5] - m[1] * m[4]) * inv_det;
+                for (unsigned int row = 0; row != 3; row++)
+                {
+                    object_to_world[row * 4 + 3] = -(object_to_world[row * 4] * m[3] +
+                                                     object_to_world[row * 4 + 1] * m[7] +
+                                                     object_to_world[row * 4 + 2] * m[11]);
+                }
+
+                __global const BVHNode* root = blas_nodes + instances[i].root_node;
+                for (unsigned int corner = 0; corner != 8; corner++)
+                {
+                    const float x = (corner & 1) ? root->max_x : root->min_x;
+                    const float y = (corner & 2) ? root->max_y : root->min_y;
+                    const float z = (corner & 4) ? root->max_z : root->min_z;
+                    ExtendBounds(&bounds_min, &bounds_max,
+                                 NewVector3(object_to_world[0] * x + object_to_world[1] * y +
+                                            object_to_world[2] * z + object_to_world[3],
+                                            object_to_world[4] * x + object_to_world[5] * y +
+                                            object_to_world[6] * z + object_to_world[7],
+                                            object_to_world[8] * x + object_to_world[9] * y +
+                                            object_to_world[10] * z + object_to_world[11]));
+                }
+            }
+        }
+        else
+        {
+            ExtendBoundsNode(&bounds_min, &bounds_max, tlas_nodes + node->left_first);
+            ExtendBoundsNode(&bounds_min, &bounds_max, tlas_nodes + node->left_first + 1);
+        }
+        SetNodeBounds(node, bounds_min, bounds_max);
+    }
+}
+#endif
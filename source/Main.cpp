@@ -1,187 +1,686 @@
 #include "RenderingContext.hpp"
+#include "RenderServer.hpp"
+#include "RenderCoordinator.hpp"
 #include "TileRendering.hpp"
+#include "CameraPath.hpp"
+#include "SphereAnimation.hpp"
+#include "BVHRefit.hpp"
+#include "Autotuner.hpp"
+#include "IntersectionBenchmark.hpp"
+#include "CLEnvironment.hpp"
+#include "HybridRendering.hpp"
 #include "CLError.hpp"
 
+#include <algorithm>
 #include <array>
+#include <future>
+#include <iomanip>
 #include <iostream>
 #include <memory>
+#include <sstream>
 #include <random>
 #include <chrono>
+#include <cstdlib>
+#include <string>
+#include <utility>
+#include <vector>
 
-int main(int argc, const char** argv)
+// Read the scene description from the file or generate a random scene if no file is given. With a crop window only
+// that part of the image is rendered, throws if it is outside of the image
+SceneDescription LoadSceneDescription(const char* scene_filename, const CropWindow* crop_window = nullptr)
 {
-    if (argc > 2)
+    SceneDescription scene_description;
+    if (scene_filename != nullptr)
     {
-        std::cerr << "Invalid number of arguments, expecting file to Scene description file or nothing\n";
-        exit(EXIT_FAILURE);
+        // Read scene description
+        scene_description = SceneParser::ReadSceneDescription(scene_filename);
     }
+    else
+    {
+        // Random scene generation
+        scene_description.image_width = 1920;
+        scene_description.image_height = 1080;
+        scene_description.tile_width = 32;
+        scene_description.tile_height = 32;
+        scene_description.pixel_samples = 1024;
 
-    try
+        scene_description.loaded_spheres.emplace_back(0.f, -5000.f, 0.f, 5000.f);
+        scene_description.loaded_materials.emplace_back(0.9f, 0.9f, 0.9f, 0.f, 0.f, 0.f);
+        scene_description.material_index.push_back(0);
+
+        scene_description.loaded_spheres.emplace_back(0.f, 0.f, 0.f, 5000.f);
+        scene_description.loaded_materials.emplace_back(0.f, 0.f, 0.f, 1.f, 1.f, 1.f);
+        scene_description.material_index.push_back(1);
+
+        std::mt19937 generator;
+        std::uniform_real_distribution<float> position(-40.f, 40.f);
+        std::uniform_real_distribution<float> radius(0.5f, 5.f);
+        std::uniform_real_distribution<float> color(0.4f, 0.99f);
+        std::uniform_real_distribution<float> emitting;
+
+        for (unsigned int s = 0; s != 100; s++)
+        {
+            const float r{ radius(generator) };
+            scene_description.loaded_spheres.emplace_back(position(generator), r, position(generator), r);
+            if (emitting(generator) < 0.2f)
+            {
+                scene_description.loaded_materials.emplace_back(0.f, 0.f, 0.f, 1.5f, 1.5f, 1.5f);
+            }
+            else
+            {
+                scene_description.loaded_materials.emplace_back(color(generator), color(generator), color(generator), 0.f, 0.f, 0.f);
+            }
+            scene_description.material_index.push_back(scene_description.loaded_materials.size() - 1);
+        }
+    }
+    if (crop_window != nullptr)
     {
-        SceneDescription scene_description;
-        if (argc == 2)
+        crop_window->CheckInside(scene_description.image_width, scene_description.image_height);
+        scene_description.crop_window = *crop_window;
+    }
+
+    return scene_description;
+}
+
+// Render each frame of the camera path to <output>_<frame>.<extension>, only the camera and the animated spheres are
+// uploaded between frames and the image of a frame is encoded while the next one renders
+void RenderCameraPath(Rendering::CL::RenderingDevice& rendering_device, const SceneDescription& scene_description,
+                      const Rendering::RenderingOptions& rendering_options, const Rendering::CameraPath& camera_path,
+                      const Rendering::SphereAnimation* sphere_animation, const std::string& output_filename)
+{
+    // The frame number goes before the extension, which selects the image format
+    size_t extension_start{ output_filename.find_last_of('.') };
+    const size_t name_start{ output_filename.find_last_of("/\\") };
+    if (name_start != std::string::npos && extension_start < name_start)
+    {
+        extension_start = std::string::npos;
+    }
+    const std::string output_stem{ output_filename.substr(0, extension_start) };
+    const std::string output_extension{ extension_start != std::string::npos ?
+                                        output_filename.substr(extension_start) : ".png" };
+
+    Vector3 eye, at, up;
+    camera_path.Evaluate(0, eye, at, up);
+    Rendering::Camera camera{ eye, at, up, 45.f, scene_description.image_width, scene_description.image_height,
+                              scene_description.FilmWindow() };
+
+    CL::Scene scene{ rendering_device.Context(), scene_description, camera, rendering_options.use_bvh,
+                     rendering_options.bvh_width };
+    const Rendering::CL::RenderingContext rendering_context{ rendering_device, scene_description, scene,
+                                                             rendering_options };
+    // Moving spheres refit the acceleration structure instead of building it again for each frame
+    Rendering::CL::BVHRefit bvh_refit{ rendering_device, rendering_options, scene, scene_description };
+    std::vector<Sphere> animated_spheres;
+    unsigned int num_rebuilds{ 0 };
+
+    std::future<void> pending_image;
+    const unsigned int num_frames{ sphere_animation != nullptr ?
+                                   std::max(camera_path.NumFrames(), sphere_animation->NumFrames()) :
+                                   camera_path.NumFrames() };
+    for (unsigned int frame = 0; frame != num_frames; frame++)
+    {
+        if (frame != 0)
         {
-            // Read scene description
-            scene_description = SceneParser::ReadSceneDescription(argv[1]);
+            camera_path.Evaluate(frame, eye, at, up);
+            camera.Move(eye, at, up);
+            scene.UpdateCamera(rendering_device.UploadQueue(), camera);
         }
-        else
+        if (sphere_animation != nullptr)
         {
-            // Random scene generation
-            scene_description.image_width = 1920;
-            scene_description.image_height = 1080;
-            scene_description.tile_width = 32;
-            scene_description.tile_height = 32;
-            scene_description.pixel_samples = 1024;
+            sphere_animation->Evaluate(frame, scene_description.loaded_spheres, animated_spheres);
+            if (bvh_refit.UpdateSpheres(sphere_animation->FirstSphere(), animated_spheres))
+            {
+                num_rebuilds++;
+            }
+        }
 
-            scene_description.loaded_spheres.emplace_back(0.f, -5000.f, 0.f, 5000.f);
-            scene_description.loaded_materials.emplace_back(0.9f, 0.9f, 0.9f, 0.f, 0.f, 0.f);
-            scene_description.material_index.push_back(0);
+        std::ostringstream frame_filename;
+        frame_filename << output_stem << "_" << std::setw(4) << std::setfill('0') << frame << output_extension;
 
-            scene_description.loaded_spheres.emplace_back(0.f, 0.f, 0.f, 5000.f);
-            scene_description.loaded_materials.emplace_back(0.f, 0.f, 0.f, 1.f, 1.f, 1.f);
-            scene_description.material_index.push_back(1);
+        const auto start = std::chrono::high_resolution_clock::now();
+        std::future<void> frame_image{ rendering_context.RenderAsync(frame_filename.str()) };
+        const auto end = std::chrono::high_resolution_clock::now();
+
+        // Wait for the previous image before queueing another one
+        if (pending_image.valid())
+        {
+            pending_image.get();
+        }
+        pending_image = std::move(frame_image);
+
+        std::cout << "Frame " << frame << " rendering time: "
+                  << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() << " ms\n";
+    }
+    if (pending_image.valid())
+    {
+        pending_image.get();
+    }
 
-            std::mt19937 generator;
-            std::uniform_real_distribution<float> position(-40.f, 40.f);
-            std::uniform_real_distribution<float> radius(0.5f, 5.f);
-            std::uniform_real_distribution<float> color(0.4f, 0.99f);
-            std::uniform_real_distribution<float> emitting;
+    if (sphere_animation != nullptr)
+    {
+        std::cout << "Acceleration structure rebuilt in " << num_rebuilds << " of " << num_frames << " frames\n";
+    }
+}
 
-            for (unsigned int s = 0; s != 100; s++)
+int main(int argc, const char** argv)
+{
+    // Parse the optional scene description file and the rendering options
+    const char* scene_filename{ nullptr };
+    Rendering::RenderingOptions rendering_options;
+    // Server mode reads jobs from stdin or from a Unix socket if a path is given
+    bool server_mode{ false };
+    std::string server_socket_path;
+    // Worker mode serves chunks of images on a TCP port, coordinator mode sends them to the workers
+    unsigned short worker_port{ 0 };
+    std::vector<Rendering::WorkerAddress> worker_addresses;
+    unsigned int worker_timeout{ 600 };
+    // Batch mode renders a frame for each camera of the path
+    const char* camera_path_filename{ nullptr };
+    const char* sphere_animation_filename{ nullptr };
+    // Image to write, the extension selects the format
+    std::string output_filename{ "render.png" };
+    // Periodic dump of the render state, resumed in a later run if asked
+    std::string checkpoint_filename;
+    unsigned int checkpoint_interval{ 300 };
+    bool resume{ false };
+    // Time budget mode renders passes of a few samples per pixel until the budget in milliseconds is spent
+    unsigned int time_budget{ 0 };
+    unsigned int pass_samples{ 4 };
+    // Window of the image to render, the whole image if not given
+    std::unique_ptr<CropWindow> crop_window;
+    // Tuning mode stores the best launch parameters for the device in the cache used by the renders
+    bool autotune{ false };
+    std::string tuning_cache_filename{ "rabbit_tuning.txt" };
+    // Directory where the built programs are cached, disabled if empty
+    std::string binary_cache_directory;
+    // Intersection benchmark mode compares the host intersector with the kernel on this number of rays
+    unsigned int benchmark_rays{ 0 };
+    // Device selection, the environment variables are overridden by the arguments
+    const std::string kernel_filename{ "./kernel/rendering_kernel.cl" };
+    Rendering::CL::DeviceSelectionPolicy device_policy;
+    try
+    {
+        device_policy = Rendering::CL::DeviceSelectionPolicy::FromEnvironment();
+    }
+    catch (const std::exception& ex)
+    {
+        std::cerr << ex.what() << "\n";
+        exit(EXIT_FAILURE);
+    }
+    int exit_code{ EXIT_SUCCESS };
+    for (int arg = 1; arg != argc; arg++)
+    {
+        const std::string argument{ argv[arg] };
+        if (argument == "--compact-intersections")
+        {
+            rendering_options.compact_intersections = true;
+        }
+        else if (argument == "--layout" && arg + 1 != argc)
+        {
+            try
             {
-                const float r{ radius(generator) };
-                scene_description.loaded_spheres.emplace_back(position(generator), r, position(generator), r);
-                if (emitting(generator) < 0.2f)
-                {
-                    scene_description.loaded_materials.emplace_back(0.f, 0.f, 0.f, 1.5f, 1.5f, 1.5f);
-                }
-                else
+                rendering_options.storage_layout = Rendering::ParseStorageLayout(argv[++arg]);
+            }
+            catch (const std::exception& ex)
+            {
+                std::cerr << ex.what() << "\n";
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (argument == "--out-of-order")
+        {
+            rendering_options.out_of_order_queue = true;
+        }
+        else if (argument == "--lanes" && arg + 1 != argc)
+        {
+            const int lanes{ std::atoi(argv[++arg]) };
+            if (lanes <= 0)
+            {
+                std::cerr << "Invalid number of lanes: " << argv[arg] << "\n";
+                exit(EXIT_FAILURE);
+            }
+            rendering_options.pipeline_lanes = static_cast<unsigned int>(lanes);
+        }
+        else if (argument == "--specialise")
+        {
+            rendering_options.specialise_kernels = true;
+        }
+        else if (argument == "--binary-cache" && arg + 1 != argc)
+        {
+            binary_cache_directory = argv[++arg];
+        }
+        else if (argument == "--autotune")
+        {
+            autotune = true;
+        }
+        else if (argument == "--tuning-cache" && arg + 1 != argc)
+        {
+            tuning_cache_filename = argv[++arg];
+        }
+        else if (argument == "--bvh")
+        {
+            rendering_options.use_bvh = true;
+        }
+        else if (argument == "--bvh-width" && arg + 1 != argc)
+        {
+            const int width{ std::atoi(argv[++arg]) };
+            if (width != 2 && width != 4 && width != 8)
+            {
+                std::cerr << "Invalid BVH width: " << argv[arg] << "\n";
+                exit(EXIT_FAILURE);
+            }
+            rendering_options.bvh_width = static_cast<unsigned int>(width);
+        }
+        else if (argument == "--server")
+        {
+            server_mode = true;
+        }
+        else if (argument == "--server-socket" && arg + 1 != argc)
+        {
+            server_mode = true;
+            server_socket_path = argv[++arg];
+        }
+        else if (argument == "--worker" && arg + 1 != argc)
+        {
+            const int port{ std::atoi(argv[++arg]) };
+            if (port <= 0 || port > 65535)
+            {
+                std::cerr << "Invalid port: " << argv[arg] << "\n";
+                exit(EXIT_FAILURE);
+            }
+            server_mode = true;
+            worker_port = static_cast<unsigned short>(port);
+        }
+        else if (argument == "--workers" && arg + 1 != argc)
+        {
+            try
+            {
+                std::istringstream addresses{ argv[++arg] };
+                std::string address;
+                while (std::getline(addresses, address, ','))
                 {
-                    scene_description.loaded_materials.emplace_back(color(generator), color(generator), color(generator), 0.f, 0.f, 0.f);
+                    worker_addresses.push_back(Rendering::WorkerAddress::Parse(address));
                 }
-                scene_description.material_index.push_back(scene_description.loaded_materials.size() - 1);
+            }
+            catch (const std::exception& ex)
+            {
+                std::cerr << ex.what() << "\n";
+                exit(EXIT_FAILURE);
             }
         }
-
-        // Create camera
-        const Rendering::Camera camera{ Vector3{ 40.f, 60.f, -70.f }, Vector3{ 0.f }, Vector3{ 0.f, 1.f, 0.f },
-                                        45.f, scene_description.image_width, scene_description.image_height };
-
-        cl_uint num_platforms;
-        CL_CHECK_CALL(clGetPlatformIDs(0, nullptr, &num_platforms));
-        if (num_platforms == 0)
+        else if (argument == "--worker-timeout" && arg + 1 != argc)
         {
-            throw std::runtime_error("No available OpenCL platforms");
+            const int seconds{ std::atoi(argv[++arg]) };
+            if (seconds <= 0)
+            {
+                std::cerr << "Invalid worker timeout: " << argv[arg] << "\n";
+                exit(EXIT_FAILURE);
+            }
+            worker_timeout = static_cast<unsigned int>(seconds);
         }
-        std::vector<cl_platform_id> platforms(num_platforms);
-        CL_CHECK_CALL(clGetPlatformIDs(num_platforms, platforms.data(), nullptr));
-
-        // Select platform by name
-        cl_platform_id selected_platform;
-        if (num_platforms > 1)
+        else if (argument == "--camera-path" && arg + 1 != argc)
+        {
+            camera_path_filename = argv[++arg];
+        }
+        else if (argument == "--intersect-benchmark" && arg + 1 != argc)
         {
-            std::size_t selected_platform_index{ num_platforms };
-            std::cout << "Select platform by corresponding index\n";
-            int platform_index{ 0 };
-            for (auto platform : platforms)
+            const int rays{ std::atoi(argv[++arg]) };
+            if (rays <= 0)
             {
-                size_t platform_name_size;
-                CL_CHECK_CALL(clGetPlatformInfo(platform, CL_PLATFORM_NAME, 0, nullptr, &platform_name_size));
-                auto platform_name{ std::make_unique<char[]>(platform_name_size) };
-                CL_CHECK_CALL(clGetPlatformInfo(platform, CL_PLATFORM_NAME, platform_name_size, platform_name.get(),
-                                                nullptr));
-                std::cout << "[" << platform_index++ << "]: " << platform_name.get() << "\n";
+                std::cerr << "Invalid number of rays: " << argv[arg] << "\n";
+                exit(EXIT_FAILURE);
             }
-            do
+            benchmark_rays = static_cast<unsigned int>(rays);
+        }
+        else if (argument == "--sphere-animation" && arg + 1 != argc)
+        {
+            sphere_animation_filename = argv[++arg];
+        }
+        else if (argument == "--output" && arg + 1 != argc)
+        {
+            output_filename = argv[++arg];
+        }
+        else if (argument == "--checkpoint" && arg + 1 != argc)
+        {
+            checkpoint_filename = argv[++arg];
+        }
+        else if (argument == "--checkpoint-interval" && arg + 1 != argc)
+        {
+            const int seconds{ std::atoi(argv[++arg]) };
+            if (seconds < 0)
             {
-                std::cout << "Platform index: ";
-                std::cin >> selected_platform_index;
+                std::cerr << "Invalid checkpoint interval: " << argv[arg] << "\n";
+                exit(EXIT_FAILURE);
             }
-            while (selected_platform_index >= num_platforms);
-            selected_platform = platforms[selected_platform_index];
+            checkpoint_interval = static_cast<unsigned int>(seconds);
         }
-        else
+        else if (argument == "--time-budget" && arg + 1 != argc)
         {
-            selected_platform = platforms[0];
-            size_t platform_name_size;
-            CL_CHECK_CALL(clGetPlatformInfo(selected_platform, CL_PLATFORM_NAME, 0, nullptr, &platform_name_size));
-            auto selected_platform_name{ std::make_unique<char[]>(platform_name_size) };
-            CL_CHECK_CALL(clGetPlatformInfo(selected_platform, CL_PLATFORM_NAME,
-                                            platform_name_size, selected_platform_name.get(),
-                                            nullptr));
-            std::cout << "Found one platform: " << selected_platform_name.get() << "\n";
+            const int milliseconds{ std::atoi(argv[++arg]) };
+            if (milliseconds <= 0)
+            {
+                std::cerr << "Invalid time budget: " << argv[arg] << "\n";
+                exit(EXIT_FAILURE);
+            }
+            time_budget = static_cast<unsigned int>(milliseconds);
         }
-
-        // Select device from platform
-        cl_uint num_devices;
-        CL_CHECK_CALL(clGetDeviceIDs(selected_platform, CL_DEVICE_TYPE_ALL, 0, nullptr, &num_devices));
-        if (num_devices == 0)
+        else if (argument == "--pass-samples" && arg + 1 != argc)
+        {
+            const int samples{ std::atoi(argv[++arg]) };
+            if (samples <= 0)
+            {
+                std::cerr << "Invalid samples per pass: " << argv[arg] << "\n";
+                exit(EXIT_FAILURE);
+            }
+            pass_samples = static_cast<unsigned int>(samples);
+        }
+        else if (argument == "--crop" && arg + 1 != argc)
+        {
+            try
+            {
+                crop_window = std::make_unique<CropWindow>(CropWindow::Parse(argv[++arg]));
+            }
+            catch (const std::exception& ex)
+            {
+                std::cerr << ex.what() << "\n";
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (argument == "--resume")
         {
-            throw std::runtime_error("No available devices in selected platform");
+            resume = true;
         }
-        std::vector<cl_device_id> devices(num_devices);
-        CL_CHECK_CALL(clGetDeviceIDs(selected_platform, CL_DEVICE_TYPE_ALL, num_devices, devices.data(), nullptr));
-
-        // Select device by name
-        cl_device_id selected_device;
-        if (num_devices > 1)
+        else if (argument == "--denoise")
+        {
+            rendering_options.denoise = true;
+        }
+        else if (argument == "--stats")
+        {
+            rendering_options.collect_stats = true;
+        }
+        else if (argument == "--cost-heatmap")
         {
-            std::size_t selected_device_index{ num_devices };
-            std::cout << "Select device by corresponding index\n";
-            int device_index{ 0 };
-            for (auto device : devices)
+            rendering_options.cost_heatmap = true;
+        }
+        else if (argument == "--device-type" && arg + 1 != argc)
+        {
+            try
+            {
+                device_policy.device_type = Rendering::CL::ParseDeviceType(argv[++arg]);
+            }
+            catch (const std::exception& ex)
             {
-                size_t device_name_size;
-                CL_CHECK_CALL(clGetDeviceInfo(device, CL_DEVICE_NAME, 0, nullptr, &device_name_size));
-                auto device_name{ std::make_unique<char[]>(device_name_size) };
-                CL_CHECK_CALL(clGetDeviceInfo(device, CL_DEVICE_NAME, device_name_size, device_name.get(), nullptr));
-                std::cout << "[" << device_index++ << "]: " << device_name.get() << "\n";
+                std::cerr << ex.what() << "\n";
+                exit(EXIT_FAILURE);
             }
-            do
+        }
+        else if (argument == "--device-name" && arg + 1 != argc)
+        {
+            device_policy.name_pattern = argv[++arg];
+        }
+        else if (argument == "--device-index" && arg + 1 != argc)
+        {
+            const int device_index{ std::atoi(argv[++arg]) };
+            if (device_index < 0 || (device_index == 0 && std::string{ argv[arg] } != "0"))
             {
-                std::cout << "Device index: ";
-                std::cin >> selected_device_index;
+                std::cerr << "Invalid device index: " << argv[arg] << "\n";
+                exit(EXIT_FAILURE);
             }
-            while (selected_device_index >= num_devices);
-            selected_device = devices[selected_device_index];
+            device_policy.device_index = device_index;
+        }
+        else if (argument == "--device-cache" && arg + 1 != argc)
+        {
+            device_policy.benchmark_cache_filename = argv[++arg];
+        }
+        else if (argument == "--hybrid")
+        {
+            device_policy.hybrid = true;
+        }
+        else if (argument.compare(0, 2, "--") != 0 && scene_filename == nullptr)
+        {
+            scene_filename = argv[arg];
         }
         else
         {
-            selected_device = devices[0];
-            size_t device_name_size;
-            CL_CHECK_CALL(clGetDeviceInfo(selected_device, CL_DEVICE_NAME, 0, nullptr, &device_name_size));
-            auto selected_device_name{ std::make_unique<char[]>(device_name_size) };
-            CL_CHECK_CALL(clGetDeviceInfo(selected_device, CL_DEVICE_NAME, device_name_size, selected_device_name.get(),
-                                          nullptr));
-            std::cout << "Found one device: " << selected_device_name.get() << "\n";
+            std::cerr << "Invalid argument: " << argument << "\n";
+            std::cerr << "Usage: " << argv[0]
+                      << " [--compact-intersections] [--layout automatic|soa|aos|aosoa8|aosoa16]"
+                      << " [--out-of-order] [--lanes n] [--autotune] [--tuning-cache file]"
+                      << " [--specialise] [--binary-cache directory] [--bvh] [--bvh-width 2|4|8]"
+                      << " [--server | --server-socket path | --worker port]"
+                      << " [--workers host:port,... [--worker-timeout seconds]]"
+                      << " [--camera-path file [--sphere-animation file]]"
+                      << " [--intersect-benchmark rays] [--output file.png|file.pfm|file.exr]"
+                      << " [--checkpoint file [--checkpoint-interval seconds] [--resume]]"
+                      << " [--time-budget milliseconds [--pass-samples n]] [--crop x,y,width,height]"
+                      << " [--denoise] [--stats]"
+                      << " [--cost-heatmap] [--device-type all|cpu|gpu|accelerator] [--device-name regex]"
+                      << " [--device-index n] [--device-cache file] [--hybrid] [scene_file]\n";
+            exit(EXIT_FAILURE);
         }
+    }
+    if (resume && checkpoint_filename.empty())
+    {
+        std::cerr << "--resume needs the --checkpoint file\n";
+        exit(EXIT_FAILURE);
+    }
+    if (time_budget != 0 && !checkpoint_filename.empty())
+    {
+        std::cerr << "--time-budget can not be used with --checkpoint\n";
+        exit(EXIT_FAILURE);
+    }
+    // The time budget and the checkpoints only apply to the render of a single image on this process
+    const char* mode_option{ nullptr };
+    if (!worker_addresses.empty())
+    {
+        mode_option = "--workers";
+    }
+    else if (server_mode)
+    {
+        mode_option = worker_port != 0 ? "--worker" : server_socket_path.empty() ? "--server" : "--server-socket";
+    }
+    else if (camera_path_filename != nullptr)
+    {
+        mode_option = "--camera-path";
+    }
+    if (mode_option != nullptr)
+    {
+        const std::pair<bool, const char*> unsupported_options[]{ { !checkpoint_filename.empty(), "--checkpoint" },
+                                                                   { time_budget != 0, "--time-budget" } };
+        for (const auto& option : unsupported_options)
+        {
+            if (option.first)
+            {
+                std::cerr << mode_option << " can not be used with " << option.second << "\n";
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+    // The coordinator and the workers split and merge rows of tiles of the full image
+    if (crop_window != nullptr && (!worker_addresses.empty() || server_mode))
+    {
+        std::cerr << mode_option << " can not be used with --crop\n";
+        exit(EXIT_FAILURE);
+    }
+    // A hybrid render only reads back the radiance of the bands and renders all the samples at once
+    if (device_policy.hybrid)
+    {
+        const std::pair<bool, const char*> unsupported_options[]{ { rendering_options.denoise, "--denoise" },
+                                                                   { rendering_options.collect_stats, "--stats" },
+                                                                   { rendering_options.cost_heatmap,
+                                                                     "--cost-heatmap" },
+                                                                   { !checkpoint_filename.empty(), "--checkpoint" },
+                                                                   { time_budget != 0, "--time-budget" } };
+        for (const auto& option : unsupported_options)
+        {
+            if (option.first)
+            {
+                std::cerr << "--hybrid can not be used with " << option.second << "\n";
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
 
-        // Create OpenCL context
-        const std::array<cl_context_properties, 3> context_properties{
-            CL_CONTEXT_PLATFORM, reinterpret_cast<cl_context_properties>(selected_platform),
-            0 };
-        cl_int err_code{ CL_SUCCESS };
-        cl_context context{ clCreateContext(context_properties.data(), 1, &selected_device,
-                                            CL::ContextCallback, nullptr, &err_code) };
-        CL_CHECK_STATUS(err_code);
-
+    // The coordinator does not render, it only needs the scene file to split the image
+    if (!worker_addresses.empty())
+    {
+        if (scene_filename == nullptr)
+        {
+            std::cerr << "--workers needs a scene file the workers can open\n";
+            exit(EXIT_FAILURE);
+        }
+        try
+        {
+            Rendering::RenderJob job;
+            job.scene_filename = scene_filename;
+            job.output_filename = output_filename;
+            const Rendering::RenderCoordinator coordinator{ worker_addresses,
+                                                            std::chrono::seconds{ worker_timeout } };
 
-        // TODO All up to here should go in a separate class that handles the OpenCL environment
-        const CL::Scene scene{ context, scene_description, camera };
-        Rendering::CL::RenderingContext rendering_context{ context, selected_device, scene_description, scene };
+            const auto start = std::chrono::high_resolution_clock::now();
+            coordinator.Render(job, std::cout);
+            const auto end = std::chrono::high_resolution_clock::now();
 
-        const auto start = std::chrono::high_resolution_clock::now();
-        rendering_context.Render("render.png");
-        const auto end = std::chrono::high_resolution_clock::now();
+            std::cout << "Rendering time: "
+                      << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() << " ms\n";
+        }
+        catch (const std::exception& ex)
+        {
+            std::cerr << ex.what() << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
 
-        std::cout << "Rendering time: " << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() << " ms\n";
+        return exit_code;
+    }
 
-        // Cleanup
-        clReleaseContext(context);
+    try
+    {
+        // The device is selected without interaction, by the policy or by a benchmark of the candidates
+        const Rendering::CL::CLEnvironment environment{ device_policy, kernel_filename, binary_cache_directory,
+                                                        std::cout };
+        const cl_context context{ environment.Context() };
 
-        for (auto device : devices)
         {
-            CL_CHECK_CALL(clReleaseDevice(device));
+            // Device resources are kept for the whole run
+            Rendering::CL::RenderingDevice rendering_device{ context, environment.Device(), kernel_filename,
+                                                             tuning_cache_filename, binary_cache_directory };
+
+            if (benchmark_rays != 0)
+            {
+                Rendering::CL::IntersectionBenchmark benchmark{ rendering_device, rendering_options };
+                if (benchmark.Run(LoadSceneDescription(scene_filename), benchmark_rays, std::cout) != 0)
+                {
+                    exit_code = EXIT_FAILURE;
+                }
+            }
+            else if (autotune)
+            {
+                Rendering::CL::Autotuner autotuner{ rendering_device, rendering_options };
+                autotuner.Tune(LoadSceneDescription(scene_filename), std::cout);
+            }
+            else if (server_mode)
+            {
+                Rendering::RenderServer render_server{ rendering_device, rendering_options };
+                if (worker_port != 0)
+                {
+                    render_server.ServeWorker(worker_port);
+                }
+                else if (server_socket_path.empty())
+                {
+                    render_server.Serve(std::cin, std::cout);
+                }
+                else
+                {
+                    render_server.ServeSocket(server_socket_path);
+                }
+            }
+            else if (camera_path_filename != nullptr)
+            {
+                const Rendering::CameraPath camera_path{ Rendering::CameraPath::ReadCameraPath(camera_path_filename) };
+                if (sphere_animation_filename != nullptr)
+                {
+                    const Rendering::SphereAnimation sphere_animation{
+                        Rendering::SphereAnimation::ReadSphereAnimation(sphere_animation_filename) };
+                    RenderCameraPath(rendering_device, LoadSceneDescription(scene_filename, crop_window.get()),
+                                     rendering_options, camera_path, &sphere_animation, output_filename);
+                }
+                else
+                {
+                    RenderCameraPath(rendering_device, LoadSceneDescription(scene_filename, crop_window.get()),
+                                     rendering_options, camera_path, nullptr, output_filename);
+                }
+            }
+            else if (environment.Devices().size() > 1)
+            {
+                // The selected device renders with the others, each device keeps its own resources
+                std::vector<std::unique_ptr<Rendering::CL::RenderingDevice>> other_devices;
+                std::vector<Rendering::CL::RenderingDevice*> hybrid_devices{ &rendering_device };
+                for (size_t d = 1; d != environment.Devices().size(); d++)
+                {
+                    other_devices.push_back(std::make_unique<Rendering::CL::RenderingDevice>(
+                        environment.Contexts()[d], environment.Devices()[d], kernel_filename, tuning_cache_filename,
+                        binary_cache_directory));
+                    hybrid_devices.push_back(other_devices.back().get());
+                }
+
+                const SceneDescription scene_description{ LoadSceneDescription(scene_filename, crop_window.get()) };
+                const Rendering::Camera camera{ Vector3{ 40.f, 60.f, -70.f }, Vector3{ 0.f }, Vector3{ 0.f, 1.f, 0.f },
+                                                45.f, scene_description.image_width, scene_description.image_height,
+                                                scene_description.FilmWindow() };
+                const Rendering::CL::HybridRendering hybrid_rendering{ hybrid_devices, scene_description, camera,
+                                                                       rendering_options };
+
+                const auto start = std::chrono::high_resolution_clock::now();
+                hybrid_rendering.Render(output_filename, std::cout);
+                const auto end = std::chrono::high_resolution_clock::now();
+
+                std::cout << "Rendering time: "
+                          << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() << " ms\n";
+            }
+            else if (time_budget != 0)
+            {
+                // Each pass renders a few samples per pixel of the whole image, the scene samples are not used
+                SceneDescription scene_description{ LoadSceneDescription(scene_filename, crop_window.get()) };
+                scene_description.pixel_samples = pass_samples;
+
+                const Rendering::Camera camera{ Vector3{ 40.f, 60.f, -70.f }, Vector3{ 0.f }, Vector3{ 0.f, 1.f, 0.f },
+                                                45.f, scene_description.image_width, scene_description.image_height,
+                                                scene_description.FilmWindow() };
+                const CL::Scene scene{ context, scene_description, camera, rendering_options.use_bvh,
+                                       rendering_options.bvh_width };
+                const Rendering::CL::RenderingContext rendering_context{ rendering_device, scene_description, scene,
+                                                                         rendering_options };
+                rendering_context.RenderForTime(output_filename, std::chrono::milliseconds{ time_budget });
+            }
+            else
+            {
+                const SceneDescription scene_description{ LoadSceneDescription(scene_filename, crop_window.get()) };
+
+                // Create camera
+                const Rendering::Camera camera{ Vector3{ 40.f, 60.f, -70.f }, Vector3{ 0.f }, Vector3{ 0.f, 1.f, 0.f },
+                                                45.f, scene_description.image_width, scene_description.image_height,
+                                                scene_description.FilmWindow() };
+
+                const CL::Scene scene{ context, scene_description, camera, rendering_options.use_bvh,
+                                       rendering_options.bvh_width };
+                const Rendering::CL::RenderingContext rendering_context{ rendering_device, scene_description, scene,
+                                                                         rendering_options };
+
+                // Without a file the render is not checkpointed
+                std::unique_ptr<Rendering::CL::RenderCheckpoint> checkpoint;
+                if (!checkpoint_filename.empty())
+                {
+                    checkpoint = std::make_unique<Rendering::CL::RenderCheckpoint>(
+                        checkpoint_filename, std::chrono::seconds{ checkpoint_interval }, resume);
+                }
+
+                const auto start = std::chrono::high_resolution_clock::now();
+                rendering_context.Render(output_filename, checkpoint.get());
+                const auto end = std::chrono::high_resolution_clock::now();
+
+                std::cout << "Rendering time: "
+                          << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() << " ms\n";
+            }
         }
     }
     catch (const std::exception& ex)
@@ -190,5 +689,5 @@ int main(int argc, const char** argv)
         std::exit(EXIT_FAILURE);
     }
 
-    return 0;
+    return exit_code;
 }
\ No newline at end of file
@@ -0,0 +1,149 @@
+//
+// Created by Simon on 2019-03-28.
+//
+
+#include "Autotuner.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <limits>
+
+namespace Rendering
+{
+namespace CL
+{
+
+namespace
+{
+
+// Largest image side used while tuning, keeps the sweep short while the device is still fully loaded
+constexpr unsigned int MAX_TUNING_IMAGE_SIZE{ 512 };
+
+// Candidate tile sides
+constexpr std::array<unsigned int, 4> TILE_SIZES{ { 8, 16, 32, 64 } };
+
+// Candidate work-group sizes
+constexpr std::array<size_t, 6> LOCAL_SIZES{ { 32, 64, 128, 256, 512, 1024 } };
+
+} // Anonymous namespace
+
+Autotuner::Autotuner(RenderingDevice& device, const RenderingOptions& options)
+    : rendering_device(device), rendering_options{ options }
+{}
+
+LaunchTuning Autotuner::Tune(const SceneDescription& scene_description, std::ostream& log)
+{
+    SceneDescription tuning_description{ scene_description };
+    tuning_description.image_width = std::min(tuning_description.image_width, MAX_TUNING_IMAGE_SIZE);
+    tuning_description.image_height = std::min(tuning_description.image_height, MAX_TUNING_IMAGE_SIZE);
+
+    // Same default camera used for the renders
+    const Camera camera{ Vector3{ 40.f, 60.f, -70.f }, Vector3{ 0.f }, Vector3{ 0.f, 1.f, 0.f },
+                         45.f, tuning_description.image_width, tuning_description.image_height };
+    const ::CL::Scene scene{ rendering_device.Context(), tuning_description, camera, rendering_options.use_bvh,
+                             rendering_options.bvh_width };
+
+    // First render builds the program and allocates the arena, it is not timed
+    LaunchTuning best_tuning;
+    TimeRender(tuning_description, scene, best_tuning);
+
+    // Tile size, it sets the number of samples in flight and the amount of work between two host synchronisations
+    double best_milliseconds{ std::numeric_limits<double>::max() };
+    for (const auto tile_width : TILE_SIZES)
+    {
+        for (const auto tile_height : TILE_SIZES)
+        {
+            LaunchTuning candidate_tuning;
+            candidate_tuning.tile_width = tile_width;
+            candidate_tuning.tile_height = tile_height;
+
+            log << "Tile " << tile_width << "x" << tile_height << ": ";
+            try
+            {
+                const TuningRun run{ TimeRender(tuning_description, scene, candidate_tuning) };
+                log << run.milliseconds << " ms\n";
+                if (run.milliseconds < best_milliseconds)
+                {
+                    best_milliseconds = run.milliseconds;
+                    best_tuning = candidate_tuning;
+                }
+            }
+            catch (const std::exception& ex)
+            {
+                log << "skipped (" << ex.what() << ")\n";
+            }
+        }
+    }
+
+    // Work-group size of each kernel with the best tile, all kernels are measured in the same render
+    std::array<cl_ulong, NUM_KERNELS> best_kernel_nanoseconds;
+    best_kernel_nanoseconds.fill(std::numeric_limits<cl_ulong>::max());
+    const LaunchTuning tile_tuning{ best_tuning };
+    for (const auto local_size : LOCAL_SIZES)
+    {
+        LaunchTuning candidate_tuning{ tile_tuning };
+        candidate_tuning.local_size.fill(local_size);
+
+        log << "Work-group size " << local_size << ":";
+        try
+        {
+            const TuningRun run{ TimeRender(tuning_description, scene, candidate_tuning) };
+            for (unsigned int k = 0; k != NUM_KERNELS; k++)
+            {
+                // Kernels that can't use the size run with the default one
+                if (run.local_size[k] != local_size)
+                {
+                    continue;
+                }
+                log << " " << KernelName(static_cast<KernelId>(k)) << " "
+                    << static_cast<double>(run.kernel_times.nanoseconds[k]) * 1e-6 << " ms";
+                if (run.kernel_times.nanoseconds[k] < best_kernel_nanoseconds[k])
+                {
+                    best_kernel_nanoseconds[k] = run.kernel_times.nanoseconds[k];
+                    best_tuning.local_size[k] = local_size;
+                }
+            }
+            log << "\n";
+        }
+        catch (const std::exception& ex)
+        {
+            log << " skipped (" << ex.what() << ")\n";
+        }
+    }
+
+    log << "Selected tile " << best_tuning.tile_width << "x" << best_tuning.tile_height << ", work-group sizes:";
+    for (unsigned int k = 0; k != NUM_KERNELS; k++)
+    {
+        log << " " << KernelName(static_cast<KernelId>(k)) << " " << best_tuning.local_size[k];
+    }
+    log << "\n";
+
+    const RenderingOptions resolved_options{ rendering_options.ResolveForDevice(rendering_device.Device()) };
+    rendering_device.Tuning().Store(TileRendering::TuningKey(rendering_device.Device(), resolved_options, scene),
+                                    best_tuning);
+
+    return best_tuning;
+}
+
+Autotuner::TuningRun Autotuner::TimeRender(const SceneDescription& scene_description, const ::CL::Scene& scene,
+                                           const LaunchTuning& launch_tuning) const
+{
+    const TileRendering tile_rendering{ rendering_device, CL_QUEUE_PROFILING_ENABLE, scene_description, scene,
+                                        rendering_options, &launch_tuning };
+
+    TuningRun run;
+    const auto start = std::chrono::high_resolution_clock::now();
+    tile_rendering.Render(nullptr, &run.kernel_times);
+    const auto end = std::chrono::high_resolution_clock::now();
+    run.milliseconds = std::chrono::duration<double, std::milli>(end - start).count();
+
+    for (unsigned int k = 0; k != NUM_KERNELS; k++)
+    {
+        run.local_size[k] = tile_rendering.LocalSize(static_cast<KernelId>(k));
+    }
+
+    return run;
+}
+
+} // CL namespace
+} // Rendering namespace
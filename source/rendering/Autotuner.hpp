@@ -0,0 +1,51 @@
+//
+// Created by Simon on 2019-03-28.
+//
+
+#ifndef RABBIT_AUTOTUNER_HPP
+#define RABBIT_AUTOTUNER_HPP
+
+#include "TileRendering.hpp"
+
+#include <ostream>
+
+namespace Rendering
+{
+namespace CL
+{
+
+// Sweeps the tile size and the work-group size of each kernel on the device and stores the fastest
+// configuration in the tuning cache of the device, later renders with the same program variant use it
+class Autotuner
+{
+public:
+    Autotuner(RenderingDevice& device, const RenderingOptions& options);
+
+    // Tune the launch parameters rendering the scene, the progress is written to the log
+    LaunchTuning Tune(const SceneDescription& scene_description, std::ostream& log);
+
+private:
+    // Measurements of a single render
+    struct TuningRun
+    {
+        // Wall clock time of the render
+        double milliseconds;
+        // Time spent in each kernel
+        KernelTimes kernel_times;
+        // Work-group size each kernel was launched with
+        std::array<size_t, NUM_KERNELS> local_size;
+    };
+
+    // Render the scene once with the given tuning, throws if the configuration can't be used on the device
+    TuningRun TimeRender(const SceneDescription& scene_description, const ::CL::Scene& scene,
+                         const LaunchTuning& launch_tuning) const;
+
+    // Device to tune
+    RenderingDevice& rendering_device;
+    const RenderingOptions rendering_options;
+};
+
+} // CL namespace
+} // Rendering namespace
+
+#endif //RABBIT_AUTOTUNER_HPP
@@ -0,0 +1,172 @@
+//
+// Created by Simon on 2019-03-29.
+//
+
+#include "BVHRefit.hpp"
+#include "AccelerationStructure.hpp"
+
+#include <algorithm>
+#include <iostream>
+
+namespace Rendering
+{
+namespace CL
+{
+
+namespace
+{
+
+// Index of the level range arguments of the refit kernels
+constexpr cl_uint REFIT_PROTOTYPES_RANGE_ARG{ 10 };
+constexpr cl_uint REFIT_INSTANCES_RANGE_ARG{ 4 };
+
+} // Anonymous namespace
+
+BVHRefit::BVHRefit(RenderingDevice& device, const RenderingOptions& options, ::CL::Scene& scene,
+                   const SceneDescription& scene_description, float rebuild_threshold)
+    : rendering_device(device), target_scene(scene), current_description{ scene_description },
+      cost_threshold{ rebuild_threshold },
+      refit_prototypes_kernel{ nullptr }, refit_instances_kernel{ nullptr }, d_prototype_costs{ nullptr }
+{
+    if (!scene.HasAcceleration() || scene.blas_width != 2)
+    {
+        return;
+    }
+
+    try
+    {
+        // Same program variant used for rendering without the specialisation, the refit does not depend on it
+        const cl_program program{ device.Programs().GetProgram(
+            options.ResolveForDevice(device.Device()).ProgramDefines() + scene.ProgramDefines()) };
+
+        cl_int err_code{ CL_SUCCESS };
+        refit_prototypes_kernel = clCreateKernel(program, "RefitPrototypes", &err_code);
+        CL_CHECK_STATUS(err_code);
+        refit_instances_kernel = clCreateKernel(program, "RefitInstances", &err_code);
+        CL_CHECK_STATUS(err_code);
+
+        d_prototype_costs = clCreateBuffer(device.Context(), CL_MEM_READ_WRITE,
+                                           2 * scene.prototype_costs.size() * sizeof(float), nullptr, &err_code);
+        CL_CHECK_STATUS(err_code);
+
+        CL_CHECK_CALL(clSetKernelArg(refit_prototypes_kernel, 0, sizeof(cl_mem), &scene.d_blas_nodes));
+        CL_CHECK_CALL(clSetKernelArg(refit_prototypes_kernel, 1, sizeof(cl_mem), &scene.d_primitive_indices));
+        CL_CHECK_CALL(clSetKernelArg(refit_prototypes_kernel, 2, sizeof(cl_mem), &scene.d_spheres));
+        CL_CHECK_CALL(clSetKernelArg(refit_prototypes_kernel, 3, sizeof(cl_uint), &scene.num_spheres));
+        CL_CHECK_CALL(clSetKernelArg(refit_prototypes_kernel, 4, sizeof(cl_mem), &scene.d_vertices));
+        CL_CHECK_CALL(clSetKernelArg(refit_prototypes_kernel, 5, sizeof(cl_mem), &scene.d_triangles));
+        CL_CHECK_CALL(clSetKernelArg(refit_prototypes_kernel, 6, sizeof(cl_mem), &scene.d_blas_refit_nodes));
+        CL_CHECK_CALL(clSetKernelArg(refit_prototypes_kernel, 7, sizeof(cl_mem), &scene.d_blas_refit_prototypes));
+        CL_CHECK_CALL(clSetKernelArg(refit_prototypes_kernel, 8, sizeof(cl_mem), &scene.d_prototype_roots));
+        CL_CHECK_CALL(clSetKernelArg(refit_prototypes_kernel, 9, sizeof(cl_mem), &d_prototype_costs));
+
+        CL_CHECK_CALL(clSetKernelArg(refit_instances_kernel, 0, sizeof(cl_mem), &scene.d_tlas_nodes));
+        CL_CHECK_CALL(clSetKernelArg(refit_instances_kernel, 1, sizeof(cl_mem), &scene.d_instances));
+        CL_CHECK_CALL(clSetKernelArg(refit_instances_kernel, 2, sizeof(cl_mem), &scene.d_blas_nodes));
+        CL_CHECK_CALL(clSetKernelArg(refit_instances_kernel, 3, sizeof(cl_mem), &scene.d_tlas_refit_nodes));
+    }
+    catch (...)
+    {
+        Cleanup();
+        throw;
+    }
+}
+
+BVHRefit::~BVHRefit() noexcept
+{
+    Cleanup();
+}
+
+bool BVHRefit::UpdateSpheres(unsigned int first_sphere, const std::vector<Sphere>& spheres)
+{
+    const cl_command_queue queue{ rendering_device.UploadQueue() };
+    target_scene.UpdateSpheres(queue, first_sphere, spheres);
+    std::copy(spheres.cbegin(), spheres.cend(), current_description.loaded_spheres.begin() + first_sphere);
+    if (!target_scene.HasAcceleration())
+    {
+        return false;
+    }
+    if (target_scene.blas_width != 2)
+    {
+        // Quantised bounds can not be refit, compressed hierarchies are always built again
+        target_scene.UpdateAcceleration(queue, AccelerationStructure{ current_description, target_scene.blas_width });
+        return true;
+    }
+
+    // Bottom level hierarchies first, the top level one uses their roots
+    const float zero{ 0.f };
+    const size_t costs_size{ 2 * target_scene.prototype_costs.size() * sizeof(float) };
+    CL_CHECK_CALL(clEnqueueFillBuffer(queue, d_prototype_costs, &zero, sizeof(float), 0, costs_size,
+                                      0, nullptr, nullptr));
+    const std::vector<unsigned int>& blas_levels{ target_scene.blas_refit_levels };
+    for (size_t l = 0; l + 1 < blas_levels.size(); l++)
+    {
+        RefitLevel(refit_prototypes_kernel, REFIT_PROTOTYPES_RANGE_ARG, blas_levels[l], blas_levels[l + 1]);
+    }
+    const std::vector<unsigned int>& tlas_levels{ target_scene.tlas_refit_levels };
+    for (size_t l = 0; l + 1 < tlas_levels.size(); l++)
+    {
+        RefitLevel(refit_instances_kernel, REFIT_INSTANCES_RANGE_ARG, tlas_levels[l], tlas_levels[l + 1]);
+    }
+
+    std::vector<float> prototype_costs(2 * target_scene.prototype_costs.size());
+    CL_CHECK_CALL(clEnqueueReadBuffer(queue, d_prototype_costs, CL_TRUE, 0, costs_size, prototype_costs.data(),
+                                      0, nullptr, nullptr));
+
+    // Rebuild everything once a prototype degrades too much, refitting only keeps the topology of the last build
+    bool rebuild{ false };
+    for (size_t p = 0; p != target_scene.prototype_costs.size(); p++)
+    {
+        const float root_area{ prototype_costs[2 * p + 1] };
+        const float cost{ root_area > 0.f ? prototype_costs[2 * p] / root_area : 0.f };
+        if (cost > cost_threshold * target_scene.prototype_costs[p])
+        {
+            rebuild = true;
+            break;
+        }
+    }
+    if (rebuild)
+    {
+        target_scene.UpdateAcceleration(queue, AccelerationStructure{ current_description });
+    }
+
+    return rebuild;
+}
+
+void BVHRefit::RefitLevel(cl_kernel kernel, cl_uint range_arg, unsigned int level_begin, unsigned int level_end) const
+{
+    CL_CHECK_CALL(clSetKernelArg(kernel, range_arg, sizeof(cl_uint), &level_begin));
+    CL_CHECK_CALL(clSetKernelArg(kernel, range_arg + 1, sizeof(cl_uint), &level_end));
+
+    // The queue is in order, each level sees the bounds written by the previous one
+    const size_t global_size{ level_end - level_begin };
+    CL_CHECK_CALL(clEnqueueNDRangeKernel(rendering_device.UploadQueue(), kernel, 1, nullptr, &global_size, nullptr,
+                                         0, nullptr, nullptr));
+}
+
+void BVHRefit::Cleanup() noexcept
+{
+    try
+    {
+        if (refit_prototypes_kernel != nullptr)
+        {
+            CL_CHECK_CALL(clReleaseKernel(refit_prototypes_kernel));
+        }
+        if (refit_instances_kernel != nullptr)
+        {
+            CL_CHECK_CALL(clReleaseKernel(refit_instances_kernel));
+        }
+        if (d_prototype_costs != nullptr)
+        {
+            CL_CHECK_CALL(clReleaseMemObject(d_prototype_costs));
+        }
+    }
+    catch (const std::exception& ex)
+    {
+        // TODO operator<< could throw
+        std::cerr << ex.what() << std::endl;
+    }
+}
+
+} // CL namespace
+} // Rendering namespace
@@ -0,0 +1,64 @@
+//
+// Created by Simon on 2019-03-29.
+//
+
+#ifndef RABBIT_BVHREFIT_HPP
+#define RABBIT_BVHREFIT_HPP
+
+#include "RenderingDevice.hpp"
+#include "RenderingOptions.hpp"
+#include "Scene.hpp"
+
+namespace Rendering
+{
+namespace CL
+{
+
+// Keeps the acceleration structure of a scene valid while its spheres move. The node bounds are refit bottom-up
+// on the device one level at a time, the hierarchies are rebuilt on the host once the surface area heuristic cost
+// of a prototype grows past the threshold times its cost after the last build. Compressed hierarchies are rebuilt
+// on every update
+class BVHRefit
+{
+public:
+    BVHRefit(RenderingDevice& device, const RenderingOptions& options, ::CL::Scene& scene,
+             const SceneDescription& scene_description, float rebuild_threshold = 1.5f);
+
+    ~BVHRefit() noexcept;
+
+    BVHRefit(const BVHRefit&) = delete;
+
+    BVHRefit& operator=(const BVHRefit&) = delete;
+
+    // Upload new values for the spheres starting from the given one and update the acceleration structure,
+    // returns true if it was rebuilt. The call blocks until the update is done
+    bool UpdateSpheres(unsigned int first_sphere, const std::vector<Sphere>& spheres);
+
+private:
+    // Cleanup OpenCL resources without throwing
+    void Cleanup() noexcept;
+
+    // Launch the kernel over the range [level_begin, level_end) of the refit order, the range is passed in the
+    // arguments starting from range_arg
+    void RefitLevel(cl_kernel kernel, cl_uint range_arg, unsigned int level_begin, unsigned int level_end) const;
+
+    RenderingDevice& rendering_device;
+    ::CL::Scene& target_scene;
+
+    // Copy of the scene used to rebuild the hierarchies with the current spheres
+    SceneDescription current_description;
+
+    const float cost_threshold;
+
+    // Refit kernels, null if the scene has no acceleration structure
+    cl_kernel refit_prototypes_kernel;
+    cl_kernel refit_instances_kernel;
+
+    // Accumulated cost and root area of each prototype
+    cl_mem d_prototype_costs;
+};
+
+} // CL namespace
+} // Rendering namespace
+
+#endif //RABBIT_BVHREFIT_HPP
@@ -0,0 +1,413 @@
+//
+// Created by Simon on 2019-04-01.
+//
+
+#include "CLEnvironment.hpp"
+#include "CLError.hpp"
+#include "IntersectionBenchmark.hpp"
+#include "RenderingDevice.hpp"
+
+#include <array>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <regex>
+#include <sstream>
+#include <stdexcept>
+
+namespace Rendering
+{
+namespace CL
+{
+
+namespace
+{
+
+// Rays intersected by each run of the benchmark and spheres of its scene
+constexpr unsigned int BENCHMARK_RAYS{ 1u << 18u };
+constexpr unsigned int BENCHMARK_SPHERES{ 128 };
+
+// Random spheres over a ground sphere, as in the default scene
+SceneDescription BenchmarkScene()
+{
+    SceneDescription scene_description;
+    scene_description.image_width = 1920;
+    scene_description.image_height = 1080;
+    scene_description.loaded_spheres.emplace_back(0.f, -5000.f, 0.f, 5000.f);
+
+    std::mt19937 generator;
+    std::uniform_real_distribution<float> position(-40.f, 40.f);
+    std::uniform_real_distribution<float> radius(0.5f, 5.f);
+    for (unsigned int s = 1; s != BENCHMARK_SPHERES; s++)
+    {
+        const float r{ radius(generator) };
+        scene_description.loaded_spheres.emplace_back(position(generator), r, position(generator), r);
+    }
+    scene_description.loaded_materials.emplace_back(0.9f, 0.9f, 0.9f, 0.f, 0.f, 0.f);
+    scene_description.material_index.assign(BENCHMARK_SPHERES, 0);
+
+    return scene_description;
+}
+
+std::string PlatformInfoString(cl_platform_id platform, cl_platform_info parameter)
+{
+    size_t info_size;
+    CL_CHECK_CALL(clGetPlatformInfo(platform, parameter, 0, nullptr, &info_size));
+    std::string info(info_size, '\0');
+    CL_CHECK_CALL(clGetPlatformInfo(platform, parameter, info_size, &info[0], nullptr));
+    // Drop the terminator
+    info.resize(info_size != 0 ? info_size - 1 : 0);
+
+    return info;
+}
+
+// Key identifying the device and its driver in the benchmark cache
+std::string BenchmarkKey(cl_platform_id platform, cl_device_id device)
+{
+    return PlatformInfoString(platform, CL_PLATFORM_NAME) + " | " + DeviceInfoString(device, CL_DEVICE_NAME) +
+           " | " + DeviceInfoString(device, CL_DRIVER_VERSION);
+}
+
+} // Anonymous namespace
+
+std::string DeviceInfoString(cl_device_id device, cl_device_info parameter)
+{
+    size_t info_size;
+    CL_CHECK_CALL(clGetDeviceInfo(device, parameter, 0, nullptr, &info_size));
+    std::string info(info_size, '\0');
+    CL_CHECK_CALL(clGetDeviceInfo(device, parameter, info_size, &info[0], nullptr));
+    // Drop the terminator
+    info.resize(info_size != 0 ? info_size - 1 : 0);
+
+    return info;
+}
+
+cl_device_type ParseDeviceType(const std::string& name)
+{
+    if (name == "all")
+    {
+        return CL_DEVICE_TYPE_ALL;
+    }
+    if (name == "cpu")
+    {
+        return CL_DEVICE_TYPE_CPU;
+    }
+    if (name == "gpu")
+    {
+        return CL_DEVICE_TYPE_GPU;
+    }
+    if (name == "accelerator")
+    {
+        return CL_DEVICE_TYPE_ACCELERATOR;
+    }
+
+    std::ostringstream error_message;
+    error_message << "Unknown device type: " << name;
+    throw std::invalid_argument{ error_message.str() };
+}
+
+constexpr unsigned int DeviceSelectionPolicy::BENCHMARK_MILLISECONDS;
+
+DeviceSelectionPolicy::DeviceSelectionPolicy() noexcept
+    : device_type{ CL_DEVICE_TYPE_ALL }, device_index{ -1 }, benchmark_cache_filename{ "rabbit_devices.txt" },
+      hybrid{ false }
+{}
+
+DeviceSelectionPolicy DeviceSelectionPolicy::FromEnvironment()
+{
+    DeviceSelectionPolicy policy;
+    if (const char* device_type = std::getenv("RABBIT_DEVICE_TYPE"))
+    {
+        policy.device_type = ParseDeviceType(device_type);
+    }
+    if (const char* name_pattern = std::getenv("RABBIT_DEVICE_NAME"))
+    {
+        policy.name_pattern = name_pattern;
+    }
+    if (const char* device_index = std::getenv("RABBIT_DEVICE_INDEX"))
+    {
+        // The whole value must be a non-negative number
+        const std::string value{ device_index };
+        size_t parsed_length{ 0 };
+        try
+        {
+            policy.device_index = std::stoi(value, &parsed_length);
+        }
+        catch (const std::exception&)
+        {
+            parsed_length = 0;
+        }
+        if (parsed_length == 0 || parsed_length != value.size() || policy.device_index < 0)
+        {
+            throw std::invalid_argument{ "Invalid device index: " + value };
+        }
+    }
+
+    return policy;
+}
+
+DeviceBenchmarkCache::DeviceBenchmarkCache(const std::string& filename)
+    : cache_filename{ filename }
+{
+    if (cache_filename.empty())
+    {
+        return;
+    }
+
+    std::ifstream cache_file{ cache_filename };
+    std::string line;
+    while (std::getline(cache_file, line))
+    {
+        // Each line is the key, a tab and the throughput
+        const auto separator = line.find('\t');
+        if (separator == std::string::npos)
+        {
+            continue;
+        }
+
+        double mrays_per_second;
+        std::istringstream values{ line.substr(separator + 1) };
+        if (values >> mrays_per_second)
+        {
+            results[line.substr(0, separator)] = mrays_per_second;
+        }
+    }
+}
+
+bool DeviceBenchmarkCache::Find(const std::string& key, double& mrays_per_second) const
+{
+    const auto cached_result = results.find(key);
+    if (cached_result == results.end())
+    {
+        return false;
+    }
+    mrays_per_second = cached_result->second;
+
+    return true;
+}
+
+void DeviceBenchmarkCache::Store(const std::string& key, double mrays_per_second)
+{
+    results[key] = mrays_per_second;
+    if (cache_filename.empty())
+    {
+        return;
+    }
+
+    std::ofstream cache_file{ cache_filename };
+    if (!cache_file.is_open())
+    {
+        throw std::runtime_error{ "Could not write device benchmark cache: " + cache_filename };
+    }
+    for (const auto& result : results)
+    {
+        cache_file << result.first << '\t' << result.second << '\n';
+    }
+}
+
+CLEnvironment::CLEnvironment(const DeviceSelectionPolicy& policy, const std::string& kernel_filename,
+                             const std::string& binary_cache_directory, std::ostream& log)
+    : devices{ EnumerateDevices() }
+{
+    try
+    {
+        if (devices.empty())
+        {
+            throw std::runtime_error("No available OpenCL devices");
+        }
+
+        // Devices passing the type and name filters, all of them are listed with their index
+        const std::regex name_regex{ policy.name_pattern };
+        std::vector<const DeviceEntry*> candidates;
+        for (unsigned int d = 0; d != devices.size(); d++)
+        {
+            const DeviceEntry& entry{ devices[d] };
+            const bool candidate{ (entry.type & policy.device_type) != 0 &&
+                                  (policy.name_pattern.empty() || std::regex_search(entry.name, name_regex)) };
+            log << "[" << d << "]: " << entry.name << (candidate ? "\n" : " (excluded by the policy)\n");
+            if (candidate)
+            {
+                candidates.push_back(&entry);
+            }
+        }
+        if (candidates.empty())
+        {
+            throw std::runtime_error("No OpenCL device matches the device type and name");
+        }
+
+        const DeviceEntry* selected{ candidates.front() };
+        if (policy.device_index >= 0)
+        {
+            if (static_cast<size_t>(policy.device_index) >= candidates.size())
+            {
+                throw std::runtime_error("Device index " + std::to_string(policy.device_index) + " out of range, " +
+                                         std::to_string(candidates.size()) + " devices match");
+            }
+            selected = candidates[policy.device_index];
+        }
+        else if (candidates.size() > 1)
+        {
+            // The fastest device wins, a device the benchmark fails on is never selected
+            DeviceBenchmarkCache benchmark_cache{ policy.benchmark_cache_filename };
+            double best_mrays_per_second{ 0. };
+            for (const DeviceEntry* candidate : candidates)
+            {
+                const std::string key{ BenchmarkKey(candidate->platform, candidate->device) };
+                double mrays_per_second;
+                const bool cached{ benchmark_cache.Find(key, mrays_per_second) };
+                if (!cached)
+                {
+                    // Failures are not cached, the device is measured again in the next run
+                    try
+                    {
+                        mrays_per_second = BenchmarkDevice(*candidate, kernel_filename, binary_cache_directory);
+                        benchmark_cache.Store(key, mrays_per_second);
+                    }
+                    catch (const std::exception& ex)
+                    {
+                        log << "Benchmark failed on " << candidate->name << ": " << ex.what() << "\n";
+                        continue;
+                    }
+                }
+                log << candidate->name << ": " << mrays_per_second << " Mrays/s" << (cached ? " (cached)" : "")
+                    << "\n";
+                if (mrays_per_second > best_mrays_per_second)
+                {
+                    best_mrays_per_second = mrays_per_second;
+                    selected = candidate;
+                }
+            }
+            if (best_mrays_per_second == 0.)
+            {
+                throw std::runtime_error("The benchmark failed on all the OpenCL devices that match");
+            }
+        }
+        log << "Selected device: " << selected->name << "\n";
+        selected_devices.push_back(selected->device);
+        contexts.push_back(CreateContext(*selected));
+
+        // The other candidates share the render with the selected device
+        if (policy.hybrid && policy.device_index < 0)
+        {
+            for (const DeviceEntry* candidate : candidates)
+            {
+                if (candidate != selected)
+                {
+                    log << "Hybrid rendering with: " << candidate->name << "\n";
+                    selected_devices.push_back(candidate->device);
+                    contexts.push_back(CreateContext(*candidate));
+                }
+            }
+        }
+    }
+    catch (const std::exception& ex)
+    {
+        // Cleanup what is needed and rethrow exception
+        Cleanup();
+        throw;
+    }
+}
+
+CLEnvironment::~CLEnvironment() noexcept
+{
+    Cleanup();
+}
+
+std::vector<CLEnvironment::DeviceEntry> CLEnvironment::EnumerateDevices()
+{
+    cl_uint num_platforms;
+    CL_CHECK_CALL(clGetPlatformIDs(0, nullptr, &num_platforms));
+    if (num_platforms == 0)
+    {
+        throw std::runtime_error("No available OpenCL platforms");
+    }
+    std::vector<cl_platform_id> platforms(num_platforms);
+    CL_CHECK_CALL(clGetPlatformIDs(num_platforms, platforms.data(), nullptr));
+
+    std::vector<DeviceEntry> entries;
+    for (auto platform : platforms)
+    {
+        cl_uint num_devices{ 0 };
+        const cl_int devices_status{ clGetDeviceIDs(platform, CL_DEVICE_TYPE_ALL, 0, nullptr, &num_devices) };
+        if (devices_status == CL_DEVICE_NOT_FOUND || num_devices == 0)
+        {
+            continue;
+        }
+        CL_CHECK_STATUS(devices_status);
+        std::vector<cl_device_id> platform_devices(num_devices);
+        CL_CHECK_CALL(clGetDeviceIDs(platform, CL_DEVICE_TYPE_ALL, num_devices, platform_devices.data(), nullptr));
+
+        const std::string platform_name{ PlatformInfoString(platform, CL_PLATFORM_NAME) };
+        for (auto platform_device : platform_devices)
+        {
+            cl_device_type type;
+            CL_CHECK_CALL(clGetDeviceInfo(platform_device, CL_DEVICE_TYPE, sizeof(cl_device_type), &type, nullptr));
+            entries.push_back({ platform, platform_device, type,
+                                platform_name + ": " + DeviceInfoString(platform_device, CL_DEVICE_NAME) });
+        }
+    }
+
+    return entries;
+}
+
+cl_context CLEnvironment::CreateContext(const DeviceEntry& entry)
+{
+    const std::array<cl_context_properties, 3> context_properties{
+        CL_CONTEXT_PLATFORM, reinterpret_cast<cl_context_properties>(entry.platform),
+        0 };
+    cl_int err_code{ CL_SUCCESS };
+    cl_context new_context{ clCreateContext(context_properties.data(), 1, &entry.device,
+                                            ::CL::ContextCallback, nullptr, &err_code) };
+    CL_CHECK_STATUS(err_code);
+
+    return new_context;
+}
+
+double CLEnvironment::BenchmarkDevice(const DeviceEntry& entry, const std::string& kernel_filename,
+                                      const std::string& binary_cache_directory)
+{
+    // The context is only kept for the benchmark, the device takes its own reference
+    const cl_context benchmark_context{ CreateContext(entry) };
+    double mrays_per_second{ 0. };
+    try
+    {
+        RenderingDevice rendering_device{ benchmark_context, entry.device, kernel_filename, "",
+                                          binary_cache_directory };
+        IntersectionBenchmark benchmark{ rendering_device, RenderingOptions{} };
+        mrays_per_second = benchmark.Throughput(BenchmarkScene(), BENCHMARK_RAYS,
+                                                std::chrono::milliseconds{
+                                                    DeviceSelectionPolicy::BENCHMARK_MILLISECONDS });
+    }
+    catch (const std::exception& ex)
+    {
+        clReleaseContext(benchmark_context);
+        throw;
+    }
+    CL_CHECK_CALL(clReleaseContext(benchmark_context));
+
+    return mrays_per_second;
+}
+
+void CLEnvironment::Cleanup() noexcept
+{
+    try
+    {
+        for (auto context : contexts)
+        {
+            CL_CHECK_CALL(clReleaseContext(context));
+        }
+        for (const auto& entry : devices)
+        {
+            CL_CHECK_CALL(clReleaseDevice(entry.device));
+        }
+    }
+    catch (const std::exception& ex)
+    {
+        // TODO operator<< could throw
+        std::cerr << ex.what() << std::endl;
+    }
+}
+
+} // CL namespace
+} // Rendering namespace
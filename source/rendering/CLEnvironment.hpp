@@ -0,0 +1,157 @@
+//
+// Created by Simon on 2019-04-01.
+//
+
+#ifndef RABBIT_CLENVIRONMENT_HPP
+#define RABBIT_CLENVIRONMENT_HPP
+
+#ifdef __APPLE__
+
+#include <OpenCL/cl.h>
+
+#else
+#include <CL/cl.h>
+#endif
+
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace Rendering
+{
+namespace CL
+{
+
+// Parse device type name (all, cpu, gpu, accelerator), throws if the name is not valid
+cl_device_type ParseDeviceType(const std::string& name);
+
+// Read a string parameter of the device
+std::string DeviceInfoString(cl_device_id device, cl_device_info parameter);
+
+// How the device is selected among the devices of all the platforms. The type and name restrict the candidates, the
+// index picks one of them in platform order. Without an index the only candidate is used, or the fastest one in
+// a short benchmark of the Intersect kernel if there are more
+struct DeviceSelectionPolicy
+{
+    // Benchmark time spent on each device
+    static constexpr unsigned int BENCHMARK_MILLISECONDS{ 200 };
+
+    // Type of the candidates, CL_DEVICE_TYPE_ALL does not restrict them
+    cl_device_type device_type;
+
+    // ECMAScript regular expression searched in "platform name: device name", empty does not restrict them
+    std::string name_pattern;
+
+    // Index among the candidates, negative if not given
+    int device_index;
+
+    // File where the benchmark results are cached, the benchmark is not cached if empty
+    std::string benchmark_cache_filename;
+
+    // Also create a context for the other candidates so a render can be split among them, unless an index is given
+    bool hybrid;
+
+    DeviceSelectionPolicy() noexcept;
+
+    // Policy read from the RABBIT_DEVICE_TYPE, RABBIT_DEVICE_NAME and RABBIT_DEVICE_INDEX environment variables,
+    // throws if a value is not valid
+    static DeviceSelectionPolicy FromEnvironment();
+};
+
+// Throughput of the Intersect kernel measured on each device, stored in a text file
+class DeviceBenchmarkCache
+{
+public:
+    // Load the cache from the file, a missing file is an empty cache
+    explicit DeviceBenchmarkCache(const std::string& filename);
+
+    // Find the throughput in Mrays/s for the key, returns false if the device was never measured
+    bool Find(const std::string& key, double& mrays_per_second) const;
+
+    // Store the throughput for the key and save the file if there is one
+    void Store(const std::string& key, double mrays_per_second);
+
+private:
+    // File with the cache
+    const std::string cache_filename;
+
+    // Throughput for each key
+    std::map<std::string, double> results;
+};
+
+// OpenCL platform, device and context used for the run. All the devices are enumerated and one is selected without
+// user interaction, the context is created for it
+class CLEnvironment
+{
+public:
+    // Select the device by the policy and create its context, the selection is written to the log. The benchmark
+    // builds the kernel from the file and caches the program binaries in the directory if it is not empty. Throws if
+    // there are no devices or none matches the policy
+    CLEnvironment(const DeviceSelectionPolicy& policy, const std::string& kernel_filename,
+                  const std::string& binary_cache_directory, std::ostream& log);
+
+    ~CLEnvironment() noexcept;
+
+    CLEnvironment(const CLEnvironment&) = delete;
+
+    CLEnvironment& operator=(const CLEnvironment&) = delete;
+
+    // Selected device and its context
+    cl_context Context() const noexcept
+    {
+        return contexts.front();
+    }
+
+    cl_device_id Device() const noexcept
+    {
+        return selected_devices.front();
+    }
+
+    // Devices used for hybrid rendering and their contexts, the selected device is the first one
+    const std::vector<cl_device_id>& Devices() const noexcept
+    {
+        return selected_devices;
+    }
+
+    const std::vector<cl_context>& Contexts() const noexcept
+    {
+        return contexts;
+    }
+
+private:
+    // Device of a platform
+    struct DeviceEntry
+    {
+        cl_platform_id platform;
+        cl_device_id device;
+        cl_device_type type;
+        // Platform and device name as matched by the policy
+        std::string name;
+    };
+
+    // Devices of all the platforms in platform order
+    static std::vector<DeviceEntry> EnumerateDevices();
+
+    // Create a context with only the device
+    static cl_context CreateContext(const DeviceEntry& entry);
+
+    // Measure the throughput of the Intersect kernel on the device in Mrays/s
+    static double BenchmarkDevice(const DeviceEntry& entry, const std::string& kernel_filename,
+                                  const std::string& binary_cache_directory);
+
+    // Cleanup OpenCL resources without throwing
+    void Cleanup() noexcept;
+
+    // Enumerated devices, released with the environment
+    std::vector<DeviceEntry> devices;
+
+    // Selected devices and their contexts
+    std::vector<cl_device_id> selected_devices;
+    std::vector<cl_context> contexts;
+};
+
+} // CL namespace
+} // Rendering namespace
+
+#endif //RABBIT_CLENVIRONMENT_HPP
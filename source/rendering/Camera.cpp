@@ -10,18 +10,25 @@ namespace Rendering
 
 Camera::Camera(const Vector3& eye, const Vector3& at, const Vector3& up,
                float fov, unsigned int width, unsigned int height) noexcept
-    : eye{ eye }, image_width{ width }, image_height{ height },
-      inv_width{ 1.f / image_width }, inv_height{ 1.f / image_height }
+    : Camera{ eye, at, up, fov, width, height, CropWindow{ 0, 0, width, height } }
+{}
+
+Camera::Camera(const Vector3& eye, const Vector3& at, const Vector3& up,
+               float fov, unsigned int width, unsigned int height, const CropWindow& film_window) noexcept
+    : eye{ eye }, image_width{ film_window.width }, image_height{ film_window.height },
+      inv_width{ 1.f / width }, inv_height{ 1.f / height },
+      film_x{ film_window.x }, film_y{ height - film_window.y - film_window.height }
 {
     // Compute local base
     ComputeLocalBase(eye, at, up);
     // Compute FOV
     bottom = -std::tan(Radians(fov / 2.f));
-    left = bottom * image_width / image_height;
+    left = bottom * width / height;
 }
 
 void Camera::Move(const Vector3& eye, const Vector3& at, const Vector3& up) noexcept
 {
+    this->eye = eye;
     ComputeLocalBase(eye, at, up);
 }
 
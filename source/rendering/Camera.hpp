@@ -6,6 +6,7 @@
 #define RABBIT_CAMERA_HPP
 
 #include "Vector.hpp"
+#include "CropWindow.hpp"
 
 namespace Rendering
 {
@@ -17,6 +18,10 @@ public:
     Camera(const Vector3& eye, const Vector3& at, const Vector3& up,
            float fov, unsigned int width, unsigned int height) noexcept;
 
+    // Camera of the whole image that only generates the rays of the pixels in the window, the film covers the window
+    Camera(const Vector3& eye, const Vector3& at, const Vector3& up,
+           float fov, unsigned int width, unsigned int height, const CropWindow& film_window) noexcept;
+
     // Move camera around
     void Move(const Vector3& eye, const Vector3& at, const Vector3& up) noexcept;
 
@@ -30,10 +35,12 @@ private:
     Vector3 u, v, w;
     // FOV
     float bottom, left;
-    // Image size
+    // Size of the film, the window of the image that is rendered
     const unsigned int image_width, image_height;
-    // Inverse of the size of the image
+    // Inverse of the size of the whole image
     const float inv_width, inv_height;
+    // Bottom left corner of the film in the image
+    const unsigned int film_x, film_y;
 };
 
 } // Rendering namespace
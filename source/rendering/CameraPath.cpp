@@ -0,0 +1,75 @@
+//
+// Created by Simon on 2019-03-26.
+//
+
+#include "CameraPath.hpp"
+#include "Keyframes.hpp"
+
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+namespace Rendering
+{
+
+CameraPath CameraPath::ReadCameraPath(const std::string& filename)
+{
+    CameraPath camera_path;
+
+    // Open file for reading
+    std::ifstream path_file{ filename };
+    if (!path_file.is_open())
+    {
+        std::ostringstream error_message;
+        error_message << "Could not open file: " << filename;
+        throw std::invalid_argument{ error_message.str() };
+    }
+
+    std::string line;
+    unsigned int line_number{ 0 };
+    while (std::getline(path_file, line))
+    {
+        line_number++;
+        // Skip empty lines and comments
+        const auto first = line.find_first_not_of(" \t\r");
+        if (first == std::string::npos || line[first] == '#')
+        {
+            continue;
+        }
+
+        std::istringstream line_stream{ line };
+        unsigned int frame;
+        Vector3 eye, at, up;
+        if (!(line_stream >> frame >> eye.x >> eye.y >> eye.z >> at.x >> at.y >> at.z >> up.x >> up.y >> up.z))
+        {
+            std::ostringstream error_message;
+            error_message << filename << ":" << line_number << ": expected <frame> <eye> <at> <up>";
+            throw std::invalid_argument{ error_message.str() };
+        }
+        if (!camera_path.keyframes.empty() && frame <= camera_path.keyframes.back().frame)
+        {
+            std::ostringstream error_message;
+            error_message << filename << ":" << line_number << ": keyframes must have increasing frame numbers";
+            throw std::invalid_argument{ error_message.str() };
+        }
+
+        camera_path.keyframes.emplace_back(frame, eye, at, up);
+    }
+
+    if (camera_path.keyframes.empty())
+    {
+        throw std::invalid_argument{ "No keyframes in camera path: " + filename };
+    }
+
+    return camera_path;
+}
+
+void CameraPath::Evaluate(unsigned int frame, Vector3& eye, Vector3& at, Vector3& up) const noexcept
+{
+    const KeyframeInterval<CameraKeyframe> interval{ FindKeyframes(keyframes, frame) };
+    eye = interval.Interpolate(&CameraKeyframe::eye);
+    at = interval.Interpolate(&CameraKeyframe::at);
+    up = interval.Interpolate(&CameraKeyframe::up);
+}
+
+} // Rendering namespace
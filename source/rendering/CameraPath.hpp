@@ -0,0 +1,51 @@
+//
+// Created by Simon on 2019-03-26.
+//
+
+#ifndef RABBIT_CAMERAPATH_HPP
+#define RABBIT_CAMERAPATH_HPP
+
+#include "Vector.hpp"
+
+#include <vector>
+#include <string>
+
+namespace Rendering
+{
+
+// Camera position at a given frame
+struct CameraKeyframe
+{
+    unsigned int frame;
+    Vector3 eye, at, up;
+
+    constexpr CameraKeyframe(unsigned int frame, const Vector3& eye, const Vector3& at, const Vector3& up) noexcept
+        : frame{ frame }, eye{ eye }, at{ at }, up{ up }
+    {}
+};
+
+// Camera animation, the frames between two keyframes are linearly interpolated
+// so a keyframe for each frame gives a plain list of cameras
+class CameraPath
+{
+public:
+    // Read the keyframes from a file, one per line: <frame> <eye> <at> <up>
+    static CameraPath ReadCameraPath(const std::string& filename);
+
+    // Number of frames in the animation, from frame 0 to the last keyframe
+    unsigned int NumFrames() const noexcept
+    {
+        return keyframes.empty() ? 0 : keyframes.back().frame + 1;
+    }
+
+    // Compute the camera for the given frame
+    void Evaluate(unsigned int frame, Vector3& eye, Vector3& at, Vector3& up) const noexcept;
+
+private:
+    // Keyframes sorted by frame
+    std::vector<CameraKeyframe> keyframes;
+};
+
+} // Rendering namespace
+
+#endif //RABBIT_CAMERAPATH_HPP
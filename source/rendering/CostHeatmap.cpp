@@ -0,0 +1,120 @@
+//
+// Created by Simon on 2019-04-01.
+//
+
+#include "CostHeatmap.hpp"
+#include "CLError.hpp"
+#include "ImageIO.hpp"
+
+#include <algorithm>
+#include <array>
+
+namespace Rendering
+{
+namespace CL
+{
+
+namespace
+{
+
+// Percentile of the tests mapped to white
+constexpr float SCALE_PERCENTILE{ 0.99f };
+
+// Colours at evenly spaced values of the normalised cost
+constexpr std::array<std::array<float, 3>, 5> COLOUR_MAP{ { { 0.f, 0.f, 0.f }, { 0.f, 0.f, 1.f }, { 1.f, 0.f, 0.f },
+                                                            { 1.f, 1.f, 0.f }, { 1.f, 1.f, 1.f } } };
+
+// Interpolate the colour map at a value in [0, 1]
+std::array<unsigned char, 3> FalseColour(float value) noexcept
+{
+    const float position{ std::min(std::max(value, 0.f), 1.f) * (COLOUR_MAP.size() - 1) };
+    const size_t segment{ std::min(static_cast<size_t>(position), COLOUR_MAP.size() - 2) };
+    const float t{ position - segment };
+
+    std::array<unsigned char, 3> colour;
+    for (size_t c = 0; c != 3; c++)
+    {
+        const float channel{ COLOUR_MAP[segment][c] * (1.f - t) + COLOUR_MAP[segment + 1][c] * t };
+        colour[c] = static_cast<unsigned char>(channel * 255.f + 0.5f);
+    }
+
+    return colour;
+}
+
+} // Anonymous namespace
+
+CostHeatmap CostHeatmap::Read(cl_command_queue queue, const CostPixels& cost_pixels, unsigned int width,
+                              unsigned int height)
+{
+    CostHeatmap heatmap{ width, height, std::vector<cl_uint>(cost_pixels.num_pixels),
+                         std::vector<cl_uint>(cost_pixels.num_pixels) };
+    const size_t size{ cost_pixels.num_pixels * sizeof(cl_uint) };
+    CL_CHECK_CALL(clEnqueueReadBuffer(queue, cost_pixels.rays, CL_TRUE, 0, size, heatmap.rays.data(),
+                                      0, nullptr, nullptr));
+    CL_CHECK_CALL(clEnqueueReadBuffer(queue, cost_pixels.tests, CL_TRUE, 0, size, heatmap.tests.data(),
+                                      0, nullptr, nullptr));
+
+    return heatmap;
+}
+
+std::string CostHeatmap::ImageFilenameForImage(const std::string& image_filename)
+{
+    return IO::ReplaceExtension(image_filename, ".cost.png");
+}
+
+std::string CostHeatmap::RawFilenameForImage(const std::string& image_filename)
+{
+    return IO::ReplaceExtension(image_filename, ".cost.pfm");
+}
+
+void CostHeatmap::WriteImage(const std::string& filename) const
+{
+    std::vector<cl_uint> sorted_tests{ tests };
+    const auto percentile = sorted_tests.begin() + static_cast<size_t>(SCALE_PERCENTILE * (sorted_tests.size() - 1));
+    std::nth_element(sorted_tests.begin(), percentile, sorted_tests.end());
+    const float inv_scale{ *percentile != 0 ? 1.f / *percentile : 0.f };
+
+    std::vector<unsigned char> raster(3 * width * height);
+    for (unsigned int y = 0; y != height; y++)
+    {
+        // Rows are flipped to the image order
+        const cl_uint* const film_row{ tests.data() + (height - 1 - y) * width };
+        for (unsigned int x = 0; x != width; x++)
+        {
+            const auto colour = FalseColour(film_row[x] * inv_scale);
+            std::copy(colour.begin(), colour.end(), raster.begin() + 3 * (y * width + x));
+        }
+    }
+    IO::WritePNG(filename, width, height, raster);
+}
+
+void CostHeatmap::WriteRaw(const std::string& filename) const
+{
+    std::vector<float> raster(3 * width * height);
+    for (size_t i = 0; i != rays.size(); i++)
+    {
+        raster[3 * i] = static_cast<float>(rays[i]);
+        raster[3 * i + 1] = static_cast<float>(tests[i]);
+        raster[3 * i + 2] = rays[i] != 0 ? static_cast<float>(tests[i]) / rays[i] : 0.f;
+    }
+    IO::WritePFM(filename, width, height, raster);
+}
+
+void CostHeatmap::Print(std::ostream& output) const
+{
+    cl_ulong total_rays{ 0 }, total_tests{ 0 };
+    for (size_t i = 0; i != rays.size(); i++)
+    {
+        total_rays += rays[i];
+        total_tests += tests[i];
+    }
+    const cl_uint max_tests{ tests.empty() ? 0 : *std::max_element(tests.begin(), tests.end()) };
+    const double num_pixels{ static_cast<double>(std::max<size_t>(tests.size(), 1)) };
+
+    output << "Cost: " << total_rays / num_pixels << " rays and " << total_tests / num_pixels
+           << " tests per pixel, " << (total_rays != 0 ? static_cast<double>(total_tests) / total_rays : 0.)
+           << " tests per ray, at most " << max_tests << " tests in a pixel\n";
+}
+
+} // CL namespace
+} // Rendering namespace
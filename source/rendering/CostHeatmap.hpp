@@ -0,0 +1,51 @@
+//
+// Created by Simon on 2019-04-01.
+//
+
+#ifndef RABBIT_COSTHEATMAP_HPP
+#define RABBIT_COSTHEATMAP_HPP
+
+#include "RenderingData.hpp"
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace Rendering
+{
+namespace CL
+{
+
+// Rays traced and intersection tests done for each pixel, read back from the counters summed by Intersect. The
+// tests are the primitives tested plus the acceleration structure nodes visited, without one every sphere is tested
+struct CostHeatmap
+{
+    // Copy the counters to the host, the call blocks until the copy is done
+    static CostHeatmap Read(cl_command_queue queue, const CostPixels& cost_pixels, unsigned int width,
+                            unsigned int height);
+
+    // Files the heatmap of an image is written to: the image name with the extension replaced by .cost.png for the
+    // false colour image and by .cost.pfm for the raw values
+    static std::string ImageFilenameForImage(const std::string& image_filename);
+    static std::string RawFilenameForImage(const std::string& image_filename);
+
+    // Write the tests of each pixel as a false colour image, black to blue, red, yellow and white. The scale is set
+    // by the 99th percentile so a few very expensive pixels do not make the rest black
+    void WriteImage(const std::string& filename) const;
+
+    // Write a float image with rays, tests and tests per ray of each pixel in the red, green and blue channels
+    void WriteRaw(const std::string& filename) const;
+
+    // Print the average and maximum cost of the pixels
+    void Print(std::ostream& output) const;
+
+    unsigned int width, height;
+
+    // Counters of each pixel, with the first row at the bottom as in the film
+    std::vector<cl_uint> rays, tests;
+};
+
+} // CL namespace
+} // Rendering namespace
+
+#endif //RABBIT_COSTHEATMAP_HPP
@@ -0,0 +1,230 @@
+//
+// Created by Simon on 2019-03-29.
+//
+
+#include "Denoiser.hpp"
+#include "HostSIMD.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <future>
+#include <stdexcept>
+#include <thread>
+
+namespace Rendering
+{
+
+namespace
+{
+
+// B3 spline filter taps
+constexpr float KERNEL[5]{ 1.f / 16.f, 1.f / 4.f, 3.f / 8.f, 1.f / 4.f, 1.f / 16.f };
+
+// Albedo below this value is not divided out, the radiance is filtered as it is
+constexpr float MIN_ALBEDO{ 1e-3f };
+
+// Exponential of non positive values without a library call: 2^(x log2(e)) with the integer part in the exponent
+// bits and a polynomial for the fraction, the relative error is below 1e-4. Values below 2^MIN_EXP2 are clamped to
+// it. The exponent is biased before the conversion, truncating a positive value is the floor
+inline float FastExp(float x) noexcept
+{
+    const float biased{ std::max(x * 1.44269504f, Denoiser::MIN_EXP2) + 127.f };
+    const std::int32_t exponent{ static_cast<std::int32_t>(biased) };
+    const float fraction{ biased - static_cast<float>(exponent) };
+    const float p{ 1.f + fraction * (0.69314718f + fraction * (0.24022651f + fraction * (0.05550411f +
+                                                                                          fraction * 0.00961813f))) };
+    const std::int32_t bits{ exponent << 23 };
+    float scale;
+    std::memcpy(&scale, &bits, sizeof(float));
+
+    return p * scale;
+}
+
+inline float Luminance(float r, float g, float b) noexcept
+{
+    return 0.2126f * r + 0.7152f * g + 0.0722f * b;
+}
+
+} // Anonymous namespace
+
+constexpr float Denoiser::MIN_LUMINANCE_SQUARED;
+constexpr float Denoiser::MIN_EXP2;
+constexpr float Denoiser::NORMAL_SHARPNESS;
+
+Denoiser::Denoiser(float illumination_sigma, float albedo_sigma)
+    : illumination_sigma{ illumination_sigma }, albedo_sigma{ albedo_sigma }
+{}
+
+void Denoiser::Denoise(unsigned int width, unsigned int height, std::vector<float>& radiance,
+                       const std::vector<float>& albedo, const std::vector<float>& normal) const
+{
+    const size_t num_pixels{ static_cast<size_t>(width) * height };
+    if (radiance.size() != 3 * num_pixels || albedo.size() != 3 * num_pixels || normal.size() != 3 * num_pixels)
+    {
+        throw std::invalid_argument{ "Denoiser input does not match the image size" };
+    }
+
+    // Split in planes, divide the albedo out of the radiance and make the averaged normals unit length
+    Planes illumination, albedo_planes, normal_planes, modulation;
+    for (Planes* planes : { &illumination, &albedo_planes, &normal_planes, &modulation })
+    {
+        planes->r.resize(num_pixels);
+        planes->g.resize(num_pixels);
+        planes->b.resize(num_pixels);
+    }
+    for (size_t p = 0; p != num_pixels; p++)
+    {
+        albedo_planes.r[p] = albedo[3 * p];
+        albedo_planes.g[p] = albedo[3 * p + 1];
+        albedo_planes.b[p] = albedo[3 * p + 2];
+        modulation.r[p] = albedo[3 * p] > MIN_ALBEDO ? albedo[3 * p] : 1.f;
+        modulation.g[p] = albedo[3 * p + 1] > MIN_ALBEDO ? albedo[3 * p + 1] : 1.f;
+        modulation.b[p] = albedo[3 * p + 2] > MIN_ALBEDO ? albedo[3 * p + 2] : 1.f;
+        illumination.r[p] = radiance[3 * p] / modulation.r[p];
+        illumination.g[p] = radiance[3 * p + 1] / modulation.g[p];
+        illumination.b[p] = radiance[3 * p + 2] / modulation.b[p];
+
+        const float length{ std::sqrt(normal[3 * p] * normal[3 * p] + normal[3 * p + 1] * normal[3 * p + 1] +
+                                      normal[3 * p + 2] * normal[3 * p + 2]) };
+        const float inv_length{ length > 0.f ? 1.f / length : 0.f };
+        normal_planes.r[p] = normal[3 * p] * inv_length;
+        normal_planes.g[p] = normal[3 * p + 1] * inv_length;
+        normal_planes.b[p] = normal[3 * p + 2] * inv_length;
+    }
+
+    // Each pass reads the output of the previous one, the rows are split among the threads
+    Planes filtered{ illumination };
+    const unsigned int num_threads{ std::max(1u, std::min(std::thread::hardware_concurrency(), height)) };
+    for (unsigned int pass = 0; pass != NUM_PASSES; pass++)
+    {
+        std::vector<std::future<void>> bands;
+        for (unsigned int t = 0; t != num_threads; t++)
+        {
+            bands.push_back(std::async(std::launch::async, &Denoiser::FilterRows, this, width, height, 1u << pass,
+                                       1.f / static_cast<float>(1u << pass), std::cref(illumination),
+                                       std::cref(albedo_planes), std::cref(normal_planes), std::ref(filtered),
+                                       t * height / num_threads, (t + 1) * height / num_threads));
+        }
+        for (auto& band : bands)
+        {
+            band.get();
+        }
+        std::swap(illumination, filtered);
+    }
+
+    for (size_t p = 0; p != num_pixels; p++)
+    {
+        radiance[3 * p] = illumination.r[p] * modulation.r[p];
+        radiance[3 * p + 1] = illumination.g[p] * modulation.g[p];
+        radiance[3 * p + 2] = illumination.b[p] * modulation.b[p];
+    }
+}
+
+void Denoiser::FilterRows(unsigned int width, unsigned int height, unsigned int step, float illumination_scale,
+                          const Planes& input, const Planes& albedo, const Planes& normal, Planes& output,
+                          unsigned int first_row, unsigned int end_row) const
+{
+    // Illumination differences are relative to the luminance, the sigma shrinks with the pass
+    const float illumination_sigma_squared{ illumination_sigma * illumination_sigma *
+                                            illumination_scale * illumination_scale };
+    const float inv_albedo_sigma_squared{ 1.f / (albedo_sigma * albedo_sigma) };
+#ifdef RABBIT_HOST_SIMD
+    const bool use_avx2{ HostInstructions() != HostInstructionSet::Scalar };
+#endif
+
+    std::vector<float> sum_r(width), sum_g(width), sum_b(width), sum_weight(width), luminance(width);
+    for (unsigned int y = first_row; y != end_row; y++)
+    {
+        std::fill(sum_r.begin(), sum_r.end(), 0.f);
+        std::fill(sum_g.begin(), sum_g.end(), 0.f);
+        std::fill(sum_b.begin(), sum_b.end(), 0.f);
+        std::fill(sum_weight.begin(), sum_weight.end(), 0.f);
+
+        const size_t row{ static_cast<size_t>(y) * width };
+        for (unsigned int x = 0; x != width; x++)
+        {
+            luminance[x] = Luminance(input.r[row + x], input.g[row + x], input.b[row + x]);
+        }
+
+        for (int tap_y = -2; tap_y <= 2; tap_y++)
+        {
+            const int source_y{ static_cast<int>(y) + tap_y * static_cast<int>(step) };
+            if (source_y < 0 || source_y >= static_cast<int>(height))
+            {
+                continue;
+            }
+            for (int tap_x = -2; tap_x <= 2; tap_x++)
+            {
+                // Only the pixels whose tap falls inside the image, so the inner loop has no bounds checks
+                const int offset{ tap_x * static_cast<int>(step) };
+                const int first_x{ std::max(0, -offset) };
+                const int end_x{ std::min(static_cast<int>(width), static_cast<int>(width) - offset) };
+                if (first_x >= end_x)
+                {
+                    continue;
+                }
+                const float tap_weight{ KERNEL[tap_x + 2] * KERNEL[tap_y + 2] };
+
+                // Plain pointers to the row of the pixels and to the row of their taps
+                const size_t source_row{ static_cast<size_t>(source_y) * width + offset };
+                const TapRows rows{ input.r.data() + row, input.g.data() + row, input.b.data() + row,
+                                    input.r.data() + source_row, input.g.data() + source_row,
+                                    input.b.data() + source_row,
+                                    albedo.r.data() + row, albedo.g.data() + row, albedo.b.data() + row,
+                                    albedo.r.data() + source_row, albedo.g.data() + source_row,
+                                    albedo.b.data() + source_row,
+                                    normal.r.data() + row, normal.g.data() + row, normal.b.data() + row,
+                                    normal.r.data() + source_row, normal.g.data() + source_row,
+                                    normal.b.data() + source_row,
+                                    sum_r.data(), sum_g.data(), sum_b.data(), sum_weight.data(), luminance.data() };
+
+                int x{ first_x };
+#ifdef RABBIT_HOST_SIMD
+                if (use_avx2)
+                {
+                    x = AccumulateTapAVX2(rows, tap_weight, illumination_sigma_squared, inv_albedo_sigma_squared,
+                                          first_x, end_x);
+                }
+#endif
+                // Remaining pixels of the row
+                for (; x < end_x; x++)
+                {
+                    const float d_r{ rows.p_r[x] - rows.q_r[x] }, d_g{ rows.p_g[x] - rows.q_g[x] },
+                        d_b{ rows.p_b[x] - rows.q_b[x] };
+                    const float mean_luminance{ 0.5f * (rows.luminance[x] +
+                                                        Luminance(rows.q_r[x], rows.q_g[x], rows.q_b[x])) };
+                    const float a_r{ rows.p_albedo_r[x] - rows.q_albedo_r[x] },
+                        a_g{ rows.p_albedo_g[x] - rows.q_albedo_g[x] }, a_b{ rows.p_albedo_b[x] - rows.q_albedo_b[x] };
+                    // Pixels without a hit have a zero normal, they are filtered only with each other
+                    const float n_x{ rows.p_normal_x[x] - rows.q_normal_x[x] },
+                        n_y{ rows.p_normal_y[x] - rows.q_normal_y[x] }, n_z{ rows.p_normal_z[x] - rows.q_normal_z[x] };
+                    // Illumination, albedo and normal weights in a single exponential
+                    const float feature_weight{ FastExp(-(d_r * d_r + d_g * d_g + d_b * d_b) /
+                                                        (illumination_sigma_squared *
+                                                         (mean_luminance * mean_luminance + MIN_LUMINANCE_SQUARED)) -
+                                                        (a_r * a_r + a_g * a_g + a_b * a_b) * inv_albedo_sigma_squared -
+                                                        (n_x * n_x + n_y * n_y + n_z * n_z) * NORMAL_SHARPNESS) };
+
+                    const float weight{ tap_weight * feature_weight };
+                    rows.sum_r[x] += weight * rows.q_r[x];
+                    rows.sum_g[x] += weight * rows.q_g[x];
+                    rows.sum_b[x] += weight * rows.q_b[x];
+                    rows.sum_weight[x] += weight;
+                }
+            }
+        }
+
+        // The center tap always has a positive weight
+        for (unsigned int x = 0; x != width; x++)
+        {
+            const float inv_weight{ 1.f / sum_weight[x] };
+            output.r[row + x] = sum_r[x] * inv_weight;
+            output.g[row + x] = sum_g[x] * inv_weight;
+            output.b[row + x] = sum_b[x] * inv_weight;
+        }
+    }
+}
+
+} // Rendering namespace
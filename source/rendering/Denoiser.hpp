@@ -0,0 +1,92 @@
+//
+// Created by Simon on 2019-03-29.
+//
+
+#ifndef RABBIT_DENOISER_HPP
+#define RABBIT_DENOISER_HPP
+
+#include <vector>
+
+namespace Rendering
+{
+
+// Edge avoiding a-trous wavelet filter guided by the first hit albedo and normal of the pixels. The radiance is
+// divided by the albedo so the filter only blurs the illumination and the texture detail is restored after.
+// Each pass is a 5x5 B3 spline kernel whose taps are spaced twice as much as in the previous pass, the weight of a
+// tap falls off with the difference of illumination, albedo and normal. Rows are filtered on all the cores over
+// planar channels, eight pixels at once on CPUs with AVX2
+class Denoiser
+{
+public:
+    // Number of passes, the last one has taps 2^(passes - 1) pixels apart
+    static constexpr unsigned int NUM_PASSES{ 5 };
+
+    // Keeps the relative illumination weight finite for black pixels
+    static constexpr float MIN_LUMINANCE_SQUARED{ 1e-4f };
+
+    // Smallest power of two returned by FastExp, the sums of the weights must not become denormals since those are
+    // very slow on most CPUs
+    static constexpr float MIN_EXP2{ -24.f };
+
+    // Scale of the squared distance of two unit normals, 2 - 2 cos, in the exponent: the weight is close to cos^64
+    static constexpr float NORMAL_SHARPNESS{ 32.f };
+
+    explicit Denoiser(float illumination_sigma = 2.f, float albedo_sigma = 0.1f);
+
+    // Filter the RGB radiance in place, the albedo and normal are RGB and XYZ per pixel with the same layout.
+    // Pixels without a hit have zero albedo and normal
+    void Denoise(unsigned int width, unsigned int height, std::vector<float>& radiance,
+                 const std::vector<float>& albedo, const std::vector<float>& normal) const;
+
+private:
+    // Image split in planes
+    struct Planes
+    {
+        std::vector<float> r, g, b;
+    };
+
+    // Row of the pixels filtered and row of one of their taps, the sums of the taps and the luminance of the pixels
+    struct TapRows
+    {
+        const float* p_r;
+        const float* p_g;
+        const float* p_b;
+        const float* q_r;
+        const float* q_g;
+        const float* q_b;
+        const float* p_albedo_r;
+        const float* p_albedo_g;
+        const float* p_albedo_b;
+        const float* q_albedo_r;
+        const float* q_albedo_g;
+        const float* q_albedo_b;
+        const float* p_normal_x;
+        const float* p_normal_y;
+        const float* p_normal_z;
+        const float* q_normal_x;
+        const float* q_normal_y;
+        const float* q_normal_z;
+        float* sum_r;
+        float* sum_g;
+        float* sum_b;
+        float* sum_weight;
+        const float* luminance;
+    };
+
+    // Run a pass with taps step pixels apart over the rows [first_row, end_row) of the output
+    void FilterRows(unsigned int width, unsigned int height, unsigned int step, float illumination_scale,
+                    const Planes& input, const Planes& albedo, const Planes& normal, Planes& output,
+                    unsigned int first_row, unsigned int end_row) const;
+
+    // Add a tap to the pixels [first_x, end_x) of the rows eight at a time, in its own file compiled for AVX2.
+    // Returns the first pixel left for the scalar loop
+    static int AccumulateTapAVX2(const TapRows& rows, float tap_weight, float illumination_sigma_squared,
+                                 float inv_albedo_sigma_squared, int first_x, int end_x) noexcept;
+
+    // Weight parameters, the illumination one is relative to the luminance of the pixels
+    const float illumination_sigma, albedo_sigma;
+};
+
+} // Rendering namespace
+
+#endif //RABBIT_DENOISER_HPP
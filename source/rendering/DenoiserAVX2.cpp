@@ -0,0 +1,128 @@
+//
+// Created by Simon on 2019-03-29.
+//
+
+// Compiled for AVX2 and FMA when the build targets x86, only called on the CPUs that support it
+
+#include "Denoiser.hpp"
+
+#ifdef RABBIT_HOST_SIMD
+
+#include <immintrin.h>
+
+namespace Rendering
+{
+
+namespace
+{
+
+// Number of pixels filtered at once, AVX-512 CPUs use this path as well
+constexpr int SIMD_WIDTH{ 8 };
+
+// FastExp of eight values
+inline __m256 FastExp(__m256 x) noexcept
+{
+    const __m256 biased{ _mm256_add_ps(_mm256_max_ps(_mm256_mul_ps(x, _mm256_set1_ps(1.44269504f)),
+                                                     _mm256_set1_ps(Denoiser::MIN_EXP2)), _mm256_set1_ps(127.f)) };
+    const __m256i exponent{ _mm256_cvttps_epi32(biased) };
+    const __m256 fraction{ _mm256_sub_ps(biased, _mm256_cvtepi32_ps(exponent)) };
+    __m256 p{ _mm256_set1_ps(0.00961813f) };
+    for (float coefficient : { 0.05550411f, 0.24022651f, 0.69314718f, 1.f })
+    {
+        p = _mm256_add_ps(_mm256_mul_ps(p, fraction), _mm256_set1_ps(coefficient));
+    }
+
+    return _mm256_mul_ps(p, _mm256_castsi256_ps(_mm256_slli_epi32(exponent, 23)));
+}
+
+inline __m256 SquaredLength(__m256 x, __m256 y, __m256 z) noexcept
+{
+    return _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, x), _mm256_mul_ps(y, y)), _mm256_mul_ps(z, z));
+}
+
+} // Anonymous namespace
+
+// Same weights as the scalar loop of FilterRows
+int Denoiser::AccumulateTapAVX2(const TapRows& rows, float tap_weight, float illumination_sigma_squared,
+                                float inv_albedo_sigma_squared, int first_x, int end_x) noexcept
+{
+    const float* const p_r{ rows.p_r };
+    const float* const p_g{ rows.p_g };
+    const float* const p_b{ rows.p_b };
+    const float* const q_r{ rows.q_r };
+    const float* const q_g{ rows.q_g };
+    const float* const q_b{ rows.q_b };
+    const float* const p_albedo_r{ rows.p_albedo_r };
+    const float* const p_albedo_g{ rows.p_albedo_g };
+    const float* const p_albedo_b{ rows.p_albedo_b };
+    const float* const q_albedo_r{ rows.q_albedo_r };
+    const float* const q_albedo_g{ rows.q_albedo_g };
+    const float* const q_albedo_b{ rows.q_albedo_b };
+    const float* const p_normal_x{ rows.p_normal_x };
+    const float* const p_normal_y{ rows.p_normal_y };
+    const float* const p_normal_z{ rows.p_normal_z };
+    const float* const q_normal_x{ rows.q_normal_x };
+    const float* const q_normal_y{ rows.q_normal_y };
+    const float* const q_normal_z{ rows.q_normal_z };
+    float* const row_sum_r{ rows.sum_r };
+    float* const row_sum_g{ rows.sum_g };
+    float* const row_sum_b{ rows.sum_b };
+    float* const row_sum_weight{ rows.sum_weight };
+    const float* const row_luminance{ rows.luminance };
+
+    int x{ first_x };
+    const __m256 v_tap_weight{ _mm256_set1_ps(tap_weight) };
+    const __m256 v_illumination_sigma_squared{ _mm256_set1_ps(illumination_sigma_squared) };
+    const __m256 v_inv_albedo_sigma_squared{ _mm256_set1_ps(inv_albedo_sigma_squared) };
+    for (; x + SIMD_WIDTH <= end_x; x += SIMD_WIDTH)
+    {
+        const __m256 q_r_x{ _mm256_loadu_ps(q_r + x) }, q_g_x{ _mm256_loadu_ps(q_g + x) },
+            q_b_x{ _mm256_loadu_ps(q_b + x) };
+        const __m256 q_luminance{ _mm256_add_ps(
+            _mm256_add_ps(_mm256_mul_ps(q_r_x, _mm256_set1_ps(0.2126f)),
+                          _mm256_mul_ps(q_g_x, _mm256_set1_ps(0.7152f))),
+            _mm256_mul_ps(q_b_x, _mm256_set1_ps(0.0722f))) };
+        const __m256 mean_luminance{ _mm256_mul_ps(_mm256_set1_ps(0.5f),
+                                                   _mm256_add_ps(_mm256_loadu_ps(row_luminance + x),
+                                                                 q_luminance)) };
+        const __m256 illumination_distance{
+            SquaredLength(_mm256_sub_ps(_mm256_loadu_ps(p_r + x), q_r_x),
+                          _mm256_sub_ps(_mm256_loadu_ps(p_g + x), q_g_x),
+                          _mm256_sub_ps(_mm256_loadu_ps(p_b + x), q_b_x)) };
+        const __m256 albedo_distance{
+            SquaredLength(_mm256_sub_ps(_mm256_loadu_ps(p_albedo_r + x), _mm256_loadu_ps(q_albedo_r + x)),
+                          _mm256_sub_ps(_mm256_loadu_ps(p_albedo_g + x), _mm256_loadu_ps(q_albedo_g + x)),
+                          _mm256_sub_ps(_mm256_loadu_ps(p_albedo_b + x),
+                                        _mm256_loadu_ps(q_albedo_b + x))) };
+        const __m256 normal_distance{
+            SquaredLength(_mm256_sub_ps(_mm256_loadu_ps(p_normal_x + x), _mm256_loadu_ps(q_normal_x + x)),
+                          _mm256_sub_ps(_mm256_loadu_ps(p_normal_y + x), _mm256_loadu_ps(q_normal_y + x)),
+                          _mm256_sub_ps(_mm256_loadu_ps(p_normal_z + x),
+                                        _mm256_loadu_ps(q_normal_z + x))) };
+
+        const __m256 illumination_scale_x{
+            _mm256_mul_ps(v_illumination_sigma_squared,
+                          _mm256_add_ps(_mm256_mul_ps(mean_luminance, mean_luminance),
+                                        _mm256_set1_ps(MIN_LUMINANCE_SQUARED))) };
+        const __m256 exponent{ _mm256_sub_ps(
+            _mm256_sub_ps(_mm256_sub_ps(_mm256_setzero_ps(),
+                                        _mm256_div_ps(illumination_distance, illumination_scale_x)),
+                          _mm256_mul_ps(albedo_distance, v_inv_albedo_sigma_squared)),
+            _mm256_mul_ps(normal_distance, _mm256_set1_ps(NORMAL_SHARPNESS))) };
+
+        const __m256 weight{ _mm256_mul_ps(v_tap_weight, FastExp(exponent)) };
+        _mm256_storeu_ps(row_sum_r + x, _mm256_add_ps(_mm256_loadu_ps(row_sum_r + x),
+                                                      _mm256_mul_ps(weight, q_r_x)));
+        _mm256_storeu_ps(row_sum_g + x, _mm256_add_ps(_mm256_loadu_ps(row_sum_g + x),
+                                                      _mm256_mul_ps(weight, q_g_x)));
+        _mm256_storeu_ps(row_sum_b + x, _mm256_add_ps(_mm256_loadu_ps(row_sum_b + x),
+                                                      _mm256_mul_ps(weight, q_b_x)));
+        _mm256_storeu_ps(row_sum_weight + x, _mm256_add_ps(_mm256_loadu_ps(row_sum_weight + x), weight));
+    }
+
+    return x;
+}
+
+} // Rendering namespace
+
+#endif
@@ -0,0 +1,139 @@
+//
+// Created by Simon on 2019-03-22.
+//
+
+#include "DeviceArena.hpp"
+#include "CLError.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+
+namespace Rendering
+{
+namespace CL
+{
+
+DeviceArena::DeviceArena(cl_context context, cl_device_id device)
+    : target_context{ context }, alignment{ 0 }, buffer{ nullptr }, capacity{ 0 }, offset{ 0 }
+{
+    try
+    {
+        // Sub-buffers origin must be aligned to the base address alignment, which is given in bits
+        cl_uint base_address_align_bits{ 0 };
+        CL_CHECK_CALL(clGetDeviceInfo(device, CL_DEVICE_MEM_BASE_ADDR_ALIGN, sizeof(cl_uint),
+                                      &base_address_align_bits, nullptr));
+        alignment = std::max<size_t>(base_address_align_bits / 8, 1);
+
+        CL_CHECK_CALL(clRetainContext(target_context));
+    }
+    catch (const std::exception& ex)
+    {
+        target_context = nullptr;
+        throw;
+    }
+}
+
+DeviceArena::~DeviceArena() noexcept
+{
+    Cleanup();
+}
+
+void DeviceArena::Reserve(size_t size)
+{
+    if (!sub_buffers.empty())
+    {
+        throw std::logic_error("Cannot reserve device arena with live sub-buffers");
+    }
+
+    offset = 0;
+    if (size <= capacity)
+    {
+        return;
+    }
+
+    // Replace the allocation with a larger one
+    if (buffer != nullptr)
+    {
+        CL_CHECK_CALL(clReleaseMemObject(buffer));
+        buffer = nullptr;
+        capacity = 0;
+    }
+
+    cl_int err_code{ CL_SUCCESS };
+    buffer = clCreateBuffer(target_context, CL_MEM_READ_WRITE, size, nullptr, &err_code);
+    CL_CHECK_STATUS(err_code);
+    capacity = size;
+}
+
+cl_mem DeviceArena::Allocate(size_t size)
+{
+    const size_t aligned_size{ AlignedSize(size) };
+    if (offset + aligned_size > capacity)
+    {
+        throw std::runtime_error("Device arena capacity exceeded");
+    }
+
+    const cl_buffer_region region{ offset, size };
+    cl_int err_code{ CL_SUCCESS };
+    cl_mem sub_buffer{ clCreateSubBuffer(buffer, CL_MEM_READ_WRITE, CL_BUFFER_CREATE_TYPE_REGION, &region,
+                                         &err_code) };
+    CL_CHECK_STATUS(err_code);
+    sub_buffers.push_back(sub_buffer);
+    offset += aligned_size;
+
+    return sub_buffer;
+}
+
+void DeviceArena::Reset() noexcept
+{
+    try
+    {
+        for (auto sub_buffer : sub_buffers)
+        {
+            CL_CHECK_CALL(clReleaseMemObject(sub_buffer));
+        }
+    }
+    catch (const std::exception& ex)
+    {
+        // TODO operator<< could throw
+        std::cerr << ex.what() << std::endl;
+    }
+    sub_buffers.clear();
+    offset = 0;
+}
+
+void DeviceArena::Cleanup() noexcept
+{
+    Reset();
+    try
+    {
+        if (buffer != nullptr)
+        {
+            CL_CHECK_CALL(clReleaseMemObject(buffer));
+        }
+        if (target_context != nullptr)
+        {
+            CL_CHECK_CALL(clReleaseContext(target_context));
+        }
+    }
+    catch (const std::exception& ex)
+    {
+        // TODO operator<< could throw
+        std::cerr << ex.what() << std::endl;
+    }
+}
+
+DeviceArenaScope::DeviceArenaScope(DeviceArena& arena, size_t size)
+    : arena{ arena }
+{
+    arena.Reserve(size);
+}
+
+DeviceArenaScope::~DeviceArenaScope() noexcept
+{
+    arena.Reset();
+}
+
+} // CL namespace
+} // Rendering namespace
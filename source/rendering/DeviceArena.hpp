@@ -0,0 +1,97 @@
+//
+// Created by Simon on 2019-03-22.
+//
+
+#ifndef RABBIT_DEVICEARENA_HPP
+#define RABBIT_DEVICEARENA_HPP
+
+#ifdef __APPLE__
+
+#include <OpenCL/cl.h>
+
+#else
+#include <CL/cl.h>
+#endif
+
+#include <vector>
+
+namespace Rendering
+{
+namespace CL
+{
+
+// Single device allocation carved into aligned sub-buffers, the allocation is kept between renders and only grows
+// when a configuration needs more memory than the current one
+class DeviceArena
+{
+public:
+    DeviceArena(cl_context context, cl_device_id device);
+
+    ~DeviceArena() noexcept;
+
+    DeviceArena(const DeviceArena&) = delete;
+
+    DeviceArena& operator=(const DeviceArena&) = delete;
+
+    // Round the size up to the sub-buffer alignment of the device
+    size_t AlignedSize(size_t size) const noexcept
+    {
+        return (size + alignment - 1) / alignment * alignment;
+    }
+
+    // Current size of the device allocation
+    size_t Capacity() const noexcept
+    {
+        return capacity;
+    }
+
+    // Make sure the arena can hold the given number of bytes, must be called without live sub-buffers
+    void Reserve(size_t size);
+
+    // Carve a new sub-buffer of the given size from the arena
+    cl_mem Allocate(size_t size);
+
+    // Release all the sub-buffers without throwing, the device allocation is kept
+    void Reset() noexcept;
+
+private:
+    // Cleanup OpenCL resource without throwing
+    void Cleanup() noexcept;
+
+    // Context the allocation belongs to
+    cl_context target_context;
+
+    // Sub-buffer origin alignment in bytes
+    size_t alignment;
+
+    // Device allocation and its size
+    cl_mem buffer;
+    size_t capacity;
+
+    // Offset of the next sub-buffer
+    size_t offset;
+
+    // Live sub-buffers
+    std::vector<cl_mem> sub_buffers;
+};
+
+// Reserve the arena for the lifetime of the scope and release the sub-buffers carved meanwhile at the end
+class DeviceArenaScope
+{
+public:
+    DeviceArenaScope(DeviceArena& arena, size_t size);
+
+    ~DeviceArenaScope() noexcept;
+
+    DeviceArenaScope(const DeviceArenaScope&) = delete;
+
+    DeviceArenaScope& operator=(const DeviceArenaScope&) = delete;
+
+private:
+    DeviceArena& arena;
+};
+
+} // CL namespace
+} // Rendering namespace
+
+#endif //RABBIT_DEVICEARENA_HPP
@@ -0,0 +1,38 @@
+//
+// Created by Simon on 2019-03-27.
+//
+
+#include "EventGraph.hpp"
+#include "CLError.hpp"
+
+#include <iostream>
+
+namespace Rendering
+{
+namespace CL
+{
+
+EventGraph::~EventGraph() noexcept
+{
+    Clear();
+}
+
+void EventGraph::Clear() noexcept
+{
+    try
+    {
+        for (auto command_event : events)
+        {
+            CL_CHECK_CALL(clReleaseEvent(command_event));
+        }
+    }
+    catch (const std::exception& ex)
+    {
+        // TODO operator<< could throw
+        std::cerr << ex.what() << std::endl;
+    }
+    events.clear();
+}
+
+} // CL namespace
+} // Rendering namespace
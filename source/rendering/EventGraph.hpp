@@ -0,0 +1,76 @@
+//
+// Created by Simon on 2019-03-27.
+//
+
+#ifndef RABBIT_EVENTGRAPH_HPP
+#define RABBIT_EVENTGRAPH_HPP
+
+#ifdef __APPLE__
+
+#include <OpenCL/cl.h>
+
+#else
+#include <CL/cl.h>
+#endif
+
+#include <vector>
+
+namespace Rendering
+{
+namespace CL
+{
+
+// Dependency graph of the enqueued commands, each node is the event of a command and a command waits for the
+// events of the nodes it depends on. With an out of order queue this is the only ordering between commands
+class EventGraph
+{
+public:
+    using Node = size_t;
+
+    EventGraph() = default;
+
+    ~EventGraph() noexcept;
+
+    EventGraph(const EventGraph&) = delete;
+
+    EventGraph& operator=(const EventGraph&) = delete;
+
+    // Enqueue a command after the given nodes, the command is called with the wait list and the event to create
+    template <typename Command>
+    Node Add(const std::vector<Node>& dependencies, Command&& command)
+    {
+        wait_list.clear();
+        for (const auto dependency : dependencies)
+        {
+            wait_list.push_back(events[dependency]);
+        }
+
+        cl_event command_event{ nullptr };
+        command(static_cast<cl_uint>(wait_list.size()), wait_list.empty() ? nullptr : wait_list.data(),
+                &command_event);
+        events.push_back(command_event);
+
+        return events.size() - 1;
+    }
+
+    // Event of the node
+    cl_event Event(Node node) const noexcept
+    {
+        return events[node];
+    }
+
+    // Release the events of all the nodes, the commands must be complete or not needed as dependencies anymore
+    void Clear() noexcept;
+
+private:
+    // Event of each node
+    std::vector<cl_event> events;
+
+    // Storage for the wait list of the command being added
+    std::vector<cl_event> wait_list;
+};
+
+} // CL namespace
+} // Rendering namespace
+
+#endif //RABBIT_EVENTGRAPH_HPP
@@ -0,0 +1,147 @@
+//
+// Created by Simon on 2019-03-30.
+//
+
+#include "HostIntersector.hpp"
+#include "HostSIMD.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <future>
+#include <thread>
+
+namespace Rendering
+{
+
+namespace
+{
+
+// Number of spheres tested at once by the scalar path
+constexpr unsigned int SIMD_WIDTH{ 1 };
+
+// Smallest number of rays given to a thread
+constexpr unsigned int MIN_RAYS_PER_THREAD{ 1024 };
+
+} // Anonymous namespace
+
+HostIntersector::HostIntersector(const std::vector<Sphere>& spheres)
+{
+    // Padding spheres have a negative infinite squared radius, the discriminant is always negative
+    const size_t padded_size{ (spheres.size() + MAX_SIMD_WIDTH - 1) / MAX_SIMD_WIDTH * MAX_SIMD_WIDTH };
+    center_x.resize(padded_size, 0.f);
+    center_y.resize(padded_size, 0.f);
+    center_z.resize(padded_size, 0.f);
+    squared_radius.resize(padded_size, -std::numeric_limits<float>::infinity());
+    for (size_t s = 0; s != spheres.size(); s++)
+    {
+        center_x[s] = spheres[s].cx;
+        center_y[s] = spheres[s].cy;
+        center_z[s] = spheres[s].cz;
+        squared_radius[s] = spheres[s].radius * spheres[s].radius;
+    }
+}
+
+void HostIntersector::Intersect(const RayBatch& rays, std::vector<unsigned int>& hit_sphere,
+                                std::vector<float>& hit_distance) const
+{
+    hit_sphere.resize(rays.Size());
+    hit_distance.resize(rays.Size());
+
+    const unsigned int num_threads{ std::max(1u, std::min(std::thread::hardware_concurrency(),
+                                                          rays.Size() / MIN_RAYS_PER_THREAD)) };
+    const unsigned int rays_per_thread{ (rays.Size() + num_threads - 1) / num_threads };
+    auto intersect_range = &HostIntersector::IntersectRange;
+#ifdef RABBIT_HOST_SIMD
+    if (HostInstructions() == HostInstructionSet::AVX512)
+    {
+        intersect_range = &HostIntersector::IntersectRangeAVX512;
+    }
+    else if (HostInstructions() == HostInstructionSet::AVX2)
+    {
+        intersect_range = &HostIntersector::IntersectRangeAVX2;
+    }
+#endif
+    std::vector<std::future<void>> ranges;
+    for (unsigned int first_ray = 0; first_ray < rays.Size(); first_ray += rays_per_thread)
+    {
+        const unsigned int end_ray{ std::min(first_ray + rays_per_thread, rays.Size()) };
+        ranges.push_back(std::async(std::launch::async, [&, first_ray, end_ray]()
+        {
+            (this->*intersect_range)(rays, first_ray, end_ray, hit_sphere.data(), hit_distance.data());
+        }));
+    }
+    for (auto& range : ranges)
+    {
+        range.get();
+    }
+}
+
+const char* HostIntersector::InstructionSet() noexcept
+{
+    return HostInstructionSetName(HostInstructions());
+}
+
+void HostIntersector::ReduceLanes(const float* lane_distance, const unsigned int* lane_sphere, unsigned int num_lanes,
+                                  unsigned int& hit_sphere, float& hit_distance) noexcept
+{
+    hit_sphere = INVALID_INDEX;
+    hit_distance = std::numeric_limits<float>::infinity();
+    for (unsigned int l = 0; l != num_lanes; l++)
+    {
+        if (lane_sphere[l] == INVALID_INDEX)
+        {
+            continue;
+        }
+        if (lane_distance[l] < hit_distance ||
+            (lane_distance[l] == hit_distance && (hit_sphere == INVALID_INDEX || lane_sphere[l] > hit_sphere)))
+        {
+            hit_distance = lane_distance[l];
+            hit_sphere = lane_sphere[l];
+        }
+    }
+}
+
+// The tests follow IntersectRaySphere and SolveQuadratic in the kernel, the extent check is replaced by keeping the
+// closest hit of each lane
+void HostIntersector::IntersectRange(const RayBatch& rays, unsigned int first_ray, unsigned int end_ray,
+                                     unsigned int* hit_sphere, float* hit_distance) const noexcept
+{
+    alignas(64) float lane_distance[SIMD_WIDTH];
+    alignas(64) unsigned int lane_sphere[SIMD_WIDTH];
+    const auto padded_spheres = static_cast<unsigned int>(center_x.size());
+
+    for (unsigned int r = first_ray; r != end_ray; r++)
+    {
+        const float o_x{ rays.origin_x[r] }, o_y{ rays.origin_y[r] }, o_z{ rays.origin_z[r] };
+        const float d_x{ rays.direction_x[r] }, d_y{ rays.direction_y[r] }, d_z{ rays.direction_z[r] };
+        const float a{ d_x * d_x + d_y * d_y + d_z * d_z };
+
+        lane_distance[0] = std::numeric_limits<float>::infinity();
+        lane_sphere[0] = INVALID_INDEX;
+        for (unsigned int s = 0; s != padded_spheres; s++)
+        {
+            const float co_x{ o_x - center_x[s] }, co_y{ o_y - center_y[s] }, co_z{ o_z - center_z[s] };
+            const float b{ 2.f * (d_x * co_x + d_y * co_y + d_z * co_z) };
+            const float c{ co_x * co_x + co_y * co_y + co_z * co_z - squared_radius[s] };
+            const float discr{ b * b - 4.f * a * c };
+            if (discr < 0.f)
+            {
+                continue;
+            }
+
+            const float discr_root{ std::sqrt(discr) };
+            const float q{ -0.5f * (b < 0.f ? b - discr_root : b + discr_root) };
+            const float t0{ std::min(q / a, c / q) };
+            const float t1{ std::max(q / a, c / q) };
+            const float t_hit{ t0 >= 0.f ? t0 : t1 };
+            if (t1 >= 0.f && t_hit <= lane_distance[0])
+            {
+                lane_distance[0] = t_hit;
+                lane_sphere[0] = s;
+            }
+        }
+        ReduceLanes(lane_distance, lane_sphere, SIMD_WIDTH, hit_sphere[r], hit_distance[r]);
+    }
+}
+
+} // Rendering namespace
@@ -0,0 +1,69 @@
+//
+// Created by Simon on 2019-03-30.
+//
+
+#ifndef RABBIT_HOSTINTERSECTOR_HPP
+#define RABBIT_HOSTINTERSECTOR_HPP
+
+#include "SceneParser.hpp"
+
+#include <limits>
+#include <vector>
+
+namespace Rendering
+{
+
+// Batch of rays in SoA layout, directions don't need to be normalised
+struct RayBatch
+{
+    std::vector<float> origin_x, origin_y, origin_z;
+    std::vector<float> direction_x, direction_y, direction_z;
+
+    unsigned int Size() const noexcept
+    {
+        return static_cast<unsigned int>(origin_x.size());
+    }
+};
+
+// Brute force closest hit of ray batches with spheres on the host, reference for the Intersect kernel. The spheres
+// are stored in SoA layout and tested 16 (AVX-512), 8 (AVX2) or 1 at a time depending on the instruction set of the
+// CPU, the rays are split between the hardware threads
+class HostIntersector
+{
+public:
+    // Index of the sphere for rays that miss everything
+    static constexpr unsigned int INVALID_INDEX{ std::numeric_limits<unsigned int>::max() };
+
+    explicit HostIntersector(const std::vector<Sphere>& spheres);
+
+    // Closest sphere hit by each ray and the distance along the direction. Misses get INVALID_INDEX and
+    // an infinite distance. Ties go to the sphere with the largest index, as in the kernel
+    void Intersect(const RayBatch& rays, std::vector<unsigned int>& hit_sphere,
+                   std::vector<float>& hit_distance) const;
+
+    // Name of the instruction set used
+    static const char* InstructionSet() noexcept;
+
+private:
+    // Spheres tested at once by the widest instruction set
+    static constexpr unsigned int MAX_SIMD_WIDTH{ 16 };
+
+    // Intersect the rays in [first_ray, end_ray) with each instruction set, the SIMD ones are in their own files
+    void IntersectRange(const RayBatch& rays, unsigned int first_ray, unsigned int end_ray,
+                        unsigned int* hit_sphere, float* hit_distance) const noexcept;
+    void IntersectRangeAVX2(const RayBatch& rays, unsigned int first_ray, unsigned int end_ray,
+                            unsigned int* hit_sphere, float* hit_distance) const noexcept;
+    void IntersectRangeAVX512(const RayBatch& rays, unsigned int first_ray, unsigned int end_ray,
+                              unsigned int* hit_sphere, float* hit_distance) const noexcept;
+
+    // Keep the closest of the hits found by the lanes, ties go to the largest index
+    static void ReduceLanes(const float* lane_distance, const unsigned int* lane_sphere, unsigned int num_lanes,
+                            unsigned int& hit_sphere, float& hit_distance) noexcept;
+
+    // Spheres in SoA layout, padded to the widest SIMD width with spheres no ray can hit
+    std::vector<float> center_x, center_y, center_z, squared_radius;
+};
+
+} // Rendering namespace
+
+#endif //RABBIT_HOSTINTERSECTOR_HPP
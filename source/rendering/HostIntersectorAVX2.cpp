@@ -0,0 +1,87 @@
+//
+// Created by Simon on 2019-03-30.
+//
+
+// Compiled for AVX2 and FMA when the build targets x86, only called on the CPUs that support it
+
+#include "HostIntersector.hpp"
+
+#ifdef RABBIT_HOST_SIMD
+
+#include <immintrin.h>
+
+namespace Rendering
+{
+
+namespace
+{
+
+// Number of spheres tested at once
+constexpr unsigned int SIMD_WIDTH{ 8 };
+
+} // Anonymous namespace
+
+// Same tests as the scalar IntersectRange
+void HostIntersector::IntersectRangeAVX2(const RayBatch& rays, unsigned int first_ray, unsigned int end_ray,
+                                         unsigned int* hit_sphere, float* hit_distance) const noexcept
+{
+    alignas(64) float lane_distance[SIMD_WIDTH];
+    alignas(64) unsigned int lane_sphere[SIMD_WIDTH];
+    const auto padded_spheres = static_cast<unsigned int>(center_x.size());
+
+    for (unsigned int r = first_ray; r != end_ray; r++)
+    {
+        const float o_x{ rays.origin_x[r] }, o_y{ rays.origin_y[r] }, o_z{ rays.origin_z[r] };
+        const float d_x{ rays.direction_x[r] }, d_y{ rays.direction_y[r] }, d_z{ rays.direction_z[r] };
+        const float a{ d_x * d_x + d_y * d_y + d_z * d_z };
+
+        const __m256 v_o_x{ _mm256_set1_ps(o_x) }, v_o_y{ _mm256_set1_ps(o_y) }, v_o_z{ _mm256_set1_ps(o_z) };
+        const __m256 v_d_x{ _mm256_set1_ps(d_x) }, v_d_y{ _mm256_set1_ps(d_y) }, v_d_z{ _mm256_set1_ps(d_z) };
+        const __m256 v_a{ _mm256_set1_ps(a) }, v_four_a{ _mm256_set1_ps(4.f * a) };
+        const __m256 zero{ _mm256_setzero_ps() };
+        __m256 best_distance{ _mm256_set1_ps(std::numeric_limits<float>::infinity()) };
+        __m256i best_sphere{ _mm256_set1_epi32(-1) };
+        __m256i sphere_index{ _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7) };
+        for (unsigned int s = 0; s != padded_spheres; s += SIMD_WIDTH)
+        {
+            const __m256 co_x{ _mm256_sub_ps(v_o_x, _mm256_loadu_ps(center_x.data() + s)) };
+            const __m256 co_y{ _mm256_sub_ps(v_o_y, _mm256_loadu_ps(center_y.data() + s)) };
+            const __m256 co_z{ _mm256_sub_ps(v_o_z, _mm256_loadu_ps(center_z.data() + s)) };
+            const __m256 b{ _mm256_mul_ps(_mm256_set1_ps(2.f),
+                                          _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(v_d_x, co_x),
+                                                                      _mm256_mul_ps(v_d_y, co_y)),
+                                                        _mm256_mul_ps(v_d_z, co_z))) };
+            const __m256 c{ _mm256_sub_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(co_x, co_x),
+                                                                      _mm256_mul_ps(co_y, co_y)),
+                                                        _mm256_mul_ps(co_z, co_z)),
+                                          _mm256_loadu_ps(squared_radius.data() + s)) };
+            const __m256 discr{ _mm256_sub_ps(_mm256_mul_ps(b, b), _mm256_mul_ps(v_four_a, c)) };
+            const __m256 valid{ _mm256_cmp_ps(discr, zero, _CMP_GE_OQ) };
+
+            const __m256 discr_root{ _mm256_sqrt_ps(_mm256_max_ps(discr, zero)) };
+            const __m256 negative_b{ _mm256_cmp_ps(b, zero, _CMP_LT_OQ) };
+            const __m256 q{ _mm256_mul_ps(_mm256_set1_ps(-0.5f),
+                                          _mm256_blendv_ps(_mm256_add_ps(b, discr_root),
+                                                           _mm256_sub_ps(b, discr_root), negative_b)) };
+            const __m256 t_a{ _mm256_div_ps(q, v_a) };
+            const __m256 t_b{ _mm256_div_ps(c, q) };
+            const __m256 t0{ _mm256_min_ps(t_a, t_b) };
+            const __m256 t1{ _mm256_max_ps(t_a, t_b) };
+            const __m256 t_hit{ _mm256_blendv_ps(t1, t0, _mm256_cmp_ps(t0, zero, _CMP_GE_OQ)) };
+
+            const __m256 hit{ _mm256_and_ps(_mm256_and_ps(valid, _mm256_cmp_ps(t1, zero, _CMP_GE_OQ)),
+                                            _mm256_cmp_ps(t_hit, best_distance, _CMP_LE_OQ)) };
+            best_distance = _mm256_blendv_ps(best_distance, t_hit, hit);
+            best_sphere = _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(best_sphere),
+                                                               _mm256_castsi256_ps(sphere_index), hit));
+            sphere_index = _mm256_add_epi32(sphere_index, _mm256_set1_epi32(SIMD_WIDTH));
+        }
+        _mm256_store_ps(lane_distance, best_distance);
+        _mm256_store_si256(reinterpret_cast<__m256i*>(lane_sphere), best_sphere);
+        ReduceLanes(lane_distance, lane_sphere, SIMD_WIDTH, hit_sphere[r], hit_distance[r]);
+    }
+}
+
+} // Rendering namespace
+
+#endif
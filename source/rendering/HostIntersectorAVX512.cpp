@@ -0,0 +1,86 @@
+//
+// Created by Simon on 2019-03-30.
+//
+
+// Compiled for AVX-512 when the build targets x86, only called on the CPUs that support it
+
+#include "HostIntersector.hpp"
+
+#ifdef RABBIT_HOST_SIMD
+
+#include <immintrin.h>
+
+namespace Rendering
+{
+
+namespace
+{
+
+// Number of spheres tested at once
+constexpr unsigned int SIMD_WIDTH{ 16 };
+
+} // Anonymous namespace
+
+// Same tests as the scalar IntersectRange
+void HostIntersector::IntersectRangeAVX512(const RayBatch& rays, unsigned int first_ray, unsigned int end_ray,
+                                           unsigned int* hit_sphere, float* hit_distance) const noexcept
+{
+    alignas(64) float lane_distance[SIMD_WIDTH];
+    alignas(64) unsigned int lane_sphere[SIMD_WIDTH];
+    const auto padded_spheres = static_cast<unsigned int>(center_x.size());
+
+    for (unsigned int r = first_ray; r != end_ray; r++)
+    {
+        const float o_x{ rays.origin_x[r] }, o_y{ rays.origin_y[r] }, o_z{ rays.origin_z[r] };
+        const float d_x{ rays.direction_x[r] }, d_y{ rays.direction_y[r] }, d_z{ rays.direction_z[r] };
+        const float a{ d_x * d_x + d_y * d_y + d_z * d_z };
+
+        const __m512 v_o_x{ _mm512_set1_ps(o_x) }, v_o_y{ _mm512_set1_ps(o_y) }, v_o_z{ _mm512_set1_ps(o_z) };
+        const __m512 v_d_x{ _mm512_set1_ps(d_x) }, v_d_y{ _mm512_set1_ps(d_y) }, v_d_z{ _mm512_set1_ps(d_z) };
+        const __m512 v_a{ _mm512_set1_ps(a) }, v_four_a{ _mm512_set1_ps(4.f * a) };
+        const __m512 zero{ _mm512_setzero_ps() };
+        __m512 best_distance{ _mm512_set1_ps(std::numeric_limits<float>::infinity()) };
+        __m512i best_sphere{ _mm512_set1_epi32(-1) };
+        __m512i sphere_index{ _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15) };
+        for (unsigned int s = 0; s != padded_spheres; s += SIMD_WIDTH)
+        {
+            const __m512 co_x{ _mm512_sub_ps(v_o_x, _mm512_loadu_ps(center_x.data() + s)) };
+            const __m512 co_y{ _mm512_sub_ps(v_o_y, _mm512_loadu_ps(center_y.data() + s)) };
+            const __m512 co_z{ _mm512_sub_ps(v_o_z, _mm512_loadu_ps(center_z.data() + s)) };
+            const __m512 b{ _mm512_mul_ps(_mm512_set1_ps(2.f),
+                                          _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(v_d_x, co_x),
+                                                                      _mm512_mul_ps(v_d_y, co_y)),
+                                                        _mm512_mul_ps(v_d_z, co_z))) };
+            const __m512 c{ _mm512_sub_ps(_mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(co_x, co_x),
+                                                                      _mm512_mul_ps(co_y, co_y)),
+                                                        _mm512_mul_ps(co_z, co_z)),
+                                          _mm512_loadu_ps(squared_radius.data() + s)) };
+            const __m512 discr{ _mm512_sub_ps(_mm512_mul_ps(b, b), _mm512_mul_ps(v_four_a, c)) };
+            const __mmask16 valid{ _mm512_cmp_ps_mask(discr, zero, _CMP_GE_OQ) };
+
+            const __m512 discr_root{ _mm512_sqrt_ps(_mm512_max_ps(discr, zero)) };
+            const __mmask16 negative_b{ _mm512_cmp_ps_mask(b, zero, _CMP_LT_OQ) };
+            const __m512 q{ _mm512_mul_ps(_mm512_set1_ps(-0.5f),
+                                          _mm512_mask_blend_ps(negative_b, _mm512_add_ps(b, discr_root),
+                                                               _mm512_sub_ps(b, discr_root))) };
+            const __m512 t_a{ _mm512_div_ps(q, v_a) };
+            const __m512 t_b{ _mm512_div_ps(c, q) };
+            const __m512 t0{ _mm512_min_ps(t_a, t_b) };
+            const __m512 t1{ _mm512_max_ps(t_a, t_b) };
+            const __m512 t_hit{ _mm512_mask_blend_ps(_mm512_cmp_ps_mask(t0, zero, _CMP_GE_OQ), t1, t0) };
+
+            const __mmask16 hit{ static_cast<__mmask16>(valid & _mm512_cmp_ps_mask(t1, zero, _CMP_GE_OQ) &
+                                                        _mm512_cmp_ps_mask(t_hit, best_distance, _CMP_LE_OQ)) };
+            best_distance = _mm512_mask_blend_ps(hit, best_distance, t_hit);
+            best_sphere = _mm512_mask_blend_epi32(hit, best_sphere, sphere_index);
+            sphere_index = _mm512_add_epi32(sphere_index, _mm512_set1_epi32(SIMD_WIDTH));
+        }
+        _mm512_store_ps(lane_distance, best_distance);
+        _mm512_store_si512(lane_sphere, best_sphere);
+        ReduceLanes(lane_distance, lane_sphere, SIMD_WIDTH, hit_sphere[r], hit_distance[r]);
+    }
+}
+
+} // Rendering namespace
+
+#endif
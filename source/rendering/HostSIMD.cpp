@@ -0,0 +1,72 @@
+//
+// Created by Simon on 2019-03-30.
+//
+
+#include "HostSIMD.hpp"
+
+#if defined(RABBIT_HOST_SIMD) && defined(_MSC_VER)
+#include <immintrin.h>
+#include <intrin.h>
+#endif
+
+namespace Rendering
+{
+
+namespace
+{
+
+HostInstructionSet DetectInstructionSet() noexcept
+{
+#if defined(RABBIT_HOST_SIMD) && defined(_MSC_VER)
+    // The OS must save the AVX registers (XCR0 bits 1-2) and the AVX-512 ones (bits 5-7) as well
+    int info[4];
+    __cpuid(info, 1);
+    const bool os_saves_avx{ (info[2] & (1 << 27)) != 0 && (_xgetbv(0) & 0x6) == 0x6 };
+    const bool fma{ (info[2] & (1 << 12)) != 0 };
+    __cpuidex(info, 7, 0);
+    if (os_saves_avx && (info[1] & (1 << 16)) != 0 && (_xgetbv(0) & 0xe6) == 0xe6)
+    {
+        return HostInstructionSet::AVX512;
+    }
+    if (os_saves_avx && fma && (info[1] & (1 << 5)) != 0)
+    {
+        return HostInstructionSet::AVX2;
+    }
+#elif defined(RABBIT_HOST_SIMD)
+    // Also checks that the OS saves the registers
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+    {
+        return HostInstructionSet::AVX512;
+    }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+    {
+        return HostInstructionSet::AVX2;
+    }
+#endif
+
+    return HostInstructionSet::Scalar;
+}
+
+} // Anonymous namespace
+
+HostInstructionSet HostInstructions() noexcept
+{
+    static const HostInstructionSet instruction_set{ DetectInstructionSet() };
+    return instruction_set;
+}
+
+const char* HostInstructionSetName(HostInstructionSet instruction_set) noexcept
+{
+    switch (instruction_set)
+    {
+        case HostInstructionSet::AVX512:
+            return "AVX-512";
+        case HostInstructionSet::AVX2:
+            return "AVX2";
+        default:
+            return "scalar";
+    }
+}
+
+} // Rendering namespace
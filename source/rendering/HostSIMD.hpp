@@ -0,0 +1,28 @@
+//
+// Created by Simon on 2019-03-30.
+//
+
+#ifndef RABBIT_HOSTSIMD_HPP
+#define RABBIT_HOSTSIMD_HPP
+
+namespace Rendering
+{
+
+// Instruction sets of the SIMD paths of the host code. Each path is in its own file compiled for its instruction set
+// when the build targets x86 (RABBIT_HOST_SIMD), the rest of the program runs on any CPU
+enum class HostInstructionSet
+{
+    Scalar,
+    AVX2,
+    AVX512
+};
+
+// Widest instruction set the CPU and the build support, detected once. AVX2 needs FMA as well
+HostInstructionSet HostInstructions() noexcept;
+
+// Name of the instruction set
+const char* HostInstructionSetName(HostInstructionSet instruction_set) noexcept;
+
+} // Rendering namespace
+
+#endif //RABBIT_HOSTSIMD_HPP
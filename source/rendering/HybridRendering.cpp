@@ -0,0 +1,172 @@
+//
+// Created by Simon on 2019-04-02.
+//
+
+#include "HybridRendering.hpp"
+#include "CLEnvironment.hpp"
+#include "CLError.hpp"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <future>
+#include <stdexcept>
+
+namespace Rendering
+{
+namespace CL
+{
+
+BandScheduler::BandScheduler(unsigned int num_tile_rows, unsigned int num_devices)
+    : num_tile_rows{ num_tile_rows }, next_tile_row{ 0 }, rows_done(num_devices, 0), seconds_spent(num_devices, 0.)
+{}
+
+bool BandScheduler::Next(unsigned int device, unsigned int& first_tile_row, unsigned int& end_tile_row)
+{
+    const std::lock_guard<std::mutex> lock{ mutex };
+    if (next_tile_row == num_tile_rows)
+    {
+        return false;
+    }
+
+    unsigned int band_rows{ 1 };
+    if (seconds_spent[device] > 0.)
+    {
+        // Devices not measured yet do not count, they only take a row
+        double total_rows_per_second{ 0. };
+        for (unsigned int d = 0; d != rows_done.size(); d++)
+        {
+            if (seconds_spent[d] > 0.)
+            {
+                total_rows_per_second += rows_done[d] / seconds_spent[d];
+            }
+        }
+        const double share{ rows_done[device] / seconds_spent[device] / total_rows_per_second };
+        band_rows = std::max(1u, static_cast<unsigned int>(0.5 * share * (num_tile_rows - next_tile_row)));
+    }
+    first_tile_row = next_tile_row;
+    end_tile_row = std::min(next_tile_row + band_rows, num_tile_rows);
+    next_tile_row = end_tile_row;
+
+    return true;
+}
+
+void BandScheduler::Report(unsigned int device, unsigned int num_rows, double seconds)
+{
+    const std::lock_guard<std::mutex> lock{ mutex };
+    rows_done[device] += num_rows;
+    seconds_spent[device] += seconds;
+}
+
+unsigned int BandScheduler::RowsDone(unsigned int device) const
+{
+    const std::lock_guard<std::mutex> lock{ mutex };
+    return rows_done[device];
+}
+
+double BandScheduler::RowsPerSecond(unsigned int device) const
+{
+    const std::lock_guard<std::mutex> lock{ mutex };
+    return seconds_spent[device] > 0. ? rows_done[device] / seconds_spent[device] : 0.;
+}
+
+HybridRendering::HybridRendering(const std::vector<RenderingDevice*>& devices,
+                                 const SceneDescription& scene_description, const Camera& camera,
+                                 const RenderingOptions& options)
+    : image_width{ scene_description.FilmWindow().width }, image_height{ scene_description.FilmWindow().height },
+      film_window{ scene_description.FilmWindow() }, full_image_width{ scene_description.image_width },
+      full_image_height{ scene_description.image_height }
+{
+    // The host only reads back the radiance of the bands
+    if (options.denoise || options.collect_stats || options.cost_heatmap)
+    {
+        throw std::invalid_argument{ "Hybrid rendering does not support the denoiser, statistics or cost heatmap" };
+    }
+    for (RenderingDevice* device : devices)
+    {
+        DeviceRenderer renderer;
+        renderer.name = DeviceInfoString(device->Device(), CL_DEVICE_NAME);
+        renderer.scene = std::make_unique<::CL::Scene>(device->Context(), scene_description, camera,
+                                                       options.use_bvh, options.bvh_width);
+        const LaunchTuning tuning{ TileRendering::SceneTileTuning(*device, options, *renderer.scene) };
+        renderer.tile_rendering = std::make_unique<TileRendering>(*device, 0, scene_description, *renderer.scene,
+                                                                  options, &tuning);
+        renderers.push_back(std::move(renderer));
+    }
+}
+
+void HybridRendering::Render(const std::string& filename, std::ostream& log) const
+{
+    HostFilm film;
+    for (auto* channel : { &film.pixel_r, &film.pixel_g, &film.pixel_b, &film.filter_weight })
+    {
+        channel->resize(image_width * image_height, 0.f);
+    }
+
+    // Each device renders on its own thread, the queues of different devices run concurrently
+    const unsigned int num_devices{ static_cast<unsigned int>(renderers.size()) };
+    BandScheduler scheduler{ renderers.front().tile_rendering->NumTileRows(), num_devices };
+    std::vector<std::future<void>> device_renders;
+    for (unsigned int device = 0; device != num_devices; device++)
+    {
+        device_renders.push_back(std::async(std::launch::async, &HybridRendering::RenderBands, this, device,
+                                            std::ref(scheduler), std::ref(film)));
+    }
+    for (auto& device_render : device_renders)
+    {
+        device_render.get();
+    }
+    for (unsigned int device = 0; device != num_devices; device++)
+    {
+        log << renderers[device].name << ": " << scheduler.RowsDone(device) << " rows of tiles, "
+            << scheduler.RowsPerSecond(device) << " rows/s\n";
+    }
+
+    IO::WriteFilm(filename, film_window, full_image_width, full_image_height, film.pixel_r, film.pixel_g, film.pixel_b,
+                  film.filter_weight);
+}
+
+void HybridRendering::RenderBands(unsigned int device, BandScheduler& scheduler, HostFilm& film) const
+{
+    const TileRendering& tile_rendering{ *renderers[device].tile_rendering };
+    bool first_band{ true };
+    unsigned int first_tile_row, end_tile_row;
+    while (scheduler.Next(device, first_tile_row, end_tile_row))
+    {
+        // The bands of a device never overlap, the film of the device is only cleared once
+        const auto start = std::chrono::steady_clock::now();
+        tile_rendering.RenderTileRows(first_tile_row, end_tile_row, first_band);
+        ReadBackRows(tile_rendering, first_tile_row, end_tile_row, film);
+        scheduler.Report(device, end_tile_row - first_tile_row,
+                         std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+        first_band = false;
+    }
+}
+
+void HybridRendering::ReadBackRows(const TileRendering& tile_rendering, unsigned int first_tile_row,
+                                   unsigned int end_tile_row, HostFilm& film) const
+{
+    // The bands are disjoint, the threads write to different parts of the film
+    const unsigned int tile_height{ tile_rendering.GetTileDescription().Height() };
+    const unsigned int first_row{ first_tile_row * tile_height };
+    const unsigned int end_row{ std::min(end_tile_row * tile_height, image_height) };
+    const size_t offset{ first_row * image_width };
+    const size_t size{ (end_row - first_row) * image_width * sizeof(cl_float) };
+
+    const Pixels& pixels{ tile_rendering.rendering_data.d_pixels };
+    const std::array<std::pair<cl_mem, std::vector<float>*>, 4> copies{ { { pixels.pixel_r, &film.pixel_r },
+                                                                         { pixels.pixel_g, &film.pixel_g },
+                                                                         { pixels.pixel_b, &film.pixel_b },
+                                                                         { pixels.filter_weight,
+                                                                           &film.filter_weight } } };
+    for (const auto& copy : copies)
+    {
+        CL_CHECK_CALL(clEnqueueReadBuffer(tile_rendering.transfer_queue, copy.first, CL_FALSE,
+                                          offset * sizeof(cl_float), size, copy.second->data() + offset,
+                                          0, nullptr, nullptr));
+    }
+    CL_CHECK_CALL(clFinish(tile_rendering.transfer_queue));
+}
+
+} // CL namespace
+} // Rendering namespace
@@ -0,0 +1,103 @@
+//
+// Created by Simon on 2019-04-02.
+//
+
+#ifndef RABBIT_HYBRIDRENDERING_HPP
+#define RABBIT_HYBRIDRENDERING_HPP
+
+#include "TileRendering.hpp"
+#include "ImageIO.hpp"
+
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace Rendering
+{
+namespace CL
+{
+
+// Hands out bands of rows of tiles to the devices as they ask for work. A device that was never measured gets a
+// single row, then each device gets half of its share of the rows left, the share following the rows per second
+// measured on it so far. The bands shrink towards the end of the image so the devices finish together
+class BandScheduler
+{
+public:
+    BandScheduler(unsigned int num_tile_rows, unsigned int num_devices);
+
+    // Get the next band [first, end) for the device, returns false if all the rows were handed out
+    bool Next(unsigned int device, unsigned int& first_tile_row, unsigned int& end_tile_row);
+
+    // Add the time the device took to render a band of rows
+    void Report(unsigned int device, unsigned int num_rows, double seconds);
+
+    // Rows rendered and rows per second measured on the device
+    unsigned int RowsDone(unsigned int device) const;
+    double RowsPerSecond(unsigned int device) const;
+
+private:
+    const unsigned int num_tile_rows;
+
+    mutable std::mutex mutex;
+
+    // First row not handed out yet
+    unsigned int next_tile_row;
+
+    // Rows rendered and time spent on each device
+    std::vector<unsigned int> rows_done;
+    std::vector<double> seconds_spent;
+};
+
+// Renders an image on several devices at the same time, each with its own scene, film and kernels. The devices
+// render the bands of rows given by the scheduler and the band is copied into the host film once it is done. All
+// the devices use the tile size of the scene so the bands line up, the denoiser, statistics and cost heatmap are
+// not supported
+class HybridRendering
+{
+public:
+    // The devices must outlive the object. Throws if the options ask for the denoiser, statistics or cost heatmap
+    HybridRendering(const std::vector<RenderingDevice*>& devices, const SceneDescription& scene_description,
+                    const Camera& camera, const RenderingOptions& options);
+
+    // Render image, the format is selected by the extension of the file name. The rows rendered by each device and
+    // its throughput are written to the log
+    void Render(const std::string& filename, std::ostream& log) const;
+
+private:
+    // Scene and renderer on a device
+    struct DeviceRenderer
+    {
+        std::string name;
+        std::unique_ptr<::CL::Scene> scene;
+        std::unique_ptr<TileRendering> tile_rendering;
+    };
+
+    // Accumulated values and filter weight of the whole image, with the first row at the bottom
+    struct HostFilm
+    {
+        std::vector<float> pixel_r, pixel_g, pixel_b, filter_weight;
+    };
+
+    // Render the bands given to the device until all the rows are handed out
+    void RenderBands(unsigned int device, BandScheduler& scheduler, HostFilm& film) const;
+
+    // Copy the pixels of the rows of tiles from the film of the device, the call blocks until the copy is done
+    void ReadBackRows(const TileRendering& tile_rendering, unsigned int first_tile_row, unsigned int end_tile_row,
+                      HostFilm& film) const;
+
+    // Size of the film, the crop window if there is one
+    const unsigned int image_width, image_height;
+
+    // Window of the image covered by the film and size of the whole image
+    const CropWindow film_window;
+    const unsigned int full_image_width, full_image_height;
+
+    std::vector<DeviceRenderer> renderers;
+};
+
+} // CL namespace
+} // Rendering namespace
+
+#endif //RABBIT_HYBRIDRENDERING_HPP
@@ -0,0 +1,330 @@
+//
+// Created by Simon on 2019-03-30.
+//
+
+#include "IntersectionBenchmark.hpp"
+#include "Camera.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <random>
+
+namespace Rendering
+{
+namespace CL
+{
+
+namespace
+{
+
+// Fields of the streams, match the kernel with the SoA layout and full intersections
+constexpr unsigned int RAY_FIELDS{ 6 };
+constexpr unsigned int ISECT_FIELDS{ 11 };
+
+// Number of timed runs, the fastest one is reported
+constexpr unsigned int NUM_REPETITIONS{ 3 };
+
+// Relative tolerance on the distances, the kernel is built with the device math functions
+constexpr float DISTANCE_TOLERANCE{ 1e-4f };
+
+// Number of mismatches written to the log
+constexpr unsigned int MAX_LOGGED_MISMATCHES{ 10 };
+
+// Options the benchmark kernel is built with, only the acceleration structure choice is kept
+RenderingOptions BenchmarkOptions(const RenderingOptions& options)
+{
+    RenderingOptions benchmark_options{ options };
+    benchmark_options.compact_intersections = false;
+    benchmark_options.storage_layout = StorageLayout::SoA;
+    benchmark_options.specialise_kernels = false;
+    benchmark_options.denoise = false;
+    benchmark_options.collect_stats = false;
+    benchmark_options.cost_heatmap = false;
+
+    return benchmark_options;
+}
+
+bool SameDistance(float a, float b) noexcept
+{
+    return std::abs(a - b) <= DISTANCE_TOLERANCE * std::max(1.f, std::abs(a));
+}
+
+} // Anonymous namespace
+
+IntersectionBenchmark::IntersectionBenchmark(RenderingDevice& device, const RenderingOptions& options)
+    : rendering_device(device), rendering_options{ BenchmarkOptions(options) },
+      command_queue{ nullptr }, intersect_kernel{ nullptr },
+      d_rays{ nullptr }, d_ray_depth{ nullptr }, d_intersections{ nullptr }, d_primitive_index{ nullptr }
+{}
+
+IntersectionBenchmark::~IntersectionBenchmark() noexcept
+{
+    Cleanup();
+}
+
+unsigned int IntersectionBenchmark::Run(const SceneDescription& scene_description, unsigned int num_rays,
+                                        std::ostream& log)
+{
+    if (scene_description.HasInstances() || scene_description.NumTriangles() != 0 ||
+        scene_description.NumSpheres() == 0)
+    {
+        throw std::invalid_argument{ "The host intersector only handles scenes made of spheres" };
+    }
+    const RayBatch rays{ GenerateRays(scene_description, num_rays) };
+
+    // Host reference
+    const HostIntersector host_intersector{ scene_description.loaded_spheres };
+    std::vector<unsigned int> host_sphere;
+    std::vector<float> host_distance;
+    double host_milliseconds{ std::numeric_limits<double>::max() };
+    for (unsigned int r = 0; r != NUM_REPETITIONS; r++)
+    {
+        const auto start = std::chrono::high_resolution_clock::now();
+        host_intersector.Intersect(rays, host_sphere, host_distance);
+        const auto end = std::chrono::high_resolution_clock::now();
+        host_milliseconds = std::min(host_milliseconds, std::chrono::duration<double, std::milli>(end - start).count());
+    }
+    log << "Host (" << HostIntersector::InstructionSet() << "): " << host_milliseconds << " ms, "
+        << num_rays / (host_milliseconds * 1e3) << " Mrays/s\n";
+
+    // Device, the rays are uploaded in SoA layout
+    const Camera camera{ Vector3{ 40.f, 60.f, -70.f }, Vector3{ 0.f }, Vector3{ 0.f, 1.f, 0.f },
+                         45.f, scene_description.image_width, scene_description.image_height };
+    const ::CL::Scene scene{ rendering_device.Context(), scene_description, camera, rendering_options.use_bvh,
+                             rendering_options.bvh_width };
+
+    Prepare(scene, rays);
+    double device_milliseconds{ std::numeric_limits<double>::max() };
+    for (unsigned int r = 0; r != NUM_REPETITIONS; r++)
+    {
+        device_milliseconds = std::min(device_milliseconds, RunKernel(num_rays));
+    }
+    log << "Device" << (scene.HasAcceleration() ? " (BVH)" : "") << ": " << device_milliseconds << " ms, "
+        << num_rays / (device_milliseconds * 1e3) << " Mrays/s, " << host_milliseconds / device_milliseconds
+        << "x the host\n";
+
+    std::vector<cl_uint> device_sphere(num_rays);
+    std::vector<float> device_hit_point(3 * num_rays);
+    CL_CHECK_CALL(clEnqueueReadBuffer(command_queue, d_primitive_index, CL_TRUE, 0, num_rays * sizeof(cl_uint),
+                                      device_sphere.data(), 0, nullptr, nullptr));
+    CL_CHECK_CALL(clEnqueueReadBuffer(command_queue, d_intersections, CL_TRUE, 0, 3 * num_rays * sizeof(float),
+                                      device_hit_point.data(), 0, nullptr, nullptr));
+
+    // A different sphere at the same distance is a tie, not a mismatch
+    unsigned int mismatches{ 0 };
+    for (unsigned int r = 0; r != num_rays; r++)
+    {
+        const bool host_hit{ host_sphere[r] != HostIntersector::INVALID_INDEX };
+        const bool device_hit{ device_sphere[r] != HostIntersector::INVALID_INDEX };
+        bool match{ host_hit == device_hit };
+        float device_distance{ std::numeric_limits<float>::infinity() };
+        if (match && host_hit)
+        {
+            // Distance along the direction from the hit point
+            const Vector3 d{ rays.direction_x[r], rays.direction_y[r], rays.direction_z[r] };
+            const Vector3 offset{ device_hit_point[r] - rays.origin_x[r],
+                                  device_hit_point[num_rays + r] - rays.origin_y[r],
+                                  device_hit_point[2 * num_rays + r] - rays.origin_z[r] };
+            device_distance = Dot(offset, d) / Dot(d, d);
+            match = SameDistance(host_distance[r], device_distance);
+        }
+        if (!match)
+        {
+            if (mismatches++ < MAX_LOGGED_MISMATCHES)
+            {
+                log << "Ray " << r << ": host sphere " << static_cast<int>(host_sphere[r]) << " at "
+                    << host_distance[r] << ", device sphere " << static_cast<int>(device_sphere[r]) << " at "
+                    << device_distance << "\n";
+            }
+        }
+    }
+    log << mismatches << " of " << num_rays << " rays differ\n";
+
+    return mismatches;
+}
+
+double IntersectionBenchmark::Throughput(const SceneDescription& scene_description, unsigned int num_rays,
+                                         std::chrono::milliseconds budget)
+{
+    const RayBatch rays{ GenerateRays(scene_description, num_rays) };
+    const Camera camera{ Vector3{ 40.f, 60.f, -70.f }, Vector3{ 0.f }, Vector3{ 0.f, 1.f, 0.f },
+                         45.f, scene_description.image_width, scene_description.image_height };
+    const ::CL::Scene scene{ rendering_device.Context(), scene_description, camera, rendering_options.use_bvh,
+                             rendering_options.bvh_width };
+    Prepare(scene, rays);
+
+    // The first run also pays for the upload and the first launch, at least two are timed
+    double device_milliseconds{ std::numeric_limits<double>::max() };
+    const auto start = std::chrono::steady_clock::now();
+    for (unsigned int r = 0; r < 2 || std::chrono::steady_clock::now() - start < budget; r++)
+    {
+        device_milliseconds = std::min(device_milliseconds, RunKernel(num_rays));
+    }
+
+    return num_rays / (device_milliseconds * 1e3);
+}
+
+void IntersectionBenchmark::Prepare(const ::CL::Scene& scene, const RayBatch& rays)
+{
+    // Resources of a previous run are released
+    Cleanup();
+    command_queue = nullptr;
+    intersect_kernel = nullptr;
+    d_rays = d_ray_depth = d_intersections = d_primitive_index = nullptr;
+
+    const cl_uint num_rays{ static_cast<cl_uint>(rays.origin_x.size()) };
+    std::vector<float> ray_stream;
+    ray_stream.reserve(RAY_FIELDS * num_rays);
+    for (const auto* field : { &rays.origin_x, &rays.origin_y, &rays.origin_z,
+                               &rays.direction_x, &rays.direction_y, &rays.direction_z })
+    {
+        ray_stream.insert(ray_stream.end(), field->cbegin(), field->cend());
+    }
+
+    cl_int err_code{ CL_SUCCESS };
+    command_queue = clCreateCommandQueue(rendering_device.Context(), rendering_device.Device(),
+                                         CL_QUEUE_PROFILING_ENABLE, &err_code);
+    CL_CHECK_STATUS(err_code);
+    intersect_kernel = clCreateKernel(rendering_device.Programs().GetProgram(rendering_options.ProgramDefines() +
+                                                                             scene.ProgramDefines()),
+                                      "Intersect", &err_code);
+    CL_CHECK_STATUS(err_code);
+    d_rays = clCreateBuffer(rendering_device.Context(), CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                            ray_stream.size() * sizeof(float), ray_stream.data(), &err_code);
+    CL_CHECK_STATUS(err_code);
+    d_ray_depth = clCreateBuffer(rendering_device.Context(), CL_MEM_READ_WRITE, num_rays * sizeof(cl_uint),
+                                 nullptr, &err_code);
+    CL_CHECK_STATUS(err_code);
+    d_intersections = clCreateBuffer(rendering_device.Context(), CL_MEM_READ_WRITE,
+                                     ISECT_FIELDS * num_rays * sizeof(float), nullptr, &err_code);
+    CL_CHECK_STATUS(err_code);
+    d_primitive_index = clCreateBuffer(rendering_device.Context(), CL_MEM_READ_WRITE, num_rays * sizeof(cl_uint),
+                                       nullptr, &err_code);
+    CL_CHECK_STATUS(err_code);
+
+    cl_uint arg_index{ 0 };
+    CL_CHECK_CALL(clSetKernelArg(intersect_kernel, arg_index++, sizeof(cl_mem), &scene.d_spheres));
+    CL_CHECK_CALL(clSetKernelArg(intersect_kernel, arg_index++, sizeof(cl_uint), &scene.num_spheres));
+    if (scene.HasAcceleration())
+    {
+        CL_CHECK_CALL(clSetKernelArg(intersect_kernel, arg_index++, sizeof(cl_mem), &scene.d_tlas_nodes));
+        CL_CHECK_CALL(clSetKernelArg(intersect_kernel, arg_index++, sizeof(cl_mem), &scene.d_instances));
+        CL_CHECK_CALL(clSetKernelArg(intersect_kernel, arg_index++, sizeof(cl_mem), &scene.d_blas_nodes));
+        CL_CHECK_CALL(clSetKernelArg(intersect_kernel, arg_index++, sizeof(cl_mem), &scene.d_primitive_indices));
+        CL_CHECK_CALL(clSetKernelArg(intersect_kernel, arg_index++, sizeof(cl_mem), &scene.d_vertices));
+        CL_CHECK_CALL(clSetKernelArg(intersect_kernel, arg_index++, sizeof(cl_mem), &scene.d_triangles));
+    }
+    CL_CHECK_CALL(clSetKernelArg(intersect_kernel, arg_index++, sizeof(cl_mem), &d_rays));
+    CL_CHECK_CALL(clSetKernelArg(intersect_kernel, arg_index++, sizeof(cl_mem), &d_ray_depth));
+    CL_CHECK_CALL(clSetKernelArg(intersect_kernel, arg_index++, sizeof(cl_mem), &d_intersections));
+    CL_CHECK_CALL(clSetKernelArg(intersect_kernel, arg_index++, sizeof(cl_mem), &d_primitive_index));
+    CL_CHECK_CALL(clSetKernelArg(intersect_kernel, arg_index++, sizeof(cl_uint), &num_rays));
+}
+
+double IntersectionBenchmark::RunKernel(unsigned int num_rays)
+{
+    // The kernel marks the rays that miss, so the depths and indices are reset before each run
+    const cl_uint zero{ 0 };
+    const cl_uint invalid_index{ HostIntersector::INVALID_INDEX };
+    const size_t global_size{ num_rays };
+    CL_CHECK_CALL(clEnqueueFillBuffer(command_queue, d_ray_depth, &zero, sizeof(cl_uint), 0,
+                                      num_rays * sizeof(cl_uint), 0, nullptr, nullptr));
+    CL_CHECK_CALL(clEnqueueFillBuffer(command_queue, d_primitive_index, &invalid_index, sizeof(cl_uint), 0,
+                                      num_rays * sizeof(cl_uint), 0, nullptr, nullptr));
+    cl_event kernel_event;
+    CL_CHECK_CALL(clEnqueueNDRangeKernel(command_queue, intersect_kernel, 1, nullptr, &global_size, nullptr,
+                                         0, nullptr, &kernel_event));
+    CL_CHECK_CALL(clWaitForEvents(1, &kernel_event));
+    cl_ulong start, end;
+    CL_CHECK_CALL(clGetEventProfilingInfo(kernel_event, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &start,
+                                          nullptr));
+    CL_CHECK_CALL(clGetEventProfilingInfo(kernel_event, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &end,
+                                          nullptr));
+    CL_CHECK_CALL(clReleaseEvent(kernel_event));
+
+    return static_cast<double>(end - start) * 1e-6;
+}
+
+RayBatch IntersectionBenchmark::GenerateRays(const SceneDescription& scene_description, unsigned int num_rays)
+{
+    // Bounds of the spheres, the origins inside the scene are taken from them
+    Vector3 scene_min{ std::numeric_limits<float>::max() };
+    Vector3 scene_max{ -std::numeric_limits<float>::max() };
+    for (const auto& sphere : scene_description.loaded_spheres)
+    {
+        const Vector3 center{ sphere.cx, sphere.cy, sphere.cz };
+        scene_min = Min(scene_min, center - Vector3{ sphere.radius });
+        scene_max = Max(scene_max, center + Vector3{ sphere.radius });
+    }
+
+    std::mt19937 generator{ 0 };
+    std::uniform_real_distribution<float> unit{ 0.f, 1.f };
+    std::uniform_int_distribution<unsigned int> sphere_choice{ 0, scene_description.NumSpheres() - 1 };
+    const Vector3 eye{ 40.f, 60.f, -70.f };
+
+    RayBatch rays;
+    for (unsigned int r = 0; r != num_rays; r++)
+    {
+        Vector3 origin{ eye };
+        if (r % 2 != 0)
+        {
+            const Vector3 extent{ scene_max - scene_min };
+            origin = Vector3{ scene_min.x + unit(generator) * extent.x, scene_min.y + unit(generator) * extent.y,
+                              scene_min.z + unit(generator) * extent.z };
+        }
+        Vector3 direction;
+        if (r % 4 < 2)
+        {
+            // Aim at a point around a sphere
+            const Sphere& sphere{ scene_description.loaded_spheres[sphere_choice(generator)] };
+            const Vector3 jitter{ unit(generator) - 0.5f, unit(generator) - 0.5f, unit(generator) - 0.5f };
+            direction = Vector3{ sphere.cx, sphere.cy, sphere.cz } + 2.f * sphere.radius * jitter - origin;
+        }
+        else
+        {
+            direction = Vector3{ unit(generator) - 0.5f, unit(generator) - 0.5f, unit(generator) - 0.5f };
+        }
+        direction = Normalize(direction);
+
+        rays.origin_x.push_back(origin.x);
+        rays.origin_y.push_back(origin.y);
+        rays.origin_z.push_back(origin.z);
+        rays.direction_x.push_back(direction.x);
+        rays.direction_y.push_back(direction.y);
+        rays.direction_z.push_back(direction.z);
+    }
+
+    return rays;
+}
+
+void IntersectionBenchmark::Cleanup() noexcept
+{
+    try
+    {
+        for (cl_mem buffer : { d_rays, d_ray_depth, d_intersections, d_primitive_index })
+        {
+            if (buffer != nullptr)
+            {
+                CL_CHECK_CALL(clReleaseMemObject(buffer));
+            }
+        }
+        if (intersect_kernel != nullptr)
+        {
+            CL_CHECK_CALL(clReleaseKernel(intersect_kernel));
+        }
+        if (command_queue != nullptr)
+        {
+            CL_CHECK_CALL(clReleaseCommandQueue(command_queue));
+        }
+    }
+    catch (const std::exception& ex)
+    {
+        // TODO operator<< could throw
+        std::cerr << ex.what() << std::endl;
+    }
+}
+
+} // CL namespace
+} // Rendering namespace
@@ -0,0 +1,74 @@
+//
+// Created by Simon on 2019-03-30.
+//
+
+#ifndef RABBIT_INTERSECTIONBENCHMARK_HPP
+#define RABBIT_INTERSECTIONBENCHMARK_HPP
+
+#include "HostIntersector.hpp"
+#include "RenderingDevice.hpp"
+#include "RenderingOptions.hpp"
+#include "Scene.hpp"
+
+#include <chrono>
+#include <ostream>
+
+namespace Rendering
+{
+namespace CL
+{
+
+// Runs the same batch of rays through the host intersector and the Intersect kernel, reports the throughput of
+// both and compares the spheres hit and their distances. The kernel uses the acceleration structure if the options
+// request it, so the traversal is checked against brute force as well
+class IntersectionBenchmark
+{
+public:
+    IntersectionBenchmark(RenderingDevice& device, const RenderingOptions& options);
+
+    ~IntersectionBenchmark() noexcept;
+
+    IntersectionBenchmark(const IntersectionBenchmark&) = delete;
+
+    IntersectionBenchmark& operator=(const IntersectionBenchmark&) = delete;
+
+    // Intersect num_rays random rays with the spheres of the scene, the results are written to the log. Returns
+    // the number of rays with different results, throws if the scene has instances or triangles
+    unsigned int Run(const SceneDescription& scene_description, unsigned int num_rays, std::ostream& log);
+
+    // Intersect num_rays random rays with the spheres of the scene until the time budget is spent and return the
+    // throughput of the fastest run in Mrays/s, the results are not checked
+    double Throughput(const SceneDescription& scene_description, unsigned int num_rays,
+                      std::chrono::milliseconds budget);
+
+private:
+    // Generate rays from the default camera position and from inside the scene, half of them aimed at spheres
+    static RayBatch GenerateRays(const SceneDescription& scene_description, unsigned int num_rays);
+
+    // Create the queue, kernel and streams for the rays and set the arguments, releasing those of a previous run
+    void Prepare(const ::CL::Scene& scene, const RayBatch& rays);
+
+    // Reset the depths and indices, run the kernel and return its time in milliseconds
+    double RunKernel(unsigned int num_rays);
+
+    // Cleanup OpenCL resources without throwing
+    void Cleanup() noexcept;
+
+    RenderingDevice& rendering_device;
+    const RenderingOptions rendering_options;
+
+    // Profiling queue and kernel of the last run
+    cl_command_queue command_queue;
+    cl_kernel intersect_kernel;
+
+    // Streams of the last run in SoA layout
+    cl_mem d_rays;
+    cl_mem d_ray_depth;
+    cl_mem d_intersections;
+    cl_mem d_primitive_index;
+};
+
+} // CL namespace
+} // Rendering namespace
+
+#endif //RABBIT_INTERSECTIONBENCHMARK_HPP
@@ -0,0 +1,53 @@
+//
+// Created by Simon on 2019-03-29.
+//
+
+#ifndef RABBIT_KEYFRAMES_HPP
+#define RABBIT_KEYFRAMES_HPP
+
+#include <vector>
+
+namespace Rendering
+{
+
+// Keyframes around a frame and the weight of the next one, both are the same keyframe with a zero weight when
+// the frame is on a keyframe or outside of the animation
+template <typename Keyframe>
+struct KeyframeInterval
+{
+    const Keyframe& previous;
+    const Keyframe& next;
+    float t;
+
+    // Linear interpolation of a value of the keyframes
+    template <typename Value>
+    Value Interpolate(Value Keyframe::* value) const noexcept
+    {
+        return (1.f - t) * previous.*value + t * next.*value;
+    }
+};
+
+// Find the keyframes around the frame, the keyframes must not be empty and sorted by frame. Frames before the first
+// keyframe hold the first one and frames after the last keyframe the last one
+template <typename Keyframe>
+KeyframeInterval<Keyframe> FindKeyframes(const std::vector<Keyframe>& keyframes, unsigned int frame) noexcept
+{
+    auto next = keyframes.cbegin();
+    while (next != keyframes.cend() && next->frame < frame)
+    {
+        ++next;
+    }
+    if (next == keyframes.cbegin() || next == keyframes.cend() || next->frame == frame)
+    {
+        const Keyframe& keyframe{ next == keyframes.cend() ? keyframes.back() : *next };
+        return KeyframeInterval<Keyframe>{ keyframe, keyframe, 0.f };
+    }
+
+    const Keyframe& previous{ *(next - 1) };
+    return KeyframeInterval<Keyframe>{ previous, *next, static_cast<float>(frame - previous.frame) /
+                                                        static_cast<float>(next->frame - previous.frame) };
+}
+
+} // Rendering namespace
+
+#endif //RABBIT_KEYFRAMES_HPP
@@ -0,0 +1,108 @@
+//
+// Created by Simon on 2019-03-28.
+//
+
+#include "LaunchTuning.hpp"
+#include "CLEnvironment.hpp"
+
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+namespace Rendering
+{
+
+const char* KernelName(KernelId kernel) noexcept
+{
+    switch (kernel)
+    {
+        case KernelId::Initialise:
+            return "Initialise";
+        case KernelId::Restart:
+            return "RestartSample";
+        case KernelId::Intersect:
+            return "Intersect";
+        case KernelId::SampleBRDF:
+            return "SampleBRDF";
+        case KernelId::UpdateRadiance:
+            return "UpdateRadiance";
+        default:
+            return "DepositSamples";
+    }
+}
+
+LaunchTuning::LaunchTuning() noexcept
+    : tile_width{ 0 }, tile_height{ 0 }, local_size{}
+{}
+
+KernelTimes::KernelTimes() noexcept
+    : nanoseconds{}
+{}
+
+TuningCache::TuningCache(const std::string& filename)
+    : cache_filename{ filename }
+{
+    std::ifstream cache_file{ cache_filename };
+    std::string line;
+    while (std::getline(cache_file, line))
+    {
+        // Each line is the key, a tab and the tile size followed by the local size of each kernel
+        const auto separator = line.find('\t');
+        if (separator == std::string::npos)
+        {
+            continue;
+        }
+
+        LaunchTuning launch_tuning;
+        std::istringstream values{ line.substr(separator + 1) };
+        values >> launch_tuning.tile_width >> launch_tuning.tile_height;
+        for (auto& local_size : launch_tuning.local_size)
+        {
+            values >> local_size;
+        }
+        if (values)
+        {
+            tunings[line.substr(0, separator)] = launch_tuning;
+        }
+    }
+}
+
+std::string TuningCache::DeviceKey(cl_device_id device, const std::string& program_defines)
+{
+    return CL::DeviceInfoString(device, CL_DEVICE_NAME) + " | " +
+           CL::DeviceInfoString(device, CL_DRIVER_VERSION) + " |" + program_defines;
+}
+
+bool TuningCache::Find(const std::string& key, LaunchTuning& launch_tuning) const
+{
+    const auto cached_tuning = tunings.find(key);
+    if (cached_tuning == tunings.end())
+    {
+        return false;
+    }
+    launch_tuning = cached_tuning->second;
+
+    return true;
+}
+
+void TuningCache::Store(const std::string& key, const LaunchTuning& launch_tuning)
+{
+    tunings[key] = launch_tuning;
+
+    std::ofstream cache_file{ cache_filename };
+    if (!cache_file.is_open())
+    {
+        throw std::runtime_error{ "Could not write tuning cache: " + cache_filename };
+    }
+    for (const auto& tuning : tunings)
+    {
+        cache_file << tuning.first << '\t' << tuning.second.tile_width << ' ' << tuning.second.tile_height;
+        for (const auto local_size : tuning.second.local_size)
+        {
+            cache_file << ' ' << local_size;
+        }
+        cache_file << '\n';
+    }
+}
+
+} // Rendering namespace
@@ -0,0 +1,90 @@
+//
+// Created by Simon on 2019-03-28.
+//
+
+#ifndef RABBIT_LAUNCHTUNING_HPP
+#define RABBIT_LAUNCHTUNING_HPP
+
+#ifdef __APPLE__
+
+#include <OpenCL/cl.h>
+
+#else
+#include <CL/cl.h>
+#endif
+
+#include <array>
+#include <map>
+#include <string>
+
+namespace Rendering
+{
+
+// Kernels launched during rendering
+enum class KernelId
+{
+    Initialise,
+    Restart,
+    Intersect,
+    SampleBRDF,
+    UpdateRadiance,
+    DepositSamples
+};
+
+constexpr unsigned int NUM_KERNELS{ 6 };
+
+// Name of the kernel in the program
+const char* KernelName(KernelId kernel) noexcept;
+
+// Launch parameters found by the autotuner, zero values keep the default choice
+struct LaunchTuning
+{
+    // Tile size, the default is the one in the scene file
+    unsigned int tile_width, tile_height;
+
+    // Work-group size of each kernel, the default is the largest multiple of the preferred size
+    std::array<size_t, NUM_KERNELS> local_size;
+
+    LaunchTuning() noexcept;
+
+    size_t LocalSize(KernelId kernel) const noexcept
+    {
+        return local_size[static_cast<unsigned int>(kernel)];
+    }
+};
+
+// Accumulated execution time of each kernel, measured with profiling events
+struct KernelTimes
+{
+    std::array<cl_ulong, NUM_KERNELS> nanoseconds;
+
+    KernelTimes() noexcept;
+};
+
+// Best launch parameters for each device and program variant, stored in a text file
+class TuningCache
+{
+public:
+    // Load the cache from the file, a missing file is an empty cache
+    explicit TuningCache(const std::string& filename);
+
+    // Key identifying the device, its driver and the program variant
+    static std::string DeviceKey(cl_device_id device, const std::string& program_defines);
+
+    // Find the tuning for the key, returns false if the device was never tuned
+    bool Find(const std::string& key, LaunchTuning& launch_tuning) const;
+
+    // Store the tuning for the key and save the file
+    void Store(const std::string& key, const LaunchTuning& launch_tuning);
+
+private:
+    // File with the cache
+    const std::string cache_filename;
+
+    // Tuning for each key
+    std::map<std::string, LaunchTuning> tunings;
+};
+
+} // Rendering namespace
+
+#endif //RABBIT_LAUNCHTUNING_HPP
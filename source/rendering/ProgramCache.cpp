@@ -0,0 +1,205 @@
+//
+// Created by Simon on 2019-03-25.
+//
+
+#include "ProgramCache.hpp"
+#include "CLEnvironment.hpp"
+#include "CLError.hpp"
+#include "FileIO.hpp"
+
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <sstream>
+#include <vector>
+
+namespace Rendering
+{
+namespace CL
+{
+
+namespace
+{
+
+// 64 bit FNV-1a hash, stable between runs to name the cached binaries
+std::uint64_t HashString(const std::string& data, std::uint64_t hash = 14695981039346656037ull) noexcept
+{
+    for (const char c : data)
+    {
+        hash ^= static_cast<unsigned char>(c);
+        hash *= 1099511628211ull;
+    }
+
+    return hash;
+}
+
+} // Anonymous namespace
+
+ProgramCache::ProgramCache(cl_context context, cl_device_id device, const std::string& kernel_filename,
+                           const std::string& binary_cache_directory)
+    : target_context{ context }, target_device{ device }, kernel_source{ IO::ReadFile(kernel_filename) },
+      binary_cache_directory{ binary_cache_directory },
+      device_description{ DeviceInfoString(device, CL_DEVICE_NAME) + " " +
+                          DeviceInfoString(device, CL_DRIVER_VERSION) }
+{
+    CL_CHECK_CALL(clRetainContext(target_context));
+    try
+    {
+        CL_CHECK_CALL(clRetainDevice(target_device));
+    }
+    catch (const std::exception& ex)
+    {
+        CL_CHECK_CALL(clReleaseContext(target_context));
+        throw;
+    }
+}
+
+ProgramCache::~ProgramCache() noexcept
+{
+    Cleanup();
+}
+
+cl_program ProgramCache::GetProgram(const std::string& defines)
+{
+    const auto cached_program = programs.find(defines);
+    if (cached_program != programs.end())
+    {
+        return cached_program->second;
+    }
+
+    cl_program kernel_program{ BuildProgram(defines) };
+    programs.emplace(defines, kernel_program);
+
+    return kernel_program;
+}
+
+cl_program ProgramCache::BuildProgram(const std::string& defines) const
+{
+    const std::string program_options{ "-cl-std=CL1.2 -cl-mad-enable -cl-no-signed-zeros" + defines };
+    if (binary_cache_directory.empty())
+    {
+        return BuildFromSource(program_options);
+    }
+
+    const std::string binary_filename{ BinaryFilename(program_options) };
+    cl_program kernel_program{ LoadBinary(binary_filename, program_options) };
+    if (kernel_program == nullptr)
+    {
+        kernel_program = BuildFromSource(program_options);
+        SaveBinary(kernel_program, binary_filename);
+    }
+
+    return kernel_program;
+}
+
+cl_program ProgramCache::BuildFromSource(const std::string& program_options) const
+{
+    const char* c_ptr_source{ kernel_source.c_str() };
+
+    // Create program
+    cl_int err_code{ CL_SUCCESS };
+    cl_program kernel_program{ clCreateProgramWithSource(target_context, 1, &c_ptr_source, nullptr, &err_code) };
+    CL_CHECK_STATUS(err_code);
+
+    // Build program
+    err_code = clBuildProgram(kernel_program, 1, &target_device, program_options.c_str(), nullptr, nullptr);
+    if (err_code != CL_SUCCESS)
+    {
+        // We have an error in the program build
+        size_t program_build_log_size;
+        CL_CHECK_CALL(clGetProgramBuildInfo(kernel_program, target_device, CL_PROGRAM_BUILD_LOG,
+                                            0, nullptr, &program_build_log_size));
+        auto program_build_log{ std::make_unique<char[]>(program_build_log_size) };
+        CL_CHECK_CALL(clGetProgramBuildInfo(kernel_program, target_device, CL_PROGRAM_BUILD_LOG,
+                                            program_build_log_size, program_build_log.get(), nullptr));
+
+        // Release program and throw exception with log
+        CL_CHECK_CALL(clReleaseProgram(kernel_program));
+        throw std::runtime_error{ program_build_log.get() };
+    }
+
+    return kernel_program;
+}
+
+cl_program ProgramCache::LoadBinary(const std::string& binary_filename, const std::string& program_options) const
+{
+    std::ifstream binary_file{ binary_filename, std::ios::binary };
+    if (!binary_file.is_open())
+    {
+        return nullptr;
+    }
+    const std::vector<unsigned char> binary{ std::istreambuf_iterator<char>{ binary_file },
+                                             std::istreambuf_iterator<char>{} };
+    const unsigned char* binary_data{ binary.data() };
+    const size_t binary_size{ binary.size() };
+
+    // A binary the driver does not accept is ignored and the program is built from source again
+    cl_int binary_status{ CL_SUCCESS };
+    cl_int err_code{ CL_SUCCESS };
+    cl_program kernel_program{ clCreateProgramWithBinary(target_context, 1, &target_device, &binary_size,
+                                                         &binary_data, &binary_status, &err_code) };
+    if (err_code != CL_SUCCESS || binary_status != CL_SUCCESS)
+    {
+        if (kernel_program != nullptr)
+        {
+            CL_CHECK_CALL(clReleaseProgram(kernel_program));
+        }
+        return nullptr;
+    }
+    if (clBuildProgram(kernel_program, 1, &target_device, program_options.c_str(), nullptr, nullptr) != CL_SUCCESS)
+    {
+        CL_CHECK_CALL(clReleaseProgram(kernel_program));
+        return nullptr;
+    }
+
+    return kernel_program;
+}
+
+void ProgramCache::SaveBinary(cl_program kernel_program, const std::string& binary_filename) const
+{
+    size_t binary_size{ 0 };
+    CL_CHECK_CALL(clGetProgramInfo(kernel_program, CL_PROGRAM_BINARY_SIZES, sizeof(size_t), &binary_size, nullptr));
+    std::vector<unsigned char> binary(binary_size);
+    unsigned char* binary_data{ binary.data() };
+    CL_CHECK_CALL(clGetProgramInfo(kernel_program, CL_PROGRAM_BINARIES, sizeof(unsigned char*), &binary_data,
+                                   nullptr));
+
+    std::ofstream binary_file{ binary_filename, std::ios::binary };
+    if (!binary_file.write(reinterpret_cast<const char*>(binary.data()), binary.size()))
+    {
+        std::cerr << "Could not write program binary: " << binary_filename << "\n";
+    }
+}
+
+std::string ProgramCache::BinaryFilename(const std::string& program_options) const
+{
+    std::ostringstream binary_filename;
+    binary_filename << binary_cache_directory << "/rabbit_" << std::hex
+                    << HashString(program_options, HashString(device_description, HashString(kernel_source)))
+                    << ".bin";
+
+    return binary_filename.str();
+}
+
+void ProgramCache::Cleanup() noexcept
+{
+    try
+    {
+        for (const auto& program : programs)
+        {
+            CL_CHECK_CALL(clReleaseProgram(program.second));
+        }
+        CL_CHECK_CALL(clReleaseDevice(target_device));
+        CL_CHECK_CALL(clReleaseContext(target_context));
+    }
+    catch (const std::exception& ex)
+    {
+        // TODO operator<< could throw
+        std::cerr << ex.what() << std::endl;
+    }
+}
+
+} // CL namespace
+} // Rendering namespace
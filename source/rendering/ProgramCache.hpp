@@ -0,0 +1,80 @@
+//
+// Created by Simon on 2019-03-25.
+//
+
+#ifndef RABBIT_PROGRAMCACHE_HPP
+#define RABBIT_PROGRAMCACHE_HPP
+
+#ifdef __APPLE__
+
+#include <OpenCL/cl.h>
+
+#else
+#include <CL/cl.h>
+#endif
+
+#include <string>
+#include <map>
+
+namespace Rendering
+{
+namespace CL
+{
+
+// Builds the kernel program from a single source file and keeps one built program for each set of build defines
+// If a binary cache directory is given the built programs are also stored there and loaded by later runs
+class ProgramCache
+{
+public:
+    ProgramCache(cl_context context, cl_device_id device, const std::string& kernel_filename,
+                 const std::string& binary_cache_directory = "");
+
+    ~ProgramCache() noexcept;
+
+    ProgramCache(const ProgramCache&) = delete;
+
+    ProgramCache& operator=(const ProgramCache&) = delete;
+
+    // Get the program built with the given defines, the program is owned by the cache
+    cl_program GetProgram(const std::string& defines);
+
+private:
+    // Build program with the given defines, from the binary cache if possible
+    cl_program BuildProgram(const std::string& defines) const;
+
+    // Build program from the source with the given options
+    cl_program BuildFromSource(const std::string& program_options) const;
+
+    // Load and build the cached binary, returns nullptr if it is missing or can't be used
+    cl_program LoadBinary(const std::string& binary_filename, const std::string& program_options) const;
+
+    // Store the binary of the built program, failures are only reported
+    void SaveBinary(cl_program kernel_program, const std::string& binary_filename) const;
+
+    // Cached binary file for the program options
+    std::string BinaryFilename(const std::string& program_options) const;
+
+    // Cleanup OpenCL resource without throwing
+    void Cleanup() noexcept;
+
+    // Context and device the programs are built for
+    cl_context target_context;
+    cl_device_id target_device;
+
+    // Kernel source
+    const std::string kernel_source;
+
+    // Directory with the cached binaries, empty if disabled
+    const std::string binary_cache_directory;
+
+    // Device name and driver version, binaries are only valid for them
+    const std::string device_description;
+
+    // Built programs indexed by their defines
+    std::map<std::string, cl_program> programs;
+};
+
+} // CL namespace
+} // Rendering namespace
+
+#endif //RABBIT_PROGRAMCACHE_HPP
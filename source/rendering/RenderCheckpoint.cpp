@@ -0,0 +1,252 @@
+//
+// Created by Simon on 2019-03-28.
+//
+
+#include "RenderCheckpoint.hpp"
+#include "CLError.hpp"
+
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+namespace Rendering
+{
+namespace CL
+{
+
+RenderCheckpoint::RenderCheckpoint(const std::string& filename, std::chrono::seconds interval, bool resume)
+    : filename{ filename }, interval{ interval }, last_capture{ std::chrono::steady_clock::now() }, header{},
+      resumable{ false }
+{
+    if (!resume)
+    {
+        return;
+    }
+
+    std::ifstream checkpoint_file{ filename, std::ios::binary };
+    if (!checkpoint_file.is_open())
+    {
+        std::cout << "No checkpoint in " << filename << ", starting the render from the beginning\n";
+        return;
+    }
+    if (!checkpoint_file.read(reinterpret_cast<char*>(&header), sizeof(Header)) ||
+        header.magic != MAGIC || header.version != VERSION)
+    {
+        throw std::runtime_error("Invalid checkpoint file: " + filename);
+    }
+    state.resize(header.state_size);
+    if (!checkpoint_file.read(reinterpret_cast<char*>(state.data()), state.size()))
+    {
+        throw std::runtime_error("Truncated checkpoint file: " + filename);
+    }
+    resumable = true;
+}
+
+RenderCheckpoint::~RenderCheckpoint() noexcept
+{
+    try
+    {
+        if (pending_write.valid())
+        {
+            pending_write.wait();
+        }
+    }
+    catch (const std::exception& ex)
+    {
+        // TODO operator<< could throw
+        std::cerr << ex.what() << std::endl;
+    }
+}
+
+void RenderCheckpoint::Restore(cl_command_queue queue, const RenderingData& rendering_data,
+                               const TileDescription& tile_description, const CropWindow& film_window,
+                               StorageLayout layout, EventGraph& event_graph,
+                               std::vector<EventGraph::Node>& restore_nodes)
+{
+    if (!resumable)
+    {
+        throw std::runtime_error("No checkpoint to restore");
+    }
+
+    const Header expected{ MakeHeader(rendering_data, tile_description, film_window, layout) };
+    if (header.num_pixels != expected.num_pixels || header.film_x != expected.film_x ||
+        header.film_y != expected.film_y || header.film_width != expected.film_width ||
+        header.film_height != expected.film_height || header.tile_width != expected.tile_width ||
+        header.tile_height != expected.tile_height || header.pixel_samples != expected.pixel_samples ||
+        header.num_tile_rows != expected.num_tile_rows || header.storage_layout != expected.storage_layout ||
+        header.state_size != expected.state_size)
+    {
+        throw std::runtime_error("Checkpoint " + filename + " was saved with a different image, crop window, "
+                                 "tile size, number of samples or storage layout");
+    }
+
+    // The state is kept until the writes complete, before the first iteration reads the counters back
+    size_t offset{ 0 };
+    for (const auto& state_buffer : StateBuffers(rendering_data))
+    {
+        restore_nodes.push_back(event_graph.Add({}, [&](cl_uint num_wait, const cl_event* wait, cl_event* event)
+        {
+            CL_CHECK_CALL(clEnqueueWriteBuffer(queue, state_buffer.buffer, CL_FALSE, 0, state_buffer.size,
+                                               state.data() + offset, num_wait, wait, event));
+        }));
+        offset += state_buffer.size;
+    }
+    resumable = false;
+}
+
+bool RenderCheckpoint::Due() const
+{
+    if (interval.count() == 0)
+    {
+        return false;
+    }
+    // Do not wait for a slow disk, the next iteration checks again
+    if (pending_write.valid() && pending_write.wait_for(std::chrono::seconds{ 0 }) != std::future_status::ready)
+    {
+        return false;
+    }
+
+    return std::chrono::steady_clock::now() - last_capture >= interval;
+}
+
+void RenderCheckpoint::Capture(cl_command_queue queue, const RenderingData& rendering_data,
+                               const TileDescription& tile_description, const CropWindow& film_window,
+                               StorageLayout layout, EventGraph& event_graph,
+                               std::vector<EventGraph::Node>& capture_nodes)
+{
+    // The previous state must be written before it is overwritten
+    if (pending_write.valid())
+    {
+        pending_write.get();
+    }
+
+    header = MakeHeader(rendering_data, tile_description, film_window, layout);
+    state.resize(header.state_size);
+
+    // The events are released by the graph, the writer keeps its own reference
+    std::vector<cl_event> read_events;
+    size_t offset{ 0 };
+    for (const auto& state_buffer : StateBuffers(rendering_data))
+    {
+        capture_nodes.push_back(event_graph.Add({}, [&](cl_uint num_wait, const cl_event* wait, cl_event* event)
+        {
+            CL_CHECK_CALL(clEnqueueReadBuffer(queue, state_buffer.buffer, CL_FALSE, 0, state_buffer.size,
+                                              state.data() + offset, num_wait, wait, event));
+        }));
+        read_events.push_back(event_graph.Event(capture_nodes.back()));
+        CL_CHECK_CALL(clRetainEvent(read_events.back()));
+        offset += state_buffer.size;
+    }
+    CL_CHECK_CALL(clFlush(queue));
+
+    last_capture = std::chrono::steady_clock::now();
+    pending_write = std::async(std::launch::async, &RenderCheckpoint::WriteState, this, std::move(read_events));
+}
+
+std::vector<RenderCheckpoint::StateBuffer> RenderCheckpoint::StateBuffers(const RenderingData& rendering_data)
+{
+    std::vector<StateBuffer> state_buffers;
+    for (cl_mem buffer : { rendering_data.d_pixels.pixel_r, rendering_data.d_pixels.pixel_g,
+                           rendering_data.d_pixels.pixel_b, rendering_data.d_pixels.filter_weight,
+                           rendering_data.d_xorshift_state.state, rendering_data.d_rays.depth,
+                           rendering_data.d_rays.rays, rendering_data.d_samples.samples,
+                           rendering_data.d_samples.samples_done, rendering_data.d_samples.tile_rows_done })
+    {
+        size_t size;
+        CL_CHECK_CALL(clGetMemObjectInfo(buffer, CL_MEM_SIZE, sizeof(size_t), &size, nullptr));
+        state_buffers.push_back({ buffer, size });
+    }
+    const AuxiliaryPixels& auxiliary{ rendering_data.d_auxiliary };
+    if (auxiliary.num_pixels != 0)
+    {
+        for (cl_mem buffer : { auxiliary.albedo_r, auxiliary.albedo_g, auxiliary.albedo_b,
+                               auxiliary.normal_x, auxiliary.normal_y, auxiliary.normal_z })
+        {
+            state_buffers.push_back({ buffer, auxiliary.num_pixels * sizeof(cl_float) });
+        }
+    }
+    const CostPixels& cost{ rendering_data.d_cost };
+    if (cost.num_pixels != 0)
+    {
+        for (cl_mem buffer : { cost.rays, cost.tests })
+        {
+            state_buffers.push_back({ buffer, cost.num_pixels * sizeof(cl_uint) });
+        }
+    }
+    if (rendering_data.d_statistics.counters != nullptr)
+    {
+        state_buffers.push_back({ rendering_data.d_statistics.counters,
+                                  2 * StatisticsCounters::NUM_COUNTERS * sizeof(cl_uint) });
+    }
+
+    return state_buffers;
+}
+
+RenderCheckpoint::Header RenderCheckpoint::MakeHeader(const RenderingData& rendering_data,
+                                                      const TileDescription& tile_description,
+                                                      const CropWindow& film_window, StorageLayout layout)
+{
+    Header new_header{};
+    new_header.magic = MAGIC;
+    new_header.version = VERSION;
+    new_header.num_pixels = rendering_data.d_pixels.num_pixels;
+    new_header.film_x = film_window.x;
+    new_header.film_y = film_window.y;
+    new_header.film_width = film_window.width;
+    new_header.film_height = film_window.height;
+    new_header.tile_width = tile_description.Width();
+    new_header.tile_height = tile_description.Height();
+    new_header.pixel_samples = tile_description.PixelSamples();
+    new_header.num_tile_rows = rendering_data.d_samples.num_tile_rows;
+    new_header.storage_layout = static_cast<cl_uint>(layout);
+    for (const auto& state_buffer : StateBuffers(rendering_data))
+    {
+        new_header.state_size += state_buffer.size;
+    }
+
+    return new_header;
+}
+
+void RenderCheckpoint::WriteState(std::vector<cl_event> read_events) const
+{
+    // A failed checkpoint does not stop the render, the previous one is still there
+    try
+    {
+        const cl_int wait_status{ clWaitForEvents(static_cast<cl_uint>(read_events.size()), read_events.data()) };
+        for (auto read_event : read_events)
+        {
+            CL_CHECK_CALL(clReleaseEvent(read_event));
+        }
+        // The state is undefined if a copy failed, checked in release builds as well so it never replaces the file
+        if (wait_status != CL_SUCCESS)
+        {
+            throw std::runtime_error(std::string{ "Could not copy the checkpoint state: " } +
+                                     ::CL::ErrorCodeToString(wait_status));
+        }
+
+        const std::string temporary_filename{ filename + ".tmp" };
+        {
+            std::ofstream checkpoint_file{ temporary_filename, std::ios::binary };
+            if (!checkpoint_file.write(reinterpret_cast<const char*>(&header), sizeof(Header)) ||
+                !checkpoint_file.write(reinterpret_cast<const char*>(state.data()), state.size()))
+            {
+                throw std::runtime_error("Could not write checkpoint: " + temporary_filename);
+            }
+        }
+        // Rename does not replace an existing file on every platform
+        if (std::rename(temporary_filename.c_str(), filename.c_str()) != 0 &&
+            (std::remove(filename.c_str()) != 0 || std::rename(temporary_filename.c_str(), filename.c_str()) != 0))
+        {
+            throw std::runtime_error("Could not replace checkpoint: " + filename);
+        }
+    }
+    catch (const std::exception& ex)
+    {
+        // TODO operator<< could throw
+        std::cerr << ex.what() << std::endl;
+    }
+}
+
+} // CL namespace
+} // Rendering namespace
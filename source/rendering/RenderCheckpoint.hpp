@@ -0,0 +1,115 @@
+//
+// Created by Simon on 2019-03-28.
+//
+
+#ifndef RABBIT_RENDERCHECKPOINT_HPP
+#define RABBIT_RENDERCHECKPOINT_HPP
+
+#include "RenderingData.hpp"
+#include "TileDescription.hpp"
+#include "EventGraph.hpp"
+#include "CropWindow.hpp"
+
+#include <chrono>
+#include <future>
+#include <string>
+#include <vector>
+
+namespace Rendering
+{
+namespace CL
+{
+
+// Periodic dump of an in-progress render to a binary file and restore of it in a later run. The state is taken
+// between two iterations of the wavefront, after the samples were restarted: the film, the random number
+// generators, the depth, rays and samples streams (the tile position of each sample) and the counters. The
+// intersections are written by the next Intersect before they are read, so they are not stored
+class RenderCheckpoint
+{
+public:
+    // Checkpoints are written to the file every interval, a zero interval disables them. If resume is set the
+    // state in the file is restored by the render if the file exists, the render starts from the beginning otherwise
+    RenderCheckpoint(const std::string& filename, std::chrono::seconds interval, bool resume);
+
+    // Waits for the checkpoint being written
+    ~RenderCheckpoint() noexcept;
+
+    RenderCheckpoint(const RenderCheckpoint&) = delete;
+
+    RenderCheckpoint& operator=(const RenderCheckpoint&) = delete;
+
+    // Check if there is a state to restore
+    bool CanResume() const noexcept
+    {
+        return resumable;
+    }
+
+    // Enqueue the upload of the loaded state on the queue and add the writes to the graph, throws if the state was
+    // saved for different rendering data or another window of the image. The state can be restored only once
+    void Restore(cl_command_queue queue, const RenderingData& rendering_data, const TileDescription& tile_description,
+                 const CropWindow& film_window, StorageLayout layout, EventGraph& event_graph,
+                 std::vector<EventGraph::Node>& restore_nodes);
+
+    // Check if the interval elapsed since the last checkpoint and the previous one was written
+    bool Due() const;
+
+    // Enqueue the copy of the state on the queue and add the reads to the graph, the commands changing the state
+    // must wait for them. The file is written on a separate thread once the copies complete
+    void Capture(cl_command_queue queue, const RenderingData& rendering_data,
+                 const TileDescription& tile_description, const CropWindow& film_window, StorageLayout layout,
+                 EventGraph& event_graph, std::vector<EventGraph::Node>& capture_nodes);
+
+private:
+    // Buffer part of the state and its size
+    struct StateBuffer
+    {
+        cl_mem buffer;
+        size_t size;
+    };
+
+    // Identifies the rendering data a state belongs to, the state can be restored only with the same values
+    struct Header
+    {
+        cl_uint magic;
+        cl_uint version;
+        cl_uint num_pixels;
+        cl_uint film_x, film_y, film_width, film_height;
+        cl_uint tile_width, tile_height, pixel_samples;
+        cl_uint num_tile_rows;
+        cl_uint storage_layout;
+        cl_ulong state_size;
+    };
+
+    static constexpr cl_uint MAGIC{ 0x4b434252 };
+    static constexpr cl_uint VERSION{ 2 };
+
+    // Buffers forming the state, in file order
+    static std::vector<StateBuffer> StateBuffers(const RenderingData& rendering_data);
+
+    static Header MakeHeader(const RenderingData& rendering_data, const TileDescription& tile_description,
+                             const CropWindow& film_window, StorageLayout layout);
+
+    // Wait for the copies and write the state to a temporary file that replaces the checkpoint, so the previous
+    // checkpoint stays valid if the process is killed while writing
+    void WriteState(std::vector<cl_event> read_events) const;
+
+    const std::string filename;
+    const std::chrono::seconds interval;
+
+    // Time of the last checkpoint, or of the creation
+    std::chrono::steady_clock::time_point last_capture;
+
+    // Header and state of the last capture or of the loaded file
+    Header header;
+    std::vector<unsigned char> state;
+    // The loaded state was not restored yet
+    bool resumable;
+
+    // Write of the last capture
+    std::future<void> pending_write;
+};
+
+} // CL namespace
+} // Rendering namespace
+
+#endif //RABBIT_RENDERCHECKPOINT_HPP
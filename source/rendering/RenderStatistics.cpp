@@ -0,0 +1,152 @@
+//
+// Created by Simon on 2019-03-31.
+//
+
+#include "RenderStatistics.hpp"
+#include "CLError.hpp"
+#include "ImageIO.hpp"
+
+#include <fstream>
+#include <stdexcept>
+#include <vector>
+
+namespace Rendering
+{
+namespace CL
+{
+
+namespace
+{
+
+// Counter indices, must match the STAT_ defines in the kernel
+constexpr unsigned int STAT_RAYS{ 0 };
+constexpr unsigned int STAT_HITS{ STAT_RAYS + StatisticsCounters::MAX_DEPTH };
+constexpr unsigned int STAT_ESCAPED{ STAT_HITS + StatisticsCounters::MAX_DEPTH };
+constexpr unsigned int STAT_EMITTER{ STAT_ESCAPED + 1 };
+constexpr unsigned int STAT_ABSORBED{ STAT_EMITTER + 1 };
+constexpr unsigned int STAT_MAX_DEPTH{ STAT_ABSORBED + 1 };
+constexpr unsigned int STAT_ACTIVE_LANES{ STAT_MAX_DEPTH + 1 };
+constexpr unsigned int STAT_LAUNCHED_LANES{ STAT_ACTIVE_LANES + 1 };
+static_assert(STAT_LAUNCHED_LANES + 1 == StatisticsCounters::NUM_COUNTERS, "Counters do not match the kernel");
+
+// Ratio that is zero if there is nothing to divide
+double Ratio(cl_ulong numerator, cl_ulong denominator) noexcept
+{
+    return denominator != 0 ? static_cast<double>(numerator) / static_cast<double>(denominator) : 0.;
+}
+
+} // Anonymous namespace
+
+RenderStatistics RenderStatistics::Read(cl_command_queue queue, const StatisticsCounters& statistics_counters)
+{
+    std::vector<cl_uint> words(2 * StatisticsCounters::NUM_COUNTERS);
+    CL_CHECK_CALL(clEnqueueReadBuffer(queue, statistics_counters.counters, CL_TRUE, 0,
+                                      words.size() * sizeof(cl_uint), words.data(), 0, nullptr, nullptr));
+    const auto counter = [&words](unsigned int index)
+    {
+        return static_cast<cl_ulong>(words[2 * index]) | (static_cast<cl_ulong>(words[2 * index + 1]) << 32);
+    };
+
+    RenderStatistics statistics{};
+    for (unsigned int depth = 0; depth != StatisticsCounters::MAX_DEPTH; depth++)
+    {
+        statistics.rays[depth] = counter(STAT_RAYS + depth);
+        statistics.hits[depth] = counter(STAT_HITS + depth);
+    }
+    statistics.escaped = counter(STAT_ESCAPED);
+    statistics.emitter = counter(STAT_EMITTER);
+    statistics.absorbed = counter(STAT_ABSORBED);
+    statistics.max_depth = counter(STAT_MAX_DEPTH);
+    statistics.active_lanes = counter(STAT_ACTIVE_LANES);
+    statistics.launched_lanes = counter(STAT_LAUNCHED_LANES);
+
+    return statistics;
+}
+
+std::string RenderStatistics::FilenameForImage(const std::string& image_filename)
+{
+    return IO::ReplaceExtension(image_filename, ".stats.json");
+}
+
+cl_ulong RenderStatistics::TotalRays() const noexcept
+{
+    cl_ulong total{ 0 };
+    for (cl_ulong depth_rays : rays)
+    {
+        total += depth_rays;
+    }
+
+    return total;
+}
+
+cl_ulong RenderStatistics::TotalPaths() const noexcept
+{
+    return escaped + emitter + absorbed + max_depth;
+}
+
+double RenderStatistics::MraysPerSecond() const noexcept
+{
+    return render_seconds > 0. ? static_cast<double>(TotalRays()) / (render_seconds * 1e6) : 0.;
+}
+
+void RenderStatistics::Print(std::ostream& output) const
+{
+    const cl_ulong total_rays{ TotalRays() };
+    const cl_ulong total_paths{ TotalPaths() };
+    output << "Rays traced: " << total_rays << " (" << MraysPerSecond() << " Mrays/s), average path length "
+           << Ratio(total_rays, total_paths) << "\n";
+    for (unsigned int depth = 0; depth != StatisticsCounters::MAX_DEPTH; depth++)
+    {
+        output << "  depth " << depth << ": " << rays[depth] << " rays, " << 100. * Ratio(hits[depth], rays[depth])
+               << "% hit\n";
+    }
+    output << "Paths ended by escaping " << 100. * Ratio(escaped, total_paths) << "%, emitter "
+           << 100. * Ratio(emitter, total_paths) << "%, absorbed " << 100. * Ratio(absorbed, total_paths)
+           << "%, maximum depth " << 100. * Ratio(max_depth, total_paths) << "%\n";
+    output << "Active Intersect lanes: " << 100. * Ratio(active_lanes, launched_lanes) << "%\n";
+}
+
+void RenderStatistics::WriteJSON(const std::string& filename) const
+{
+    std::ofstream file{ filename };
+    if (!file.is_open())
+    {
+        throw std::runtime_error("Could not open statistics file: " + filename);
+    }
+
+    const auto write_array = [&file](const std::array<cl_ulong, StatisticsCounters::MAX_DEPTH>& values)
+    {
+        file << "[";
+        for (size_t i = 0; i != values.size(); i++)
+        {
+            file << (i != 0 ? ", " : "") << values[i];
+        }
+        file << "]";
+    };
+
+    const cl_ulong total_rays{ TotalRays() };
+    const cl_ulong total_paths{ TotalPaths() };
+    file << "{\n";
+    file << "  \"render_seconds\": " << render_seconds << ",\n";
+    file << "  \"total_rays\": " << total_rays << ",\n";
+    file << "  \"mrays_per_second\": " << MraysPerSecond() << ",\n";
+    file << "  \"rays_per_depth\": ";
+    write_array(rays);
+    file << ",\n  \"hits_per_depth\": ";
+    write_array(hits);
+    file << ",\n  \"total_paths\": " << total_paths << ",\n";
+    file << "  \"average_path_length\": " << Ratio(total_rays, total_paths) << ",\n";
+    file << "  \"terminations\": { \"escaped\": " << escaped << ", \"emitter\": " << emitter
+         << ", \"absorbed\": " << absorbed << ", \"max_depth\": " << max_depth << " },\n";
+    file << "  \"active_lanes\": " << active_lanes << ",\n";
+    file << "  \"launched_lanes\": " << launched_lanes << ",\n";
+    file << "  \"active_lane_ratio\": " << Ratio(active_lanes, launched_lanes) << "\n";
+    file << "}\n";
+    if (!file)
+    {
+        throw std::runtime_error("Error writing statistics file: " + filename);
+    }
+}
+
+} // CL namespace
+} // Rendering namespace
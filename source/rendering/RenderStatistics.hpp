@@ -0,0 +1,57 @@
+//
+// Created by Simon on 2019-03-31.
+//
+
+#ifndef RABBIT_RENDERSTATISTICS_HPP
+#define RABBIT_RENDERSTATISTICS_HPP
+
+#include "RenderingData.hpp"
+
+#include <array>
+#include <ostream>
+#include <string>
+
+namespace Rendering
+{
+namespace CL
+{
+
+// Ray and path statistics of a render, read back from the counters summed by the kernels
+struct RenderStatistics
+{
+    // Copy the counters to the host, the call blocks until the copy is done
+    static RenderStatistics Read(cl_command_queue queue, const StatisticsCounters& statistics_counters);
+
+    // File the statistics of an image are written to: the image name with the extension replaced by .stats.json
+    static std::string FilenameForImage(const std::string& image_filename);
+
+    // Total number of rays traced and of paths terminated
+    cl_ulong TotalRays() const noexcept;
+    cl_ulong TotalPaths() const noexcept;
+
+    // Rays traced per second of render time, 0 if the time is not set
+    double MraysPerSecond() const noexcept;
+
+    // Print a summary, the throughput is computed from the render time
+    void Print(std::ostream& output) const;
+
+    // Write the counters and the derived values as JSON, throws if the file can not be written
+    void WriteJSON(const std::string& filename) const;
+
+    // Rays traced and rays that hit something at each depth
+    std::array<cl_ulong, StatisticsCounters::MAX_DEPTH> rays, hits;
+
+    // Paths terminated by leaving the scene, hitting an emitter, a black material or the maximum depth
+    cl_ulong escaped, emitter, absorbed, max_depth;
+
+    // Work-items of Intersect with a ray to trace and launched
+    cl_ulong active_lanes, launched_lanes;
+
+    // Wall time of the render, set by the caller
+    double render_seconds;
+};
+
+} // CL namespace
+} // Rendering namespace
+
+#endif //RABBIT_RENDERSTATISTICS_HPP
@@ -3,169 +3,348 @@
 //
 
 #include "RenderingContext.hpp"
+#include "CostHeatmap.hpp"
+#include "Denoiser.hpp"
+#include "RenderStatistics.hpp"
 #include "CLError.hpp"
 
-#define STB_IMAGE_WRITE_IMPLEMENTATION
-
-#include "stb_image_writer.hpp"
-
 #include <iostream>
 #include <sstream>
 #include <stdexcept>
+#include <algorithm>
 #include <array>
+#include <chrono>
+#include <cmath>
+#include <utility>
 
 namespace Rendering
 {
 namespace CL
 {
 
-RenderingContext::RenderingContext(cl_context context, cl_device_id device,
-                                   const SceneDescription& scene_description, const ::CL::Scene& scene)
-    : target_context{ context }, target_device{ device },
-      output_image_width{ scene_description.image_width }, output_image_height{ scene_description.image_height },
-      tile_rendering_context{ context, device, CL_QUEUE_PROFILING_ENABLE, scene_description, scene }
+namespace
+{
+
+// Gamma and quantise a value of the radiance
+inline unsigned char ToLDR(float value) noexcept
+{
+    return static_cast<unsigned char>(std::pow(std::min(value, 1.f), 2.2f) * 255);
+}
+
+} // Anonymous namespace
+
+constexpr unsigned int RenderingContext::RESOLVE_RESERVE_DIVISOR;
+
+RenderingContext::RenderingContext(RenderingDevice& device,
+                                   const SceneDescription& scene_description, const ::CL::Scene& scene,
+                                   const RenderingOptions& options, const LaunchTuning* tuning)
+    : output_image_width{ scene_description.FilmWindow().width },
+      output_image_height{ scene_description.FilmWindow().height },
+      film_window{ scene_description.FilmWindow() }, full_image_width{ scene_description.image_width },
+      full_image_height{ scene_description.image_height },
+      tile_rendering_context{ device, CL_QUEUE_PROFILING_ENABLE, scene_description, scene, options, tuning }
+{}
+
+void RenderingContext::Render(const std::string& filename, RenderCheckpoint* checkpoint) const
+{
+    const auto start = std::chrono::steady_clock::now();
+    const Raster raster{ RenderImage(IO::ImageFormatFromFilename(filename), checkpoint) };
+    ReportStatistics(filename, std::chrono::steady_clock::now() - start);
+    WriteCostHeatmap(filename);
+    WriteImage(filename, film_window, full_image_width, full_image_height, raster);
+}
+
+std::future<void> RenderingContext::RenderAsync(const std::string& filename) const
+{
+    const auto start = std::chrono::steady_clock::now();
+    Raster raster{ RenderImage(IO::ImageFormatFromFilename(filename)) };
+    ReportStatistics(filename, std::chrono::steady_clock::now() - start);
+    WriteCostHeatmap(filename);
+
+    // Only the encoding runs on the other thread, the raster is owned by the task
+    return std::async(std::launch::async, WriteImage, filename, film_window, full_image_width, full_image_height,
+                      std::move(raster));
+}
+
+void RenderingContext::RenderForTime(const std::string& filename, std::chrono::milliseconds budget) const
+{
+    const auto start = std::chrono::steady_clock::now();
+    const auto passes_deadline = start + budget - budget / RESOLVE_RESERVE_DIVISOR;
+
+    // The kernels of the lanes overlap, their time is spread over the lanes. The wall time also covers the host
+    // waiting between the iterations of the wavefront, the larger of the two is the cost of the pass
+    const unsigned int num_lanes{ tile_rendering_context.rendering_kernel.NumLanes() };
+    std::chrono::steady_clock::duration pass_cost{ 0 };
+    unsigned int num_passes{ 0 };
+    auto pass_start = start;
+    do
+    {
+        KernelTimes kernel_times;
+        tile_rendering_context.RenderPass(num_passes++, &kernel_times);
+        const auto pass_end = std::chrono::steady_clock::now();
+
+        cl_ulong kernel_nanoseconds{ 0 };
+        for (const cl_ulong nanoseconds : kernel_times.nanoseconds)
+        {
+            kernel_nanoseconds += nanoseconds;
+        }
+        const auto kernel_time = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::nanoseconds{ kernel_nanoseconds / num_lanes });
+        pass_cost = std::max({ pass_cost, kernel_time, pass_end - pass_start });
+        pass_start = pass_end;
+    } while (pass_start + pass_cost <= passes_deadline);
+
+    // Resolve whatever was accumulated, the film has the samples of all the passes
+    Raster raster{ CreateRaster(IO::ImageFormatFromFilename(filename)) };
+    const std::unique_ptr<FilmBand> band{ ReadBackRows(0, output_image_height) };
+    ResolveBand(*band, raster);
+    if (!raster.albedo.empty())
+    {
+        DenoiseRaster(raster);
+    }
+    const auto render_time = std::chrono::steady_clock::now() - start;
+
+    std::cout << "Time budget: " << num_passes << " passes, "
+              << num_passes * tile_rendering_context.GetTileDescription().PixelSamples() << " samples per pixel in "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(render_time).count() << " of "
+              << budget.count() << " ms\n";
+    ReportStatistics(filename, render_time);
+    WriteCostHeatmap(filename);
+    WriteImage(filename, film_window, full_image_width, full_image_height, raster);
+}
+
+void RenderingContext::RenderTileRows(unsigned int first_tile_row, unsigned int end_tile_row,
+                                      unsigned int& first_row, unsigned int& end_row,
+                                      std::vector<float>& accumulation) const
+{
+    const unsigned int tile_height{ tile_rendering_context.GetTileDescription().Height() };
+    first_row = first_tile_row * tile_height;
+    end_row = std::min(end_tile_row * tile_height, output_image_height);
+
+    tile_rendering_context.RenderTileRows(first_tile_row, end_tile_row, true);
+    const std::unique_ptr<FilmBand> band{ ReadBackRows(first_row, end_row) };
+    CL_CHECK_CALL(clWaitForEvents(static_cast<cl_uint>(band->read_events.size()), band->read_events.data()));
+    for (auto read_event : band->read_events)
+    {
+        CL_CHECK_CALL(clReleaseEvent(read_event));
+    }
+
+    const size_t band_pixels{ band->pixel_r.size() };
+    accumulation.resize(4 * band_pixels);
+    std::copy(band->pixel_r.begin(), band->pixel_r.end(), accumulation.begin());
+    std::copy(band->pixel_g.begin(), band->pixel_g.end(), accumulation.begin() + band_pixels);
+    std::copy(band->pixel_b.begin(), band->pixel_b.end(), accumulation.begin() + 2 * band_pixels);
+    std::copy(band->filter_weight.begin(), band->filter_weight.end(), accumulation.begin() + 3 * band_pixels);
+}
+
+void RenderingContext::ReportStatistics(const std::string& image_filename,
+                                        std::chrono::steady_clock::duration render_time) const
+{
+    const StatisticsCounters& statistics_counters{ tile_rendering_context.rendering_data.d_statistics };
+    if (statistics_counters.counters == nullptr)
+    {
+        return;
+    }
+
+    RenderStatistics statistics{ RenderStatistics::Read(tile_rendering_context.transfer_queue,
+                                                        statistics_counters) };
+    statistics.render_seconds = std::chrono::duration<double>(render_time).count();
+    statistics.Print(std::cout);
+    statistics.WriteJSON(RenderStatistics::FilenameForImage(image_filename));
+}
+
+void RenderingContext::WriteCostHeatmap(const std::string& image_filename) const
+{
+    const CostPixels& cost_pixels{ tile_rendering_context.rendering_data.d_cost };
+    if (cost_pixels.num_pixels == 0)
+    {
+        return;
+    }
+
+    const CostHeatmap heatmap{ CostHeatmap::Read(tile_rendering_context.transfer_queue, cost_pixels,
+                                                 output_image_width, output_image_height) };
+    heatmap.Print(std::cout);
+    heatmap.WriteImage(CostHeatmap::ImageFilenameForImage(image_filename));
+    heatmap.WriteRaw(CostHeatmap::RawFilenameForImage(image_filename));
+}
+
+RenderingContext::Raster RenderingContext::CreateRaster(IO::ImageFormat format) const
 {
-    try
+    const bool denoise{ tile_rendering_context.rendering_data.d_auxiliary.num_pixels != 0 };
+    Raster raster;
+    raster.format = format;
+    if (format == IO::ImageFormat::PNG)
     {
-        // Increase reference count on context and device
-        CL_CHECK_CALL(clRetainContext(target_context));
-        CL_CHECK_CALL(clRetainDevice(target_device));
+        raster.ldr.resize(3 * output_image_width * output_image_height, 0);
     }
-    catch (const std::exception& ex)
+    if (format != IO::ImageFormat::PNG || denoise)
     {
-        // Cleanup what is needed and rethrow exception
-        Cleanup();
-        throw;
+        raster.hdr.resize(3 * output_image_width * output_image_height, 0.f);
     }
+    if (denoise)
+    {
+        raster.albedo.resize(3 * output_image_width * output_image_height, 0.f);
+        raster.normal.resize(3 * output_image_width * output_image_height, 0.f);
+    }
+
+    return raster;
 }
 
-RenderingContext::~RenderingContext() noexcept
+RenderingContext::Raster RenderingContext::RenderImage(IO::ImageFormat format, RenderCheckpoint* checkpoint) const
 {
-    Cleanup();
+    Raster raster{ CreateRaster(format) };
+
+    // Bands must outlive the conversions that read them, the futures are destroyed first
+    std::vector<std::unique_ptr<FilmBand>> bands;
+    std::vector<std::future<void>> band_conversions;
+
+    // Request tile renderer to render image, completed bands are copied and converted while it renders
+    const unsigned int tile_height{ tile_rendering_context.GetTileDescription().Height() };
+    tile_rendering_context.Render([&](unsigned int first_tile_row, unsigned int end_tile_row)
+                                  {
+                                      bands.push_back(ReadBackRows(first_tile_row * tile_height,
+                                                                   std::min(end_tile_row * tile_height,
+                                                                            output_image_height)));
+                                      band_conversions.push_back(std::async(std::launch::async,
+                                                                            &RenderingContext::ResolveBand, this,
+                                                                            std::cref(*bands.back()),
+                                                                            std::ref(raster)));
+                                  }, nullptr, checkpoint);
+
+    // Only the conversion of the last band is left after the last kernel
+    for (auto& band_conversion : band_conversions)
+    {
+        band_conversion.get();
+    }
+    if (!raster.albedo.empty())
+    {
+        DenoiseRaster(raster);
+    }
+
+    return raster;
 }
 
-void RenderingContext::Render(const std::string& filename) const
+std::unique_ptr<RenderingContext::FilmBand> RenderingContext::ReadBackRows(unsigned int first_row,
+                                                                           unsigned int end_row) const
 {
-    // Request tile renderer to render image
-    tile_rendering_context.Render();
+    auto band = std::make_unique<FilmBand>();
+    band->first_row = first_row;
+    band->end_row = end_row;
 
-    // Create final image after render process
-    CreateImage(filename);
+    const size_t band_pixels{ (end_row - first_row) * output_image_width };
+    const size_t offset{ first_row * output_image_width * sizeof(cl_float) };
+    const size_t size{ band_pixels * sizeof(cl_float) };
+    band->pixel_r.resize(band_pixels);
+    band->pixel_g.resize(band_pixels);
+    band->pixel_b.resize(band_pixels);
+    band->filter_weight.resize(band_pixels);
+
+    const Pixels& film{ tile_rendering_context.rendering_data.d_pixels };
+    const AuxiliaryPixels& auxiliary{ tile_rendering_context.rendering_data.d_auxiliary };
+    const cl_command_queue transfer_queue{ tile_rendering_context.transfer_queue };
+    std::vector<std::pair<cl_mem, std::vector<float>*>> copies{ { film.pixel_r, &band->pixel_r },
+                                                                { film.pixel_g, &band->pixel_g },
+                                                                { film.pixel_b, &band->pixel_b },
+                                                                { film.filter_weight, &band->filter_weight } };
+    if (auxiliary.num_pixels != 0)
+    {
+        const std::array<cl_mem, 6> auxiliary_buffers{ auxiliary.albedo_r, auxiliary.albedo_g, auxiliary.albedo_b,
+                                                       auxiliary.normal_x, auxiliary.normal_y, auxiliary.normal_z };
+        for (size_t i = 0; i != auxiliary_buffers.size(); i++)
+        {
+            band->auxiliary[i].resize(band_pixels);
+            copies.emplace_back(auxiliary_buffers[i], &band->auxiliary[i]);
+        }
+    }
+    band->read_events.resize(copies.size());
+    for (size_t i = 0; i != copies.size(); i++)
+    {
+        CL_CHECK_CALL(clEnqueueReadBuffer(transfer_queue, copies[i].first, CL_FALSE, offset, size,
+                                          copies[i].second->data(), 0, nullptr, &band->read_events[i]));
+    }
+    CL_CHECK_CALL(clFlush(transfer_queue));
+
+    return band;
 }
 
-void RenderingContext::Cleanup() noexcept
+void RenderingContext::ResolveBand(const FilmBand& band, Raster& raster) const
 {
-    try
+    CL_CHECK_CALL(clWaitForEvents(static_cast<cl_uint>(band.read_events.size()), band.read_events.data()));
+    for (auto read_event : band.read_events)
+    {
+        CL_CHECK_CALL(clReleaseEvent(read_event));
+    }
+
+    if (!raster.hdr.empty())
     {
-        CL_CHECK_CALL(clReleaseDevice(target_device));
-        CL_CHECK_CALL(clReleaseContext(target_context));
+        // The band keeps the film order, pixels without samples stay black
+        const size_t band_offset{ 3 * band.first_row * output_image_width };
+        for (unsigned int i = 0; i != band.pixel_r.size(); i++)
+        {
+            const float inv_filter_weight{ band.filter_weight[i] > 0.f ? 1.f / band.filter_weight[i] : 0.f };
+            raster.hdr[band_offset + 3 * i] = band.pixel_r[i] * inv_filter_weight;
+            raster.hdr[band_offset + 3 * i + 1] = band.pixel_g[i] * inv_filter_weight;
+            raster.hdr[band_offset + 3 * i + 2] = band.pixel_b[i] * inv_filter_weight;
+            if (!raster.albedo.empty())
+            {
+                for (unsigned int c = 0; c != 3; c++)
+                {
+                    raster.albedo[band_offset + 3 * i + c] = band.auxiliary[c][i] * inv_filter_weight;
+                    raster.normal[band_offset + 3 * i + c] = band.auxiliary[3 + c][i] * inv_filter_weight;
+                }
+            }
+        }
+        return;
     }
-    catch (const std::exception& ex)
+
+    // Convert data to format for stbi image write, the film has the first row at the bottom
+    for (unsigned int i = 0; i != band.pixel_r.size(); i++)
     {
-        // TODO operator<< could throw
-        std::cerr << ex.what() << std::endl;
+        const unsigned int x{ i % output_image_width };
+        const unsigned int y{ output_image_height - 1 - (band.first_row + i / output_image_width) };
+        const unsigned int o{ 3 * (y * output_image_width + x) };
+        const float inv_filter_weight{ 1.f / band.filter_weight[i] };
+        raster.ldr[o] = ToLDR(band.pixel_r[i] * inv_filter_weight);
+        raster.ldr[o + 1] = ToLDR(band.pixel_g[i] * inv_filter_weight);
+        raster.ldr[o + 2] = ToLDR(band.pixel_b[i] * inv_filter_weight);
     }
 }
 
-void RenderingContext::CreateImage(const std::string& filename) const
-{
-    cl_int err_code{ CL_SUCCESS };
-    const size_t buffer_size{ output_image_height * output_image_width * sizeof(cl_float) };
-
-    auto pixel_r = static_cast<float*>(clEnqueueMapBuffer(tile_rendering_context.command_queue,
-                                                          tile_rendering_context.rendering_data.d_pixels.pixel_r,
-                                                          CL_MAP_READ,
-                                                          CL_TRUE,
-                                                          0,
-                                                          buffer_size,
-                                                          0,
-                                                          nullptr,
-                                                          nullptr,
-                                                          &err_code));
-    CL_CHECK_STATUS(err_code);
-
-    auto pixel_g = static_cast<float*>(clEnqueueMapBuffer(tile_rendering_context.command_queue,
-                                                          tile_rendering_context.rendering_data.d_pixels.pixel_g,
-                                                          CL_MAP_READ,
-                                                          CL_TRUE,
-                                                          0,
-                                                          buffer_size,
-                                                          0,
-                                                          nullptr,
-                                                          nullptr,
-                                                          &err_code));
-    CL_CHECK_STATUS(err_code);
-
-    auto pixel_b = static_cast<float*>(clEnqueueMapBuffer(tile_rendering_context.command_queue,
-                                                          tile_rendering_context.rendering_data.d_pixels.pixel_b,
-                                                          CL_MAP_READ,
-                                                          CL_TRUE,
-                                                          0,
-                                                          buffer_size,
-                                                          0,
-                                                          nullptr,
-                                                          nullptr,
-                                                          &err_code));
-    CL_CHECK_STATUS(err_code);
-
-    auto filter_weight = static_cast<float*>(clEnqueueMapBuffer(tile_rendering_context.command_queue,
-                                                                tile_rendering_context.rendering_data.d_pixels.filter_weight,
-                                                                CL_MAP_READ,
-                                                                CL_TRUE,
-                                                                0,
-                                                                buffer_size,
-                                                                0,
-                                                                nullptr,
-                                                                nullptr,
-                                                                &err_code));
-    CL_CHECK_STATUS(err_code);
-
-    // Convert data to format for stbi image write
-    std::vector<unsigned char> uchar_raster(3 * output_image_width * output_image_height, 0);
-    for (unsigned int i = 0; i != uchar_raster.size() / 3; i++)
-    {
-        const float inv_filter_weight{ 1.f / filter_weight[i] };
-        uchar_raster[3 * i] = static_cast<unsigned char>(std::pow(std::min(pixel_r[i] * inv_filter_weight, 1.f), 2.2f) * 255);
-        uchar_raster[3 * i + 1] = static_cast<unsigned char>(std::pow(std::min(pixel_g[i] * inv_filter_weight, 1.f), 2.2f) * 255);
-        uchar_raster[3 * i + 2] = static_cast<unsigned char>(std::pow(std::min(pixel_b[i] * inv_filter_weight, 1.f), 2.2f) * 255);
-    }
-
-    // Unmap buffers
-    std::array<cl_event, 4> unmap_events;
-    CL_CHECK_CALL(clEnqueueUnmapMemObject(tile_rendering_context.command_queue,
-                                          tile_rendering_context.rendering_data.d_pixels.pixel_r,
-                                          pixel_r,
-                                          0,
-                                          nullptr,
-                                          &unmap_events[0]));
-    CL_CHECK_CALL(clEnqueueUnmapMemObject(tile_rendering_context.command_queue,
-                                          tile_rendering_context.rendering_data.d_pixels.pixel_g,
-                                          pixel_g,
-                                          0,
-                                          nullptr,
-                                          &unmap_events[1]));
-    CL_CHECK_CALL(clEnqueueUnmapMemObject(tile_rendering_context.command_queue,
-                                          tile_rendering_context.rendering_data.d_pixels.pixel_b,
-                                          pixel_b,
-                                          0,
-                                          nullptr,
-                                          &unmap_events[2]));
-    CL_CHECK_CALL(clEnqueueUnmapMemObject(tile_rendering_context.command_queue,
-                                          tile_rendering_context.rendering_data.d_pixels.filter_weight,
-                                          filter_weight,
-                                          0,
-                                          nullptr,
-                                          &unmap_events[3]));
-
-    // Write image, set flip vertical axis before
-    stbi_flip_vertically_on_write(1);
-    if (!stbi_write_png(filename.c_str(), output_image_width, output_image_height, 3, uchar_raster.data(), 0))
-    {
-        throw std::runtime_error("Error creating PNG image");
-    }
-    stbi_flip_vertically_on_write(0);
-
-    CL_CHECK_CALL(clWaitForEvents(4, unmap_events.data()));
+void RenderingContext::DenoiseRaster(Raster& raster) const
+{
+    Denoiser{}.Denoise(output_image_width, output_image_height, raster.hdr, raster.albedo, raster.normal);
+    if (raster.format != IO::ImageFormat::PNG)
+    {
+        return;
+    }
+
+    for (unsigned int y = 0; y != output_image_height; y++)
+    {
+        // Rows are flipped as in ResolveBand
+        const float* const film_row{ raster.hdr.data() + 3 * (output_image_height - 1 - y) * output_image_width };
+        unsigned char* const image_row{ raster.ldr.data() + 3 * y * output_image_width };
+        for (unsigned int i = 0; i != 3 * output_image_width; i++)
+        {
+            image_row[i] = ToLDR(film_row[i]);
+        }
+    }
+}
+
+void RenderingContext::WriteImage(const std::string& filename, const CropWindow& window,
+                                  unsigned int image_width, unsigned int image_height, const Raster& raster)
+{
+    switch (raster.format)
+    {
+        case IO::ImageFormat::PNG:
+            IO::WritePNG(filename, window.width, window.height, raster.ldr);
+            break;
+        case IO::ImageFormat::PFM:
+            IO::WritePFM(filename, window.width, window.height, raster.hdr);
+            break;
+        case IO::ImageFormat::EXR:
+            IO::WriteEXR(filename, window, image_width, image_height, raster.hdr);
+            break;
+    }
 }
 
 } // CL namespace
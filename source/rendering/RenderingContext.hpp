@@ -6,6 +6,13 @@
 #define RABBIT_RENDERINGCONTEXT_HPP
 
 #include "TileRendering.hpp"
+#include "ImageIO.hpp"
+
+#include <array>
+#include <chrono>
+#include <future>
+#include <memory>
+#include <vector>
 
 namespace Rendering
 {
@@ -16,30 +23,99 @@ namespace CL
 class RenderingContext
 {
 public:
+    // Part of the time budget kept to read back and convert the film, the last 1/RESOLVE_RESERVE_DIVISOR of it
+    static constexpr unsigned int RESOLVE_RESERVE_DIVISOR{ 20 };
+
     // Create a new rendering context with a single device, the scene description and a camera to use
-    RenderingContext(cl_context context, cl_device_id device,
+    // The device keeps the resources that can be reused by later contexts. The launch tuning is looked up in the
+    // device tuning cache if not given
+    RenderingContext(RenderingDevice& device,
                      const SceneDescription& scene_description,
-                     const ::CL::Scene& scene);
+                     const ::CL::Scene& scene,
+                     const RenderingOptions& options,
+                     const LaunchTuning* tuning = nullptr);
+
+    // Render image, the format is selected by the extension of the file name. PFM and EXR images store the
+    // radiance as it is accumulated, without clamping and gamma. The checkpoint, if given, is resumed and updated.
+    // Statistics and the cost heatmap, if collected, are printed and written next to the image
+    void Render(const std::string& filename, RenderCheckpoint* checkpoint = nullptr) const;
 
-    ~RenderingContext() noexcept;
+    // Render image and encode it on a separate thread, the device is free for the next render
+    // once the call returns
+    std::future<void> RenderAsync(const std::string& filename) const;
 
-    // Render image
-    void Render(const std::string& filename) const;
+    // Render full frame passes of the samples per pixel of the scene description until the time budget is spent, then
+    // resolve the film into the image. The cost of a pass is the largest profiled kernel time or wall time of the
+    // passes so far, a pass is only started if it ends before the budget minus the part kept for the resolve. At
+    // least one pass is rendered
+    void RenderForTime(const std::string& filename, std::chrono::milliseconds budget) const;
+
+    // Render only the rows of tiles [first, end) and read back the accumulated values of their pixels, so bands
+    // rendered by different processes can be summed into one film. The range of film rows is returned and the
+    // accumulation holds the red, green, blue and filter weight planes of the rows one after the other
+    void RenderTileRows(unsigned int first_tile_row, unsigned int end_tile_row, unsigned int& first_row,
+                        unsigned int& end_row, std::vector<float>& accumulation) const;
 
 private:
-    // Cleanup OpenCL resource without throwing
-    void Cleanup() noexcept;
+    // Host copy of a band of completed image rows
+    struct FilmBand
+    {
+        // Range of rows in the film
+        unsigned int first_row, end_row;
+        // Accumulated values and filter weight
+        std::vector<float> pixel_r, pixel_g, pixel_b, filter_weight;
+        // Accumulated albedo and normal, only read if the denoiser is enabled
+        std::array<std::vector<float>, 6> auxiliary;
+        // Completion of the copies from the device
+        std::vector<cl_event> read_events;
+    };
+
+    // Image on the host, only the raster of its format is filled. The denoiser needs the radiance and the
+    // auxiliary values of the whole image, the 8 bit raster is converted from them at the end
+    struct Raster
+    {
+        IO::ImageFormat format;
+        // 8 bit RGB with the first row at the top
+        std::vector<unsigned char> ldr;
+        // Float RGB radiance with the first row at the bottom, as in the film
+        std::vector<float> hdr;
+        // Average first hit albedo and normal of the pixels, in the order of the radiance
+        std::vector<float> albedo, normal;
+    };
+
+    // Empty raster of the format, with the buffers needed by the denoiser if it is enabled
+    Raster CreateRaster(IO::ImageFormat format) const;
 
-    // Produce final image
-    void CreateImage(const std::string& filename) const;
+    // Render the image and convert it to the raster of the format, the rows of tiles are read back and converted as
+    // they complete
+    Raster RenderImage(IO::ImageFormat format, RenderCheckpoint* checkpoint = nullptr) const;
 
-    // OpenCL context and associated device
-    cl_context target_context;
-    cl_device_id target_device;
+    // Enqueue the copy of the given film rows on the transfer queue
+    std::unique_ptr<FilmBand> ReadBackRows(unsigned int first_row, unsigned int end_row) const;
 
-    // Size of the image to render
+    // Wait for the copy of the band and convert it into the raster, 8 bit rows are flipped to the image order
+    void ResolveBand(const FilmBand& band, Raster& raster) const;
+
+    // Filter the radiance guided by the albedo and normal, the 8 bit raster is filled from the result
+    void DenoiseRaster(Raster& raster) const;
+
+    // Print the statistics of the last render and write them next to the image, if they were collected
+    void ReportStatistics(const std::string& image_filename, std::chrono::steady_clock::duration render_time) const;
+
+    // Write the cost heatmap of the last render next to the image, if it was collected
+    void WriteCostHeatmap(const std::string& image_filename) const;
+
+    // Encode the raster of the window of the image in its format, only EXR images keep the position of the window
+    static void WriteImage(const std::string& filename, const CropWindow& window, unsigned int image_width,
+                           unsigned int image_height, const Raster& raster);
+
+    // Size of the image to render, the crop window if there is one
     const unsigned int output_image_width, output_image_height;
 
+    // Window of the image covered by the film and size of the whole image
+    const CropWindow film_window;
+    const unsigned int full_image_width, full_image_height;
+
     // TileRendering is responsible for rendering a certain tile of the image
     TileRendering tile_rendering_context;
 };
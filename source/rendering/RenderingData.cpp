@@ -3,332 +3,148 @@
 //
 
 #include "RenderingData.hpp"
-#include "CLError.hpp"
-
-#include <iostream>
+#include "Common.hpp"
 
 namespace Rendering
 {
 namespace CL
 {
 
-// Macro that checks for non-null pointer and releases
-#define RELEASE(buffer)                         \
-if (buffer != nullptr)                          \
-{                                               \
-    CL_CHECK_CALL(clReleaseMemObject(buffer));  \
-}
-
-Rays::Rays(cl_context context, unsigned int num_rays)
-    : num_rays{ num_rays },
-      origin_x{ nullptr }, origin_y{ nullptr }, origin_z{ nullptr },
-      direction_x{ nullptr }, direction_y{ nullptr }, direction_z{ nullptr },
-      depth{ nullptr }
+size_t StreamBufferSize(StorageLayout layout, unsigned int num_fields, unsigned int count) noexcept
 {
-    cl_int err_code{ CL_SUCCESS };
-    const size_t buffer_size{ num_rays * sizeof(cl_float) };
-
-    try
-    {
-        origin_x = clCreateBuffer(context, CL_MEM_READ_WRITE, buffer_size, nullptr, &err_code);
-        CL_CHECK_STATUS(err_code);
-        origin_y = clCreateBuffer(context, CL_MEM_READ_WRITE, buffer_size, nullptr, &err_code);
-        CL_CHECK_STATUS(err_code);
-        origin_z = clCreateBuffer(context, CL_MEM_READ_WRITE, buffer_size, nullptr, &err_code);
-        CL_CHECK_STATUS(err_code);
-
-        direction_x = clCreateBuffer(context, CL_MEM_READ_WRITE, buffer_size, nullptr, &err_code);
-        CL_CHECK_STATUS(err_code);
-        direction_y = clCreateBuffer(context, CL_MEM_READ_WRITE, buffer_size, nullptr, &err_code);
-        CL_CHECK_STATUS(err_code);
-        direction_z = clCreateBuffer(context, CL_MEM_READ_WRITE, buffer_size, nullptr, &err_code);
-        CL_CHECK_STATUS(err_code);
+    // Blocked layouts store full blocks, pad the count to a multiple of the block size
+    const unsigned int padded_count{ RoundUp(count, LayoutBlockSize(layout)) };
 
-        depth = clCreateBuffer(context, CL_MEM_READ_WRITE, num_rays * sizeof(cl_uint), nullptr, &err_code);
-        CL_CHECK_STATUS(err_code);
-    }
-    catch (const std::exception& ex)
-    {
-        // Cleanup what is needed and rethrow exception
-        Cleanup();
-        throw;
-    }
+    return static_cast<size_t>(num_fields) * padded_count * sizeof(cl_float);
 }
 
-Rays::~Rays() noexcept
-{
-    Cleanup();
-}
+Rays::Rays(DeviceArena& arena, unsigned int num_rays, StorageLayout layout)
+    : num_rays{ num_rays },
+      rays{ arena.Allocate(StreamBufferSize(layout, NUM_FIELDS, num_rays)) },
+      depth{ arena.Allocate(num_rays * sizeof(cl_uint)) }
+{}
 
-void Rays::Cleanup() noexcept
+size_t Rays::ArenaSize(const DeviceArena& arena, unsigned int num_rays, StorageLayout layout) noexcept
 {
-    try
-    {
-        RELEASE(origin_x)
-        RELEASE(origin_y)
-        RELEASE(origin_z)
-        RELEASE(direction_x)
-        RELEASE(direction_y)
-        RELEASE(direction_z)
-        RELEASE(depth)
-    }
-    catch (const std::exception& ex)
-    {
-        // FIXME operator<< could throw
-        std::cerr << ex.what() << std::endl;
-    }
+    return arena.AlignedSize(StreamBufferSize(layout, NUM_FIELDS, num_rays)) +
+           arena.AlignedSize(num_rays * sizeof(cl_uint));
 }
 
-Intersections::Intersections(cl_context context, unsigned int num_intersections)
-    : num_intersections(num_intersections),
-      hit_point_x{ nullptr }, hit_point_y{ nullptr }, hit_point_z{ nullptr },
-      normal_x{ nullptr }, normal_y{ nullptr }, normal_z{ nullptr },
-      uv_s{ nullptr }, uv_t{ nullptr },
-      wo_x{ nullptr }, wo_y{ nullptr }, wo_z{ nullptr },
-      primitive_index{ nullptr }
-{
-    cl_int err_code{ CL_SUCCESS };
-    const size_t buffer_size{ num_intersections * sizeof(cl_float) };
-
-    try
-    {
-        hit_point_x = clCreateBuffer(context, CL_MEM_READ_WRITE, buffer_size, nullptr, &err_code);
-        CL_CHECK_STATUS(err_code);
-        hit_point_y = clCreateBuffer(context, CL_MEM_READ_WRITE, buffer_size, nullptr, &err_code);
-        CL_CHECK_STATUS(err_code);
-        hit_point_z = clCreateBuffer(context, CL_MEM_READ_WRITE, buffer_size, nullptr, &err_code);
-        CL_CHECK_STATUS(err_code);
-
-        normal_x = clCreateBuffer(context, CL_MEM_READ_WRITE, buffer_size, nullptr, &err_code);
-        CL_CHECK_STATUS(err_code);
-        normal_y = clCreateBuffer(context, CL_MEM_READ_WRITE, buffer_size, nullptr, &err_code);
-        CL_CHECK_STATUS(err_code);
-        normal_z = clCreateBuffer(context, CL_MEM_READ_WRITE, buffer_size, nullptr, &err_code);
-        CL_CHECK_STATUS(err_code);
-
-        uv_s = clCreateBuffer(context, CL_MEM_READ_WRITE, buffer_size, nullptr, &err_code);
-        CL_CHECK_STATUS(err_code);
-        uv_t = clCreateBuffer(context, CL_MEM_READ_WRITE, buffer_size, nullptr, &err_code);
-        CL_CHECK_STATUS(err_code);
-
-        wo_x = clCreateBuffer(context, CL_MEM_READ_WRITE, buffer_size, nullptr, &err_code);
-        CL_CHECK_STATUS(err_code);
-        wo_y = clCreateBuffer(context, CL_MEM_READ_WRITE, buffer_size, nullptr, &err_code);
-        CL_CHECK_STATUS(err_code);
-        wo_z = clCreateBuffer(context, CL_MEM_READ_WRITE, buffer_size, nullptr, &err_code);
-        CL_CHECK_STATUS(err_code);
-
-        primitive_index = clCreateBuffer(context, CL_MEM_READ_WRITE, num_intersections * sizeof(cl_uint), nullptr,
-                                         &err_code);
-        CL_CHECK_STATUS(err_code);
-    }
-    catch (const std::exception& ex)
-    {
-        // Cleanup what is needed and rethrow exception
-        Cleanup();
-        throw;
-    }
-}
+Intersections::Intersections(DeviceArena& arena, unsigned int num_intersections, StorageLayout layout, bool compact)
+    : num_intersections(num_intersections), compact{ compact },
+      intersections{ arena.Allocate(StreamBufferSize(layout, compact ? NUM_COMPACT_FIELDS : NUM_FIELDS,
+                                                     num_intersections)) },
+      primitive_index{ arena.Allocate(num_intersections * sizeof(cl_uint)) }
+{}
 
-Intersections::~Intersections() noexcept
+size_t Intersections::ArenaSize(const DeviceArena& arena, unsigned int num_intersections, StorageLayout layout,
+                                bool compact) noexcept
 {
-    Cleanup();
+    return arena.AlignedSize(StreamBufferSize(layout, compact ? NUM_COMPACT_FIELDS : NUM_FIELDS,
+                                              num_intersections)) +
+           arena.AlignedSize(num_intersections * sizeof(cl_uint));
 }
 
-void Intersections::Cleanup() noexcept
-{
-    try
-    {
-        RELEASE(hit_point_x)
-        RELEASE(hit_point_y)
-        RELEASE(hit_point_z)
-        RELEASE(normal_x)
-        RELEASE(normal_y)
-        RELEASE(normal_z)
-        RELEASE(uv_s)
-        RELEASE(uv_t)
-        RELEASE(wo_x)
-        RELEASE(wo_y)
-        RELEASE(wo_z)
-        RELEASE(primitive_index)
-    }
-    catch (const std::exception& ex)
-    {
-        // TODO operator<< could throw
-        std::cerr << ex.what() << std::endl;
-    }
-}
+Samples::Samples(DeviceArena& arena, unsigned int num_samples, unsigned int num_tile_rows, StorageLayout layout)
+    : num_samples{ num_samples }, num_tile_rows{ num_tile_rows },
+      samples{ arena.Allocate(StreamBufferSize(layout, NUM_FIELDS, num_samples)) },
+      samples_done{ arena.Allocate(sizeof(cl_uint)) },
+      tile_rows_done{ arena.Allocate(num_tile_rows * sizeof(cl_uint)) }
+{}
 
-Samples::Samples(cl_context context, unsigned int num_samples)
-    : num_samples{ num_samples },
-      Li_r{ nullptr }, Li_g{ nullptr }, Li_b{ nullptr },
-      beta_r{ nullptr }, beta_g{ nullptr }, beta_b{ nullptr },
-      pixel_x{ nullptr }, pixel_y{ nullptr },
-      sample_offset_x{ nullptr }, sample_offset_y{ nullptr }
+size_t Samples::ArenaSize(const DeviceArena& arena, unsigned int num_samples, unsigned int num_tile_rows,
+                          StorageLayout layout) noexcept
 {
-    cl_int err_code{ CL_SUCCESS };
-    const size_t buffer_size{ num_samples * sizeof(cl_float) };
-
-    try
-    {
-        Li_r = clCreateBuffer(context, CL_MEM_READ_WRITE, buffer_size, nullptr, &err_code);
-        CL_CHECK_STATUS(err_code);
-        Li_g = clCreateBuffer(context, CL_MEM_READ_WRITE, buffer_size, nullptr, &err_code);
-        CL_CHECK_STATUS(err_code);
-        Li_b = clCreateBuffer(context, CL_MEM_READ_WRITE, buffer_size, nullptr, &err_code);
-        CL_CHECK_STATUS(err_code);
-
-        beta_r = clCreateBuffer(context, CL_MEM_READ_WRITE, buffer_size, nullptr, &err_code);
-        CL_CHECK_STATUS(err_code);
-        beta_g = clCreateBuffer(context, CL_MEM_READ_WRITE, buffer_size, nullptr, &err_code);
-        CL_CHECK_STATUS(err_code);
-        beta_b = clCreateBuffer(context, CL_MEM_READ_WRITE, buffer_size, nullptr, &err_code);
-        CL_CHECK_STATUS(err_code);
-
-        pixel_x = clCreateBuffer(context, CL_MEM_READ_WRITE, num_samples * sizeof(cl_uint), nullptr, &err_code);
-        CL_CHECK_STATUS(err_code);
-        pixel_y = clCreateBuffer(context, CL_MEM_READ_WRITE, num_samples * sizeof(cl_uint), nullptr, &err_code);
-        CL_CHECK_STATUS(err_code);
-
-        sample_offset_x = clCreateBuffer(context, CL_MEM_READ_WRITE, buffer_size, nullptr, &err_code);
-        CL_CHECK_STATUS(err_code);
-        sample_offset_y = clCreateBuffer(context, CL_MEM_READ_WRITE, buffer_size, nullptr, &err_code);
-        CL_CHECK_STATUS(err_code);
-
-        cl_uint samples_done_init{ 0 };
-        samples_done = clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
-                                      sizeof(cl_uint), &samples_done_init, &err_code);
-        CL_CHECK_STATUS(err_code);
-    }
-    catch (const std::exception& ex)
-    {
-        // Cleanup what is needed and rethrow exception
-        Cleanup();
-        throw;
-    }
+    return arena.AlignedSize(StreamBufferSize(layout, NUM_FIELDS, num_samples)) +
+           arena.AlignedSize(sizeof(cl_uint)) +
+           arena.AlignedSize(num_tile_rows * sizeof(cl_uint));
 }
 
-Samples::~Samples() noexcept
-{
-    Cleanup();
-}
+Pixels::Pixels(DeviceArena& arena, unsigned int num_pixels)
+    : num_pixels(num_pixels),
+      pixel_r{ arena.Allocate(num_pixels * sizeof(cl_float)) },
+      pixel_g{ arena.Allocate(num_pixels * sizeof(cl_float)) },
+      pixel_b{ arena.Allocate(num_pixels * sizeof(cl_float)) },
+      filter_weight{ arena.Allocate(num_pixels * sizeof(cl_float)) }
+{}
 
-void Samples::Cleanup() noexcept
+size_t Pixels::ArenaSize(const DeviceArena& arena, unsigned int num_pixels) noexcept
 {
-    try
-    {
-        RELEASE(Li_r)
-        RELEASE(Li_g)
-        RELEASE(Li_b)
-        RELEASE(beta_r)
-        RELEASE(beta_g)
-        RELEASE(beta_b)
-        RELEASE(pixel_x)
-        RELEASE(pixel_y)
-        RELEASE(sample_offset_x)
-        RELEASE(sample_offset_y)
-        RELEASE(samples_done)
-    }
-    catch (const std::exception& ex)
-    {
-        // TODO operator<< could throw
-        std::cerr << ex.what() << std::endl;
-    }
+    return 4 * arena.AlignedSize(num_pixels * sizeof(cl_float));
 }
 
-Pixels::Pixels(cl_context context, unsigned int num_pixels)
+AuxiliaryPixels::AuxiliaryPixels(DeviceArena& arena, unsigned int num_pixels)
     : num_pixels(num_pixels),
-      pixel_r{ nullptr }, pixel_g{ nullptr }, pixel_b{ nullptr },
-      filter_weight{ nullptr }
-{
-    cl_int err_code{ CL_SUCCESS };
-    const size_t buffer_size{ num_pixels * sizeof(cl_float) };
-
-    try
-    {
-        pixel_r = clCreateBuffer(context, CL_MEM_READ_WRITE, buffer_size, nullptr, &err_code);
-        CL_CHECK_STATUS(err_code);
-        pixel_g = clCreateBuffer(context, CL_MEM_READ_WRITE, buffer_size, nullptr, &err_code);
-        CL_CHECK_STATUS(err_code);
-        pixel_b = clCreateBuffer(context, CL_MEM_READ_WRITE, buffer_size, nullptr, &err_code);
-        CL_CHECK_STATUS(err_code);
+      albedo_r{ num_pixels != 0 ? arena.Allocate(num_pixels * sizeof(cl_float)) : nullptr },
+      albedo_g{ num_pixels != 0 ? arena.Allocate(num_pixels * sizeof(cl_float)) : nullptr },
+      albedo_b{ num_pixels != 0 ? arena.Allocate(num_pixels * sizeof(cl_float)) : nullptr },
+      normal_x{ num_pixels != 0 ? arena.Allocate(num_pixels * sizeof(cl_float)) : nullptr },
+      normal_y{ num_pixels != 0 ? arena.Allocate(num_pixels * sizeof(cl_float)) : nullptr },
+      normal_z{ num_pixels != 0 ? arena.Allocate(num_pixels * sizeof(cl_float)) : nullptr }
+{}
 
-        filter_weight = clCreateBuffer(context, CL_MEM_READ_WRITE, buffer_size, nullptr, &err_code);
-        CL_CHECK_STATUS(err_code);
-    }
-    catch (const std::exception& ex)
-    {
-        // Cleanup what is needed and rethrow exception
-        Cleanup();
-        throw;
-    }
+size_t AuxiliaryPixels::ArenaSize(const DeviceArena& arena, unsigned int num_pixels) noexcept
+{
+    return num_pixels != 0 ? 6 * arena.AlignedSize(num_pixels * sizeof(cl_float)) : 0;
 }
 
-Pixels::~Pixels() noexcept
+CostPixels::CostPixels(DeviceArena& arena, unsigned int num_pixels)
+    : num_pixels(num_pixels),
+      rays{ num_pixels != 0 ? arena.Allocate(num_pixels * sizeof(cl_uint)) : nullptr },
+      tests{ num_pixels != 0 ? arena.Allocate(num_pixels * sizeof(cl_uint)) : nullptr }
+{}
+
+size_t CostPixels::ArenaSize(const DeviceArena& arena, unsigned int num_pixels) noexcept
 {
-    Cleanup();
+    return num_pixels != 0 ? 2 * arena.AlignedSize(num_pixels * sizeof(cl_uint)) : 0;
 }
 
-void Pixels::Cleanup() noexcept
+StatisticsCounters::StatisticsCounters(DeviceArena& arena, bool enabled)
+    : counters{ enabled ? arena.Allocate(2 * NUM_COUNTERS * sizeof(cl_uint)) : nullptr }
+{}
+
+size_t StatisticsCounters::ArenaSize(const DeviceArena& arena, bool enabled) noexcept
 {
-    try
-    {
-        RELEASE(pixel_r)
-        RELEASE(pixel_g)
-        RELEASE(pixel_b)
-        RELEASE(filter_weight)
-    }
-    catch (const std::exception& ex)
-    {
-        // TODO operator<< could throw
-        std::cerr << ex.what() << std::endl;
-    }
+    return enabled ? arena.AlignedSize(2 * NUM_COUNTERS * sizeof(cl_uint)) : 0;
 }
 
-XOrShift::XOrShift(cl_context context, unsigned int num_generators)
+XOrShift::XOrShift(DeviceArena& arena, unsigned int num_generators)
     : num_generators{ num_generators },
-      state{ nullptr }
-{
-    cl_int err_code{ CL_SUCCESS };
-
-    try
-    {
-        state = clCreateBuffer(context, CL_MEM_READ_WRITE, num_generators * sizeof(cl_uint), nullptr, &err_code);
-        CL_CHECK_STATUS(err_code);
-    }
-    catch (const std::exception& ex)
-    {
-        // Cleanup what is needed and rethrow exception
-        Cleanup();
-        throw;
-    }
-}
+      state{ arena.Allocate(num_generators * sizeof(cl_uint)) }
+{}
 
-XOrShift::~XOrShift() noexcept
+size_t XOrShift::ArenaSize(const DeviceArena& arena, unsigned int num_generators) noexcept
 {
-    Cleanup();
+    return arena.AlignedSize(num_generators * sizeof(cl_uint));
 }
 
-void XOrShift::Cleanup() noexcept
+RenderingData::RenderingData(DeviceArena& arena, unsigned int total_film_pixels, unsigned int total_tile_samples,
+                             unsigned int num_tile_rows, const RenderingOptions& options)
+    : arena_scope{ arena, ArenaSize(arena, total_film_pixels, total_tile_samples, num_tile_rows, options) },
+      d_rays{ arena, total_tile_samples, options.storage_layout },
+      d_intersections{ arena, total_tile_samples, options.storage_layout, options.compact_intersections },
+      d_samples{ arena, total_tile_samples, num_tile_rows, options.storage_layout },
+      d_pixels{ arena, total_film_pixels },
+      d_auxiliary{ arena, options.denoise ? total_film_pixels : 0 },
+      d_xorshift_state{ arena, total_tile_samples },
+      d_statistics{ arena, options.collect_stats },
+      d_cost{ arena, options.cost_heatmap ? total_film_pixels : 0 }
+{}
+
+size_t RenderingData::ArenaSize(const DeviceArena& arena, unsigned int total_film_pixels,
+                                unsigned int total_tile_samples, unsigned int num_tile_rows,
+                                const RenderingOptions& options) noexcept
 {
-    try
-    {
-        RELEASE(state)
-    }
-    catch (const std::exception& ex)
-    {
-        // TODO operator<< could throw
-        std::cerr << ex.what() << std::endl;
-    }
+    return Rays::ArenaSize(arena, total_tile_samples, options.storage_layout) +
+           Intersections::ArenaSize(arena, total_tile_samples, options.storage_layout,
+                                    options.compact_intersections) +
+           Samples::ArenaSize(arena, total_tile_samples, num_tile_rows, options.storage_layout) +
+           Pixels::ArenaSize(arena, total_film_pixels) +
+           AuxiliaryPixels::ArenaSize(arena, options.denoise ? total_film_pixels : 0) +
+           XOrShift::ArenaSize(arena, total_tile_samples) +
+           StatisticsCounters::ArenaSize(arena, options.collect_stats) +
+           CostPixels::ArenaSize(arena, options.cost_heatmap ? total_film_pixels : 0);
 }
 
-RenderingData::RenderingData(cl_context context, unsigned int total_film_pixels, unsigned int total_tile_samples)
-    : d_rays{ context, total_tile_samples },
-      d_intersections{ context, total_tile_samples },
-      d_samples{ context, total_tile_samples },
-      d_pixels{ context, total_film_pixels },
-      d_xorshift_state{ context, total_tile_samples }
-{}
-
 } // CL namespace
 } // Rendering namespace
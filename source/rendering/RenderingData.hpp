@@ -13,119 +13,103 @@
 #include <CL/cl.h>
 #endif
 
+#include "RenderingOptions.hpp"
+#include "DeviceArena.hpp"
+
 namespace Rendering
 {
 namespace CL
 {
 
+// The rays, intersections and samples are stored as streams, a single buffer of 32 bit elements for each sample
+// field laid out as selected by the StorageLayout. The number of fields must match the ones in the kernel
+size_t StreamBufferSize(StorageLayout layout, unsigned int num_fields, unsigned int count) noexcept;
+
+// All the buffers below are sub-buffers carved from a DeviceArena, which is responsible for releasing them
+
 // Storage class for the Rays data
 class Rays
 {
 public:
-    Rays(cl_context context, unsigned int num_rays);
+    Rays(DeviceArena& arena, unsigned int num_rays, StorageLayout layout);
 
-    ~Rays() noexcept;
+    // Size required in the arena
+    static size_t ArenaSize(const DeviceArena& arena, unsigned int num_rays, StorageLayout layout) noexcept;
 
-    const unsigned int num_rays;
+    // Origin and direction
+    static constexpr unsigned int NUM_FIELDS{ 6 };
 
-    // Origin
-    cl_mem origin_x;
-    cl_mem origin_y;
-    cl_mem origin_z;
+    const unsigned int num_rays;
 
-    // Direction
-    cl_mem direction_x;
-    cl_mem direction_y;
-    cl_mem direction_z;
+    // Stream with origin and direction
+    cl_mem rays;
 
     // Current depth of the ray (cl_uint)
     cl_mem depth;
-
-private:
-    // Cleanup all buffers without throwing
-    void Cleanup() noexcept;
 };
 
 // Storage class for the intersection information
 class Intersections
 {
 public:
-    Intersections(cl_context context, unsigned int num_intersections);
+    Intersections(DeviceArena& arena, unsigned int num_intersections, StorageLayout layout, bool compact);
 
-    ~Intersections() noexcept;
+    // Size required in the arena
+    static size_t ArenaSize(const DeviceArena& arena, unsigned int num_intersections, StorageLayout layout,
+                            bool compact) noexcept;
 
-    const unsigned int num_intersections;
-
-    // Hit point
-    cl_mem hit_point_x;
-    cl_mem hit_point_y;
-    cl_mem hit_point_z;
+    // Hit point, normal, uv and wo
+    static constexpr unsigned int NUM_FIELDS{ 11 };
+    // Hit point, normal and uv stored as two packed half values, wo is not stored
+    static constexpr unsigned int NUM_COMPACT_FIELDS{ 5 };
 
-    // Normal
-    cl_mem normal_x;
-    cl_mem normal_y;
-    cl_mem normal_z;
+    const unsigned int num_intersections;
 
-    // UV coordinates
-    cl_mem uv_s;
-    cl_mem uv_t;
+    // Compact storage flag
+    const bool compact;
 
-    // Outgoing light direction at intersection
-    cl_mem wo_x;
-    cl_mem wo_y;
-    cl_mem wo_z;
+    // Stream with the intersections
+    cl_mem intersections;
 
     // Index of the intersected primitive (cl_uint)
     cl_mem primitive_index;
-
-private:
-    // Cleanup all buffers without throwing
-    void Cleanup() noexcept;
 };
 
 // Samples taken in the image plane
 class Samples
 {
 public:
-    Samples(cl_context context, unsigned int num_samples);
-
-    ~Samples() noexcept;
-
-    const unsigned int num_samples;
+    Samples(DeviceArena& arena, unsigned int num_samples, unsigned int num_tile_rows, StorageLayout layout);
 
-    // Incoming radiance
-    cl_mem Li_r;
-    cl_mem Li_g;
-    cl_mem Li_b;
+    // Size required in the arena
+    static size_t ArenaSize(const DeviceArena& arena, unsigned int num_samples, unsigned int num_tile_rows,
+                            StorageLayout layout) noexcept;
 
-    // Accumulation mask for current path
-    cl_mem beta_r;
-    cl_mem beta_g;
-    cl_mem beta_b;
+    // Incoming radiance, accumulation mask, pixel coordinates (cl_uint) and offset in the pixel
+    static constexpr unsigned int NUM_FIELDS{ 10 };
 
-    // Sample pixel coordinates
-    cl_mem pixel_x;
-    cl_mem pixel_y;
+    const unsigned int num_samples;
+    const unsigned int num_tile_rows;
 
-    // Sample offset in the pixel
-    cl_mem sample_offset_x;
-    cl_mem sample_offset_y;
+    // Stream with the samples
+    cl_mem samples;
 
     // Number of samples done, single cl_uint
     cl_mem samples_done;
 
-private:
-    // Cleanup all buffers without throwing
-    void Cleanup() noexcept;
+    // Number of samples that left each row of tiles, one cl_uint per row
+    // A row of the image is final once all the samples left it
+    cl_mem tile_rows_done;
 };
 
 // Film pixels
 class Pixels
 {
 public:
-    Pixels(cl_context context, unsigned int num_pixels);
+    Pixels(DeviceArena& arena, unsigned int num_pixels);
 
-    ~Pixels() noexcept;
+    // Size required in the arena
+    static size_t ArenaSize(const DeviceArena& arena, unsigned int num_pixels) noexcept;
 
     const unsigned int num_pixels;
 
@@ -136,33 +120,98 @@ public:
 
     // Total filter value
     cl_mem filter_weight;
+};
 
-private:
-    // Cleanup all buffers without throwing
-    void Cleanup() noexcept;
+// First hit features of the pixels that guide the denoiser, accumulated like the pixel values. Without
+// pixels nothing is allocated and the buffers are null
+class AuxiliaryPixels
+{
+public:
+    AuxiliaryPixels(DeviceArena& arena, unsigned int num_pixels);
+
+    // Size required in the arena
+    static size_t ArenaSize(const DeviceArena& arena, unsigned int num_pixels) noexcept;
+
+    const unsigned int num_pixels;
+
+    // Accumulated albedo
+    cl_mem albedo_r;
+    cl_mem albedo_g;
+    cl_mem albedo_b;
+
+    // Accumulated shading normal
+    cl_mem normal_x;
+    cl_mem normal_y;
+    cl_mem normal_z;
+};
+
+// Rays traced and intersection tests done for each pixel, summed by the Intersect kernel built with COST_HEATMAP.
+// Without pixels nothing is allocated and the buffers are null
+class CostPixels
+{
+public:
+    CostPixels(DeviceArena& arena, unsigned int num_pixels);
+
+    // Size required in the arena
+    static size_t ArenaSize(const DeviceArena& arena, unsigned int num_pixels) noexcept;
+
+    const unsigned int num_pixels;
+
+    // Rays traced for the samples of the pixel
+    cl_mem rays;
+    // Primitives tested and acceleration structure nodes visited by those rays
+    cl_mem tests;
+};
+
+// Counters of the wavefront statistics, summed by the kernels built with ENABLE_STATS. If they are not collected
+// nothing is allocated and the buffer is null
+class StatisticsCounters
+{
+public:
+    StatisticsCounters(DeviceArena& arena, bool enabled);
+
+    // Size required in the arena
+    static size_t ArenaSize(const DeviceArena& arena, bool enabled) noexcept;
+
+    // Rays and hits at each depth, four termination reasons and two lane counts, must match the kernel
+    static constexpr unsigned int MAX_DEPTH{ 5 };
+    static constexpr unsigned int NUM_COUNTERS{ 2 * MAX_DEPTH + 6 };
+
+    // 64 bit counters stored as low and high cl_uint words
+    cl_mem counters;
 };
 
 // XOrShift status, it's a very simple generator but good enough for testing and also has 32bit status
 class XOrShift
 {
 public:
-    XOrShift(cl_context context, unsigned int num_generators);
+    XOrShift(DeviceArena& arena, unsigned int num_generators);
 
-    ~XOrShift() noexcept;
+    // Size required in the arena
+    static size_t ArenaSize(const DeviceArena& arena, unsigned int num_generators) noexcept;
 
     const unsigned int num_generators;
 
     // Status of the generator
     cl_mem state;
-
-private:
-    // Cleanup all buffers without throwing
-    void Cleanup() noexcept;
 };
 
 // Rendering data storage
 struct RenderingData
 {
+    RenderingData(DeviceArena& arena, unsigned int total_film_pixels, unsigned int total_tile_samples,
+                  unsigned int num_tile_rows, const RenderingOptions& options);
+
+    // Size required in the arena for the rendering data
+    static size_t ArenaSize(const DeviceArena& arena, unsigned int total_film_pixels,
+                            unsigned int total_tile_samples, unsigned int num_tile_rows,
+                            const RenderingOptions& options) noexcept;
+
+private:
+    // Reserves the arena for the buffers below and releases them on destruction, must be the first member
+    DeviceArenaScope arena_scope;
+
+public:
     // Device rays, one for each sample for each pixel
     Rays d_rays;
     // Intersection information
@@ -171,10 +220,14 @@ struct RenderingData
     Samples d_samples;
     // Accumulated value and filter weight for each pixel in the tile
     Pixels d_pixels;
+    // Accumulated albedo and normal for each pixel if denoising
+    AuxiliaryPixels d_auxiliary;
     // XOrShift state for random number generation
     XOrShift d_xorshift_state;
-
-    RenderingData(cl_context context, unsigned int total_film_pixels, unsigned int total_tile_samples);
+    // Ray and path statistics if collected
+    StatisticsCounters d_statistics;
+    // Rays and intersection tests for each pixel if the cost heatmap is written
+    CostPixels d_cost;
 };
 
 } // CL namespace
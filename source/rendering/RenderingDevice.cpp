@@ -0,0 +1,64 @@
+//
+// Created by Simon on 2019-03-25.
+//
+
+#include "RenderingDevice.hpp"
+#include "CLError.hpp"
+
+#include <iostream>
+
+namespace Rendering
+{
+namespace CL
+{
+
+RenderingDevice::RenderingDevice(cl_context context, cl_device_id device, const std::string& kernel_filename,
+                                 const std::string& tuning_cache_filename, const std::string& binary_cache_directory)
+    : target_context{ context }, target_device{ device }, upload_queue{ nullptr },
+      arena{ context, device }, program_cache{ context, device, kernel_filename, binary_cache_directory },
+      tuning_cache{ tuning_cache_filename }
+{
+    cl_int err_code{ CL_SUCCESS };
+
+    try
+    {
+        // Increase reference count on context and device
+        CL_CHECK_CALL(clRetainContext(target_context));
+        CL_CHECK_CALL(clRetainDevice(target_device));
+
+        upload_queue = clCreateCommandQueue(target_context, target_device, 0, &err_code);
+        CL_CHECK_STATUS(err_code);
+    }
+    catch (const std::exception& ex)
+    {
+        // Cleanup what is needed and rethrow exception
+        Cleanup();
+        throw;
+    }
+}
+
+RenderingDevice::~RenderingDevice() noexcept
+{
+    Cleanup();
+}
+
+void RenderingDevice::Cleanup() noexcept
+{
+    try
+    {
+        if (upload_queue != nullptr)
+        {
+            CL_CHECK_CALL(clReleaseCommandQueue(upload_queue));
+        }
+        CL_CHECK_CALL(clReleaseDevice(target_device));
+        CL_CHECK_CALL(clReleaseContext(target_context));
+    }
+    catch (const std::exception& ex)
+    {
+        // TODO operator<< could throw
+        std::cerr << ex.what() << std::endl;
+    }
+}
+
+} // CL namespace
+} // Rendering namespace
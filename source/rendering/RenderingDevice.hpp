@@ -0,0 +1,85 @@
+//
+// Created by Simon on 2019-03-25.
+//
+
+#ifndef RABBIT_RENDERINGDEVICE_HPP
+#define RABBIT_RENDERINGDEVICE_HPP
+
+#include "DeviceArena.hpp"
+#include "ProgramCache.hpp"
+#include "LaunchTuning.hpp"
+
+namespace Rendering
+{
+namespace CL
+{
+
+// Resources of a device that are kept between renders: the memory arena for the rendering buffers,
+// the built programs, the launch tuning and a queue used to upload data to the device
+class RenderingDevice
+{
+public:
+    RenderingDevice(cl_context context, cl_device_id device, const std::string& kernel_filename,
+                    const std::string& tuning_cache_filename, const std::string& binary_cache_directory = "");
+
+    ~RenderingDevice() noexcept;
+
+    RenderingDevice(const RenderingDevice&) = delete;
+
+    RenderingDevice& operator=(const RenderingDevice&) = delete;
+
+    cl_context Context() const noexcept
+    {
+        return target_context;
+    }
+
+    cl_device_id Device() const noexcept
+    {
+        return target_device;
+    }
+
+    cl_command_queue UploadQueue() const noexcept
+    {
+        return upload_queue;
+    }
+
+    DeviceArena& Arena() noexcept
+    {
+        return arena;
+    }
+
+    ProgramCache& Programs() noexcept
+    {
+        return program_cache;
+    }
+
+    TuningCache& Tuning() noexcept
+    {
+        return tuning_cache;
+    }
+
+private:
+    // Cleanup OpenCL resource without throwing
+    void Cleanup() noexcept;
+
+    // OpenCL context and associated device
+    cl_context target_context;
+    cl_device_id target_device;
+
+    // Queue for the uploads of scene data
+    cl_command_queue upload_queue;
+
+    // Memory for the rendering buffers
+    DeviceArena arena;
+
+    // Programs built for the device
+    ProgramCache program_cache;
+
+    // Best launch parameters found by the autotuner
+    TuningCache tuning_cache;
+};
+
+} // CL namespace
+} // Rendering namespace
+
+#endif //RABBIT_RENDERINGDEVICE_HPP
@@ -4,40 +4,35 @@
 
 #include "RenderingKernels.hpp"
 #include "CLError.hpp"
-#include "FileIO.hpp"
 #include "Common.hpp"
 
+#include <algorithm>
 #include <iostream>
-#include <memory>
 
 namespace Rendering
 {
 namespace CL
 {
 
-RenderingKernels::RenderingKernels(cl_context context, cl_device_id device, const std::string& kernel_filename,
+RenderingKernels::RenderingKernels(cl_program kernel_program, cl_device_id device,
                                    const RenderingData& rendering_data,
-                                   const TileDescription& tile_description, const ::CL::Scene& scene)
-    : initialise_kernel{ nullptr }, restart_sample_kernel{ nullptr }, intersect_kernel{ nullptr },
+                                   const TileDescription& tile_description, const ::CL::Scene& scene,
+                                   const LaunchTuning& launch_tuning, unsigned int num_lanes)
+    : num_lanes{ num_lanes }, initialise_stream_arg{ 0 }, restart_tile_rows_arg{ 0 },
+      initialise_kernel{ nullptr }, restart_sample_kernel{ nullptr }, intersect_kernel{ nullptr },
       sample_brdf_kernel{ nullptr }, update_radiance_kernel{ nullptr }, deposit_samples_kernel{ nullptr },
       final_image_kernel{ nullptr }
 {
     try
     {
-        // Build kernel
-        cl_program kernel_program{ BuildProgram(context, device, kernel_filename) };
-
         // Get kernels from program
         SetupKernels(kernel_program);
 
-        // Release program
-        CL_CHECK_CALL(clReleaseProgram(kernel_program));
-
         // Set arguments from the given rendering data
         SetKernelArgs(rendering_data, tile_description, scene);
 
         // Compute the sizes for launching the kernels
-        SetupLaunchConfig(tile_description, device);
+        SetupLaunchConfig(tile_description, device, launch_tuning);
     }
     catch (const std::exception& ex)
     {
@@ -52,121 +47,86 @@ RenderingKernels::~RenderingKernels() noexcept
     Cleanup();
 }
 
+void RenderingKernels::SetTileRows(unsigned int first_tile_row, unsigned int end_tile_row,
+                                   unsigned int generator_stream) const
+{
+    const cl_uint first{ first_tile_row };
+    const cl_uint end{ end_tile_row };
+    const cl_uint stream{ generator_stream };
+    CL_CHECK_CALL(clSetKernelArg(initialise_kernel, initialise_stream_arg, sizeof(cl_uint), &stream));
+    CL_CHECK_CALL(clSetKernelArg(restart_sample_kernel, restart_tile_rows_arg, sizeof(cl_uint), &first));
+    CL_CHECK_CALL(clSetKernelArg(restart_sample_kernel, restart_tile_rows_arg + 1, sizeof(cl_uint), &end));
+}
+
 void RenderingKernels::RunInitialise(cl_command_queue queue, cl_uint num_wait_events, const cl_event* wait_events,
-                                     cl_event* kernel_event) const
+                                     cl_event* kernel_event, unsigned int lane) const
 {
-    CL_CHECK_CALL(clEnqueueNDRangeKernel(queue,
-                                         initialise_kernel,
-                                         1,
-                                         &initialise_launch_config.offset,
-                                         &initialise_launch_config.global_size,
-                                         &initialise_launch_config.local_size,
-                                         num_wait_events,
-                                         wait_events,
-                                         kernel_event));
+    EnqueueKernel(queue, initialise_kernel, initialise_launch_config, lane,
+                  num_wait_events, wait_events, kernel_event);
 }
 
 void RenderingKernels::RunRestart(cl_command_queue queue, cl_uint num_wait_events, const cl_event* wait_events,
-                                  cl_event* kernel_event) const
+                                  cl_event* kernel_event, unsigned int lane) const
 {
-    CL_CHECK_CALL(clEnqueueNDRangeKernel(queue,
-                                         restart_sample_kernel,
-                                         1,
-                                         &restart_launch_config.offset,
-                                         &restart_launch_config.global_size,
-                                         &restart_launch_config.local_size,
-                                         num_wait_events,
-                                         wait_events,
-                                         kernel_event));
+    EnqueueKernel(queue, restart_sample_kernel, restart_launch_config, lane,
+                  num_wait_events, wait_events, kernel_event);
 }
 
 void RenderingKernels::RunIntersect(cl_command_queue queue, cl_uint num_wait_events, const cl_event* wait_events,
-                                    cl_event* kernel_event) const
+                                    cl_event* kernel_event, unsigned int lane) const
 {
-    CL_CHECK_CALL(clEnqueueNDRangeKernel(queue,
-                                         intersect_kernel,
-                                         1,
-                                         &intersect_launch_config.offset,
-                                         &intersect_launch_config.global_size,
-                                         &intersect_launch_config.local_size,
-                                         num_wait_events,
-                                         wait_events,
-                                         kernel_event));
+    EnqueueKernel(queue, intersect_kernel, intersect_launch_config, lane,
+                  num_wait_events, wait_events, kernel_event);
 }
 
-void RenderingKernels::RunSampleBRDF(cl_command_queue queue, cl_uint num_wait_events, cl_event const* wait_events,
-                                     cl_event* kernel_event) const
+void RenderingKernels::RunSampleBRDF(cl_command_queue queue, cl_uint num_wait_events, const cl_event* wait_events,
+                                     cl_event* kernel_event, unsigned int lane) const
 {
-    CL_CHECK_CALL(clEnqueueNDRangeKernel(queue,
-                                         sample_brdf_kernel,
-                                         1,
-                                         &sample_brdf_launch_config.offset,
-                                         &sample_brdf_launch_config.global_size,
-                                         &sample_brdf_launch_config.local_size,
-                                         num_wait_events,
-                                         wait_events,
-                                         kernel_event));
+    EnqueueKernel(queue, sample_brdf_kernel, sample_brdf_launch_config, lane,
+                  num_wait_events, wait_events, kernel_event);
 }
 
-void RenderingKernels::RunUpdateRadiance(cl_command_queue queue, cl_uint num_wait_events, cl_event const* wait_events,
-                                         cl_event* kernel_event) const
+void RenderingKernels::RunUpdateRadiance(cl_command_queue queue, cl_uint num_wait_events, const cl_event* wait_events,
+                                         cl_event* kernel_event, unsigned int lane) const
 {
-    CL_CHECK_CALL(clEnqueueNDRangeKernel(queue,
-                                         update_radiance_kernel,
-                                         1,
-                                         &update_radiance_launch_config.offset,
-                                         &update_radiance_launch_config.global_size,
-                                         &update_radiance_launch_config.local_size,
-                                         num_wait_events,
-                                         wait_events,
-                                         kernel_event));
+    EnqueueKernel(queue, update_radiance_kernel, update_radiance_launch_config, lane,
+                  num_wait_events, wait_events, kernel_event);
 }
 
-void RenderingKernels::RunDepositSamples(cl_command_queue queue, cl_uint num_wait_events, cl_event const* wait_events,
-                                         cl_event* kernel_event) const
+void RenderingKernels::RunDepositSamples(cl_command_queue queue, cl_uint num_wait_events, const cl_event* wait_events,
+                                         cl_event* kernel_event, unsigned int lane) const
 {
-    CL_CHECK_CALL(clEnqueueNDRangeKernel(queue,
-                                         deposit_samples_kernel,
-                                         1,
-                                         &deposit_samples_launch_config.offset,
-                                         &deposit_samples_launch_config.global_size,
-                                         &deposit_samples_launch_config.local_size,
-                                         num_wait_events,
-                                         wait_events,
-                                         kernel_event));
+    EnqueueKernel(queue, deposit_samples_kernel, deposit_samples_launch_config, lane,
+                  num_wait_events, wait_events, kernel_event);
 }
 
-cl_program RenderingKernels::BuildProgram(cl_context context, cl_device_id device,
-                                          const std::string& kernel_filename) const
+void RenderingKernels::EnqueueKernel(cl_command_queue queue, cl_kernel kernel, const KernelLaunchSize& launch_config,
+                                     unsigned int lane, cl_uint num_wait_events, const cl_event* wait_events,
+                                     cl_event* kernel_event) const
 {
-    // Read file source
-    const auto kernel_source{ IO::ReadFile(kernel_filename) };
-    const char* c_ptr_source{ kernel_source.c_str() };
-
-    // Create program
-    cl_int err_code{ CL_SUCCESS };
-    cl_program kernel_program{ clCreateProgramWithSource(context, 1, &c_ptr_source, nullptr, &err_code) };
-    CL_CHECK_STATUS(err_code);
-
-    // Build program
-    const std::string program_options{ "-cl-std=CL1.2 -cl-mad-enable -cl-no-signed-zeros" };
-    err_code = clBuildProgram(kernel_program, 1, &device, program_options.c_str(), nullptr, nullptr);
-    if (err_code != CL_SUCCESS)
+    // Each lane covers a contiguous range of work-groups
+    const size_t lane_groups{ DivideUp(launch_config.global_size / launch_config.local_size,
+                                       static_cast<size_t>(num_lanes)) };
+    const size_t lane_offset{ std::min(lane * lane_groups * launch_config.local_size, launch_config.global_size) };
+    const size_t lane_size{ std::min(lane_groups * launch_config.local_size,
+                                     launch_config.global_size - lane_offset) };
+    if (lane_size == 0)
     {
-        // We have an error in the program build
-        size_t program_build_log_size;
-        CL_CHECK_CALL(clGetProgramBuildInfo(kernel_program, device, CL_PROGRAM_BUILD_LOG,
-                                            0, nullptr, &program_build_log_size));
-        auto program_build_log{ std::make_unique<char[]>(program_build_log_size) };
-        CL_CHECK_CALL(clGetProgramBuildInfo(kernel_program, device, CL_PROGRAM_BUILD_LOG,
-                                            program_build_log_size, program_build_log.get(), nullptr));
-
-        // Release program and throw exception with log
-        CL_CHECK_CALL(clReleaseProgram(kernel_program));
-        throw std::runtime_error{ program_build_log.get() };
+        // Lane with no work, the event still completes after the dependencies
+        CL_CHECK_CALL(clEnqueueMarkerWithWaitList(queue, num_wait_events, wait_events, kernel_event));
+        return;
     }
 
-    return kernel_program;
+    const size_t global_offset{ launch_config.offset + lane_offset };
+    CL_CHECK_CALL(clEnqueueNDRangeKernel(queue,
+                                         kernel,
+                                         1,
+                                         &global_offset,
+                                         &lane_size,
+                                         &launch_config.local_size,
+                                         num_wait_events,
+                                         wait_events,
+                                         kernel_event));
 }
 
 void RenderingKernels::SetupKernels(cl_program kernel_program)
@@ -204,6 +164,9 @@ void RenderingKernels::SetInitialiseKernelArgs(const RenderingData& rendering_da
     CL_CHECK_CALL(clSetKernelArg(initialise_kernel, arg_index++, sizeof(cl_mem), &rendering_data.d_rays.depth));
     CL_CHECK_CALL(clSetKernelArg(initialise_kernel, arg_index++, sizeof(cl_mem),
                                  &rendering_data.d_xorshift_state.state));
+    initialise_stream_arg = arg_index;
+    const cl_uint generator_stream{ 0 };
+    CL_CHECK_CALL(clSetKernelArg(initialise_kernel, arg_index++, sizeof(cl_uint), &generator_stream));
     const auto total_samples = static_cast<cl_uint>(tile_description.TotalSamples());
     CL_CHECK_CALL(clSetKernelArg(initialise_kernel, arg_index++, sizeof(unsigned int), &total_samples));
 }
@@ -214,39 +177,14 @@ void RenderingKernels::SetRestartKernelArgs(const RenderingData& rendering_data,
     cl_uint arg_index{ 0 };
     CL_CHECK_CALL(clSetKernelArg(restart_sample_kernel, arg_index++, sizeof(cl_mem), &scene.d_camera));
 
-    CL_CHECK_CALL(clSetKernelArg(restart_sample_kernel, arg_index++, sizeof(cl_mem), &rendering_data.d_rays.origin_x));
-    CL_CHECK_CALL(clSetKernelArg(restart_sample_kernel, arg_index++, sizeof(cl_mem), &rendering_data.d_rays.origin_y));
-    CL_CHECK_CALL(clSetKernelArg(restart_sample_kernel, arg_index++, sizeof(cl_mem), &rendering_data.d_rays.origin_z));
-
-    CL_CHECK_CALL(clSetKernelArg(restart_sample_kernel, arg_index++, sizeof(cl_mem),
-                                 &rendering_data.d_rays.direction_x));
-    CL_CHECK_CALL(clSetKernelArg(restart_sample_kernel, arg_index++, sizeof(cl_mem),
-                                 &rendering_data.d_rays.direction_y));
-    CL_CHECK_CALL(clSetKernelArg(restart_sample_kernel, arg_index++, sizeof(cl_mem),
-                                 &rendering_data.d_rays.direction_z));
-
+    CL_CHECK_CALL(clSetKernelArg(restart_sample_kernel, arg_index++, sizeof(cl_mem), &rendering_data.d_rays.rays));
     CL_CHECK_CALL(clSetKernelArg(restart_sample_kernel, arg_index++, sizeof(cl_mem), &rendering_data.d_rays.depth));
 
     CL_CHECK_CALL(clSetKernelArg(restart_sample_kernel, arg_index++, sizeof(cl_mem),
                                  &rendering_data.d_intersections.primitive_index));
 
-    CL_CHECK_CALL(clSetKernelArg(restart_sample_kernel, arg_index++, sizeof(cl_mem), &rendering_data.d_samples.Li_r));
-    CL_CHECK_CALL(clSetKernelArg(restart_sample_kernel, arg_index++, sizeof(cl_mem), &rendering_data.d_samples.Li_g));
-    CL_CHECK_CALL(clSetKernelArg(restart_sample_kernel, arg_index++, sizeof(cl_mem), &rendering_data.d_samples.Li_b));
-
-    CL_CHECK_CALL(clSetKernelArg(restart_sample_kernel, arg_index++, sizeof(cl_mem), &rendering_data.d_samples.beta_r));
-    CL_CHECK_CALL(clSetKernelArg(restart_sample_kernel, arg_index++, sizeof(cl_mem), &rendering_data.d_samples.beta_g));
-    CL_CHECK_CALL(clSetKernelArg(restart_sample_kernel, arg_index++, sizeof(cl_mem), &rendering_data.d_samples.beta_b));
-
-    CL_CHECK_CALL(clSetKernelArg(restart_sample_kernel, arg_index++, sizeof(cl_mem),
-                                 &rendering_data.d_samples.pixel_x));
-    CL_CHECK_CALL(clSetKernelArg(restart_sample_kernel, arg_index++, sizeof(cl_mem),
-                                 &rendering_data.d_samples.pixel_y));
-
     CL_CHECK_CALL(clSetKernelArg(restart_sample_kernel, arg_index++, sizeof(cl_mem),
-                                 &rendering_data.d_samples.sample_offset_x));
-    CL_CHECK_CALL(clSetKernelArg(restart_sample_kernel, arg_index++, sizeof(cl_mem),
-                                 &rendering_data.d_samples.sample_offset_y));
+                                 &rendering_data.d_samples.samples));
 
     CL_CHECK_CALL(clSetKernelArg(restart_sample_kernel, arg_index++, sizeof(cl_mem), &rendering_data.d_pixels.pixel_r));
     CL_CHECK_CALL(clSetKernelArg(restart_sample_kernel, arg_index++, sizeof(cl_mem), &rendering_data.d_pixels.pixel_g));
@@ -263,8 +201,16 @@ void RenderingKernels::SetRestartKernelArgs(const RenderingData& rendering_data,
     CL_CHECK_CALL(clSetKernelArg(restart_sample_kernel, arg_index++, sizeof(unsigned int), &tile_width));
     CL_CHECK_CALL(clSetKernelArg(restart_sample_kernel, arg_index++, sizeof(unsigned int), &tile_height));
     CL_CHECK_CALL(clSetKernelArg(restart_sample_kernel, arg_index++, sizeof(unsigned int), &pixel_samples));
+    // The whole image until a band of rows is set
+    restart_tile_rows_arg = arg_index;
+    const cl_uint first_tile_row{ 0 };
+    const cl_uint end_tile_row{ rendering_data.d_samples.num_tile_rows };
+    CL_CHECK_CALL(clSetKernelArg(restart_sample_kernel, arg_index++, sizeof(cl_uint), &first_tile_row));
+    CL_CHECK_CALL(clSetKernelArg(restart_sample_kernel, arg_index++, sizeof(cl_uint), &end_tile_row));
     CL_CHECK_CALL(clSetKernelArg(restart_sample_kernel, arg_index++, sizeof(cl_mem),
                                  &rendering_data.d_samples.samples_done));
+    CL_CHECK_CALL(clSetKernelArg(restart_sample_kernel, arg_index++, sizeof(cl_mem),
+                                 &rendering_data.d_samples.tile_rows_done));
 }
 
 void RenderingKernels::SetIntersectKernelArgs(const RenderingData& rendering_data,
@@ -273,40 +219,36 @@ void RenderingKernels::SetIntersectKernelArgs(const RenderingData& rendering_dat
     cl_uint arg_index{ 0 };
     CL_CHECK_CALL(clSetKernelArg(intersect_kernel, arg_index++, sizeof(cl_mem), &scene.d_spheres));
     CL_CHECK_CALL(clSetKernelArg(intersect_kernel, arg_index++, sizeof(cl_uint), &scene.num_spheres));
+    if (scene.HasAcceleration())
+    {
+        CL_CHECK_CALL(clSetKernelArg(intersect_kernel, arg_index++, sizeof(cl_mem), &scene.d_tlas_nodes));
+        CL_CHECK_CALL(clSetKernelArg(intersect_kernel, arg_index++, sizeof(cl_mem), &scene.d_instances));
+        CL_CHECK_CALL(clSetKernelArg(intersect_kernel, arg_index++, sizeof(cl_mem), &scene.d_blas_nodes));
+        CL_CHECK_CALL(clSetKernelArg(intersect_kernel, arg_index++, sizeof(cl_mem), &scene.d_primitive_indices));
+        CL_CHECK_CALL(clSetKernelArg(intersect_kernel, arg_index++, sizeof(cl_mem), &scene.d_vertices));
+        CL_CHECK_CALL(clSetKernelArg(intersect_kernel, arg_index++, sizeof(cl_mem), &scene.d_triangles));
+    }
 
-    CL_CHECK_CALL(clSetKernelArg(intersect_kernel, arg_index++, sizeof(cl_mem), &rendering_data.d_rays.origin_x));
-    CL_CHECK_CALL(clSetKernelArg(intersect_kernel, arg_index++, sizeof(cl_mem), &rendering_data.d_rays.origin_y));
-    CL_CHECK_CALL(clSetKernelArg(intersect_kernel, arg_index++, sizeof(cl_mem), &rendering_data.d_rays.origin_z));
-
-    CL_CHECK_CALL(clSetKernelArg(intersect_kernel, arg_index++, sizeof(cl_mem), &rendering_data.d_rays.direction_x));
-    CL_CHECK_CALL(clSetKernelArg(intersect_kernel, arg_index++, sizeof(cl_mem), &rendering_data.d_rays.direction_y));
-    CL_CHECK_CALL(clSetKernelArg(intersect_kernel, arg_index++, sizeof(cl_mem), &rendering_data.d_rays.direction_z));
-
+    CL_CHECK_CALL(clSetKernelArg(intersect_kernel, arg_index++, sizeof(cl_mem), &rendering_data.d_rays.rays));
     CL_CHECK_CALL(clSetKernelArg(intersect_kernel, arg_index++, sizeof(cl_mem), &rendering_data.d_rays.depth));
 
     CL_CHECK_CALL(clSetKernelArg(intersect_kernel, arg_index++, sizeof(cl_mem),
-                                 &rendering_data.d_intersections.hit_point_x));
-    CL_CHECK_CALL(clSetKernelArg(intersect_kernel, arg_index++, sizeof(cl_mem),
-                                 &rendering_data.d_intersections.hit_point_y));
-    CL_CHECK_CALL(clSetKernelArg(intersect_kernel, arg_index++, sizeof(cl_mem),
-                                 &rendering_data.d_intersections.hit_point_z));
-
-    CL_CHECK_CALL(clSetKernelArg(intersect_kernel, arg_index++, sizeof(cl_mem),
-                                 &rendering_data.d_intersections.normal_x));
-    CL_CHECK_CALL(clSetKernelArg(intersect_kernel, arg_index++, sizeof(cl_mem),
-                                 &rendering_data.d_intersections.normal_y));
-    CL_CHECK_CALL(clSetKernelArg(intersect_kernel, arg_index++, sizeof(cl_mem),
-                                 &rendering_data.d_intersections.normal_z));
-
-    CL_CHECK_CALL(clSetKernelArg(intersect_kernel, arg_index++, sizeof(cl_mem), &rendering_data.d_intersections.uv_s));
-    CL_CHECK_CALL(clSetKernelArg(intersect_kernel, arg_index++, sizeof(cl_mem), &rendering_data.d_intersections.uv_t));
-
-    CL_CHECK_CALL(clSetKernelArg(intersect_kernel, arg_index++, sizeof(cl_mem), &rendering_data.d_intersections.wo_x));
-    CL_CHECK_CALL(clSetKernelArg(intersect_kernel, arg_index++, sizeof(cl_mem), &rendering_data.d_intersections.wo_y));
-    CL_CHECK_CALL(clSetKernelArg(intersect_kernel, arg_index++, sizeof(cl_mem), &rendering_data.d_intersections.wo_z));
-
+                                 &rendering_data.d_intersections.intersections));
     CL_CHECK_CALL(clSetKernelArg(intersect_kernel, arg_index++, sizeof(cl_mem),
                                  &rendering_data.d_intersections.primitive_index));
+    if (rendering_data.d_cost.num_pixels != 0)
+    {
+        CL_CHECK_CALL(clSetKernelArg(intersect_kernel, arg_index++, sizeof(cl_mem), &scene.d_camera));
+        CL_CHECK_CALL(clSetKernelArg(intersect_kernel, arg_index++, sizeof(cl_mem),
+                                     &rendering_data.d_samples.samples));
+        CL_CHECK_CALL(clSetKernelArg(intersect_kernel, arg_index++, sizeof(cl_mem), &rendering_data.d_cost.rays));
+        CL_CHECK_CALL(clSetKernelArg(intersect_kernel, arg_index++, sizeof(cl_mem), &rendering_data.d_cost.tests));
+    }
+    if (rendering_data.d_statistics.counters != nullptr)
+    {
+        CL_CHECK_CALL(clSetKernelArg(intersect_kernel, arg_index++, sizeof(cl_mem),
+                                     &rendering_data.d_statistics.counters));
+    }
 
     const cl_uint total_samples = tile_description.TotalSamples();
     CL_CHECK_CALL(clSetKernelArg(intersect_kernel, arg_index++, sizeof(cl_uint), &total_samples));
@@ -316,39 +258,19 @@ void RenderingKernels::SetSampleBRDFKernelArgs(const RenderingData& rendering_da
                                                const TileDescription& tile_description)
 {
     cl_uint arg_index{ 0 };
-    CL_CHECK_CALL(clSetKernelArg(sample_brdf_kernel, arg_index++, sizeof(cl_mem), &rendering_data.d_rays.origin_x));
-    CL_CHECK_CALL(clSetKernelArg(sample_brdf_kernel, arg_index++, sizeof(cl_mem), &rendering_data.d_rays.origin_y));
-    CL_CHECK_CALL(clSetKernelArg(sample_brdf_kernel, arg_index++, sizeof(cl_mem), &rendering_data.d_rays.origin_z));
-
-    CL_CHECK_CALL(clSetKernelArg(sample_brdf_kernel, arg_index++, sizeof(cl_mem), &rendering_data.d_rays.direction_x));
-    CL_CHECK_CALL(clSetKernelArg(sample_brdf_kernel, arg_index++, sizeof(cl_mem), &rendering_data.d_rays.direction_y));
-    CL_CHECK_CALL(clSetKernelArg(sample_brdf_kernel, arg_index++, sizeof(cl_mem), &rendering_data.d_rays.direction_z));
-
+    CL_CHECK_CALL(clSetKernelArg(sample_brdf_kernel, arg_index++, sizeof(cl_mem), &rendering_data.d_rays.rays));
     CL_CHECK_CALL(clSetKernelArg(sample_brdf_kernel, arg_index++, sizeof(cl_mem), &rendering_data.d_rays.depth));
 
     CL_CHECK_CALL(clSetKernelArg(sample_brdf_kernel, arg_index++, sizeof(cl_mem),
-                                 &rendering_data.d_intersections.hit_point_x));
-    CL_CHECK_CALL(clSetKernelArg(sample_brdf_kernel, arg_index++, sizeof(cl_mem),
-                                 &rendering_data.d_intersections.hit_point_y));
-    CL_CHECK_CALL(clSetKernelArg(sample_brdf_kernel, arg_index++, sizeof(cl_mem),
-                                 &rendering_data.d_intersections.hit_point_z));
-
-    CL_CHECK_CALL(clSetKernelArg(sample_brdf_kernel, arg_index++, sizeof(cl_mem),
-                                 &rendering_data.d_intersections.normal_x));
-    CL_CHECK_CALL(clSetKernelArg(sample_brdf_kernel, arg_index++, sizeof(cl_mem),
-                                 &rendering_data.d_intersections.normal_y));
-    CL_CHECK_CALL(clSetKernelArg(sample_brdf_kernel, arg_index++, sizeof(cl_mem),
-                                 &rendering_data.d_intersections.normal_z));
-
-    CL_CHECK_CALL(clSetKernelArg(sample_brdf_kernel, arg_index++, sizeof(cl_mem),
-                                 &rendering_data.d_intersections.wo_x));
-    CL_CHECK_CALL(clSetKernelArg(sample_brdf_kernel, arg_index++, sizeof(cl_mem),
-                                 &rendering_data.d_intersections.wo_y));
-    CL_CHECK_CALL(clSetKernelArg(sample_brdf_kernel, arg_index++, sizeof(cl_mem),
-                                 &rendering_data.d_intersections.wo_z));
+                                 &rendering_data.d_intersections.intersections));
 
     CL_CHECK_CALL(clSetKernelArg(sample_brdf_kernel, arg_index++, sizeof(cl_mem),
                                  &rendering_data.d_xorshift_state.state));
+    if (rendering_data.d_statistics.counters != nullptr)
+    {
+        CL_CHECK_CALL(clSetKernelArg(sample_brdf_kernel, arg_index++, sizeof(cl_mem),
+                                     &rendering_data.d_statistics.counters));
+    }
 
     const cl_uint total_samples = tile_description.TotalSamples();
     CL_CHECK_CALL(clSetKernelArg(sample_brdf_kernel, arg_index++, sizeof(cl_uint), &total_samples));
@@ -358,61 +280,38 @@ void RenderingKernels::SetUpdateRadianceKernelArgs(const RenderingData& renderin
                                                    const TileDescription& tile_description, const ::CL::Scene& scene)
 {
     cl_uint arg_index{ 0 };
-    CL_CHECK_CALL(clSetKernelArg(update_radiance_kernel, arg_index++, sizeof(cl_mem), &rendering_data.d_samples.Li_r));
-    CL_CHECK_CALL(clSetKernelArg(update_radiance_kernel, arg_index++, sizeof(cl_mem), &rendering_data.d_samples.Li_g));
-    CL_CHECK_CALL(clSetKernelArg(update_radiance_kernel, arg_index++, sizeof(cl_mem), &rendering_data.d_samples.Li_b));
-
-    CL_CHECK_CALL(clSetKernelArg(update_radiance_kernel, arg_index++, sizeof(cl_mem),
-                                 &rendering_data.d_samples.beta_r));
-    CL_CHECK_CALL(clSetKernelArg(update_radiance_kernel, arg_index++, sizeof(cl_mem),
-                                 &rendering_data.d_samples.beta_g));
-    CL_CHECK_CALL(clSetKernelArg(update_radiance_kernel, arg_index++, sizeof(cl_mem),
-                                 &rendering_data.d_samples.beta_b));
-
-    CL_CHECK_CALL(clSetKernelArg(update_radiance_kernel, arg_index++, sizeof(cl_mem),
-                                 &rendering_data.d_intersections.hit_point_x));
-    CL_CHECK_CALL(clSetKernelArg(update_radiance_kernel, arg_index++, sizeof(cl_mem),
-                                 &rendering_data.d_intersections.hit_point_y));
-    CL_CHECK_CALL(clSetKernelArg(update_radiance_kernel, arg_index++, sizeof(cl_mem),
-                                 &rendering_data.d_intersections.hit_point_z));
-
-    CL_CHECK_CALL(clSetKernelArg(update_radiance_kernel, arg_index++, sizeof(cl_mem),
-                                 &rendering_data.d_intersections.normal_x));
     CL_CHECK_CALL(clSetKernelArg(update_radiance_kernel, arg_index++, sizeof(cl_mem),
-                                 &rendering_data.d_intersections.normal_y));
-    CL_CHECK_CALL(clSetKernelArg(update_radiance_kernel, arg_index++, sizeof(cl_mem),
-                                 &rendering_data.d_intersections.normal_z));
+                                 &rendering_data.d_samples.samples));
 
     CL_CHECK_CALL(clSetKernelArg(update_radiance_kernel, arg_index++, sizeof(cl_mem),
-                                 &rendering_data.d_intersections.uv_s));
-    CL_CHECK_CALL(clSetKernelArg(update_radiance_kernel, arg_index++, sizeof(cl_mem),
-                                 &rendering_data.d_intersections.uv_t));
-
-    CL_CHECK_CALL(clSetKernelArg(update_radiance_kernel, arg_index++, sizeof(cl_mem),
-                                 &rendering_data.d_intersections.wo_x));
-    CL_CHECK_CALL(clSetKernelArg(update_radiance_kernel, arg_index++, sizeof(cl_mem),
-                                 &rendering_data.d_intersections.wo_y));
-    CL_CHECK_CALL(clSetKernelArg(update_radiance_kernel, arg_index++, sizeof(cl_mem),
-                                 &rendering_data.d_intersections.wo_z));
-
+                                 &rendering_data.d_intersections.intersections));
     CL_CHECK_CALL(clSetKernelArg(update_radiance_kernel, arg_index++, sizeof(cl_mem),
                                  &rendering_data.d_intersections.primitive_index));
 
-    CL_CHECK_CALL(clSetKernelArg(update_radiance_kernel, arg_index++, sizeof(cl_mem),
-                                 &rendering_data.d_rays.direction_x));
-    CL_CHECK_CALL(clSetKernelArg(update_radiance_kernel, arg_index++, sizeof(cl_mem),
-                                 &rendering_data.d_rays.direction_y));
-    CL_CHECK_CALL(clSetKernelArg(update_radiance_kernel, arg_index++, sizeof(cl_mem),
-                                 &rendering_data.d_rays.direction_z));
-
-    CL_CHECK_CALL(clSetKernelArg(update_radiance_kernel, arg_index++, sizeof(cl_mem),
-                                 &rendering_data.d_rays.depth));
+    CL_CHECK_CALL(clSetKernelArg(update_radiance_kernel, arg_index++, sizeof(cl_mem), &rendering_data.d_rays.rays));
+    CL_CHECK_CALL(clSetKernelArg(update_radiance_kernel, arg_index++, sizeof(cl_mem), &rendering_data.d_rays.depth));
 
     CL_CHECK_CALL(clSetKernelArg(update_radiance_kernel, arg_index++, sizeof(cl_mem),
                                  &scene.d_materials));
     CL_CHECK_CALL(clSetKernelArg(update_radiance_kernel, arg_index++, sizeof(cl_mem),
                                  &scene.d_material_indices));
 
+    if (rendering_data.d_auxiliary.num_pixels != 0)
+    {
+        const AuxiliaryPixels& auxiliary{ rendering_data.d_auxiliary };
+        CL_CHECK_CALL(clSetKernelArg(update_radiance_kernel, arg_index++, sizeof(cl_mem), &scene.d_camera));
+        for (const cl_mem& buffer : { auxiliary.albedo_r, auxiliary.albedo_g, auxiliary.albedo_b,
+                                      auxiliary.normal_x, auxiliary.normal_y, auxiliary.normal_z })
+        {
+            CL_CHECK_CALL(clSetKernelArg(update_radiance_kernel, arg_index++, sizeof(cl_mem), &buffer));
+        }
+    }
+    if (rendering_data.d_statistics.counters != nullptr)
+    {
+        CL_CHECK_CALL(clSetKernelArg(update_radiance_kernel, arg_index++, sizeof(cl_mem),
+                                     &rendering_data.d_statistics.counters));
+    }
+
     const cl_uint total_samples = tile_description.TotalSamples();
     CL_CHECK_CALL(clSetKernelArg(update_radiance_kernel, arg_index++, sizeof(cl_uint), &total_samples));
 }
@@ -423,19 +322,8 @@ void RenderingKernels::SetDepositSamplesKernelArgs(const RenderingData& renderin
     cl_uint arg_index{ 0 };
     CL_CHECK_CALL(clSetKernelArg(deposit_samples_kernel, arg_index++, sizeof(cl_mem), &scene.d_camera));
 
-    CL_CHECK_CALL(clSetKernelArg(deposit_samples_kernel, arg_index++, sizeof(cl_mem), &rendering_data.d_samples.Li_r));
-    CL_CHECK_CALL(clSetKernelArg(deposit_samples_kernel, arg_index++, sizeof(cl_mem), &rendering_data.d_samples.Li_g));
-    CL_CHECK_CALL(clSetKernelArg(deposit_samples_kernel, arg_index++, sizeof(cl_mem), &rendering_data.d_samples.Li_b));
-
-    CL_CHECK_CALL(clSetKernelArg(deposit_samples_kernel, arg_index++, sizeof(cl_mem),
-                                 &rendering_data.d_samples.pixel_x));
-    CL_CHECK_CALL(clSetKernelArg(deposit_samples_kernel, arg_index++, sizeof(cl_mem),
-                                 &rendering_data.d_samples.pixel_y));
-
     CL_CHECK_CALL(clSetKernelArg(deposit_samples_kernel, arg_index++, sizeof(cl_mem),
-                                 &rendering_data.d_samples.sample_offset_x));
-    CL_CHECK_CALL(clSetKernelArg(deposit_samples_kernel, arg_index++, sizeof(cl_mem),
-                                 &rendering_data.d_samples.sample_offset_y));
+                                 &rendering_data.d_samples.samples));
 
     CL_CHECK_CALL(clSetKernelArg(deposit_samples_kernel, arg_index++, sizeof(cl_mem), &rendering_data.d_rays.depth));
 
@@ -468,23 +356,57 @@ std::pair<size_t, size_t> RenderingKernels::GetWGInfo(cl_kernel kernel, cl_devic
     return { preferred_wg_size_multiple, max_wg_size };
 }
 
-void RenderingKernels::SetupLaunchConfig(const TileDescription& tile_description, cl_device_id device)
+void RenderingKernels::SetupLaunchConfig(const TileDescription& tile_description, cl_device_id device,
+                                         const LaunchTuning& launch_tuning)
+{
+    SetupLaunchConfigKernel(initialise_kernel, initialise_launch_config, tile_description, device,
+                            launch_tuning.LocalSize(KernelId::Initialise));
+    SetupLaunchConfigKernel(restart_sample_kernel, restart_launch_config, tile_description, device,
+                            launch_tuning.LocalSize(KernelId::Restart));
+    SetupLaunchConfigKernel(intersect_kernel, intersect_launch_config, tile_description, device,
+                            launch_tuning.LocalSize(KernelId::Intersect));
+    SetupLaunchConfigKernel(sample_brdf_kernel, sample_brdf_launch_config, tile_description, device,
+                            launch_tuning.LocalSize(KernelId::SampleBRDF));
+    SetupLaunchConfigKernel(update_radiance_kernel, update_radiance_launch_config, tile_description, device,
+                            launch_tuning.LocalSize(KernelId::UpdateRadiance));
+    SetupLaunchConfigKernel(deposit_samples_kernel, deposit_samples_launch_config, tile_description, device,
+                            launch_tuning.LocalSize(KernelId::DepositSamples));
+}
+
+size_t RenderingKernels::LocalSize(KernelId kernel) const noexcept
 {
-    SetupLaunchConfigKernel(initialise_kernel, initialise_launch_config, tile_description, device);
-    SetupLaunchConfigKernel(restart_sample_kernel, restart_launch_config, tile_description, device);
-    SetupLaunchConfigKernel(intersect_kernel, intersect_launch_config, tile_description, device);
-    SetupLaunchConfigKernel(sample_brdf_kernel, sample_brdf_launch_config, tile_description, device);
-    SetupLaunchConfigKernel(update_radiance_kernel, update_radiance_launch_config, tile_description, device);
-    SetupLaunchConfigKernel(deposit_samples_kernel, deposit_samples_launch_config, tile_description, device);
+    switch (kernel)
+    {
+        case KernelId::Initialise:
+            return initialise_launch_config.local_size;
+        case KernelId::Restart:
+            return restart_launch_config.local_size;
+        case KernelId::Intersect:
+            return intersect_launch_config.local_size;
+        case KernelId::SampleBRDF:
+            return sample_brdf_launch_config.local_size;
+        case KernelId::UpdateRadiance:
+            return update_radiance_launch_config.local_size;
+        default:
+            return deposit_samples_launch_config.local_size;
+    }
 }
 
 void RenderingKernels::SetupLaunchConfigKernel(cl_kernel kernel, KernelLaunchSize& launch_size,
-                                               const TileDescription& tile_description, cl_device_id device)
+                                               const TileDescription& tile_description, cl_device_id device,
+                                               size_t tuned_local_size)
 {
     // Get the preferred sizes for the kernel
     const auto wg_info = GetWGInfo(kernel, device);
-    // Compute size for the kernel
-    launch_size.local_size = RoundDown(wg_info.second, wg_info.first);
+    // Compute size for the kernel, a tuned size is used only if the kernel can be launched with it
+    if (tuned_local_size != 0 && tuned_local_size <= wg_info.second)
+    {
+        launch_size.local_size = tuned_local_size;
+    }
+    else
+    {
+        launch_size.local_size = RoundDown(wg_info.second, wg_info.first);
+    }
     launch_size.global_size = RoundUp(static_cast<size_t>(tile_description.TotalSamples()),
                                       launch_size.local_size);
 }
@@ -8,6 +8,7 @@
 #include "RenderingData.hpp"
 #include "Scene.hpp"
 #include "TileDescription.hpp"
+#include "LaunchTuning.hpp"
 
 #include <string>
 
@@ -28,48 +29,67 @@ struct KernelLaunchSize
     {}
 };
 
-// This class is responsible for loading the kernel from a single file
+// This class is responsible for creating the kernels from the built program and setting their arguments
 class RenderingKernels
 {
 public:
-    RenderingKernels(cl_context context, cl_device_id device, const std::string& kernel_filename,
+    // The work-group sizes come from the tuning when set, the samples are split in the given number of lanes
+    // that can be launched independently
+    RenderingKernels(cl_program kernel_program, cl_device_id device,
                      const RenderingData& rendering_data,
-                     const TileDescription& tile_description, const ::CL::Scene& scene);
+                     const TileDescription& tile_description, const ::CL::Scene& scene,
+                     const LaunchTuning& launch_tuning, unsigned int num_lanes = 1);
+
+    unsigned int NumLanes() const noexcept
+    {
+        return num_lanes;
+    }
+
+    // Work-group size used for the kernel
+    size_t LocalSize(KernelId kernel) const noexcept;
 
     ~RenderingKernels() noexcept;
 
+    // Render only the rows of tiles [first, end) with the random number generators of the stream, the arguments stay
+    // set for the next launches. Until it is called the whole image is rendered with the first stream
+    void SetTileRows(unsigned int first_tile_row, unsigned int end_tile_row, unsigned int generator_stream) const;
+
+    // Launch the kernels on the range of samples of the lane
+
     // Launch the Initialise kernel
     void RunInitialise(cl_command_queue queue,
                        cl_uint num_wait_events = 0, const cl_event* wait_events = nullptr,
-                       cl_event* kernel_event = nullptr) const;
+                       cl_event* kernel_event = nullptr, unsigned int lane = 0) const;
 
     // Launch the Restart kernel
     void RunRestart(cl_command_queue queue,
                     cl_uint num_wait_events = 0, const cl_event* wait_events = nullptr,
-                    cl_event* kernel_event = nullptr) const;
+                    cl_event* kernel_event = nullptr, unsigned int lane = 0) const;
 
     // Launch the Intersect kernel
     void RunIntersect(cl_command_queue queue,
                       cl_uint num_wait_events = 0, const cl_event* wait_events = nullptr,
-                      cl_event* kernel_event = nullptr) const;
+                      cl_event* kernel_event = nullptr, unsigned int lane = 0) const;
 
     // Launch the BRDF sample kernel
     void RunSampleBRDF(cl_command_queue queue,
                        cl_uint num_wait_events = 0, const cl_event* wait_events = nullptr,
-                       cl_event* kernel_event = nullptr) const;
+                       cl_event* kernel_event = nullptr, unsigned int lane = 0) const;
 
     // Launch the UpdateRadiance kernel
     void RunUpdateRadiance(cl_command_queue queue,
                            cl_uint num_wait_events = 0, const cl_event* wait_events = nullptr,
-                           cl_event* kernel_event = nullptr) const;
+                           cl_event* kernel_event = nullptr, unsigned int lane = 0) const;
 
     void RunDepositSamples(cl_command_queue queue,
                            cl_uint num_wait_events = 0, const cl_event* wait_events = nullptr,
-                           cl_event* kernel_event = nullptr) const;
+                           cl_event* kernel_event = nullptr, unsigned int lane = 0) const;
 
 private:
-    // Load kernel program source and build program
-    cl_program BuildProgram(cl_context context, cl_device_id device, const std::string& kernel_filename) const;
+    // Launch the part of the kernel that belongs to the lane
+    void EnqueueKernel(cl_command_queue queue, cl_kernel kernel, const KernelLaunchSize& launch_config,
+                       unsigned int lane, cl_uint num_wait_events, const cl_event* wait_events,
+                       cl_event* kernel_event) const;
 
     // Setup kernel from program
     void SetupKernels(cl_program kernel_program);
@@ -104,14 +124,23 @@ private:
     std::pair<size_t, size_t> GetWGInfo(cl_kernel kernel, cl_device_id device) const;
 
     // Setup kernel launch sizes
-    void SetupLaunchConfig(const TileDescription& tile_description, cl_device_id device);
+    void SetupLaunchConfig(const TileDescription& tile_description, cl_device_id device,
+                           const LaunchTuning& launch_tuning);
 
     void SetupLaunchConfigKernel(cl_kernel kernel, KernelLaunchSize& launch_size,
-                                 const TileDescription& tile_description, cl_device_id device);
+                                 const TileDescription& tile_description, cl_device_id device,
+                                 size_t tuned_local_size);
 
     // Cleanup OpenCL resource without throwing
     void Cleanup() noexcept;
 
+    // Number of independent lanes
+    const unsigned int num_lanes;
+
+    // Index of the generator stream argument of Initialise and of the first row of tiles argument of RestartSample,
+    // the end row follows it
+    cl_uint initialise_stream_arg, restart_tile_rows_arg;
+
     // Data initialisation kernel
     cl_kernel initialise_kernel;
     KernelLaunchSize initialise_launch_config;
@@ -0,0 +1,178 @@
+//
+// Created by Simon on 2019-03-18.
+//
+
+#include "RenderingOptions.hpp"
+#include "CLError.hpp"
+
+#include <sstream>
+#include <stdexcept>
+
+namespace Rendering
+{
+
+StorageLayout ParseStorageLayout(const std::string& name)
+{
+    if (name == "automatic")
+    {
+        return StorageLayout::Automatic;
+    }
+    if (name == "soa")
+    {
+        return StorageLayout::SoA;
+    }
+    if (name == "aos")
+    {
+        return StorageLayout::AoS;
+    }
+    if (name == "aosoa8")
+    {
+        return StorageLayout::AoSoA8;
+    }
+    if (name == "aosoa16")
+    {
+        return StorageLayout::AoSoA16;
+    }
+
+    std::ostringstream error_message;
+    error_message << "Unknown storage layout: " << name;
+    throw std::invalid_argument{ error_message.str() };
+}
+
+std::string StorageLayoutName(StorageLayout layout)
+{
+    switch (layout)
+    {
+        case StorageLayout::SoA:
+            return "soa";
+        case StorageLayout::AoS:
+            return "aos";
+        case StorageLayout::AoSoA8:
+            return "aosoa8";
+        case StorageLayout::AoSoA16:
+            return "aosoa16";
+        default:
+            return "automatic";
+    }
+}
+
+unsigned int LayoutBlockSize(StorageLayout layout) noexcept
+{
+    switch (layout)
+    {
+        case StorageLayout::AoSoA8:
+            return 8;
+        case StorageLayout::AoSoA16:
+            return 16;
+        default:
+            return 1;
+    }
+}
+
+RenderingOptions::RenderingOptions() noexcept
+    : compact_intersections{ false }, storage_layout{ StorageLayout::Automatic },
+      out_of_order_queue{ false }, pipeline_lanes{ 0 }, specialise_kernels{ false },
+      use_bvh{ false }, bvh_width{ 2 }, denoise{ false }, collect_stats{ false },
+      cost_heatmap{ false }
+{}
+
+RenderingOptions RenderingOptions::ResolveForDevice(cl_device_id device) const
+{
+    RenderingOptions resolved_options{ *this };
+
+    if (storage_layout == StorageLayout::Automatic)
+    {
+        cl_device_type device_type;
+        CL_CHECK_CALL(clGetDeviceInfo(device, CL_DEVICE_TYPE, sizeof(cl_device_type), &device_type, nullptr));
+        if (device_type & CL_DEVICE_TYPE_CPU)
+        {
+            // CPU runtimes map work-items to SIMD lanes, use blocks as wide as the native vector width
+            cl_uint vector_width{ 0 };
+            CL_CHECK_CALL(clGetDeviceInfo(device, CL_DEVICE_NATIVE_VECTOR_WIDTH_FLOAT, sizeof(cl_uint),
+                                          &vector_width, nullptr));
+            resolved_options.storage_layout = vector_width >= 16 ? StorageLayout::AoSoA16 : StorageLayout::AoSoA8;
+        }
+        else
+        {
+            resolved_options.storage_layout = StorageLayout::SoA;
+        }
+    }
+
+    if (out_of_order_queue)
+    {
+        // Fall back to an in order queue if the device does not support out of order execution
+        cl_command_queue_properties queue_properties;
+        CL_CHECK_CALL(clGetDeviceInfo(device, CL_DEVICE_QUEUE_PROPERTIES, sizeof(cl_command_queue_properties),
+                                      &queue_properties, nullptr));
+        resolved_options.out_of_order_queue = (queue_properties & CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE) != 0;
+    }
+
+    if (pipeline_lanes == 0)
+    {
+        // Independent lanes only help if the queue can run them concurrently
+        resolved_options.pipeline_lanes = resolved_options.out_of_order_queue ? DEFAULT_OUT_OF_ORDER_LANES : 1;
+    }
+
+    return resolved_options;
+}
+
+std::string RenderingOptions::ProgramDefines() const
+{
+    std::ostringstream defines;
+    if (compact_intersections)
+    {
+        defines << " -D COMPACT_INTERSECTIONS";
+    }
+    if (denoise)
+    {
+        defines << " -D AUXILIARY_BUFFERS";
+    }
+    if (collect_stats)
+    {
+        defines << " -D ENABLE_STATS";
+    }
+    if (cost_heatmap)
+    {
+        defines << " -D COST_HEATMAP";
+    }
+
+    switch (storage_layout)
+    {
+        case StorageLayout::AoS:
+            defines << " -D LAYOUT_AOS";
+            break;
+        case StorageLayout::AoSoA8:
+        case StorageLayout::AoSoA16:
+            defines << " -D LAYOUT_AOSOA -D LAYOUT_BLOCK=" << LayoutBlockSize(storage_layout);
+            break;
+        default:
+            defines << " -D LAYOUT_SOA";
+            break;
+    }
+
+    return defines.str();
+}
+
+std::string RenderingOptions::SpecialisationDefines(unsigned int tile_width, unsigned int tile_height,
+                                                   unsigned int pixel_samples,
+                                                   unsigned int image_width, unsigned int image_height,
+                                                   unsigned int num_spheres) const
+{
+    if (!specialise_kernels)
+    {
+        return "";
+    }
+
+    std::ostringstream defines;
+    defines << " -D SPEC_TILE_WIDTH=" << tile_width << "u"
+            << " -D SPEC_TILE_HEIGHT=" << tile_height << "u"
+            << " -D SPEC_PIXEL_SAMPLES=" << pixel_samples << "u"
+            << " -D SPEC_TOTAL_SAMPLES=" << tile_width * tile_height * pixel_samples << "u"
+            << " -D SPEC_IMAGE_WIDTH=" << image_width << "u"
+            << " -D SPEC_IMAGE_HEIGHT=" << image_height << "u"
+            << " -D SPEC_NUM_SPHERES=" << num_spheres << "u";
+
+    return defines.str();
+}
+
+} // Rendering namespace
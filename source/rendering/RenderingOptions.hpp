@@ -0,0 +1,96 @@
+//
+// Created by Simon on 2019-03-18.
+//
+
+#ifndef RABBIT_RENDERINGOPTIONS_HPP
+#define RABBIT_RENDERINGOPTIONS_HPP
+
+#ifdef __APPLE__
+
+#include <OpenCL/cl.h>
+
+#else
+#include <CL/cl.h>
+#endif
+
+#include <string>
+
+namespace Rendering
+{
+
+// Storage layout of the rays, intersections and samples streams
+enum class StorageLayout
+{
+    // Select the layout from the device type
+    Automatic,
+    // Structure of arrays, coalesced accesses on GPUs
+    SoA,
+    // Array of structures, all the fields of a sample are contiguous
+    AoS,
+    // Blocks of 8 or 16 samples stored in SoA layout, matches the SIMD width of CPU devices
+    AoSoA8,
+    AoSoA16
+};
+
+// Parse layout name (automatic, soa, aos, aosoa8, aosoa16), throws if the name is not valid
+StorageLayout ParseStorageLayout(const std::string& name);
+
+// Name of the layout
+std::string StorageLayoutName(StorageLayout layout);
+
+// Number of samples in a block of the layout, 1 if the layout is not blocked
+unsigned int LayoutBlockSize(StorageLayout layout) noexcept;
+
+// Options selecting the storage layout and the kernel variants used for rendering
+struct RenderingOptions
+{
+    // Number of pipeline lanes used with an out of order queue if not given
+    static constexpr unsigned int DEFAULT_OUT_OF_ORDER_LANES{ 4 };
+
+    // Store the intersections in compact form: octahedral encoded normal and uv as half floats, wo is not stored
+    bool compact_intersections;
+
+    // Layout of the rays, intersections and samples streams
+    StorageLayout storage_layout;
+
+    // Use an out of order queue, the dependencies between the commands are given by events only
+    bool out_of_order_queue;
+
+    // Number of independent pipelines the samples are split into, 0 selects it from the queue mode
+    unsigned int pipeline_lanes;
+
+    // Build the kernels for the tile, image and scene sizes, each configuration gets its own program
+    bool specialise_kernels;
+
+    // Build the two level acceleration structure also for scenes without instances
+    bool use_bvh;
+
+    // Children of the bottom level nodes: 2 for binary nodes with float bounds, 4 or 8 for compressed nodes
+    unsigned int bvh_width;
+
+    // Accumulate the first hit albedo and normal of each pixel and denoise the image on the host guided by them
+    bool denoise;
+
+    // Count the rays traced at each depth, the reasons the paths end and the active work-items of Intersect
+    bool collect_stats;
+
+    // Count the rays traced and the intersection tests done for each pixel and write them as a heatmap
+    bool cost_heatmap;
+
+    RenderingOptions() noexcept;
+
+    // Create a copy of the options where the automatic choices are resolved for the given device
+    RenderingOptions ResolveForDevice(cl_device_id device) const;
+
+    // Compute the defines to pass when building the kernel program
+    std::string ProgramDefines() const;
+
+    // Compute the defines with the build-time constants of the configuration, empty if not specialising
+    std::string SpecialisationDefines(unsigned int tile_width, unsigned int tile_height, unsigned int pixel_samples,
+                                      unsigned int image_width, unsigned int image_height,
+                                      unsigned int num_spheres) const;
+};
+
+} // Rendering namespace
+
+#endif //RABBIT_RENDERINGOPTIONS_HPP
@@ -0,0 +1,101 @@
+//
+// Created by Simon on 2019-03-29.
+//
+
+#include "SphereAnimation.hpp"
+#include "Keyframes.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+namespace Rendering
+{
+
+SphereAnimation SphereAnimation::ReadSphereAnimation(const std::string& filename)
+{
+    SphereAnimation sphere_animation;
+
+    // Open file for reading
+    std::ifstream animation_file{ filename };
+    if (!animation_file.is_open())
+    {
+        std::ostringstream error_message;
+        error_message << "Could not open file: " << filename;
+        throw std::invalid_argument{ error_message.str() };
+    }
+
+    std::string line;
+    unsigned int line_number{ 0 };
+    while (std::getline(animation_file, line))
+    {
+        line_number++;
+        // Skip empty lines and comments
+        const auto first = line.find_first_not_of(" \t\r");
+        if (first == std::string::npos || line[first] == '#')
+        {
+            continue;
+        }
+
+        std::istringstream line_stream{ line };
+        unsigned int frame, sphere;
+        Vector3 center;
+        float radius;
+        if (!(line_stream >> frame >> sphere >> center.x >> center.y >> center.z >> radius) || radius <= 0.f)
+        {
+            std::ostringstream error_message;
+            error_message << filename << ":" << line_number
+                          << ": expected <frame> <sphere_index> <center> <radius> with a positive radius";
+            throw std::invalid_argument{ error_message.str() };
+        }
+
+        std::vector<SphereKeyframe>& track{ sphere_animation.tracks[sphere] };
+        if (!track.empty() && frame <= track.back().frame)
+        {
+            std::ostringstream error_message;
+            error_message << filename << ":" << line_number
+                          << ": keyframes of a sphere must have increasing frame numbers";
+            throw std::invalid_argument{ error_message.str() };
+        }
+        track.emplace_back(frame, center, radius);
+    }
+
+    if (sphere_animation.tracks.empty())
+    {
+        throw std::invalid_argument{ "No keyframes in sphere animation: " + filename };
+    }
+
+    return sphere_animation;
+}
+
+unsigned int SphereAnimation::NumFrames() const noexcept
+{
+    unsigned int num_frames{ 0 };
+    for (const auto& track : tracks)
+    {
+        num_frames = std::max(num_frames, track.second.back().frame + 1);
+    }
+
+    return num_frames;
+}
+
+void SphereAnimation::Evaluate(unsigned int frame, const std::vector<Sphere>& scene_spheres,
+                               std::vector<Sphere>& spheres) const
+{
+    if (EndSphere() > scene_spheres.size())
+    {
+        throw std::invalid_argument{ "Sphere animation references a sphere not in the scene" };
+    }
+    spheres.assign(scene_spheres.cbegin() + FirstSphere(), scene_spheres.cbegin() + EndSphere());
+
+    for (const auto& track : tracks)
+    {
+        const KeyframeInterval<SphereKeyframe> interval{ FindKeyframes(track.second, frame) };
+        const Vector3 center{ interval.Interpolate(&SphereKeyframe::center) };
+        const float radius{ interval.Interpolate(&SphereKeyframe::radius) };
+        spheres[track.first - FirstSphere()] = Sphere{ center.x, center.y, center.z, radius };
+    }
+}
+
+} // Rendering namespace
@@ -0,0 +1,63 @@
+//
+// Created by Simon on 2019-03-29.
+//
+
+#ifndef RABBIT_SPHEREANIMATION_HPP
+#define RABBIT_SPHEREANIMATION_HPP
+
+#include "SceneParser.hpp"
+#include "Vector.hpp"
+
+#include <map>
+#include <string>
+#include <vector>
+
+namespace Rendering
+{
+
+// Sphere center and radius at a given frame
+struct SphereKeyframe
+{
+    unsigned int frame;
+    Vector3 center;
+    float radius;
+
+    constexpr SphereKeyframe(unsigned int frame, const Vector3& center, float radius) noexcept
+        : frame{ frame }, center{ center }, radius{ radius }
+    {}
+};
+
+// Animation of some of the spheres of a scene, the frames between two keyframes of a sphere are linearly
+// interpolated. Spheres without keyframes keep the values they have in the scene
+class SphereAnimation
+{
+public:
+    // Read the keyframes from a file, one per line: <frame> <sphere_index> <center> <radius>
+    static SphereAnimation ReadSphereAnimation(const std::string& filename);
+
+    // Number of frames in the animation, from frame 0 to the last keyframe
+    unsigned int NumFrames() const noexcept;
+
+    // Range of spheres with keyframes, all spheres updated for a frame are in [FirstSphere(), EndSphere())
+    unsigned int FirstSphere() const noexcept
+    {
+        return tracks.cbegin()->first;
+    }
+
+    unsigned int EndSphere() const noexcept
+    {
+        return tracks.crbegin()->first + 1;
+    }
+
+    // Compute the spheres of the animated range for the given frame, the scene spheres give the values of the
+    // spheres in the range without keyframes. Throws if an animated sphere is not in the scene
+    void Evaluate(unsigned int frame, const std::vector<Sphere>& scene_spheres, std::vector<Sphere>& spheres) const;
+
+private:
+    // Keyframes of each animated sphere sorted by frame
+    std::map<unsigned int, std::vector<SphereKeyframe>> tracks;
+};
+
+} // Rendering namespace
+
+#endif //RABBIT_SPHEREANIMATION_HPP
@@ -5,30 +5,69 @@
 #include "TileRendering.hpp"
 #include "FileIO.hpp"
 #include "CLError.hpp"
+#include "Common.hpp"
 
+#include <algorithm>
 #include <iostream>
 #include <limits>
-#include <array>
+#include <vector>
 
 namespace Rendering
 {
 namespace CL
 {
 
-TileRendering::TileRendering(cl_context context, cl_device_id device, cl_command_queue_properties queue_properties,
-                             const SceneDescription& scene_description, const ::CL::Scene& scene)
-    : command_queue{ nullptr },
-      tile_description{ scene_description.tile_width, scene_description.tile_height, scene_description.pixel_samples },
-      rendering_data{ context, scene_description.image_width * scene_description.image_height,
-                      tile_description.TotalSamples() },
-      rendering_kernel{ context, device, "./kernel/rendering_kernel.cl", rendering_data, tile_description, scene }
+namespace
+{
+
+// A crop window can be smaller than a tile, the samples outside of the film would only be idle
+inline cl_uint TileSize(cl_uint tile_size, cl_uint film_size) noexcept
+{
+    return std::min(tile_size, film_size);
+}
+
+} // Anonymous namespace
+
+TileRendering::TileRendering(RenderingDevice& device, cl_command_queue_properties queue_properties,
+                             const SceneDescription& scene_description, const ::CL::Scene& scene,
+                             const RenderingOptions& options, const LaunchTuning* tuning)
+    : command_queue{ nullptr }, transfer_queue{ nullptr },
+      rendering_options{ options.ResolveForDevice(device.Device()) },
+      launch_tuning{ FindLaunchTuning(device, rendering_options, scene, tuning) },
+      tile_description{ TileSize(launch_tuning.tile_width != 0 ? launch_tuning.tile_width :
+                                 scene_description.tile_width, scene_description.FilmWindow().width),
+                        TileSize(launch_tuning.tile_height != 0 ? launch_tuning.tile_height :
+                                 scene_description.tile_height, scene_description.FilmWindow().height),
+                        scene_description.pixel_samples },
+      film_window{ scene_description.FilmWindow() },
+      num_tile_rows{ DivideUp(scene_description.FilmWindow().height, tile_description.Height()) },
+      rendering_data{ device.Arena(), scene_description.FilmWindow().width * scene_description.FilmWindow().height,
+                      tile_description.TotalSamples(), num_tile_rows, rendering_options },
+      rendering_kernel{ device.Programs().GetProgram(
+                            rendering_options.ProgramDefines() + scene.ProgramDefines() +
+                            rendering_options.SpecialisationDefines(tile_description.Width(),
+                                                                    tile_description.Height(),
+                                                                    tile_description.PixelSamples(),
+                                                                    scene_description.FilmWindow().width,
+                                                                    scene_description.FilmWindow().height,
+                                                                    scene.num_spheres)),
+                        device.Device(), rendering_data, tile_description, scene, launch_tuning,
+                        rendering_options.pipeline_lanes }
 {
     cl_int err_code{ CL_SUCCESS };
 
     try
     {
         // Create command queue
-        command_queue = clCreateCommandQueue(context, device, queue_properties, &err_code);
+        if (rendering_options.out_of_order_queue)
+        {
+            queue_properties |= CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE;
+        }
+        command_queue = clCreateCommandQueue(device.Context(), device.Device(), queue_properties, &err_code);
+        CL_CHECK_STATUS(err_code);
+
+        // Create transfer queue, the copies only depend on the counters read back by the host
+        transfer_queue = clCreateCommandQueue(device.Context(), device.Device(), 0, &err_code);
         CL_CHECK_STATUS(err_code);
     }
     catch (const std::exception& ex)
@@ -44,56 +83,196 @@ TileRendering::~TileRendering() noexcept
     Cleanup();
 }
 
-void TileRendering::Render() const
+void TileRendering::Render(const TileRowsCallback& tile_rows_done, KernelTimes* kernel_times,
+                           RenderCheckpoint* checkpoint) const
 {
-    // Synchronisation events
-    cl_event initialise_event, restart_event, intersect_event,
-        sample_event, update_radiance_event, deposit_samples_event;
+    RenderRows(0, num_tile_rows, true, tile_rows_done, kernel_times, checkpoint);
+}
+
+void TileRendering::RenderTileRows(unsigned int first_tile_row, unsigned int end_tile_row, bool clear_film,
+                                   const TileRowsCallback& tile_rows_done) const
+{
+    RenderRows(first_tile_row, std::min(end_tile_row, num_tile_rows), clear_film, tile_rows_done, nullptr, nullptr);
+}
+
+void TileRendering::RenderPass(unsigned int sample_pass, KernelTimes* kernel_times) const
+{
+    RenderRows(0, num_tile_rows, sample_pass == 0, nullptr, kernel_times, nullptr, sample_pass);
+}
+
+void TileRendering::RenderRows(unsigned int first_tile_row, unsigned int end_tile_row, bool clear_film,
+                               const TileRowsCallback& tile_rows_done, KernelTimes* kernel_times,
+                               RenderCheckpoint* checkpoint, unsigned int sample_pass) const
+{
+    // Every band of rows of every pass has its own generator stream
+    rendering_kernel.SetTileRows(first_tile_row, end_tile_row, sample_pass * num_tile_rows + first_tile_row);
+
+    // Dependencies between the commands, the queue can be out of order
+    EventGraph event_graph;
+    const unsigned int num_lanes{ rendering_kernel.NumLanes() };
 
-    // Initially set all pixels and filter weight to zero
-    SetRasterToZero();
+    // Kernel commands to profile before their events are released
+    std::vector<std::pair<EventGraph::Node, KernelId>> kernel_nodes;
 
-    // Run Initialise kernel
-    rendering_kernel.RunInitialise(command_queue, 0, nullptr, &initialise_event);
+    // The last command of each lane is what the next Restart of the lane waits for
+    std::vector<EventGraph::Node> lane_nodes(num_lanes);
+    std::vector<EventGraph::Node> reset_nodes;
+    if (checkpoint != nullptr && checkpoint->CanResume())
+    {
+        // The restored samples continue from where they were, the Restart below does not change them
+        checkpoint->Restore(command_queue, rendering_data, tile_description, film_window,
+                            rendering_options.storage_layout, event_graph, reset_nodes);
+        std::fill(lane_nodes.begin(), lane_nodes.end(), reset_nodes.back());
+    }
+    else
+    {
+        // Initially set all pixels, filter weight and counters to zero, the fills are independent
+        if (clear_film)
+        {
+            SetRasterToZero(event_graph, reset_nodes);
+        }
+        ResetSamplesDone(event_graph, reset_nodes);
+
+        // Run Initialise kernel
+        for (unsigned int lane = 0; lane != num_lanes; lane++)
+        {
+            lane_nodes[lane] = event_graph.Add({}, [&](cl_uint num_wait, const cl_event* wait, cl_event* event)
+            {
+                rendering_kernel.RunInitialise(command_queue, num_wait, wait, event, lane);
+            });
+            kernel_nodes.emplace_back(lane_nodes[lane], KernelId::Initialise);
+        }
+    }
     bool first_restart{ true };
 
     cl_uint samples_done{ 0 };
+    // Samples that left each row of tiles and number of rows already reported as done
+    std::vector<cl_uint> tile_row_samples(num_tile_rows, 0);
+    unsigned int tile_rows_reported{ first_tile_row };
+    std::vector<EventGraph::Node> restart_nodes(num_lanes);
     while (true)
     {
         // Restart the samples
-        if (first_restart)
+        for (unsigned int lane = 0; lane != num_lanes; lane++)
         {
-            rendering_kernel.RunRestart(command_queue, 1, &initialise_event, &restart_event);
-            first_restart = false;
+            std::vector<EventGraph::Node> restart_dependencies{ lane_nodes[lane] };
+            if (first_restart)
+            {
+                restart_dependencies.insert(restart_dependencies.end(), reset_nodes.cbegin(), reset_nodes.cend());
+            }
+            restart_nodes[lane] = event_graph.Add(restart_dependencies,
+                                                  [&](cl_uint num_wait, const cl_event* wait, cl_event* event)
+                                                  {
+                                                      rendering_kernel.RunRestart(command_queue, num_wait, wait,
+                                                                                  event, lane);
+                                                  });
+            kernel_nodes.emplace_back(restart_nodes[lane], KernelId::Restart);
         }
-        else
+        first_restart = false;
+
+        // Copy to host the rows of tiles counters, the blocking read below waits for them
+        std::vector<EventGraph::Node> counters_dependencies{ restart_nodes };
+        if (tile_rows_done)
         {
-            rendering_kernel.RunRestart(command_queue, 1, &deposit_samples_event, &restart_event);
+            counters_dependencies.push_back(
+                event_graph.Add(restart_nodes, [&](cl_uint num_wait, const cl_event* wait, cl_event* event)
+                {
+                    CL_CHECK_CALL(clEnqueueReadBuffer(command_queue,
+                                                      rendering_data.d_samples.tile_rows_done,
+                                                      CL_FALSE,
+                                                      0, num_tile_rows * sizeof(cl_uint), tile_row_samples.data(),
+                                                      num_wait, wait, event));
+                }));
         }
 
         // Copy to host the number of samples that are done
-        CL_CHECK_CALL(clEnqueueReadBuffer(command_queue,
-                                          rendering_data.d_samples.samples_done,
-                                          CL_TRUE,
-                                          0, sizeof(cl_uint), &samples_done,
-                                          0, nullptr, nullptr));
+        event_graph.Add(counters_dependencies, [&](cl_uint num_wait, const cl_event* wait, cl_event* event)
+        {
+            CL_CHECK_CALL(clEnqueueReadBuffer(command_queue,
+                                              rendering_data.d_samples.samples_done,
+                                              CL_TRUE,
+                                              0, sizeof(cl_uint), &samples_done,
+                                              num_wait, wait, event));
+        });
+
+        // Everything enqueued so far is complete, the next commands do not need to wait for it
+        if (kernel_times != nullptr)
+        {
+            AccumulateKernelTimes(event_graph, kernel_nodes, *kernel_times);
+        }
+        kernel_nodes.clear();
+        event_graph.Clear();
+
+        // Samples leave the rows of tiles in order so the completed rows are always a prefix
+        if (tile_rows_done)
+        {
+            unsigned int tile_rows_completed{ tile_rows_reported };
+            while (tile_rows_completed != end_tile_row &&
+                   tile_row_samples[tile_rows_completed] == tile_description.TotalSamples())
+            {
+                tile_rows_completed++;
+            }
+            if (tile_rows_completed != tile_rows_reported)
+            {
+                tile_rows_done(tile_rows_reported, tile_rows_completed);
+                tile_rows_reported = tile_rows_completed;
+            }
+        }
+
         // Check if we are done rendering
         if (samples_done == tile_description.TotalSamples())
         {
             break;
         }
 
-        // Intersect the rays
-        rendering_kernel.RunIntersect(command_queue, 1, &restart_event, &intersect_event);
+        // Nothing is running, copy the state on the transfer queue and let the next kernels wait for the copies
+        std::vector<EventGraph::Node> checkpoint_nodes;
+        if (checkpoint != nullptr && checkpoint->Due())
+        {
+            checkpoint->Capture(transfer_queue, rendering_data, tile_description, film_window,
+                                rendering_options.storage_layout, event_graph, checkpoint_nodes);
+        }
 
-        // Sample the BRDF
-        rendering_kernel.RunSampleBRDF(command_queue, 1, &intersect_event, &sample_event);
+        // Each lane runs its pipeline independently of the others
+        for (unsigned int lane = 0; lane != num_lanes; lane++)
+        {
+            // Intersect the rays
+            const auto intersect_node = event_graph.Add(checkpoint_nodes, [&](cl_uint num_wait,
+                                                                              const cl_event* wait, cl_event* event)
+            {
+                rendering_kernel.RunIntersect(command_queue, num_wait, wait, event, lane);
+            });
+
+            // Sample the BRDF
+            const auto sample_node = event_graph.Add({ intersect_node }, [&](cl_uint num_wait, const cl_event* wait,
+                                                                             cl_event* event)
+            {
+                rendering_kernel.RunSampleBRDF(command_queue, num_wait, wait, event, lane);
+            });
+
+            // Update radiance
+            const auto update_radiance_node = event_graph.Add({ sample_node }, [&](cl_uint num_wait,
+                                                                                   const cl_event* wait,
+                                                                                   cl_event* event)
+            {
+                rendering_kernel.RunUpdateRadiance(command_queue, num_wait, wait, event, lane);
+            });
 
-        // Update radiance
-        rendering_kernel.RunUpdateRadiance(command_queue, 1, &sample_event, &update_radiance_event);
+            // Deposit samples
+            lane_nodes[lane] = event_graph.Add({ update_radiance_node }, [&](cl_uint num_wait, const cl_event* wait,
+                                                                             cl_event* event)
+            {
+                rendering_kernel.RunDepositSamples(command_queue, num_wait, wait, event, lane);
+            });
+
+            kernel_nodes.emplace_back(intersect_node, KernelId::Intersect);
+            kernel_nodes.emplace_back(sample_node, KernelId::SampleBRDF);
+            kernel_nodes.emplace_back(update_radiance_node, KernelId::UpdateRadiance);
+            kernel_nodes.emplace_back(lane_nodes[lane], KernelId::DepositSamples);
+        }
 
-        // Deposit samples
-        rendering_kernel.RunDepositSamples(command_queue, 1, &update_radiance_event, &deposit_samples_event);
+        // Start the lanes while the host enqueues the next commands
+        CL_CHECK_CALL(clFlush(command_queue));
     }
 }
 
@@ -105,6 +284,10 @@ void TileRendering::Cleanup() noexcept
         {
             CL_CHECK_CALL(clReleaseCommandQueue(command_queue));
         }
+        if (transfer_queue != nullptr)
+        {
+            CL_CHECK_CALL(clReleaseCommandQueue(transfer_queue));
+        }
     }
     catch (const std::exception& ex)
     {
@@ -113,22 +296,108 @@ void TileRendering::Cleanup() noexcept
     }
 }
 
-void TileRendering::SetRasterToZero() const
+LaunchTuning TileRendering::SceneTileTuning(RenderingDevice& device, const RenderingOptions& options,
+                                            const ::CL::Scene& scene)
+{
+    LaunchTuning tuning{ FindLaunchTuning(device, options.ResolveForDevice(device.Device()), scene, nullptr) };
+    tuning.tile_width = 0;
+    tuning.tile_height = 0;
+
+    return tuning;
+}
+
+std::string TileRendering::TuningKey(cl_device_id device, const RenderingOptions& resolved_options,
+                                     const ::CL::Scene& scene)
 {
-    std::array<cl_event, 4> fill_events;
+    // Defines of the program without the specialisation constants, the tile size they hold is part of the tuning
+    return TuningCache::DeviceKey(device, resolved_options.ProgramDefines() + scene.ProgramDefines());
+}
+
+LaunchTuning TileRendering::FindLaunchTuning(RenderingDevice& device, const RenderingOptions& resolved_options,
+                                             const ::CL::Scene& scene, const LaunchTuning* tuning)
+{
+    if (tuning != nullptr)
+    {
+        return *tuning;
+    }
+
+    // Use the defaults if the device was never tuned
+    LaunchTuning cached_tuning;
+    device.Tuning().Find(TuningKey(device.Device(), resolved_options, scene), cached_tuning);
 
-    const cl_float zero{ 0 };
+    return cached_tuning;
+}
+
+void TileRendering::AccumulateKernelTimes(const EventGraph& event_graph,
+                                          const std::vector<std::pair<EventGraph::Node, KernelId>>& kernel_nodes,
+                                          KernelTimes& kernel_times) const
+{
+    for (const auto& kernel_node : kernel_nodes)
+    {
+        cl_ulong start, end;
+        const cl_event kernel_event{ event_graph.Event(kernel_node.first) };
+        CL_CHECK_CALL(clGetEventProfilingInfo(kernel_event, CL_PROFILING_COMMAND_START, sizeof(cl_ulong),
+                                              &start, nullptr));
+        CL_CHECK_CALL(clGetEventProfilingInfo(kernel_event, CL_PROFILING_COMMAND_END, sizeof(cl_ulong),
+                                              &end, nullptr));
+        kernel_times.nanoseconds[static_cast<unsigned int>(kernel_node.second)] += end - start;
+    }
+}
+
+void TileRendering::SetRasterToZero(EventGraph& event_graph, std::vector<EventGraph::Node>& fill_nodes) const
+{
     const size_t buffer_size{ rendering_data.d_pixels.num_pixels * sizeof(cl_float) };
+    std::vector<cl_mem> buffers{ rendering_data.d_pixels.pixel_r, rendering_data.d_pixels.pixel_g,
+                                 rendering_data.d_pixels.pixel_b, rendering_data.d_pixels.filter_weight };
+    const AuxiliaryPixels& auxiliary{ rendering_data.d_auxiliary };
+    if (auxiliary.num_pixels != 0)
+    {
+        buffers.insert(buffers.end(), { auxiliary.albedo_r, auxiliary.albedo_g, auxiliary.albedo_b,
+                                        auxiliary.normal_x, auxiliary.normal_y, auxiliary.normal_z });
+    }
+    // The cost counters are cl_uint of the same size, a float zero clears them too
+    if (rendering_data.d_cost.num_pixels != 0)
+    {
+        buffers.insert(buffers.end(), { rendering_data.d_cost.rays, rendering_data.d_cost.tests });
+    }
+    for (cl_mem buffer : buffers)
+    {
+        fill_nodes.push_back(event_graph.Add({}, [&](cl_uint num_wait, const cl_event* wait, cl_event* event)
+        {
+            const cl_float zero{ 0 };
+            CL_CHECK_CALL(clEnqueueFillBuffer(command_queue, buffer, &zero, sizeof(cl_float),
+                                              0, buffer_size, num_wait, wait, event));
+        }));
+    }
+    // The counters add up over the passes rendered on the same film
+    if (rendering_data.d_statistics.counters != nullptr)
+    {
+        fill_nodes.push_back(event_graph.Add({}, [&](cl_uint num_wait, const cl_event* wait, cl_event* event)
+        {
+            const cl_uint zero{ 0 };
+            CL_CHECK_CALL(clEnqueueFillBuffer(command_queue, rendering_data.d_statistics.counters, &zero,
+                                              sizeof(cl_uint), 0,
+                                              2 * StatisticsCounters::NUM_COUNTERS * sizeof(cl_uint),
+                                              num_wait, wait, event));
+        }));
+    }
+}
 
-    CL_CHECK_CALL(clEnqueueFillBuffer(command_queue, rendering_data.d_pixels.pixel_r, &zero, sizeof(cl_float),
-                                      0, buffer_size, 0, nullptr, &fill_events[0]));
-    CL_CHECK_CALL(clEnqueueFillBuffer(command_queue, rendering_data.d_pixels.pixel_g, &zero, sizeof(cl_float),
-                                      0, buffer_size, 0, nullptr, &fill_events[1]));
-    CL_CHECK_CALL(clEnqueueFillBuffer(command_queue, rendering_data.d_pixels.pixel_b, &zero, sizeof(cl_float),
-                                      0, buffer_size, 0, nullptr, &fill_events[2]));
-    CL_CHECK_CALL(clEnqueueFillBuffer(command_queue, rendering_data.d_pixels.filter_weight, &zero, sizeof(cl_float),
-                                      0, buffer_size, 0, nullptr, &fill_events[3]));
-    CL_CHECK_CALL(clWaitForEvents(4, fill_events.data()));
+void TileRendering::ResetSamplesDone(EventGraph& event_graph, std::vector<EventGraph::Node>& fill_nodes) const
+{
+    fill_nodes.push_back(event_graph.Add({}, [&](cl_uint num_wait, const cl_event* wait, cl_event* event)
+    {
+        const cl_uint zero{ 0 };
+        CL_CHECK_CALL(clEnqueueFillBuffer(command_queue, rendering_data.d_samples.samples_done, &zero,
+                                          sizeof(cl_uint), 0, sizeof(cl_uint), num_wait, wait, event));
+    }));
+    fill_nodes.push_back(event_graph.Add({}, [&](cl_uint num_wait, const cl_event* wait, cl_event* event)
+    {
+        const cl_uint zero{ 0 };
+        CL_CHECK_CALL(clEnqueueFillBuffer(command_queue, rendering_data.d_samples.tile_rows_done, &zero,
+                                          sizeof(cl_uint), 0, num_tile_rows * sizeof(cl_uint),
+                                          num_wait, wait, event));
+    }));
 }
 
 } // CL namespace
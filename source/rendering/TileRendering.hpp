@@ -6,6 +6,11 @@
 #define RABBIT_TILERENDERING_HPP
 
 #include "RenderingKernels.hpp"
+#include "RenderingDevice.hpp"
+#include "EventGraph.hpp"
+#include "RenderCheckpoint.hpp"
+
+#include <functional>
 
 namespace Rendering
 {
@@ -15,35 +20,111 @@ namespace CL
 class TileRendering
 {
 public:
-    TileRendering(cl_context context, cl_device_id device, cl_command_queue_properties queue_properties,
-                  const SceneDescription& scene_description, const ::CL::Scene& scene);
+    // Called with the range [first, end) of rows of tiles whose pixels will not change anymore
+    using TileRowsCallback = std::function<void(unsigned int, unsigned int)>;
+
+    // The rendering data is carved from the device arena and the kernels come from its program cache,
+    // the device must outlive the object. The launch tuning is looked up in the device tuning cache if not given
+    TileRendering(RenderingDevice& device, cl_command_queue_properties queue_properties,
+                  const SceneDescription& scene_description, const ::CL::Scene& scene,
+                  const RenderingOptions& options, const LaunchTuning* tuning = nullptr);
 
     ~TileRendering() noexcept;
 
+    // Tuned work-group sizes of the device with the tile size of the scene, for renders whose rows of tiles must line
+    // up with the ones of other renderers
+    static LaunchTuning SceneTileTuning(RenderingDevice& device, const RenderingOptions& options,
+                                        const ::CL::Scene& scene);
+
+    // Key of the tuning cache for the device and the program variant built for the options and the scene, the
+    // options must be resolved for the device
+    static std::string TuningKey(cl_device_id device, const RenderingOptions& resolved_options,
+                                 const ::CL::Scene& scene);
+
     // Access TileDescription from the context
     const TileDescription& GetTileDescription() const noexcept
     {
         return tile_description;
     }
 
-    // Render image
-    void Render() const;
+    // Number of rows of tiles in the image
+    unsigned int NumTileRows() const noexcept
+    {
+        return num_tile_rows;
+    }
+
+    // Work-group size used for the kernel
+    size_t LocalSize(KernelId kernel) const noexcept
+    {
+        return rendering_kernel.LocalSize(kernel);
+    }
+
+    // Render image, the callback is invoked in order as rows of tiles complete so they can be read back
+    // on the transfer queue while the rest of the image renders. The kernel times are accumulated if given,
+    // the queue must have profiling enabled. With a checkpoint the render continues from its state if it can resume
+    // and the state is dumped periodically
+    void Render(const TileRowsCallback& tile_rows_done = nullptr, KernelTimes* kernel_times = nullptr,
+                RenderCheckpoint* checkpoint = nullptr) const;
+
+    // Render only the rows of tiles [first, end) on top of the film, the pixels of the other rows are not changed.
+    // The film is cleared first if asked, the random number generators of each band start from different states
+    void RenderTileRows(unsigned int first_tile_row, unsigned int end_tile_row, bool clear_film,
+                        const TileRowsCallback& tile_rows_done = nullptr) const;
+
+    // Render the samples of the tile description for the whole image on top of the film, the film is cleared before
+    // the first pass. Each pass draws different random numbers so the passes add up to a render with more samples.
+    // The kernel times are accumulated if given, the queue must have profiling enabled
+    void RenderPass(unsigned int sample_pass, KernelTimes* kernel_times = nullptr) const;
 
 private:
     friend class RenderingContext;
+    friend class HybridRendering;
+
+    // Render the rows of tiles with the random number generators of the pass, the film is left as it is if it is not
+    // cleared or restored from the checkpoint
+    void RenderRows(unsigned int first_tile_row, unsigned int end_tile_row, bool clear_film,
+                    const TileRowsCallback& tile_rows_done, KernelTimes* kernel_times,
+                    RenderCheckpoint* checkpoint, unsigned int sample_pass = 0) const;
 
     // Cleanup OpenCL resource without throwing
     void Cleanup() noexcept;
 
-    // Set pixel and filter weight to 0
-    void SetRasterToZero() const;
+    // Tuning to use for the device, options and scene
+    static LaunchTuning FindLaunchTuning(RenderingDevice& device, const RenderingOptions& resolved_options,
+                                         const ::CL::Scene& scene, const LaunchTuning* tuning);
+
+    // Add the execution time of the kernel commands to the times
+    void AccumulateKernelTimes(const EventGraph& event_graph,
+                               const std::vector<std::pair<EventGraph::Node, KernelId>>& kernel_nodes,
+                               KernelTimes& kernel_times) const;
+
+    // Set pixel, filter weight and the statistics counters to 0, adds the fill commands to the graph
+    void SetRasterToZero(EventGraph& event_graph, std::vector<EventGraph::Node>& fill_nodes) const;
+
+    // Set the number of samples done and the rows of tiles to 0, adds the fill commands to the graph
+    void ResetSamplesDone(EventGraph& event_graph, std::vector<EventGraph::Node>& fill_nodes) const;
 
     // Command queue where the commands are issued for the tile rendering
     cl_command_queue command_queue;
 
+    // Command queue for the copies of the completed pixels back to the host
+    cl_command_queue transfer_queue;
+
+    // Rendering options with the choices resolved for the device
+    const RenderingOptions rendering_options;
+
+    // Tile and work-group sizes, from the tuning cache of the device if it was tuned
+    const LaunchTuning launch_tuning;
+
     // Description of the tile
     const TileDescription tile_description;
 
+    // Window of the image rendered, the checkpoints are only valid for it
+    const CropWindow film_window;
+
+    // Number of rows of tiles to cover the image
+    const unsigned int num_tile_rows;
+
     // Rendering data
     RenderingData rendering_data;
 
@@ -0,0 +1,259 @@
+//
+// Created by Simon on 2019-03-26.
+//
+
+#include "AccelerationStructure.hpp"
+#include "WideBVH.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+namespace
+{
+
+constexpr std::array<float, 12> IDENTITY_TRANSFORM{ 1.f, 0.f, 0.f, 0.f,
+                                                    0.f, 1.f, 0.f, 0.f,
+                                                    0.f, 0.f, 1.f, 0.f };
+
+// Invert an affine transform given as rows of a 3x4 matrix, throws if it is singular
+std::array<float, 12> InvertTransform(const std::array<float, 12>& m)
+{
+    // Cofactors of the linear part
+    const float c00{ m[5] * m[10] - m[6] * m[9] };
+    const float c01{ m[6] * m[8] - m[4] * m[10] };
+    const float c02{ m[4] * m[9] - m[5] * m[8] };
+    const float determinant{ m[0] * c00 + m[1] * c01 + m[2] * c02 };
+    if (std::abs(determinant) < 1e-12f)
+    {
+        throw std::invalid_argument{ "Instance transform is not invertible" };
+    }
+    const float inv_det{ 1.f / determinant };
+
+    std::array<float, 12> inverse;
+    inverse[0] = c00 * inv_det;
+    inverse[1] = (m[2] * m[9] - m[1] * m[10]) * inv_det;
+    inverse[2] = (m[1] * m[6] - m[2] * m[5]) * inv_det;
+    inverse[4] = c01 * inv_det;
+    inverse[5] = (m[0] * m[10] - m[2] * m[8]) * inv_det;
+    inverse[6] = (m[2] * m[4] - m[0] * m[6]) * inv_det;
+    inverse[8] = c02 * inv_det;
+    inverse[9] = (m[1] * m[8] - m[0] * m[9]) * inv_det;
+    inverse[10] = (m[0] * m[5] - m[1] * m[4]) * inv_det;
+
+    // Translation is the inverse linear part applied to the opposite of the translation
+    for (unsigned int row = 0; row != 3; row++)
+    {
+        inverse[row * 4 + 3] = -(inverse[row * 4] * m[3] + inverse[row * 4 + 1] * m[7] +
+                                 inverse[row * 4 + 2] * m[11]);
+    }
+
+    return inverse;
+}
+
+Vector3 TransformPoint(const std::array<float, 12>& m, const Vector3& p) noexcept
+{
+    return { m[0] * p.x + m[1] * p.y + m[2] * p.z + m[3],
+             m[4] * p.x + m[5] * p.y + m[6] * p.z + m[7],
+             m[8] * p.x + m[9] * p.y + m[10] * p.z + m[11] };
+}
+
+// World bounds of a box placed with the transform
+BBox TransformBounds(const std::array<float, 12>& m, const BBox& bounds) noexcept
+{
+    BBox transformed_bounds;
+    for (unsigned int corner = 0; corner != 8; corner++)
+    {
+        transformed_bounds.Extend(TransformPoint(m, { (corner & 1) ? bounds.max.x : bounds.min.x,
+                                                      (corner & 2) ? bounds.max.y : bounds.min.y,
+                                                      (corner & 4) ? bounds.max.z : bounds.min.z }));
+    }
+
+    return transformed_bounds;
+}
+
+// Collapse the hierarchies with the given roots and store the nodes in bytes, returns the compressed roots
+template <unsigned int WIDTH>
+std::vector<unsigned int> CollapseHierarchies(const std::vector<BVHNode>& nodes, const std::vector<unsigned int>& roots,
+                                              std::vector<unsigned char>& wide_nodes)
+{
+    WideBVH<WIDTH> wide_bvh;
+    std::vector<unsigned int> wide_roots;
+    for (const auto root : roots)
+    {
+        wide_roots.push_back(wide_bvh.AddHierarchy(nodes, root));
+    }
+    wide_nodes.resize(wide_bvh.nodes.size() * sizeof(WideBVHNode<WIDTH>));
+    std::memcpy(wide_nodes.data(), wide_bvh.nodes.data(), wide_nodes.size());
+
+    return wide_roots;
+}
+
+} // Anonymous namespace
+
+AccelerationStructure::AccelerationStructure(const SceneDescription& scene_description, unsigned int width)
+    : blas_width{ width }
+{
+    if (blas_width != 2)
+    {
+        // Fail before building anything if the width is not supported
+        WideBVHNodeSize(blas_width);
+    }
+
+    // Bottom level hierarchies of the prototypes
+    std::vector<bool> instanced_sphere(scene_description.NumSpheres(), false);
+    for (const auto& prototype : scene_description.loaded_prototypes)
+    {
+        std::vector<unsigned int> spheres;
+        for (unsigned int s = prototype.first_sphere; s != prototype.first_sphere + prototype.num_spheres; s++)
+        {
+            spheres.push_back(s);
+            instanced_sphere[s] = true;
+        }
+        prototype_roots.push_back(AddPrototype(scene_description, spheres));
+    }
+
+    std::vector<Instance> scene_instances{ scene_description.loaded_instances };
+
+    // Spheres outside the prototypes and triangles form one more prototype with an identity instance
+    std::vector<unsigned int> world_primitives;
+    for (unsigned int s = 0; s != scene_description.NumSpheres(); s++)
+    {
+        if (!instanced_sphere[s])
+        {
+            world_primitives.push_back(s);
+        }
+    }
+    for (unsigned int t = 0; t != scene_description.NumTriangles(); t++)
+    {
+        world_primitives.push_back(scene_description.NumSpheres() + t);
+    }
+    if (!world_primitives.empty())
+    {
+        prototype_roots.push_back(AddPrototype(scene_description, world_primitives));
+        scene_instances.push_back(Instance{ IDENTITY_TRANSFORM,
+                                            static_cast<unsigned int>(prototype_roots.size() - 1) });
+    }
+
+    // Top level hierarchy over the world bounds of the instances
+    std::vector<BBox> instance_bounds;
+    for (const auto& instance : scene_instances)
+    {
+        instance_bounds.push_back(TransformBounds(instance.transform,
+                                                  blas_nodes[prototype_roots[instance.prototype]].Bounds()));
+    }
+    if (instance_bounds.empty())
+    {
+        throw std::invalid_argument{ "The scene has no geometry to build the acceleration structure for" };
+    }
+    BVH tlas{ instance_bounds };
+    tlas_nodes = std::move(tlas.nodes);
+
+    // Store the instances in leaf order so the leaves reference them without indirection
+    for (const auto instance_index : tlas.primitive_indices)
+    {
+        const Instance& instance{ scene_instances[instance_index] };
+        const std::array<float, 12> world_to_object{ InvertTransform(instance.transform) };
+
+        InstanceNode instance_node{};
+        std::copy(world_to_object.cbegin(), world_to_object.cend(), instance_node.world_to_object);
+        instance_node.root_node = prototype_roots[instance.prototype];
+        instances.push_back(instance_node);
+    }
+
+    // Refit order and build quality of the hierarchies
+    std::vector<std::vector<unsigned int>> blas_levels;
+    std::vector<std::vector<unsigned int>> blas_level_prototypes;
+    for (unsigned int p = 0; p != prototype_roots.size(); p++)
+    {
+        BVH::NodesByDepth(blas_nodes, prototype_roots[p], blas_levels);
+        blas_level_prototypes.resize(blas_levels.size());
+        for (unsigned int l = 0; l != blas_levels.size(); l++)
+        {
+            blas_level_prototypes[l].resize(blas_levels[l].size(), p);
+        }
+        prototype_costs.push_back(BVH::SAHCost(blas_nodes, prototype_roots[p]));
+    }
+    for (auto l = blas_levels.size(); l-- != 0;)
+    {
+        blas_refit_levels.push_back(static_cast<unsigned int>(blas_refit_nodes.size()));
+        blas_refit_nodes.insert(blas_refit_nodes.end(), blas_levels[l].cbegin(), blas_levels[l].cend());
+        blas_refit_prototypes.insert(blas_refit_prototypes.end(),
+                                     blas_level_prototypes[l].cbegin(), blas_level_prototypes[l].cend());
+    }
+    blas_refit_levels.push_back(static_cast<unsigned int>(blas_refit_nodes.size()));
+
+    std::vector<std::vector<unsigned int>> tlas_levels;
+    BVH::NodesByDepth(tlas_nodes, 0, tlas_levels);
+    for (auto l = tlas_levels.size(); l-- != 0;)
+    {
+        tlas_refit_levels.push_back(static_cast<unsigned int>(tlas_refit_nodes.size()));
+        tlas_refit_nodes.insert(tlas_refit_nodes.end(), tlas_levels[l].cbegin(), tlas_levels[l].cend());
+    }
+    tlas_refit_levels.push_back(static_cast<unsigned int>(tlas_refit_nodes.size()));
+
+    // Collapse the bottom level hierarchies, the quantised bounds can not be refit so only the top level keeps
+    // its refit order
+    if (blas_width != 2)
+    {
+        const std::vector<unsigned int> wide_roots{ blas_width == 4 ?
+                                                    CollapseHierarchies<4>(blas_nodes, prototype_roots,
+                                                                           blas_wide_nodes) :
+                                                    CollapseHierarchies<8>(blas_nodes, prototype_roots,
+                                                                           blas_wide_nodes) };
+        for (auto& instance : instances)
+        {
+            const auto prototype = std::find(prototype_roots.cbegin(), prototype_roots.cend(), instance.root_node);
+            instance.root_node = wide_roots[prototype - prototype_roots.cbegin()];
+        }
+        prototype_roots = wide_roots;
+        blas_refit_nodes.clear();
+        blas_refit_prototypes.clear();
+        blas_refit_levels.clear();
+    }
+}
+
+unsigned int AccelerationStructure::AddPrototype(const SceneDescription& scene_description,
+                                                 const std::vector<unsigned int>& primitives)
+{
+    std::vector<BBox> primitive_bounds;
+    for (const auto primitive : primitives)
+    {
+        if (primitive < scene_description.NumSpheres())
+        {
+            const Sphere& sphere{ scene_description.loaded_spheres[primitive] };
+            const Vector3 center{ sphere.cx, sphere.cy, sphere.cz };
+            primitive_bounds.emplace_back(center - Vector3{ sphere.radius }, center + Vector3{ sphere.radius });
+        }
+        else
+        {
+            BBox triangle_bounds;
+            const unsigned int triangle{ primitive - scene_description.NumSpheres() };
+            for (unsigned int v = 0; v != 3; v++)
+            {
+                const unsigned int vertex{ scene_description.mesh_indices[3 * triangle + v] };
+                triangle_bounds.Extend(Vector3{ scene_description.mesh_vertices[3 * vertex],
+                                                scene_description.mesh_vertices[3 * vertex + 1],
+                                                scene_description.mesh_vertices[3 * vertex + 2] });
+            }
+            primitive_bounds.push_back(triangle_bounds);
+        }
+    }
+    const BVH blas{ primitive_bounds };
+
+    // Move the node and primitive references after the hierarchies already added
+    const auto node_offset = static_cast<unsigned int>(blas_nodes.size());
+    const auto primitive_offset = static_cast<unsigned int>(primitive_indices.size());
+    for (BVHNode node : blas.nodes)
+    {
+        node.left_first += node.count == 0 ? node_offset : primitive_offset;
+        blas_nodes.push_back(node);
+    }
+    for (const auto primitive : blas.primitive_indices)
+    {
+        primitive_indices.push_back(primitives[primitive]);
+    }
+
+    return node_offset;
+}
@@ -0,0 +1,66 @@
+//
+// Created by Simon on 2019-03-26.
+//
+
+#ifndef RABBIT_ACCELERATIONSTRUCTURE_HPP
+#define RABBIT_ACCELERATIONSTRUCTURE_HPP
+
+#include "BVH.hpp"
+#include "SceneParser.hpp"
+
+// Instance layout on the device
+struct InstanceNode
+{
+    // World to prototype transform, rows of a 3x4 matrix
+    float world_to_object[12];
+    // Root of the bottom level hierarchy of the prototype
+    unsigned int root_node;
+    unsigned int padding[3];
+};
+
+// Two level acceleration structure: a bottom level hierarchy over the primitives of each prototype and a top level
+// hierarchy over the instances. Memory scales with the unique geometry, not with the number of instances.
+// Primitives are numbered with the spheres first and the triangles after them
+class AccelerationStructure
+{
+public:
+    // Build the hierarchies for the scene, spheres not part of a prototype and triangles are placed with an
+    // identity instance. A width of 4 or 8 collapses the bottom level hierarchies to compressed wide nodes,
+    // throws for other widths than 2, 4 and 8
+    explicit AccelerationStructure(const SceneDescription& scene_description, unsigned int width = 2);
+
+    // Number of children of the bottom level nodes
+    const unsigned int blas_width;
+
+    // Nodes of the bottom level hierarchies of all the prototypes
+    std::vector<BVHNode> blas_nodes;
+    // Compressed nodes the binary ones are collapsed to if the width is not 2, the instances and the prototype
+    // roots reference them. Stored as bytes since the node type depends on the width, see WideBVHNode
+    std::vector<unsigned char> blas_wide_nodes;
+    // Primitives referenced by the bottom level leaves
+    std::vector<unsigned int> primitive_indices;
+
+    // Nodes of the top level hierarchy, the leaves reference the instances directly
+    std::vector<BVHNode> tlas_nodes;
+    // Instances in the order of the top level leaves
+    std::vector<InstanceNode> instances;
+
+    // Root of the bottom level hierarchy of each prototype and its surface area heuristic cost after the build
+    std::vector<unsigned int> prototype_roots;
+    std::vector<float> prototype_costs;
+
+    // Nodes in refit order, grouped by depth starting from the deepest level. Level l is the range
+    // [refit_levels[l], refit_levels[l + 1]), the prototype of each bottom level node is kept for the cost check.
+    // Compressed bottom level hierarchies have no refit order
+    std::vector<unsigned int> blas_refit_nodes;
+    std::vector<unsigned int> blas_refit_prototypes;
+    std::vector<unsigned int> blas_refit_levels;
+    std::vector<unsigned int> tlas_refit_nodes;
+    std::vector<unsigned int> tlas_refit_levels;
+
+private:
+    // Build the bottom level hierarchy over the primitives and append it, returns the index of its root
+    unsigned int AddPrototype(const SceneDescription& scene_description, const std::vector<unsigned int>& primitives);
+};
+
+#endif //RABBIT_ACCELERATIONSTRUCTURE_HPP
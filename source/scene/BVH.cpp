@@ -0,0 +1,212 @@
+//
+// Created by Simon on 2019-03-26.
+//
+
+#include "BVH.hpp"
+
+#include <algorithm>
+#include <array>
+#include <numeric>
+#include <stdexcept>
+
+namespace
+{
+
+// Number of bins used to evaluate the splits along an axis
+constexpr unsigned int NUM_BINS{ 16 };
+
+float Component(const Vector3& v, unsigned int axis) noexcept
+{
+    return axis == 0 ? v.x : (axis == 1 ? v.y : v.z);
+}
+
+} // Anonymous namespace
+
+BVH::BVH(const std::vector<BBox>& primitive_bounds)
+{
+    if (primitive_bounds.empty())
+    {
+        throw std::invalid_argument{ "Can not build a BVH without primitives" };
+    }
+
+    std::vector<Vector3> centroids;
+    centroids.reserve(primitive_bounds.size());
+    for (const auto& bounds : primitive_bounds)
+    {
+        centroids.push_back(bounds.Centroid());
+    }
+
+    primitive_indices.resize(primitive_bounds.size());
+    std::iota(primitive_indices.begin(), primitive_indices.end(), 0u);
+
+    // A tree over N primitives has at most 2N - 1 nodes
+    nodes.reserve(2 * primitive_bounds.size() - 1);
+    nodes.push_back(BVHNode{});
+    nodes.front().left_first = 0;
+    nodes.front().count = static_cast<unsigned int>(primitive_bounds.size());
+
+    Subdivide(0, 0, primitive_bounds, centroids);
+}
+
+void BVH::Subdivide(unsigned int node_index, unsigned int depth,
+                    const std::vector<BBox>& primitive_bounds, const std::vector<Vector3>& centroids)
+{
+    const unsigned int first{ nodes[node_index].left_first };
+    const unsigned int count{ nodes[node_index].count };
+
+    // Bounds of the primitives and of their centroids
+    BBox node_bounds, centroid_bounds;
+    for (unsigned int p = first; p != first + count; p++)
+    {
+        node_bounds.Extend(primitive_bounds[primitive_indices[p]]);
+        centroid_bounds.Extend(centroids[primitive_indices[p]]);
+    }
+    nodes[node_index].SetBounds(node_bounds);
+
+    if (count == 1 || depth + 1 == MAX_DEPTH)
+    {
+        return;
+    }
+
+    // Split along the axis with the largest centroid extent
+    const Vector3 centroid_extent{ centroid_bounds.max - centroid_bounds.min };
+    unsigned int axis{ 0 };
+    if (centroid_extent.y > centroid_extent.x)
+    {
+        axis = 1;
+    }
+    if (centroid_extent.z > Component(centroid_extent, axis))
+    {
+        axis = 2;
+    }
+    const float axis_min{ Component(centroid_bounds.min, axis) };
+    const float axis_extent{ Component(centroid_extent, axis) };
+
+    unsigned int middle{ first + count / 2 };
+    if (axis_extent > 0.f)
+    {
+        // Bin the primitives by centroid
+        std::array<BBox, NUM_BINS> bin_bounds;
+        std::array<unsigned int, NUM_BINS> bin_count{};
+        const float bin_scale{ NUM_BINS / axis_extent };
+        const auto bin_index = [&](unsigned int primitive)
+        {
+            const float offset{ Component(centroids[primitive], axis) - axis_min };
+            return std::min(static_cast<unsigned int>(offset * bin_scale), NUM_BINS - 1);
+        };
+        for (unsigned int p = first; p != first + count; p++)
+        {
+            const unsigned int bin{ bin_index(primitive_indices[p]) };
+            bin_bounds[bin].Extend(primitive_bounds[primitive_indices[p]]);
+            bin_count[bin]++;
+        }
+
+        // Sweep from the right to get the cost of the right side of each split
+        std::array<float, NUM_BINS> right_cost{};
+        BBox right_bounds;
+        unsigned int right_count{ 0 };
+        for (unsigned int b = NUM_BINS - 1; b != 0; b--)
+        {
+            right_bounds.Extend(bin_bounds[b]);
+            right_count += bin_count[b];
+            right_cost[b] = right_bounds.SurfaceArea() * right_count;
+        }
+
+        // Sweep from the left and keep the cheapest split, the split b puts the bins before b on the left
+        float best_cost{ std::numeric_limits<float>::max() };
+        unsigned int best_split{ 0 };
+        BBox left_bounds;
+        unsigned int left_count{ 0 };
+        for (unsigned int b = 1; b != NUM_BINS; b++)
+        {
+            left_bounds.Extend(bin_bounds[b - 1]);
+            left_count += bin_count[b - 1];
+            const float cost{ left_bounds.SurfaceArea() * left_count + right_cost[b] };
+            if (left_count != 0 && left_count != count && cost < best_cost)
+            {
+                best_cost = cost;
+                best_split = b;
+            }
+        }
+
+        // Keep a leaf if it is small and the best split is not cheaper than intersecting all its primitives
+        const float split_cost{ TRAVERSAL_COST + best_cost / node_bounds.SurfaceArea() };
+        if (count <= MAX_LEAF_PRIMITIVES && (best_split == 0 || split_cost >= static_cast<float>(count)))
+        {
+            return;
+        }
+
+        if (best_split != 0)
+        {
+            const auto split_iterator = std::partition(primitive_indices.begin() + first,
+                                                       primitive_indices.begin() + first + count,
+                                                       [&](unsigned int primitive)
+                                                       {
+                                                           return bin_index(primitive) < best_split;
+                                                       });
+            middle = static_cast<unsigned int>(split_iterator - primitive_indices.begin());
+        }
+    }
+    else if (count <= MAX_LEAF_PRIMITIVES)
+    {
+        // All centroids are in the same point, there is nothing to gain from splitting a small node
+        return;
+    }
+
+    // Children are allocated next to each other, the node becomes an interior one
+    const auto left_child = static_cast<unsigned int>(nodes.size());
+    nodes.push_back(BVHNode{});
+    nodes.push_back(BVHNode{});
+    nodes[left_child].left_first = first;
+    nodes[left_child].count = middle - first;
+    nodes[left_child + 1].left_first = middle;
+    nodes[left_child + 1].count = first + count - middle;
+    nodes[node_index].left_first = left_child;
+    nodes[node_index].count = 0;
+
+    Subdivide(left_child, depth + 1, primitive_bounds, centroids);
+    Subdivide(left_child + 1, depth + 1, primitive_bounds, centroids);
+}
+
+float BVH::SAHCost(const std::vector<BVHNode>& nodes, unsigned int root)
+{
+    float cost{ 0.f };
+    std::vector<unsigned int> stack{ root };
+    while (!stack.empty())
+    {
+        const BVHNode& node{ nodes[stack.back()] };
+        stack.pop_back();
+        cost += node.Bounds().SurfaceArea() * (node.count != 0 ? static_cast<float>(node.count) : TRAVERSAL_COST);
+        if (node.count == 0)
+        {
+            stack.push_back(node.left_first);
+            stack.push_back(node.left_first + 1);
+        }
+    }
+
+    const float root_area{ nodes[root].Bounds().SurfaceArea() };
+    return root_area > 0.f ? cost / root_area : 0.f;
+}
+
+void BVH::NodesByDepth(const std::vector<BVHNode>& nodes, unsigned int root,
+                       std::vector<std::vector<unsigned int>>& levels)
+{
+    std::vector<std::pair<unsigned int, unsigned int>> stack{ { root, 0 } };
+    while (!stack.empty())
+    {
+        const auto node_depth = stack.back();
+        stack.pop_back();
+        if (levels.size() <= node_depth.second)
+        {
+            levels.resize(node_depth.second + 1);
+        }
+        levels[node_depth.second].push_back(node_depth.first);
+
+        const BVHNode& node{ nodes[node_depth.first] };
+        if (node.count == 0)
+        {
+            stack.emplace_back(node.left_first, node_depth.second + 1);
+            stack.emplace_back(node.left_first + 1, node_depth.second + 1);
+        }
+    }
+}
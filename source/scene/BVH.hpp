@@ -0,0 +1,118 @@
+//
+// Created by Simon on 2019-03-26.
+//
+
+#ifndef RABBIT_BVH_HPP
+#define RABBIT_BVH_HPP
+
+#include "Vector.hpp"
+
+#include <limits>
+#include <vector>
+
+// Axis aligned bounding box
+struct BBox
+{
+    Vector3 min, max;
+
+    // Empty box, extending it with anything gives the other bounds
+    BBox() noexcept
+        : min{ std::numeric_limits<float>::max() }, max{ -std::numeric_limits<float>::max() }
+    {}
+
+    constexpr BBox(const Vector3& min, const Vector3& max) noexcept
+        : min{ min }, max{ max }
+    {}
+
+    void Extend(const Vector3& point) noexcept
+    {
+        min = Min(min, point);
+        max = Max(max, point);
+    }
+
+    void Extend(const BBox& box) noexcept
+    {
+        min = Min(min, box.min);
+        max = Max(max, box.max);
+    }
+
+    const Vector3 Centroid() const noexcept
+    {
+        return 0.5f * (min + max);
+    }
+
+    float SurfaceArea() const noexcept
+    {
+        if (min.x > max.x)
+        {
+            return 0.f;
+        }
+        const Vector3 extent{ max - min };
+        return 2.f * (extent.x * extent.y + extent.x * extent.z + extent.y * extent.z);
+    }
+};
+
+// Node layout shared with the kernel. Interior nodes have count 0 and the two children at left_first and
+// left_first + 1, leaves have count primitives starting at left_first in the primitive indices
+struct BVHNode
+{
+    float min_x, min_y, min_z;
+    unsigned int left_first;
+    float max_x, max_y, max_z;
+    unsigned int count;
+
+    BBox Bounds() const noexcept
+    {
+        return { Vector3{ min_x, min_y, min_z }, Vector3{ max_x, max_y, max_z } };
+    }
+
+    void SetBounds(const BBox& bounds) noexcept
+    {
+        min_x = bounds.min.x;
+        min_y = bounds.min.y;
+        min_z = bounds.min.z;
+        max_x = bounds.max.x;
+        max_y = bounds.max.y;
+        max_z = bounds.max.z;
+    }
+};
+
+// Binary hierarchy built with the binned surface area heuristic, the root is node 0 and every child comes after
+// its parent in the node list
+class BVH
+{
+public:
+    // Maximum depth of the tree, the kernel traversal stack is sized on it
+    static constexpr unsigned int MAX_DEPTH{ 32 };
+    // Leaves with at most this number of primitives are created when splitting does not pay off
+    static constexpr unsigned int MAX_LEAF_PRIMITIVES{ 4 };
+    // Cost of traversing a node relative to intersecting a primitive
+    static constexpr float TRAVERSAL_COST{ 1.f };
+
+    // Build hierarchy over the bounds of the primitives, throws if there are no primitives
+    explicit BVH(const std::vector<BBox>& primitive_bounds);
+
+    BBox Bounds() const noexcept
+    {
+        return nodes.front().Bounds();
+    }
+
+    // Surface area heuristic cost of the tree with the given root, relative to the area of the root
+    static float SAHCost(const std::vector<BVHNode>& nodes, unsigned int root);
+
+    // Append the nodes of the tree with the given root to the level of their depth
+    static void NodesByDepth(const std::vector<BVHNode>& nodes, unsigned int root,
+                             std::vector<std::vector<unsigned int>>& levels);
+
+    // Nodes of the tree
+    std::vector<BVHNode> nodes;
+    // Primitives referenced by the leaves, indices in the list given to the constructor
+    std::vector<unsigned int> primitive_indices;
+
+private:
+    // Recursively split the node over the given primitives bounds and centroids
+    void Subdivide(unsigned int node_index, unsigned int depth,
+                   const std::vector<BBox>& primitive_bounds, const std::vector<Vector3>& centroids);
+};
+
+#endif //RABBIT_BVH_HPP
@@ -0,0 +1,35 @@
+//
+// Created by Simon on 2019-04-04.
+//
+
+#include "CropWindow.hpp"
+
+#include <sstream>
+#include <stdexcept>
+
+CropWindow CropWindow::Parse(const std::string& value)
+{
+    CropWindow window{ 0, 0, 0, 0 };
+    char separator_0, separator_1, separator_2;
+    std::istringstream value_stream{ value };
+    // Nothing but spaces can follow the height
+    if (!(value_stream >> window.x >> separator_0 >> window.y >> separator_1 >> window.width >> separator_2 >>
+          window.height) || !(value_stream >> std::ws).eof() || separator_0 != ',' || separator_1 != ',' ||
+        separator_2 != ',' || window.width == 0 || window.height == 0)
+    {
+        throw std::invalid_argument{ "Invalid crop window: " + value };
+    }
+
+    return window;
+}
+
+void CropWindow::CheckInside(unsigned int image_width, unsigned int image_height) const
+{
+    if (x >= image_width || y >= image_height || width > image_width - x || height > image_height - y)
+    {
+        std::ostringstream error_message;
+        error_message << "The crop window " << x << "," << y << "," << width << "," << height
+                      << " is outside of the " << image_width << "x" << image_height << " image";
+        throw std::invalid_argument{ error_message.str() };
+    }
+}
@@ -0,0 +1,22 @@
+//
+// Created by Simon on 2019-04-04.
+//
+
+#ifndef RABBIT_CROPWINDOW_HPP
+#define RABBIT_CROPWINDOW_HPP
+
+#include <string>
+
+// Rectangle of pixels of an image, the origin is the top left corner of the image
+struct CropWindow
+{
+    unsigned int x, y, width, height;
+
+    // Parse the x,y,width,height form, throws if it is not valid or empty
+    static CropWindow Parse(const std::string& value);
+
+    // Throws if the window is not inside an image of the given size
+    void CheckInside(unsigned int image_width, unsigned int image_height) const;
+};
+
+#endif //RABBIT_CROPWINDOW_HPP
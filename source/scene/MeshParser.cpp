@@ -0,0 +1,535 @@
+//
+// Created by Simon on 2019-03-27.
+//
+
+#include "MeshParser.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+namespace
+{
+
+// Reads a file in large blocks and hands out lines parsed in place, the line terminator is replaced with a null
+class BlockReader
+{
+public:
+    static constexpr size_t BLOCK_SIZE{ 1 << 20 };
+
+    explicit BlockReader(const std::string& filename)
+        : file{ std::fopen(filename.c_str(), "rb") }, buffer(BLOCK_SIZE + 1), position{ 0 }, available{ 0 },
+          end_of_file{ false }
+    {
+        if (file == nullptr)
+        {
+            std::ostringstream error_message;
+            error_message << "Could not open file: " << filename;
+            throw std::invalid_argument{ error_message.str() };
+        }
+    }
+
+    ~BlockReader() noexcept
+    {
+        std::fclose(file);
+    }
+
+    BlockReader(const BlockReader&) = delete;
+
+    BlockReader& operator=(const BlockReader&) = delete;
+
+    // Next line without terminator, nullptr at the end of the file
+    char* NextLine()
+    {
+        while (true)
+        {
+            char* const line_begin{ buffer.data() + position };
+            char* const line_end{ static_cast<char*>(std::memchr(line_begin, '\n', available - position)) };
+            if (line_end != nullptr)
+            {
+                *line_end = '\0';
+                if (line_end != line_begin && *(line_end - 1) == '\r')
+                {
+                    *(line_end - 1) = '\0';
+                }
+                position = static_cast<size_t>(line_end - buffer.data()) + 1;
+                return line_begin;
+            }
+            if (end_of_file)
+            {
+                // Last line without terminator, the buffer always has room for the null
+                if (position == available)
+                {
+                    return nullptr;
+                }
+                buffer[available] = '\0';
+                position = available;
+                return line_begin;
+            }
+            Fill();
+        }
+    }
+
+    // Copy the next bytes, throws if the file ends before
+    void Read(void* data, size_t size)
+    {
+        while (available - position < size)
+        {
+            if (end_of_file)
+            {
+                throw std::runtime_error{ "Unexpected end of file" };
+            }
+            Fill();
+        }
+        std::memcpy(data, buffer.data() + position, size);
+        position += size;
+    }
+
+private:
+    // Move the data not consumed yet to the front and read another block after it
+    void Fill()
+    {
+        std::memmove(buffer.data(), buffer.data() + position, available - position);
+        available -= position;
+        position = 0;
+        if (buffer.size() - available < BLOCK_SIZE + 1)
+        {
+            // A line longer than a block, grow the buffer
+            buffer.resize(available + BLOCK_SIZE + 1);
+        }
+        const size_t bytes_read{ std::fread(buffer.data() + available, 1, BLOCK_SIZE, file) };
+        available += bytes_read;
+        end_of_file = bytes_read < BLOCK_SIZE;
+    }
+
+    std::FILE* file;
+    std::vector<char> buffer;
+    size_t position, available;
+    bool end_of_file;
+};
+
+// Skip spaces and tabs
+const char* SkipSpaces(const char* p) noexcept
+{
+    while (*p == ' ' || *p == '\t')
+    {
+        p++;
+    }
+
+    return p;
+}
+
+// Parse a number and move after it, false if there is no number
+bool ParseFloat(const char*& p, float& value) noexcept
+{
+    char* end;
+    value = std::strtof(p, &end);
+    if (end == p)
+    {
+        return false;
+    }
+    p = end;
+
+    return true;
+}
+
+bool ParseLong(const char*& p, long& value) noexcept
+{
+    char* end;
+    value = std::strtol(p, &end, 10);
+    if (end == p)
+    {
+        return false;
+    }
+    p = end;
+
+    return true;
+}
+
+[[noreturn]] void ThrowParseError(const std::string& filename, unsigned long line_number, const std::string& message)
+{
+    std::ostringstream error_message;
+    error_message << filename << ":" << line_number << ": " << message;
+    throw std::invalid_argument{ error_message.str() };
+}
+
+// Split polygon in a triangle fan around the first vertex
+void AddPolygon(const std::vector<unsigned int>& polygon, std::vector<unsigned int>& indices)
+{
+    for (size_t v = 2; v < polygon.size(); v++)
+    {
+        indices.push_back(polygon[0]);
+        indices.push_back(polygon[v - 1]);
+        indices.push_back(polygon[v]);
+    }
+}
+
+// Scalar property types of PLY files
+enum class PLYType
+{
+    Int8, UInt8, Int16, UInt16, Int32, UInt32, Float32, Float64
+};
+
+PLYType ParsePLYType(const std::string& name)
+{
+    if (name == "char" || name == "int8")
+    {
+        return PLYType::Int8;
+    }
+    if (name == "uchar" || name == "uint8")
+    {
+        return PLYType::UInt8;
+    }
+    if (name == "short" || name == "int16")
+    {
+        return PLYType::Int16;
+    }
+    if (name == "ushort" || name == "uint16")
+    {
+        return PLYType::UInt16;
+    }
+    if (name == "int" || name == "int32")
+    {
+        return PLYType::Int32;
+    }
+    if (name == "uint" || name == "uint32")
+    {
+        return PLYType::UInt32;
+    }
+    if (name == "float" || name == "float32")
+    {
+        return PLYType::Float32;
+    }
+    if (name == "double" || name == "float64")
+    {
+        return PLYType::Float64;
+    }
+
+    throw std::invalid_argument{ "Unknown PLY property type: " + name };
+}
+
+// Read a binary little endian value, the host is assumed to be little endian as well
+double ReadPLYValue(BlockReader& reader, PLYType type)
+{
+    switch (type)
+    {
+        case PLYType::Int8:
+        {
+            std::int8_t value;
+            reader.Read(&value, sizeof(value));
+            return value;
+        }
+        case PLYType::UInt8:
+        {
+            std::uint8_t value;
+            reader.Read(&value, sizeof(value));
+            return value;
+        }
+        case PLYType::Int16:
+        {
+            std::int16_t value;
+            reader.Read(&value, sizeof(value));
+            return value;
+        }
+        case PLYType::UInt16:
+        {
+            std::uint16_t value;
+            reader.Read(&value, sizeof(value));
+            return value;
+        }
+        case PLYType::Int32:
+        {
+            std::int32_t value;
+            reader.Read(&value, sizeof(value));
+            return value;
+        }
+        case PLYType::UInt32:
+        {
+            std::uint32_t value;
+            reader.Read(&value, sizeof(value));
+            return value;
+        }
+        case PLYType::Float32:
+        {
+            float value;
+            reader.Read(&value, sizeof(value));
+            return value;
+        }
+        default:
+        {
+            double value;
+            reader.Read(&value, sizeof(value));
+            return value;
+        }
+    }
+}
+
+struct PLYProperty
+{
+    std::string name;
+    // Type of the value, of the list elements for lists
+    PLYType type;
+    // Lists store the number of elements before them
+    bool is_list;
+    PLYType count_type;
+};
+
+struct PLYElement
+{
+    std::string name;
+    unsigned long count;
+    std::vector<PLYProperty> properties;
+};
+
+} // Anonymous namespace
+
+TriangleMesh MeshParser::ReadMesh(const std::string& filename)
+{
+    const auto extension_begin = filename.find_last_of('.');
+    std::string extension{ extension_begin == std::string::npos ? "" : filename.substr(extension_begin + 1) };
+    std::transform(extension.begin(), extension.end(), extension.begin(),
+                   [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+
+    TriangleMesh mesh;
+    if (extension == "obj")
+    {
+        mesh = ReadOBJ(filename);
+    }
+    else if (extension == "ply")
+    {
+        mesh = ReadPLY(filename);
+    }
+    else
+    {
+        throw std::invalid_argument{ "Unknown mesh format: " + filename };
+    }
+
+    // Check that faces reference existing vertices
+    const unsigned int num_vertices{ mesh.NumVertices() };
+    if (std::any_of(mesh.indices.cbegin(), mesh.indices.cend(),
+                    [num_vertices](unsigned int index) { return index >= num_vertices; }))
+    {
+        throw std::invalid_argument{ "Face references a vertex that does not exist in file: " + filename };
+    }
+
+    return mesh;
+}
+
+TriangleMesh MeshParser::ReadOBJ(const std::string& filename)
+{
+    TriangleMesh mesh;
+    BlockReader reader{ filename };
+
+    std::vector<unsigned int> polygon;
+    unsigned long line_number{ 0 };
+    while (const char* line = reader.NextLine())
+    {
+        line_number++;
+        const char* p{ SkipSpaces(line) };
+
+        if (p[0] == 'v' && (p[1] == ' ' || p[1] == '\t'))
+        {
+            // Vertex position, the optional w is ignored
+            p += 2;
+            float x, y, z;
+            if (!ParseFloat(p, x) || !ParseFloat(p, y) || !ParseFloat(p, z))
+            {
+                ThrowParseError(filename, line_number, "expected v <x> <y> <z>");
+            }
+            mesh.vertices.push_back(x);
+            mesh.vertices.push_back(y);
+            mesh.vertices.push_back(z);
+        }
+        else if (p[0] == 'f' && (p[1] == ' ' || p[1] == '\t'))
+        {
+            // Face vertices are v, v/vt, v//vn or v/vt/vn, only the position index is used
+            p += 2;
+            polygon.clear();
+            long index;
+            while (ParseLong(p, index))
+            {
+                // Indices start from one, negative ones are relative to the last vertex
+                const long num_vertices{ static_cast<long>(mesh.NumVertices()) };
+                const long vertex{ index < 0 ? num_vertices + index : index - 1 };
+                if (index == 0 || vertex < 0)
+                {
+                    ThrowParseError(filename, line_number, "invalid vertex index");
+                }
+                polygon.push_back(static_cast<unsigned int>(vertex));
+                while (*p != '\0' && *p != ' ' && *p != '\t')
+                {
+                    p++;
+                }
+            }
+            if (polygon.size() < 3)
+            {
+                ThrowParseError(filename, line_number, "a face needs at least three vertices");
+            }
+            AddPolygon(polygon, mesh.indices);
+        }
+        // Everything else (normals, texture coordinates, groups, materials) is skipped
+    }
+
+    return mesh;
+}
+
+TriangleMesh MeshParser::ReadPLY(const std::string& filename)
+{
+    BlockReader reader{ filename };
+
+    // Parse the header
+    const char* line{ reader.NextLine() };
+    if (line == nullptr || std::strcmp(line, "ply") != 0)
+    {
+        throw std::invalid_argument{ "Not a PLY file: " + filename };
+    }
+    unsigned long line_number{ 1 };
+    bool binary{ false };
+    std::vector<PLYElement> elements;
+    while ((line = reader.NextLine()) != nullptr)
+    {
+        line_number++;
+        std::istringstream line_stream{ line };
+        std::string keyword;
+        line_stream >> keyword;
+        if (keyword == "end_header")
+        {
+            break;
+        }
+        if (keyword == "format")
+        {
+            std::string format;
+            line_stream >> format;
+            if (format == "binary_little_endian")
+            {
+                binary = true;
+            }
+            else if (format != "ascii")
+            {
+                ThrowParseError(filename, line_number, "unsupported PLY format " + format);
+            }
+        }
+        else if (keyword == "element")
+        {
+            PLYElement element;
+            if (!(line_stream >> element.name >> element.count))
+            {
+                ThrowParseError(filename, line_number, "expected element <name> <count>");
+            }
+            elements.push_back(element);
+        }
+        else if (keyword == "property")
+        {
+            if (elements.empty())
+            {
+                ThrowParseError(filename, line_number, "property outside of an element");
+            }
+            PLYProperty property;
+            std::string type;
+            line_stream >> type;
+            property.is_list = type == "list";
+            property.count_type = PLYType::UInt8;
+            if (property.is_list)
+            {
+                std::string count_type;
+                line_stream >> count_type >> type;
+                property.count_type = ParsePLYType(count_type);
+            }
+            property.type = ParsePLYType(type);
+            if (!(line_stream >> property.name))
+            {
+                ThrowParseError(filename, line_number, "expected property name");
+            }
+            elements.back().properties.push_back(property);
+        }
+        // Comments and obj_info are skipped
+    }
+    if (line == nullptr)
+    {
+        throw std::invalid_argument{ "Missing end_header in file: " + filename };
+    }
+
+    // Read the elements, only the vertex positions and the face indices are kept
+    TriangleMesh mesh;
+    std::vector<unsigned int> polygon;
+    for (const auto& element : elements)
+    {
+        const bool is_vertex{ element.name == "vertex" };
+        const bool is_face{ element.name == "face" };
+        for (unsigned long e = 0; e != element.count; e++)
+        {
+            const char* p{ nullptr };
+            if (!binary)
+            {
+                p = reader.NextLine();
+                line_number++;
+                if (p == nullptr)
+                {
+                    ThrowParseError(filename, line_number, "unexpected end of file");
+                }
+            }
+
+            // Read next value of the element as text or binary
+            const auto next_value = [&](PLYType type)
+            {
+                if (binary)
+                {
+                    return ReadPLYValue(reader, type);
+                }
+                // Integers are parsed as such, indices above 2^24 do not fit a float
+                float float_value;
+                long integer_value;
+                const bool parsed{ type == PLYType::Float32 || type == PLYType::Float64 ?
+                                   ParseFloat(p, float_value) : ParseLong(p, integer_value) };
+                if (!parsed)
+                {
+                    ThrowParseError(filename, line_number, "missing value of " + element.name);
+                }
+                return type == PLYType::Float32 || type == PLYType::Float64 ? static_cast<double>(float_value) :
+                       static_cast<double>(integer_value);
+            };
+
+            float position[3]{ 0.f, 0.f, 0.f };
+            for (const auto& property : element.properties)
+            {
+                if (property.is_list)
+                {
+                    const auto count = static_cast<unsigned long>(next_value(property.count_type));
+                    polygon.clear();
+                    for (unsigned long v = 0; v != count; v++)
+                    {
+                        const double index{ next_value(property.type) };
+                        if (index < 0.0)
+                        {
+                            ThrowParseError(filename, line_number, "invalid vertex index");
+                        }
+                        polygon.push_back(static_cast<unsigned int>(index));
+                    }
+                    if (is_face && (property.name == "vertex_indices" || property.name == "vertex_index"))
+                    {
+                        AddPolygon(polygon, mesh.indices);
+                    }
+                }
+                else
+                {
+                    const double value{ next_value(property.type) };
+                    if (is_vertex && property.name.size() == 1 && property.name[0] >= 'x' && property.name[0] <= 'z')
+                    {
+                        position[property.name[0] - 'x'] = static_cast<float>(value);
+                    }
+                }
+            }
+            if (is_vertex)
+            {
+                mesh.vertices.insert(mesh.vertices.end(), position, position + 3);
+            }
+        }
+    }
+
+    return mesh;
+}
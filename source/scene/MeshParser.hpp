@@ -0,0 +1,44 @@
+//
+// Created by Simon on 2019-03-27.
+//
+
+#ifndef RABBIT_MESHPARSER_HPP
+#define RABBIT_MESHPARSER_HPP
+
+#include <string>
+#include <vector>
+
+// Indexed triangle mesh
+struct TriangleMesh
+{
+    // Vertex positions, three floats for each vertex
+    std::vector<float> vertices;
+    // Vertex indices, three for each triangle
+    std::vector<unsigned int> indices;
+
+    unsigned int NumVertices() const noexcept
+    {
+        return static_cast<unsigned int>(vertices.size() / 3);
+    }
+
+    unsigned int NumTriangles() const noexcept
+    {
+        return static_cast<unsigned int>(indices.size() / 3);
+    }
+};
+
+// Loads the positions and the faces of OBJ and PLY (ascii and binary little endian) files, polygons are split
+// in triangle fans. Files are read in large blocks and parsed in place, so big meshes do not go through iostreams
+class MeshParser
+{
+public:
+    // Read the mesh, the format is selected by the file extension
+    static TriangleMesh ReadMesh(const std::string& filename);
+
+private:
+    static TriangleMesh ReadOBJ(const std::string& filename);
+
+    static TriangleMesh ReadPLY(const std::string& filename);
+};
+
+#endif //RABBIT_MESHPARSER_HPP
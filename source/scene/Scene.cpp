@@ -3,8 +3,12 @@
 //
 
 #include "Scene.hpp"
+#include "AccelerationStructure.hpp"
+#include "WideBVH.hpp"
 
+#include <algorithm>
 #include <iostream>
+#include <stdexcept>
 
 namespace CL
 {
@@ -16,10 +20,55 @@ if (buffer != nullptr)                          \
     CL_CHECK_CALL(clReleaseMemObject(buffer));  \
 }
 
-Scene::Scene(cl_context context, const SceneDescription& scene_description, const ::Rendering::Camera& camera)
+namespace
+{
+
+// Create a buffer with a copy of the host data and room for capacity elements, empty data gets a buffer of one
+// element since the kernel arguments can not be null
+template <typename T>
+cl_mem CreateBuffer(cl_context context, cl_mem_flags flags, const std::vector<T>& data, size_t capacity = 0)
+{
+    const size_t size{ std::max<size_t>(std::max(data.size(), capacity), 1) };
+    std::vector<T> padded_data;
+    if (size != data.size())
+    {
+        padded_data.resize(size);
+        std::copy(data.cbegin(), data.cend(), padded_data.begin());
+    }
+
+    cl_int err_code{ CL_SUCCESS };
+    cl_mem buffer{ clCreateBuffer(context, flags | CL_MEM_COPY_HOST_PTR, size * sizeof(T),
+                                  padded_data.empty() ? const_cast<T*>(data.data()) : padded_data.data(),
+                                  &err_code) };
+    CL_CHECK_STATUS(err_code);
+
+    return buffer;
+}
+
+// Write the host data at the start of the buffer, empty data writes nothing since a write of zero bytes is an error
+template <typename T>
+void WriteBuffer(cl_command_queue queue, cl_mem buffer, const std::vector<T>& data)
+{
+    if (data.empty())
+    {
+        return;
+    }
+    CL_CHECK_CALL(clEnqueueWriteBuffer(queue, buffer, CL_TRUE, 0, data.size() * sizeof(T), data.data(),
+                                       0, nullptr, nullptr));
+}
+
+} // Anonymous namespace
+
+Scene::Scene(cl_context context, const SceneDescription& scene_description, const ::Rendering::Camera& camera,
+             bool build_acceleration, unsigned int bvh_width)
     : d_spheres{ nullptr }, num_spheres{ scene_description.NumSpheres() },
+      d_vertices{ nullptr }, d_triangles{ nullptr }, num_triangles{ scene_description.NumTriangles() },
       d_material_indices{ nullptr }, d_materials{ nullptr },
-      d_camera{ nullptr }
+      d_camera{ nullptr },
+      d_tlas_nodes{ nullptr }, d_instances{ nullptr }, d_blas_nodes{ nullptr }, d_primitive_indices{ nullptr },
+      blas_width{ bvh_width },
+      d_blas_refit_nodes{ nullptr }, d_blas_refit_prototypes{ nullptr }, d_tlas_refit_nodes{ nullptr },
+      d_prototype_roots{ nullptr }
 {
     cl_int err_code{ CL_SUCCESS };
 
@@ -29,11 +78,11 @@ Scene::Scene(cl_context context, const SceneDescription& scene_description, cons
                                    const_cast<Sphere*>(scene_description.loaded_spheres.data()), &err_code);
         CL_CHECK_STATUS(err_code);
 
-        d_material_indices = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
-                                            num_spheres * sizeof(cl_uint),
-                                            const_cast<unsigned int*>(scene_description.material_index.data()),
-                                            &err_code);
-        CL_CHECK_STATUS(err_code);
+        // Triangles come after the spheres in the primitive indices
+        std::vector<unsigned int> material_indices{ scene_description.material_index };
+        material_indices.insert(material_indices.end(), scene_description.triangle_material_index.cbegin(),
+                                scene_description.triangle_material_index.cend());
+        d_material_indices = CreateBuffer(context, CL_MEM_READ_ONLY, material_indices);
 
         d_materials = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
                                      scene_description.NumMaterials() * sizeof(DiffuseMaterial),
@@ -44,6 +93,46 @@ Scene::Scene(cl_context context, const SceneDescription& scene_description, cons
         d_camera = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(::Rendering::Camera),
                                   const_cast<::Rendering::Camera*>(&camera), &err_code);
         CL_CHECK_STATUS(err_code);
+
+        // Triangles are only intersected through the acceleration structure
+        if (build_acceleration || scene_description.HasInstances() || num_triangles != 0)
+        {
+            d_vertices = CreateBuffer(context, CL_MEM_READ_ONLY, scene_description.mesh_vertices);
+            d_triangles = CreateBuffer(context, CL_MEM_READ_ONLY, scene_description.mesh_indices);
+
+            // A tree over N primitives has at most 2N - 1 nodes, N - 1 of them interior ones to collapse
+            const AccelerationStructure acceleration_structure{ scene_description, blas_width };
+            const size_t max_blas_nodes{ 2 * acceleration_structure.primitive_indices.size() };
+            const size_t max_tlas_nodes{ 2 * acceleration_structure.instances.size() };
+            d_tlas_nodes = CreateBuffer(context, CL_MEM_READ_WRITE, acceleration_structure.tlas_nodes, max_tlas_nodes);
+            d_instances = CreateBuffer(context, CL_MEM_READ_ONLY, acceleration_structure.instances);
+            if (blas_width == 2)
+            {
+                d_blas_nodes = CreateBuffer(context, CL_MEM_READ_WRITE, acceleration_structure.blas_nodes,
+                                            max_blas_nodes);
+            }
+            else
+            {
+                d_blas_nodes = CreateBuffer(context, CL_MEM_READ_ONLY, acceleration_structure.blas_wide_nodes,
+                                            acceleration_structure.primitive_indices.size() *
+                                            WideBVHNodeSize(blas_width));
+            }
+            d_primitive_indices = CreateBuffer(context, CL_MEM_READ_ONLY, acceleration_structure.primitive_indices);
+
+            // Compressed hierarchies are not refit, they only get the placeholder buffers of the kernel arguments
+            const size_t max_blas_refit_nodes{ blas_width == 2 ? max_blas_nodes : 0 };
+            d_blas_refit_nodes = CreateBuffer(context, CL_MEM_READ_ONLY, acceleration_structure.blas_refit_nodes,
+                                              max_blas_refit_nodes);
+            d_blas_refit_prototypes = CreateBuffer(context, CL_MEM_READ_ONLY,
+                                                   acceleration_structure.blas_refit_prototypes,
+                                                   max_blas_refit_nodes);
+            d_tlas_refit_nodes = CreateBuffer(context, CL_MEM_READ_ONLY, acceleration_structure.tlas_refit_nodes,
+                                              max_tlas_nodes);
+            d_prototype_roots = CreateBuffer(context, CL_MEM_READ_ONLY, acceleration_structure.prototype_roots);
+            blas_refit_levels = acceleration_structure.blas_refit_levels;
+            tlas_refit_levels = acceleration_structure.tlas_refit_levels;
+            prototype_costs = acceleration_structure.prototype_costs;
+        }
     }
     catch (const std::exception& ex)
     {
@@ -58,14 +147,79 @@ Scene::~Scene() noexcept
     Cleanup();
 }
 
+void Scene::UpdateCamera(cl_command_queue queue, const ::Rendering::Camera& camera) const
+{
+    CL_CHECK_CALL(clEnqueueWriteBuffer(queue, d_camera, CL_TRUE, 0, sizeof(::Rendering::Camera), &camera,
+                                       0, nullptr, nullptr));
+}
+
+void Scene::UpdateSpheres(cl_command_queue queue, unsigned int first_sphere, const std::vector<Sphere>& spheres) const
+{
+    if (first_sphere + spheres.size() > num_spheres)
+    {
+        throw std::invalid_argument{ "Sphere update out of the range of the scene spheres" };
+    }
+    CL_CHECK_CALL(clEnqueueWriteBuffer(queue, d_spheres, CL_TRUE, first_sphere * sizeof(Sphere),
+                                       spheres.size() * sizeof(Sphere), spheres.data(), 0, nullptr, nullptr));
+}
+
+void Scene::UpdateAcceleration(cl_command_queue queue, const AccelerationStructure& acceleration_structure)
+{
+    // Same primitives and instances, only the nodes and their order change
+    if (acceleration_structure.blas_width != blas_width)
+    {
+        throw std::invalid_argument{ "The acceleration structure has a different node width than the scene" };
+    }
+    WriteBuffer(queue, d_tlas_nodes, acceleration_structure.tlas_nodes);
+    WriteBuffer(queue, d_instances, acceleration_structure.instances);
+    if (blas_width == 2)
+    {
+        WriteBuffer(queue, d_blas_nodes, acceleration_structure.blas_nodes);
+        WriteBuffer(queue, d_blas_refit_nodes, acceleration_structure.blas_refit_nodes);
+        WriteBuffer(queue, d_blas_refit_prototypes, acceleration_structure.blas_refit_prototypes);
+    }
+    else
+    {
+        // Compressed hierarchies have no refit levels
+        WriteBuffer(queue, d_blas_nodes, acceleration_structure.blas_wide_nodes);
+    }
+    WriteBuffer(queue, d_primitive_indices, acceleration_structure.primitive_indices);
+    WriteBuffer(queue, d_tlas_refit_nodes, acceleration_structure.tlas_refit_nodes);
+    WriteBuffer(queue, d_prototype_roots, acceleration_structure.prototype_roots);
+    blas_refit_levels = acceleration_structure.blas_refit_levels;
+    tlas_refit_levels = acceleration_structure.tlas_refit_levels;
+    prototype_costs = acceleration_structure.prototype_costs;
+}
+
+std::string Scene::ProgramDefines() const
+{
+    if (!HasAcceleration())
+    {
+        return num_spheres <= MAX_CONSTANT_SPHERES ? " -D CONSTANT_SPHERES" :
+               " -D SPHERE_TILE_SIZE=" + std::to_string(SPHERE_TILE_SIZE);
+    }
+
+    return blas_width == 2 ? " -D USE_BVH" : " -D USE_BVH -D BVH_WIDTH=" + std::to_string(blas_width);
+}
+
 void Scene::Cleanup() noexcept
 {
     try
     {
         RELEASE(d_spheres)
+        RELEASE(d_vertices)
+        RELEASE(d_triangles)
         RELEASE(d_material_indices)
         RELEASE(d_materials)
         RELEASE(d_camera)
+        RELEASE(d_tlas_nodes)
+        RELEASE(d_instances)
+        RELEASE(d_blas_nodes)
+        RELEASE(d_primitive_indices)
+        RELEASE(d_blas_refit_nodes)
+        RELEASE(d_blas_refit_prototypes)
+        RELEASE(d_tlas_refit_nodes)
+        RELEASE(d_prototype_roots)
     }
     catch (const std::exception& ex)
     {
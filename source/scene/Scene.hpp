@@ -9,6 +9,11 @@
 #include "SceneParser.hpp"
 #include "Camera.hpp"
 
+#include <string>
+#include <vector>
+
+class AccelerationStructure;
+
 namespace CL
 {
 
@@ -16,15 +21,46 @@ namespace CL
 class Scene
 {
 public:
-    Scene(cl_context context, const SceneDescription& scene_description, const ::Rendering::Camera& camera);
+    // Scenes without acceleration structure and with at most this many spheres read them from constant memory,
+    // larger ones are copied to local memory by each work-group in tiles of the same size
+    static constexpr cl_uint MAX_CONSTANT_SPHERES{ 256 };
+    static constexpr cl_uint SPHERE_TILE_SIZE{ 256 };
+
+    // The two level acceleration structure is built if requested or if the scene has instances or triangles,
+    // the bottom level hierarchies use compressed nodes if the width is 4 or 8
+    Scene(cl_context context, const SceneDescription& scene_description, const ::Rendering::Camera& camera,
+          bool build_acceleration = false, unsigned int bvh_width = 2);
 
     ~Scene() noexcept;
 
+    // Upload a new camera to the device, the call blocks until the copy is done
+    void UpdateCamera(cl_command_queue queue, const ::Rendering::Camera& camera) const;
+
+    // Upload new values for the spheres starting from the given one, the call blocks until the copy is done
+    void UpdateSpheres(cl_command_queue queue, unsigned int first_sphere, const std::vector<Sphere>& spheres) const;
+
+    // Replace the acceleration structure with one built again for the same primitives, the call blocks until the
+    // copy is done
+    void UpdateAcceleration(cl_command_queue queue, const AccelerationStructure& acceleration_structure);
+
+    bool HasAcceleration() const noexcept
+    {
+        return d_tlas_nodes != nullptr;
+    }
+
+    // Defines selecting the intersection code for the scene when building the kernel program
+    std::string ProgramDefines() const;
+
     // List of spheres
     cl_mem d_spheres;
     const cl_uint num_spheres;
 
-    // List of indices of material for each sphere
+    // Triangles, vertex positions and three vertex indices for each triangle
+    cl_mem d_vertices;
+    cl_mem d_triangles;
+    const cl_uint num_triangles;
+
+    // List of indices of material for each sphere followed by the ones of each triangle
     cl_mem d_material_indices;
 
     // List of materials
@@ -33,6 +69,26 @@ public:
     // Camera on the device
     cl_mem d_camera;
 
+    // Two level acceleration structure, all null if not built. The node buffers have room for the largest
+    // hierarchies the primitives can produce, so they can be refit and rebuilt in place
+    cl_mem d_tlas_nodes;
+    cl_mem d_instances;
+    cl_mem d_blas_nodes;
+    cl_mem d_primitive_indices;
+    // Number of children of the bottom level nodes, binary nodes are the only ones that can be refit
+    const unsigned int blas_width;
+
+    // Refit order of the nodes and roots of the prototypes, see AccelerationStructure
+    cl_mem d_blas_refit_nodes;
+    cl_mem d_blas_refit_prototypes;
+    cl_mem d_tlas_refit_nodes;
+    cl_mem d_prototype_roots;
+    std::vector<unsigned int> blas_refit_levels;
+    std::vector<unsigned int> tlas_refit_levels;
+
+    // Surface area heuristic cost of each prototype hierarchy after the last build
+    std::vector<float> prototype_costs;
+
 private:
     // Cleanup all buffers without throwing
     void Cleanup() noexcept;
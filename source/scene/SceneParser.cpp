@@ -3,12 +3,14 @@
 //
 
 #include "SceneParser.hpp"
+#include "MeshParser.hpp"
 
 #include <fstream>
 #include <sstream>
 
 SceneDescription::SceneDescription()
-    : image_width{ 0 }, image_height{ 0 }, tile_width{ 0 }, tile_height{ 0 }, pixel_samples{ 0 }
+    : image_width{ 0 }, image_height{ 0 }, tile_width{ 0 }, tile_height{ 0 }, pixel_samples{ 0 },
+      crop_window{ 0, 0, 0, 0 }
 {}
 
 SceneDescription SceneParser::ReadSceneDescription(const std::string& filename)
@@ -55,5 +57,79 @@ SceneDescription SceneParser::ReadSceneDescription(const std::string& filename)
         scene_description.material_index.emplace_back(material_index);
     }
 
+    // Optional prototypes and instances
+    unsigned int num_prototypes;
+    if (scene_file >> num_prototypes)
+    {
+        for (unsigned int p = 0; p != num_prototypes; p++)
+        {
+            unsigned int first_sphere, prototype_spheres;
+            scene_file >> first_sphere >> prototype_spheres;
+            if (!scene_file || prototype_spheres == 0 || first_sphere >= num_spheres ||
+                prototype_spheres > num_spheres - first_sphere)
+            {
+                std::ostringstream error_message;
+                error_message << "Invalid sphere range for prototype " << p << " in file: " << filename;
+                throw std::invalid_argument{ error_message.str() };
+            }
+            scene_description.loaded_prototypes.emplace_back(first_sphere, prototype_spheres);
+        }
+
+        unsigned int num_instances{ 0 };
+        scene_file >> num_instances;
+        for (unsigned int i = 0; i != num_instances; i++)
+        {
+            Instance instance;
+            scene_file >> instance.prototype;
+            for (auto& element : instance.transform)
+            {
+                scene_file >> element;
+            }
+            if (!scene_file || instance.prototype >= num_prototypes)
+            {
+                std::ostringstream error_message;
+                error_message << "Invalid instance " << i << " in file: " << filename;
+                throw std::invalid_argument{ error_message.str() };
+            }
+            scene_description.loaded_instances.push_back(instance);
+        }
+
+        // Optional meshes, relative paths start from the directory of the scene file
+        unsigned int num_meshes;
+        if (scene_file >> num_meshes)
+        {
+            const auto directory_end = filename.find_last_of("/\\");
+            const std::string scene_directory{ directory_end == std::string::npos ?
+                                               "" : filename.substr(0, directory_end + 1) };
+            for (unsigned int m = 0; m != num_meshes; m++)
+            {
+                std::string mesh_filename;
+                unsigned int material_index;
+                if (!(scene_file >> mesh_filename >> material_index))
+                {
+                    std::ostringstream error_message;
+                    error_message << "Invalid mesh " << m << " in file: " << filename;
+                    throw std::invalid_argument{ error_message.str() };
+                }
+                if (mesh_filename.front() != '/')
+                {
+                    mesh_filename = scene_directory + mesh_filename;
+                }
+
+                // Append the mesh to the scene buffers
+                const TriangleMesh mesh{ MeshParser::ReadMesh(mesh_filename) };
+                const auto vertex_offset = static_cast<unsigned int>(scene_description.mesh_vertices.size() / 3);
+                scene_description.mesh_vertices.insert(scene_description.mesh_vertices.end(),
+                                                       mesh.vertices.cbegin(), mesh.vertices.cend());
+                for (const auto index : mesh.indices)
+                {
+                    scene_description.mesh_indices.push_back(vertex_offset + index);
+                }
+                scene_description.triangle_material_index.insert(scene_description.triangle_material_index.end(),
+                                                                  mesh.NumTriangles(), material_index);
+            }
+        }
+    }
+
     return scene_description;
 }
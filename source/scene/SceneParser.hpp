@@ -5,6 +5,9 @@
 #ifndef RABBIT_SCENEPARSER_HPP
 #define RABBIT_SCENEPARSER_HPP
 
+#include "CropWindow.hpp"
+
+#include <array>
 #include <vector>
 #include <string>
 
@@ -34,6 +37,26 @@ struct DiffuseMaterial
     {}
 };
 
+// Group of spheres placed in the scene through instances
+struct Prototype
+{
+    // Range in the list of spheres
+    unsigned int first_sphere, num_spheres;
+
+    constexpr Prototype(unsigned int first, unsigned int num) noexcept
+        : first_sphere{ first }, num_spheres{ num }
+    {}
+};
+
+// Placement of a prototype in the scene
+struct Instance
+{
+    // Prototype to world transform, rows of a 3x4 matrix
+    std::array<float, 12> transform;
+    // Index of the prototype
+    unsigned int prototype;
+};
+
 // Utility class that parses the given file and returns a SceneDescription object
 struct SceneDescription
 {
@@ -43,6 +66,8 @@ struct SceneDescription
     unsigned int tile_width, tile_height;
     // Samples per-pixel
     unsigned int pixel_samples;
+    // Window of the image that is rendered, the whole image if its size is zero. It is not read from the scene file
+    CropWindow crop_window;
 
     // Spheres in the scene
     std::vector<Sphere> loaded_spheres;
@@ -51,8 +76,24 @@ struct SceneDescription
     // Materials
     std::vector<DiffuseMaterial> loaded_materials;
 
+    // Prototypes and their instances, spheres not part of a prototype are placed in the scene as they are
+    std::vector<Prototype> loaded_prototypes;
+    std::vector<Instance> loaded_instances;
+
+    // Triangles of all the meshes in one indexed buffer, placed in the scene as they are
+    std::vector<float> mesh_vertices;
+    std::vector<unsigned int> mesh_indices;
+    // Indices of the materials of each triangle
+    std::vector<unsigned int> triangle_material_index;
+
     SceneDescription();
 
+    // Window of the image covered by the film, the film and the tiles only cover the crop window if there is one
+    CropWindow FilmWindow() const noexcept
+    {
+        return crop_window.width != 0 ? crop_window : CropWindow{ 0, 0, image_width, image_height };
+    }
+
     unsigned int NumSpheres() const noexcept
     {
         return static_cast<unsigned int>(loaded_spheres.size());
@@ -62,6 +103,16 @@ struct SceneDescription
     {
         return static_cast<unsigned int>(loaded_materials.size());
     }
+
+    unsigned int NumTriangles() const noexcept
+    {
+        return static_cast<unsigned int>(mesh_indices.size() / 3);
+    }
+
+    bool HasInstances() const noexcept
+    {
+        return !loaded_instances.empty();
+    }
 };
 
 class SceneParser
@@ -0,0 +1,207 @@
+//
+// Created by Simon on 2019-03-30.
+//
+
+#include "WideBVH.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+namespace
+{
+
+// Largest quantised coordinate
+constexpr float MAX_QUANTISED{ 255.f };
+
+// Exponents of the cell size, inside the range of normal floats so the kernel can build the scale from the bits
+constexpr int MIN_EXPONENT{ -126 };
+constexpr int MAX_EXPONENT{ 127 };
+
+float Component(const Vector3& v, unsigned int axis) noexcept
+{
+    return axis == 0 ? v.x : (axis == 1 ? v.y : v.z);
+}
+
+// Smallest power of two cell size that covers the extent with the quantised range
+int QuantisationExponent(float extent)
+{
+    if (!(extent > 0.f))
+    {
+        return MIN_EXPONENT;
+    }
+    int exponent{ std::max(static_cast<int>(std::ceil(std::log2(extent / MAX_QUANTISED))), MIN_EXPONENT) };
+    while (std::ldexp(MAX_QUANTISED, exponent) < extent)
+    {
+        exponent++;
+    }
+    if (exponent > MAX_EXPONENT)
+    {
+        throw std::runtime_error{ "Node extent too large for the compressed node format" };
+    }
+
+    return exponent;
+}
+
+// Quantise the interval conservatively, the decoded bounds are computed as the kernel does and contain it
+void QuantiseInterval(float origin, float scale, float min, float max, unsigned char& q_min, unsigned char& q_max)
+{
+    float lower{ std::min(std::max(std::floor((min - origin) / scale), 0.f), MAX_QUANTISED) };
+    while (lower > 0.f && origin + lower * scale > min)
+    {
+        lower -= 1.f;
+    }
+    float upper{ std::min(std::max(std::ceil((max - origin) / scale), 0.f), MAX_QUANTISED) };
+    while (upper < MAX_QUANTISED && origin + upper * scale < max)
+    {
+        upper += 1.f;
+    }
+    q_min = static_cast<unsigned char>(lower);
+    q_max = static_cast<unsigned char>(upper);
+}
+
+} // Anonymous namespace
+
+size_t WideBVHNodeSize(unsigned int width)
+{
+    switch (width)
+    {
+        case 4:
+            return sizeof(WideBVHNode<4>);
+        case 8:
+            return sizeof(WideBVHNode<8>);
+        default:
+            throw std::invalid_argument{ "The compressed node width must be 4 or 8" };
+    }
+}
+
+template <unsigned int WIDTH>
+unsigned int WideBVH<WIDTH>::AddHierarchy(const std::vector<BVHNode>& binary_nodes, unsigned int binary_root)
+{
+    const auto root = static_cast<unsigned int>(nodes.size());
+
+    // Wide nodes and the binary node each one was collapsed from, in allocation order
+    std::vector<unsigned int> collapsed_from{ binary_root };
+    nodes.emplace_back();
+    for (unsigned int n = root; n != nodes.size(); n++)
+    {
+        // Open the interior child with the largest area until the node is full, a leaf root is its only child
+        std::vector<unsigned int> children;
+        const BVHNode& binary_node{ binary_nodes[collapsed_from[n - root]] };
+        if (binary_node.count != 0)
+        {
+            children.push_back(collapsed_from[n - root]);
+        }
+        else
+        {
+            children.push_back(binary_node.left_first);
+            children.push_back(binary_node.left_first + 1);
+        }
+        while (children.size() < WIDTH)
+        {
+            auto largest = children.end();
+            float largest_area{ -1.f };
+            for (auto c = children.begin(); c != children.end(); ++c)
+            {
+                const float area{ binary_nodes[*c].Bounds().SurfaceArea() };
+                if (binary_nodes[*c].count == 0 && area > largest_area)
+                {
+                    largest = c;
+                    largest_area = area;
+                }
+            }
+            if (largest == children.end())
+            {
+                break;
+            }
+            const unsigned int opened{ binary_nodes[*largest].left_first };
+            *largest = opened;
+            children.push_back(opened + 1);
+        }
+
+        std::vector<BBox> children_bounds;
+        nodes[n].num_children = static_cast<unsigned char>(children.size());
+        for (unsigned int c = 0; c != children.size(); c++)
+        {
+            const BVHNode& child{ binary_nodes[children[c]] };
+            children_bounds.push_back(child.Bounds());
+            if (child.count != 0)
+            {
+                if (child.count > std::numeric_limits<unsigned short>::max())
+                {
+                    throw std::runtime_error{ "Leaf too large for the compressed node format" };
+                }
+                nodes[n].child[c] = child.left_first;
+                nodes[n].count[c] = static_cast<unsigned short>(child.count);
+            }
+            else
+            {
+                nodes[n].child[c] = static_cast<unsigned int>(nodes.size());
+                nodes[n].count[c] = 0;
+                collapsed_from.push_back(children[c]);
+                nodes.emplace_back();
+            }
+        }
+        QuantiseChildren(n, children_bounds);
+    }
+
+    // Deepest stack the traversal can reach: it descends into one interior child and pushes the others
+    std::vector<unsigned int> stack_depth(nodes.size() - root, 0);
+    for (auto n = static_cast<unsigned int>(nodes.size()); n-- != root;)
+    {
+        const unsigned int num_interior{ static_cast<unsigned int>(
+            std::count(nodes[n].count, nodes[n].count + nodes[n].num_children, 0)) };
+        for (unsigned int c = 0; c != nodes[n].num_children; c++)
+        {
+            if (nodes[n].count[c] == 0)
+            {
+                stack_depth[n - root] = std::max(stack_depth[n - root],
+                                                 num_interior - 1 + stack_depth[nodes[n].child[c] - root]);
+            }
+        }
+    }
+    if (stack_depth.front() > STACK_SIZE)
+    {
+        throw std::runtime_error{ "Compressed hierarchy too deep for the traversal stack" };
+    }
+
+    return root;
+}
+
+template <unsigned int WIDTH>
+void WideBVH<WIDTH>::QuantiseChildren(unsigned int node_index, const std::vector<BBox>& children_bounds)
+{
+    WideBVHNode<WIDTH>& node{ nodes[node_index] };
+    BBox bounds;
+    for (const auto& child_bounds : children_bounds)
+    {
+        bounds.Extend(child_bounds);
+    }
+    node.origin_x = bounds.min.x;
+    node.origin_y = bounds.min.y;
+    node.origin_z = bounds.min.z;
+
+    signed char* exponents[3]{ &node.exponent_x, &node.exponent_y, &node.exponent_z };
+    unsigned char* q_min[3]{ node.min_x, node.min_y, node.min_z };
+    unsigned char* q_max[3]{ node.max_x, node.max_y, node.max_z };
+    for (unsigned int axis = 0; axis != 3; axis++)
+    {
+        const float origin{ Component(bounds.min, axis) };
+        const int exponent{ QuantisationExponent(Component(bounds.max, axis) - origin) };
+        *exponents[axis] = static_cast<signed char>(exponent);
+        const float scale{ std::ldexp(1.f, exponent) };
+
+        // Empty slots get an empty box on every axis
+        std::fill(q_min[axis], q_min[axis] + WIDTH, static_cast<unsigned char>(MAX_QUANTISED));
+        std::fill(q_max[axis], q_max[axis] + WIDTH, 0);
+        for (unsigned int c = 0; c != children_bounds.size(); c++)
+        {
+            QuantiseInterval(origin, scale, Component(children_bounds[c].min, axis),
+                             Component(children_bounds[c].max, axis), q_min[axis][c], q_max[axis][c]);
+        }
+    }
+}
+
+template class WideBVH<4>;
+template class WideBVH<8>;
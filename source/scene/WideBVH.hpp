@@ -0,0 +1,55 @@
+//
+// Created by Simon on 2019-03-30.
+//
+
+#ifndef RABBIT_WIDEBVH_HPP
+#define RABBIT_WIDEBVH_HPP
+
+#include "BVH.hpp"
+
+#include <cstddef>
+#include <vector>
+
+// Compressed node layout shared with the kernel. The children bounds are quantised to 8 bits per axis on a grid
+// placed at the origin with a power of two cell size, so they are read with one fetch and decoded exactly.
+// Children are packed at the front, interior children have count 0 and child is the index of their node,
+// leaves have count primitives starting at child in the primitive indices
+template <unsigned int WIDTH>
+struct WideBVHNode
+{
+    float origin_x, origin_y, origin_z;
+    signed char exponent_x, exponent_y, exponent_z;
+    unsigned char num_children;
+    unsigned int child[WIDTH];
+    unsigned short count[WIDTH];
+    unsigned char min_x[WIDTH], min_y[WIDTH], min_z[WIDTH];
+    unsigned char max_x[WIDTH], max_y[WIDTH], max_z[WIDTH];
+};
+
+static_assert(sizeof(WideBVHNode<4>) == 64, "The 4 wide node must fill a cache line");
+static_assert(sizeof(WideBVHNode<8>) == 112, "Unexpected size of the 8 wide node");
+
+// Size of the compressed node of the given width, throws if the width is not 4 or 8
+size_t WideBVHNodeSize(unsigned int width);
+
+// Hierarchies collapsed from binary ones, each node holds up to WIDTH children. Interior nodes are collapsed
+// greedily opening the child with the largest surface area, every child comes after its parent
+template <unsigned int WIDTH>
+class WideBVH
+{
+public:
+    // Size of the kernel traversal stack, collapsing fails if a hierarchy could overflow it
+    static constexpr unsigned int STACK_SIZE{ 64 };
+
+    // Collapse the binary hierarchy with the given root and append it, returns the index of its root
+    unsigned int AddHierarchy(const std::vector<BVHNode>& binary_nodes, unsigned int binary_root);
+
+    // Nodes of all the hierarchies
+    std::vector<WideBVHNode<WIDTH>> nodes;
+
+private:
+    // Store the children bounds quantised in the node
+    void QuantiseChildren(unsigned int node_index, const std::vector<BBox>& children_bounds);
+};
+
+#endif //RABBIT_WIDEBVH_HPP
@@ -0,0 +1,385 @@
+//
+// Created by Simon on 2019-04-03.
+//
+
+#include "RenderCoordinator.hpp"
+#include "Common.hpp"
+#include "ImageIO.hpp"
+
+#ifndef _WIN32
+
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#endif
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <future>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+namespace Rendering
+{
+
+namespace
+{
+
+#ifndef _WIN32
+
+// Send all the bytes, throws if the connection failed
+void SendAll(int socket, const std::string& data)
+{
+    size_t bytes_sent{ 0 };
+    while (bytes_sent != data.size())
+    {
+        const ssize_t sent{ send(socket, data.data() + bytes_sent, data.size() - bytes_sent, MSG_NOSIGNAL) };
+        if (sent <= 0)
+        {
+            throw std::runtime_error{ "Could not send the chunk: " + std::string{ std::strerror(errno) } };
+        }
+        bytes_sent += static_cast<size_t>(sent);
+    }
+}
+
+// Append what the socket received to the pending bytes, throws if the connection was closed or timed out
+void Receive(int socket, std::string& pending)
+{
+    char buffer[65536];
+    const ssize_t bytes_read{ read(socket, buffer, sizeof(buffer)) };
+    if (bytes_read == 0)
+    {
+        throw std::runtime_error{ "The worker closed the connection" };
+    }
+    if (bytes_read < 0)
+    {
+        throw std::runtime_error{ "Could not read the reply: " + std::string{ std::strerror(errno) } };
+    }
+    pending.append(buffer, static_cast<size_t>(bytes_read));
+}
+
+void CloseSocket(int socket) noexcept
+{
+    close(socket);
+}
+
+#else
+
+void SendAll(int socket, const std::string& data)
+{
+    throw std::runtime_error{ "Distributed rendering is not supported on this platform" };
+}
+
+void Receive(int socket, std::string& pending)
+{
+    throw std::runtime_error{ "Distributed rendering is not supported on this platform" };
+}
+
+void CloseSocket(int socket) noexcept
+{}
+
+#endif
+
+// Read a line from the socket, the bytes after it are left in the pending ones
+std::string ReceiveLine(int socket, std::string& pending)
+{
+    size_t line_end;
+    while ((line_end = pending.find('\n')) == std::string::npos)
+    {
+        Receive(socket, pending);
+    }
+    const std::string line{ pending.substr(0, line_end) };
+    pending.erase(0, line_end + 1);
+
+    return line;
+}
+
+// Read the values from the socket, the bytes after them are left in the pending ones
+void ReceiveFloats(int socket, std::string& pending, std::vector<float>& values)
+{
+    const size_t size{ values.size() * sizeof(float) };
+    while (pending.size() < size)
+    {
+        Receive(socket, pending);
+    }
+    std::memcpy(values.data(), pending.data(), size);
+    pending.erase(0, size);
+}
+
+} // Anonymous namespace
+
+WorkerAddress WorkerAddress::Parse(const std::string& address)
+{
+    const auto separator = address.find_last_of(':');
+    if (separator == std::string::npos || separator == 0 || separator + 1 == address.size())
+    {
+        throw std::invalid_argument{ "Expected host:port, found: " + address };
+    }
+
+    return WorkerAddress{ address.substr(0, separator), address.substr(separator + 1) };
+}
+
+ChunkQueue::ChunkQueue(unsigned int num_tile_rows, unsigned int chunk_tile_rows, unsigned int max_attempts)
+    : max_attempts{ max_attempts }, num_in_flight{ 0 }, num_done{ 0 }, aborted{ false }
+{
+    for (unsigned int first_tile_row = 0; first_tile_row < num_tile_rows; first_tile_row += chunk_tile_rows)
+    {
+        pending.push_back(static_cast<unsigned int>(chunks.size()));
+        chunks.push_back(Chunk{ first_tile_row, std::min(first_tile_row + chunk_tile_rows, num_tile_rows) });
+    }
+    failures.resize(chunks.size(), 0);
+}
+
+bool ChunkQueue::Next(unsigned int& chunk)
+{
+    std::unique_lock<std::mutex> lock{ mutex };
+    chunk_available.wait(lock, [this]()
+    {
+        return aborted || !pending.empty() || num_in_flight == 0;
+    });
+    if (aborted || pending.empty())
+    {
+        return false;
+    }
+    chunk = pending.front();
+    pending.pop_front();
+    num_in_flight++;
+
+    return true;
+}
+
+void ChunkQueue::Done()
+{
+    {
+        const std::lock_guard<std::mutex> lock{ mutex };
+        num_in_flight--;
+        num_done++;
+    }
+    chunk_available.notify_all();
+}
+
+bool ChunkQueue::Failed(unsigned int chunk)
+{
+    bool retry;
+    {
+        const std::lock_guard<std::mutex> lock{ mutex };
+        num_in_flight--;
+        retry = ++failures[chunk] < max_attempts;
+        if (retry)
+        {
+            pending.push_back(chunk);
+        }
+        else
+        {
+            aborted = true;
+        }
+    }
+    chunk_available.notify_all();
+
+    return retry;
+}
+
+bool ChunkQueue::Complete() const
+{
+    const std::lock_guard<std::mutex> lock{ mutex };
+    return num_done == chunks.size();
+}
+
+RenderCoordinator::RenderCoordinator(const std::vector<WorkerAddress>& workers, std::chrono::seconds reply_timeout)
+    : workers{ workers }, reply_timeout{ reply_timeout }
+{
+    if (workers.empty())
+    {
+        throw std::invalid_argument{ "No workers given to the coordinator" };
+    }
+}
+
+void RenderCoordinator::Render(const RenderJob& job, std::ostream& log) const
+{
+    if (job.scene_filename.empty())
+    {
+        throw std::invalid_argument{ "The coordinator needs a scene file" };
+    }
+    const SceneDescription scene_description{ SceneParser::ReadSceneDescription(job.scene_filename) };
+
+    HostFilm film;
+    film.width = scene_description.image_width;
+    film.height = scene_description.image_height;
+    film.tile_height = scene_description.tile_height;
+    for (auto* channel : { &film.pixel_r, &film.pixel_g, &film.pixel_b, &film.filter_weight })
+    {
+        channel->resize(film.width * film.height, 0.f);
+    }
+
+    // The workers render with the tile size of the scene, the chunks are whole rows of tiles
+    const unsigned int num_workers{ static_cast<unsigned int>(workers.size()) };
+    const unsigned int num_tile_rows{ DivideUp(scene_description.image_height, scene_description.tile_height) };
+    ChunkQueue queue{ num_tile_rows, std::max(1u, num_tile_rows / (CHUNKS_PER_WORKER * num_workers)),
+                      MAX_CHUNK_ATTEMPTS };
+
+    // A thread for each worker keeps a connection to it
+    std::vector<std::future<void>> worker_renders;
+    for (unsigned int worker = 0; worker != num_workers; worker++)
+    {
+        worker_renders.push_back(std::async(std::launch::async, &RenderCoordinator::RenderChunks, this, worker,
+                                            std::cref(job), std::ref(queue), std::ref(film), std::ref(log)));
+    }
+    for (auto& worker_render : worker_renders)
+    {
+        worker_render.get();
+    }
+    if (!queue.Complete())
+    {
+        throw std::runtime_error{ "The image could not be rendered by the workers" };
+    }
+
+    IO::WriteFilm(job.output_filename, film.width, film.height, film.pixel_r, film.pixel_g, film.pixel_b,
+                  film.filter_weight);
+}
+
+void RenderCoordinator::RenderChunks(unsigned int worker, const RenderJob& job, ChunkQueue& queue, HostFilm& film,
+                                     std::ostream& log) const
+{
+    const WorkerAddress& address{ workers[worker] };
+    int worker_socket{ -1 };
+    std::string pending;
+    unsigned int chunks_done{ 0 }, failures_in_row{ 0 };
+    unsigned int chunk;
+    while (failures_in_row != MAX_WORKER_FAILURES && queue.Next(chunk))
+    {
+        try
+        {
+            if (worker_socket < 0)
+            {
+                worker_socket = Connect(address);
+                pending.clear();
+            }
+            RenderChunk(worker_socket, pending, job, queue.GetChunk(chunk), film);
+            queue.Done();
+            chunks_done++;
+            failures_in_row = 0;
+        }
+        catch (const std::exception& ex)
+        {
+            // The connection is dropped, the reply of the failed chunk could still be on the way
+            if (worker_socket >= 0)
+            {
+                CloseSocket(worker_socket);
+                worker_socket = -1;
+            }
+            failures_in_row++;
+            const bool retry{ queue.Failed(chunk) };
+            {
+                const std::lock_guard<std::mutex> lock{ log_mutex };
+                log << address.host << ":" << address.port << ": " << ex.what()
+                    << (retry ? ", the chunk is sent again\n" : ", the chunk failed too many times\n");
+            }
+
+            // Give a restarting worker some time before connecting again
+            std::this_thread::sleep_for(std::chrono::milliseconds{ 500 * failures_in_row });
+        }
+    }
+    if (worker_socket >= 0)
+    {
+        CloseSocket(worker_socket);
+    }
+
+    const std::lock_guard<std::mutex> lock{ log_mutex };
+    log << address.host << ":" << address.port << ": " << chunks_done << " chunks"
+        << (failures_in_row == MAX_WORKER_FAILURES ? ", not used anymore after failing\n" : "\n");
+}
+
+#ifndef _WIN32
+
+int RenderCoordinator::Connect(const WorkerAddress& address) const
+{
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* addresses{ nullptr };
+    const int lookup_error{ getaddrinfo(address.host.c_str(), address.port.c_str(), &hints, &addresses) };
+    if (lookup_error != 0)
+    {
+        throw std::runtime_error{ "Could not resolve " + address.host + ": " + gai_strerror(lookup_error) };
+    }
+
+    int worker_socket{ -1 };
+    for (const addrinfo* candidate = addresses; candidate != nullptr && worker_socket < 0;
+         candidate = candidate->ai_next)
+    {
+        worker_socket = socket(candidate->ai_family, candidate->ai_socktype, candidate->ai_protocol);
+        if (worker_socket >= 0 && connect(worker_socket, candidate->ai_addr, candidate->ai_addrlen) != 0)
+        {
+            close(worker_socket);
+            worker_socket = -1;
+        }
+    }
+    freeaddrinfo(addresses);
+    if (worker_socket < 0)
+    {
+        throw std::runtime_error{ "Could not connect: " + std::string{ std::strerror(errno) } };
+    }
+
+    // A worker that does not reply in time makes the reads fail
+    timeval timeout{};
+    timeout.tv_sec = static_cast<decltype(timeout.tv_sec)>(reply_timeout.count());
+    setsockopt(worker_socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    return worker_socket;
+}
+
+#else
+
+int RenderCoordinator::Connect(const WorkerAddress& address) const
+{
+    throw std::runtime_error{ "Distributed rendering is not supported on this platform" };
+}
+
+#endif
+
+void RenderCoordinator::RenderChunk(int worker_socket, std::string& pending, const RenderJob& job,
+                                    const ChunkQueue::Chunk& chunk, HostFilm& film) const
+{
+    RenderJob chunk_job{ job };
+    chunk_job.first_tile_row = chunk.first_tile_row;
+    chunk_job.end_tile_row = chunk.end_tile_row;
+    SendAll(worker_socket, chunk_job.Format() + "\n");
+
+    const unsigned int chunk_first_row{ chunk.first_tile_row * film.tile_height };
+    const unsigned int chunk_end_row{ std::min(chunk.end_tile_row * film.tile_height, film.height) };
+
+    const std::string header{ ReceiveLine(worker_socket, pending) };
+    std::istringstream header_stream{ header };
+    std::string status;
+    unsigned int first_row, end_row, width;
+    // The reply must be for the rows of the chunk, the rows of another chunk could be merged by another thread
+    if (!(header_stream >> status >> first_row >> end_row >> width) || status != "OK" || width != film.width ||
+        first_row != chunk_first_row || end_row != chunk_end_row)
+    {
+        throw std::runtime_error{ "Unexpected reply: " + header };
+    }
+
+    // The whole reply is received before it is merged, a failed chunk leaves the film as it was
+    const size_t band_pixels{ (end_row - first_row) * width };
+    std::vector<float> accumulation(4 * band_pixels);
+    ReceiveFloats(worker_socket, pending, accumulation);
+
+    // The chunks do not overlap, the threads add to different parts of the film
+    const size_t offset{ first_row * width };
+    const std::array<std::vector<float>*, 4> planes{ { &film.pixel_r, &film.pixel_g, &film.pixel_b,
+                                                       &film.filter_weight } };
+    for (size_t p = 0; p != planes.size(); p++)
+    {
+        for (size_t i = 0; i != band_pixels; i++)
+        {
+            (*planes[p])[offset + i] += accumulation[p * band_pixels + i];
+        }
+    }
+}
+
+} // Rendering namespace
@@ -0,0 +1,137 @@
+//
+// Created by Simon on 2019-04-03.
+//
+
+#ifndef RABBIT_RENDERCOORDINATOR_HPP
+#define RABBIT_RENDERCOORDINATOR_HPP
+
+#include "RenderServer.hpp"
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace Rendering
+{
+
+// Address of a worker started with --worker, parsed from host:port
+struct WorkerAddress
+{
+    std::string host;
+    std::string port;
+
+    // Throws if the address has no port
+    static WorkerAddress Parse(const std::string& address);
+};
+
+// Chunks of rows of tiles still to render. A chunk that fails goes back into the queue until it failed too many times,
+// the render is aborted then
+class ChunkQueue
+{
+public:
+    // Rows of tiles [first, end) of the image
+    struct Chunk
+    {
+        unsigned int first_tile_row, end_tile_row;
+    };
+
+    // Split the rows of tiles of the image into chunks of the given number of rows
+    ChunkQueue(unsigned int num_tile_rows, unsigned int chunk_tile_rows, unsigned int max_attempts);
+
+    // Get the next chunk, waits while the only chunks left are being rendered since they could fail. Returns false
+    // when all the chunks are done or the render was aborted
+    bool Next(unsigned int& chunk);
+
+    // Rows of tiles of the chunk
+    const Chunk& GetChunk(unsigned int chunk) const noexcept
+    {
+        return chunks[chunk];
+    }
+
+    // Mark the chunk as merged into the film
+    void Done();
+
+    // Put the chunk back into the queue, returns false if it failed too many times and the render is aborted
+    bool Failed(unsigned int chunk);
+
+    // True if all the chunks were merged into the film
+    bool Complete() const;
+
+private:
+    std::vector<Chunk> chunks;
+
+    // Times each chunk failed
+    std::vector<unsigned int> failures;
+    const unsigned int max_attempts;
+
+    mutable std::mutex mutex;
+    std::condition_variable chunk_available;
+
+    // Chunks waiting for a worker, and number of chunks being rendered and done
+    std::deque<unsigned int> pending;
+    unsigned int num_in_flight, num_done;
+
+    // Set when a chunk failed too many times
+    bool aborted;
+};
+
+// Splits an image into chunks of rows of tiles and sends them to worker processes over TCP, each worker renders the
+// chunks with its own rendering context and sends back the accumulated values and filter weight of the rows, which are
+// summed into the film of the image. A chunk that fails is sent again, to any worker, and a worker that fails several
+// times in a row is not used anymore. The workers must be able to open the scene file with the path given in the job
+// and must have the same byte order as the coordinator
+class RenderCoordinator
+{
+public:
+    // Chunks a worker gets on average, more chunks balance the load better but each one clears the film of the worker
+    static constexpr unsigned int CHUNKS_PER_WORKER{ 4 };
+
+    // Attempts of a chunk before the render is aborted
+    static constexpr unsigned int MAX_CHUNK_ATTEMPTS{ 3 };
+
+    // Failures in a row before a worker is not used anymore
+    static constexpr unsigned int MAX_WORKER_FAILURES{ 3 };
+
+    // A worker that does not reply in time is taken as failed
+    RenderCoordinator(const std::vector<WorkerAddress>& workers, std::chrono::seconds reply_timeout);
+
+    // Render the job on the workers and write the image to its output file, the format is selected by the extension.
+    // The job needs a scene file, the chunks done by each worker are written to the log. Throws if a chunk could
+    // not be rendered
+    void Render(const RenderJob& job, std::ostream& log) const;
+
+private:
+    // Accumulated values and filter weight of the whole image, with the first row at the bottom. The tiles are the
+    // ones of the scene, which the workers render with
+    struct HostFilm
+    {
+        unsigned int width, height, tile_height;
+        std::vector<float> pixel_r, pixel_g, pixel_b, filter_weight;
+    };
+
+    // Send the chunks of the queue to the worker until none is left or the worker failed too many times
+    void RenderChunks(unsigned int worker, const RenderJob& job, ChunkQueue& queue, HostFilm& film,
+                      std::ostream& log) const;
+
+    // Connect to the worker, throws if it can not be reached
+    int Connect(const WorkerAddress& address) const;
+
+    // Send the chunk to the worker connected on the socket and add its reply to the film, throws if the worker
+    // replied with an error or the connection failed
+    void RenderChunk(int worker_socket, std::string& pending, const RenderJob& job, const ChunkQueue::Chunk& chunk,
+                     HostFilm& film) const;
+
+    const std::vector<WorkerAddress> workers;
+    const std::chrono::seconds reply_timeout;
+
+    // Serialises the log lines of the workers
+    mutable std::mutex log_mutex;
+};
+
+} // Rendering namespace
+
+#endif //RABBIT_RENDERCOORDINATOR_HPP
@@ -0,0 +1,476 @@
+//
+// Created by Simon on 2019-03-25.
+//
+
+#include "RenderServer.hpp"
+#include "Common.hpp"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifndef _WIN32
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#endif
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+
+namespace Rendering
+{
+
+namespace
+{
+
+// Parse a vector in the x,y,z form
+Vector3 ParseVector3(const std::string& value)
+{
+    Vector3 v;
+    char separator_0, separator_1;
+    std::istringstream value_stream{ value };
+    if (!(value_stream >> v.x >> separator_0 >> v.y >> separator_1 >> v.z) ||
+        separator_0 != ',' || separator_1 != ',')
+    {
+        throw std::invalid_argument{ "Invalid vector: " + value };
+    }
+
+    return v;
+}
+
+bool SameVector3(const Vector3& lhs, const Vector3& rhs) noexcept
+{
+    return lhs.x == rhs.x && lhs.y == rhs.y && lhs.z == rhs.z;
+}
+
+// Modification time of the file, throws if the file does not exist
+long long FileModificationTime(const std::string& filename)
+{
+    struct stat file_status;
+    if (stat(filename.c_str(), &file_status) != 0)
+    {
+        throw std::invalid_argument{ "Could not open file: " + filename };
+    }
+
+    return static_cast<long long>(file_status.st_mtime);
+}
+
+// Reply line for the error, new lines are replaced to keep one reply per line
+std::string ErrorReply(const std::exception& ex)
+{
+    std::string error{ ex.what() };
+    for (auto& c : error)
+    {
+        if (c == '\n' || c == '\r')
+        {
+            c = ' ';
+        }
+    }
+    return "ERROR " + error;
+}
+
+// True for empty lines and comments
+bool SkipLine(const std::string& line)
+{
+    const auto first = line.find_first_not_of(" \t\r");
+    return first == std::string::npos || line[first] == '#';
+}
+
+// True for the quit request
+bool QuitLine(const std::string& line)
+{
+    const auto first = line.find_first_not_of(" \t\r");
+    return first != std::string::npos && line.compare(first, 4, "quit") == 0;
+}
+
+} // Anonymous namespace
+
+RenderJob::RenderJob() noexcept
+    : eye{ 40.f, 60.f, -70.f }, at{ 0.f }, up{ 0.f, 1.f, 0.f }, fov{ 45.f }, pixel_samples{ 0 },
+      output_filename{ "render.png" }, first_tile_row{ 0 }, end_tile_row{ 0 }
+{}
+
+RenderJob RenderJob::Parse(const std::string& line)
+{
+    RenderJob job;
+
+    std::istringstream line_stream{ line };
+    std::string token;
+    while (line_stream >> token)
+    {
+        const auto separator = token.find('=');
+        if (separator == std::string::npos)
+        {
+            throw std::invalid_argument{ "Expected key=value, found: " + token };
+        }
+        const std::string key{ token.substr(0, separator) };
+        const std::string value{ token.substr(separator + 1) };
+
+        if (key == "scene")
+        {
+            job.scene_filename = value;
+        }
+        else if (key == "eye")
+        {
+            job.eye = ParseVector3(value);
+        }
+        else if (key == "at")
+        {
+            job.at = ParseVector3(value);
+        }
+        else if (key == "up")
+        {
+            job.up = ParseVector3(value);
+        }
+        else if (key == "fov")
+        {
+            job.fov = std::stof(value);
+        }
+        else if (key == "spp")
+        {
+            job.pixel_samples = static_cast<unsigned int>(std::stoul(value));
+        }
+        else if (key == "output")
+        {
+            job.output_filename = value;
+        }
+        else if (key == "tiles")
+        {
+            char separator;
+            std::istringstream value_stream{ value };
+            if (!(value_stream >> job.first_tile_row >> separator >> job.end_tile_row) || separator != ',' ||
+                job.first_tile_row >= job.end_tile_row)
+            {
+                throw std::invalid_argument{ "Invalid range of rows of tiles: " + value };
+            }
+        }
+        else
+        {
+            throw std::invalid_argument{ "Unknown key: " + key };
+        }
+    }
+
+    return job;
+}
+
+std::string RenderJob::Format() const
+{
+    std::ostringstream line;
+    line << std::setprecision(9);
+    if (!scene_filename.empty())
+    {
+        line << "scene=" << scene_filename << " ";
+    }
+    line << "eye=" << eye.x << "," << eye.y << "," << eye.z << " at=" << at.x << "," << at.y << "," << at.z
+         << " up=" << up.x << "," << up.y << "," << up.z << " fov=" << fov;
+    if (pixel_samples != 0)
+    {
+        line << " spp=" << pixel_samples;
+    }
+    line << " output=" << output_filename;
+    if (end_tile_row != 0)
+    {
+        line << " tiles=" << first_tile_row << "," << end_tile_row;
+    }
+
+    return line.str();
+}
+
+RenderServer::RenderServer(CL::RenderingDevice& device, const RenderingOptions& options)
+    : rendering_device(device), rendering_options{ options }, scene_modification_time{ 0 },
+      camera_fov{ 0.f }, running{ true }
+{}
+
+void RenderServer::Serve(std::istream& input, std::ostream& output)
+{
+    std::string line;
+    while (running && std::getline(input, line))
+    {
+        const std::string reply{ ProcessRequest(line) };
+        if (!reply.empty())
+        {
+            output << reply << std::endl;
+        }
+    }
+}
+
+#ifndef _WIN32
+
+void RenderServer::ServeSocket(const std::string& socket_path)
+{
+    sockaddr_un address{};
+    if (socket_path.size() >= sizeof(address.sun_path))
+    {
+        throw std::invalid_argument{ "Socket path too long: " + socket_path };
+    }
+    address.sun_family = AF_UNIX;
+    std::strncpy(address.sun_path, socket_path.c_str(), sizeof(address.sun_path) - 1);
+
+    const int server_socket{ socket(AF_UNIX, SOCK_STREAM, 0) };
+    if (server_socket < 0)
+    {
+        throw std::runtime_error{ "Could not create socket: " + std::string{ std::strerror(errno) } };
+    }
+
+    // Remove stale socket file left by a previous run
+    unlink(socket_path.c_str());
+    if (bind(server_socket, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0 ||
+        listen(server_socket, 1) != 0)
+    {
+        const std::string error{ std::strerror(errno) };
+        close(server_socket);
+        throw std::runtime_error{ "Could not listen on " + socket_path + ": " + error };
+    }
+
+    AcceptRequests(server_socket, [this](const std::string& line)
+                   {
+                       const std::string reply{ ProcessRequest(line) };
+                       return reply.empty() ? reply : reply + "\n";
+                   });
+
+    close(server_socket);
+    unlink(socket_path.c_str());
+}
+
+void RenderServer::ServeWorker(unsigned short port)
+{
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(port);
+
+    const int server_socket{ socket(AF_INET, SOCK_STREAM, 0) };
+    if (server_socket < 0)
+    {
+        throw std::runtime_error{ "Could not create socket: " + std::string{ std::strerror(errno) } };
+    }
+
+    // A restarted worker can listen again while the connections of the previous one are closing
+    const int reuse_address{ 1 };
+    setsockopt(server_socket, SOL_SOCKET, SO_REUSEADDR, &reuse_address, sizeof(reuse_address));
+    if (bind(server_socket, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0 ||
+        listen(server_socket, 1) != 0)
+    {
+        const std::string error{ std::strerror(errno) };
+        close(server_socket);
+        throw std::runtime_error{ "Could not listen on port " + std::to_string(port) + ": " + error };
+    }
+
+    AcceptRequests(server_socket, [this](const std::string& line)
+                   {
+                       return ProcessChunkRequest(line);
+                   });
+
+    close(server_socket);
+}
+
+void RenderServer::AcceptRequests(int server_socket, const RequestHandler& handler)
+{
+    while (running)
+    {
+        const int client_socket{ accept(server_socket, nullptr, nullptr) };
+        if (client_socket < 0)
+        {
+            continue;
+        }
+
+        // Read requests line by line and send back the reply of each
+        std::string pending;
+        char buffer[4096];
+        ssize_t bytes_read;
+        bool connected{ true };
+        while (running && connected && (bytes_read = read(client_socket, buffer, sizeof(buffer))) > 0)
+        {
+            pending.append(buffer, static_cast<size_t>(bytes_read));
+            size_t line_end;
+            while (running && connected && (line_end = pending.find('\n')) != std::string::npos)
+            {
+                const std::string reply{ handler(pending.substr(0, line_end)) };
+                pending.erase(0, line_end + 1);
+
+                // The client could have gone away, the rest of the reply is dropped in that case
+                size_t bytes_sent{ 0 };
+                while (connected && bytes_sent != reply.size())
+                {
+                    const ssize_t sent{ send(client_socket, reply.data() + bytes_sent, reply.size() - bytes_sent,
+                                             MSG_NOSIGNAL) };
+                    connected = sent > 0;
+                    bytes_sent += connected ? static_cast<size_t>(sent) : 0;
+                }
+            }
+        }
+        close(client_socket);
+    }
+}
+
+#else
+
+void RenderServer::ServeSocket(const std::string& socket_path)
+{
+    throw std::runtime_error{ "Unix socket server is not supported on this platform" };
+}
+
+void RenderServer::ServeWorker(unsigned short port)
+{
+    throw std::runtime_error{ "Worker server is not supported on this platform" };
+}
+
+#endif
+
+std::string RenderServer::ProcessRequest(const std::string& line)
+{
+    if (SkipLine(line))
+    {
+        return "";
+    }
+    if (QuitLine(line))
+    {
+        running = false;
+        return "OK quit";
+    }
+
+    try
+    {
+        const RenderJob job{ RenderJob::Parse(line) };
+
+        const auto start = std::chrono::high_resolution_clock::now();
+        ExecuteJob(job);
+        const auto end = std::chrono::high_resolution_clock::now();
+
+        std::ostringstream reply;
+        reply << "OK " << job.output_filename << " "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() << " ms";
+        return reply.str();
+    }
+    catch (const std::exception& ex)
+    {
+        // Report the error and keep serving
+        return ErrorReply(ex);
+    }
+}
+
+std::string RenderServer::ProcessChunkRequest(const std::string& line)
+{
+    if (SkipLine(line))
+    {
+        return "";
+    }
+    if (QuitLine(line))
+    {
+        running = false;
+        return "OK quit\n";
+    }
+
+    try
+    {
+        const RenderJob job{ RenderJob::Parse(line) };
+        if (job.end_tile_row == 0)
+        {
+            throw std::invalid_argument{ "No rows of tiles in the chunk, specify them with tiles=<first>,<end>" };
+        }
+        const SceneDescription job_description{ PrepareJob(job) };
+        if (job.end_tile_row > DivideUp(job_description.image_height, job_description.tile_height))
+        {
+            throw std::invalid_argument{ "The chunk is outside of the image" };
+        }
+
+        // The coordinator merges the radiance only, the rows of tiles follow the tile size of the scene
+        RenderingOptions chunk_options{ rendering_options };
+        chunk_options.denoise = false;
+        chunk_options.collect_stats = false;
+        chunk_options.cost_heatmap = false;
+        const LaunchTuning tuning{ CL::TileRendering::SceneTileTuning(rendering_device, chunk_options, *scene) };
+        const CL::RenderingContext rendering_context{ rendering_device, job_description, *scene, chunk_options,
+                                                      &tuning };
+
+        unsigned int first_row, end_row;
+        std::vector<float> accumulation;
+        rendering_context.RenderTileRows(job.first_tile_row, job.end_tile_row, first_row, end_row, accumulation);
+
+        std::ostringstream header;
+        header << "OK " << first_row << " " << end_row << " " << job_description.image_width << "\n";
+        std::string reply{ header.str() };
+        reply.append(reinterpret_cast<const char*>(accumulation.data()), accumulation.size() * sizeof(float));
+        return reply;
+    }
+    catch (const std::exception& ex)
+    {
+        // Report the error and keep serving, the coordinator sends the chunk again
+        return ErrorReply(ex) + "\n";
+    }
+}
+
+SceneDescription RenderServer::PrepareJob(const RenderJob& job)
+{
+    if (!job.scene_filename.empty())
+    {
+        UpdateScene(job.scene_filename);
+    }
+    if (scene == nullptr)
+    {
+        throw std::invalid_argument{ "No scene loaded, specify one with scene=<file>" };
+    }
+
+    // Upload camera only if it changed
+    if (!SameVector3(job.eye, camera_eye) || !SameVector3(job.at, camera_at) || !SameVector3(job.up, camera_up) ||
+        job.fov != camera_fov)
+    {
+        const Camera camera{ job.eye, job.at, job.up, job.fov,
+                             scene_description.image_width, scene_description.image_height };
+        scene->UpdateCamera(rendering_device.UploadQueue(), camera);
+        camera_eye = job.eye;
+        camera_at = job.at;
+        camera_up = job.up;
+        camera_fov = job.fov;
+    }
+
+    SceneDescription job_description{ scene_description };
+    if (job.pixel_samples != 0)
+    {
+        job_description.pixel_samples = job.pixel_samples;
+    }
+
+    return job_description;
+}
+
+void RenderServer::ExecuteJob(const RenderJob& job)
+{
+    const SceneDescription job_description{ PrepareJob(job) };
+
+    // Rendering buffers come from the device arena and the kernels from the program cache
+    const CL::RenderingContext rendering_context{ rendering_device, job_description, *scene, rendering_options };
+    rendering_context.Render(job.output_filename);
+}
+
+void RenderServer::UpdateScene(const std::string& filename)
+{
+    const long long modification_time{ FileModificationTime(filename) };
+    if (scene != nullptr && filename == scene_filename && modification_time == scene_modification_time)
+    {
+        return;
+    }
+
+    // Drop the resident scene before uploading the new one
+    scene.reset();
+    scene_filename.clear();
+
+    scene_description = SceneParser::ReadSceneDescription(filename);
+    const Camera camera{ camera_eye, camera_at, camera_up, camera_fov,
+                         scene_description.image_width, scene_description.image_height };
+    scene = std::make_unique<const ::CL::Scene>(rendering_device.Context(), scene_description, camera,
+                                                rendering_options.use_bvh, rendering_options.bvh_width);
+    scene_filename = filename;
+    scene_modification_time = modification_time;
+
+    // Force the camera of the next job to be uploaded
+    camera_fov = 0.f;
+}
+
+} // Rendering namespace
@@ -0,0 +1,101 @@
+//
+// Created by Simon on 2019-03-25.
+//
+
+#ifndef RABBIT_RENDERSERVER_HPP
+#define RABBIT_RENDERSERVER_HPP
+
+#include "RenderingContext.hpp"
+
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+
+namespace Rendering
+{
+
+// Single render request, parsed from a line of whitespace separated key=value pairs:
+// scene=<file> eye=x,y,z at=x,y,z up=x,y,z fov=<degrees> spp=<samples> output=<file> tiles=<first>,<end>
+struct RenderJob
+{
+    // Scene file, empty to keep using the resident scene
+    std::string scene_filename;
+    // Camera
+    Vector3 eye, at, up;
+    float fov;
+    // Samples per pixel, zero to use the value from the scene file
+    unsigned int pixel_samples;
+    // Output image
+    std::string output_filename;
+    // Range [first, end) of rows of tiles of a chunk sent to a worker, empty for a whole image
+    unsigned int first_tile_row, end_tile_row;
+
+    RenderJob() noexcept;
+
+    static RenderJob Parse(const std::string& line);
+
+    // Line that parses back to the job
+    std::string Format() const;
+};
+
+// Long running server that keeps the device resources and the last scene on the device between jobs
+class RenderServer
+{
+public:
+    RenderServer(CL::RenderingDevice& device, const RenderingOptions& options);
+
+    // Serve the requests read from the input stream, one per line, until quit or end of input
+    void Serve(std::istream& input, std::ostream& output);
+
+    // Serve the requests sent to a local Unix socket, one connection at a time, until quit
+    void ServeSocket(const std::string& socket_path);
+
+    // Serve the chunks sent by a coordinator on the TCP port, one connection at a time, until quit. Each chunk is a
+    // job with the tiles key, the reply is the line "OK <first row> <end row> <width>" followed by the red, green,
+    // blue and filter weight planes of the film rows as native 32 bit floats, or an ERROR line
+    void ServeWorker(unsigned short port);
+
+private:
+    // Handle a request line and produce the bytes to send back, nothing is sent if empty
+    using RequestHandler = std::function<std::string(const std::string&)>;
+
+    // Read requests line by line from the clients accepted on the socket, until quit
+    void AcceptRequests(int server_socket, const RequestHandler& handler);
+
+    // Process a single request line and produce the reply
+    std::string ProcessRequest(const std::string& line);
+
+    // Process a chunk request line and produce the reply header and accumulation
+    std::string ProcessChunkRequest(const std::string& line);
+
+    // Load the scene and upload the camera of the job, returns the scene description with the samples of the job
+    SceneDescription PrepareJob(const RenderJob& job);
+
+    // Render the job, uploading only what changed since the previous one
+    void ExecuteJob(const RenderJob& job);
+
+    // Load scene file if it is not the resident one or if it changed on disk
+    void UpdateScene(const std::string& filename);
+
+    // Device resources kept between jobs
+    CL::RenderingDevice& rendering_device;
+    const RenderingOptions rendering_options;
+
+    // Resident scene, the file modification time tells if it needs to be loaded again
+    std::string scene_filename;
+    long long scene_modification_time;
+    SceneDescription scene_description;
+    std::unique_ptr<const ::CL::Scene> scene;
+
+    // Camera currently on the device
+    Vector3 camera_eye, camera_at, camera_up;
+    float camera_fov;
+
+    // Set when a quit request is received
+    bool running;
+};
+
+} // Rendering namespace
+
+#endif //RABBIT_RENDERSERVER_HPP
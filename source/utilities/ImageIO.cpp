@@ -0,0 +1,349 @@
+//
+// Created by Simon on 2019-03-28.
+//
+
+#include "ImageIO.hpp"
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+
+#include "stb_image_writer.hpp"
+
+#ifdef RABBIT_HAS_ZLIB
+#include <zlib.h>
+#endif
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <future>
+#include <stdexcept>
+#include <thread>
+
+namespace IO
+{
+
+namespace
+{
+
+// Rows in each block of a ZIP compressed EXR file
+constexpr unsigned int EXR_BLOCK_ROWS{ 16 };
+
+// Values are written in the host byte order, both formats are little endian
+template<typename T>
+void Append(std::vector<char>& output, const T& value)
+{
+    const auto bytes = reinterpret_cast<const char*>(&value);
+    output.insert(output.end(), bytes, bytes + sizeof(T));
+}
+
+void AppendString(std::vector<char>& output, const std::string& value)
+{
+    output.insert(output.end(), value.c_str(), value.c_str() + value.size() + 1);
+}
+
+void AppendAttribute(std::vector<char>& header, const std::string& name, const std::string& type,
+                     const std::vector<char>& value)
+{
+    AppendString(header, name);
+    AppendString(header, type);
+    Append(header, static_cast<std::int32_t>(value.size()));
+    header.insert(header.end(), value.begin(), value.end());
+}
+
+// Build the header of a scanline image with 32 bit float B, G and R channels, the channels are sorted by name. The
+// pixels are the ones of the window of the image
+std::vector<char> EXRHeader(const CropWindow& window, unsigned int image_width, unsigned int image_height,
+                            unsigned char compression)
+{
+    std::vector<char> header;
+    // Magic number and version 2, single part scanline file
+    Append(header, static_cast<std::int32_t>(20000630));
+    Append(header, static_cast<std::int32_t>(2));
+
+    std::vector<char> channels;
+    for (const char* channel_name : { "B", "G", "R" })
+    {
+        AppendString(channels, channel_name);
+        // Pixel type FLOAT, not linear, three reserved bytes and sampling 1 in x and y
+        Append(channels, static_cast<std::int32_t>(2));
+        Append(channels, static_cast<std::uint32_t>(0));
+        Append(channels, static_cast<std::int32_t>(1));
+        Append(channels, static_cast<std::int32_t>(1));
+    }
+    channels.push_back('\0');
+    AppendAttribute(header, "channels", "chlist", channels);
+
+    AppendAttribute(header, "compression", "compression", { static_cast<char>(compression) });
+
+    std::vector<char> data_window;
+    Append(data_window, static_cast<std::int32_t>(window.x));
+    Append(data_window, static_cast<std::int32_t>(window.y));
+    Append(data_window, static_cast<std::int32_t>(window.x + window.width - 1));
+    Append(data_window, static_cast<std::int32_t>(window.y + window.height - 1));
+    AppendAttribute(header, "dataWindow", "box2i", data_window);
+    std::vector<char> display_window;
+    Append(display_window, static_cast<std::int32_t>(0));
+    Append(display_window, static_cast<std::int32_t>(0));
+    Append(display_window, static_cast<std::int32_t>(image_width - 1));
+    Append(display_window, static_cast<std::int32_t>(image_height - 1));
+    AppendAttribute(header, "displayWindow", "box2i", display_window);
+
+    // Increasing y, the blocks are written from the top of the image
+    AppendAttribute(header, "lineOrder", "lineOrder", { 0 });
+
+    std::vector<char> one;
+    Append(one, 1.f);
+    AppendAttribute(header, "pixelAspectRatio", "float", one);
+    std::vector<char> center;
+    Append(center, 0.f);
+    Append(center, 0.f);
+    AppendAttribute(header, "screenWindowCenter", "v2f", center);
+    AppendAttribute(header, "screenWindowWidth", "float", one);
+
+    header.push_back('\0');
+    return header;
+}
+
+// Encode the chunk of the raster rows [first_row, end_row), counted from the top: the first row in the image, the
+// size of the data and the rows with the channels one after the other. The raster starts at the given image row
+std::vector<char> EXRChunk(unsigned int width, unsigned int height, const std::vector<float>& raster,
+                           unsigned int first_row, unsigned int end_row, unsigned int raster_y)
+{
+    std::vector<float> rows;
+    rows.reserve(3 * width * (end_row - first_row));
+    for (unsigned int y = first_row; y != end_row; y++)
+    {
+        // The raster has the first row at the bottom
+        const float* row{ raster.data() + 3 * (height - 1 - y) * width };
+        for (unsigned int channel = 3; channel-- != 0;)
+        {
+            for (unsigned int x = 0; x != width; x++)
+            {
+                rows.push_back(row[3 * x + channel]);
+            }
+        }
+    }
+    const auto raw = reinterpret_cast<const unsigned char*>(rows.data());
+    const size_t raw_size{ rows.size() * sizeof(float) };
+
+    std::vector<char> chunk;
+    Append(chunk, static_cast<std::int32_t>(raster_y + first_row));
+
+#ifdef RABBIT_HAS_ZLIB
+    // Split the even and odd bytes, the high bytes of the floats end up together, and store the difference of
+    // consecutive bytes so the smooth parts of the image become runs of similar values for deflate
+    std::vector<unsigned char> predicted(raw_size);
+    const size_t odd_start{ (raw_size + 1) / 2 };
+    for (size_t i = 0; i != raw_size; i++)
+    {
+        predicted[(i % 2 == 0) ? i / 2 : odd_start + i / 2] = raw[i];
+    }
+    for (size_t i = raw_size; i-- > 1;)
+    {
+        predicted[i] = static_cast<unsigned char>(predicted[i] - predicted[i - 1] + 128);
+    }
+
+    uLongf compressed_size{ compressBound(static_cast<uLong>(raw_size)) };
+    std::vector<unsigned char> compressed(compressed_size);
+    if (compress2(compressed.data(), &compressed_size, predicted.data(), static_cast<uLong>(raw_size),
+                  Z_BEST_SPEED) != Z_OK)
+    {
+        throw std::runtime_error("Error compressing EXR block");
+    }
+    // Blocks that do not shrink are stored as they are, readers recognise them by the size
+    if (compressed_size < raw_size)
+    {
+        Append(chunk, static_cast<std::int32_t>(compressed_size));
+        chunk.insert(chunk.end(), compressed.begin(), compressed.begin() + compressed_size);
+        return chunk;
+    }
+#endif
+
+    Append(chunk, static_cast<std::int32_t>(raw_size));
+    chunk.insert(chunk.end(), raw, raw + raw_size);
+    return chunk;
+}
+
+} // Anonymous namespace
+
+ImageFormat ImageFormatFromFilename(const std::string& filename)
+{
+    const size_t dot{ filename.find_last_of('.') };
+    if (dot == std::string::npos)
+    {
+        return ImageFormat::PNG;
+    }
+    std::string extension{ filename.substr(dot + 1) };
+    std::transform(extension.begin(), extension.end(), extension.begin(),
+                   [](unsigned char c)
+                   {
+                       return static_cast<char>(std::tolower(c));
+                   });
+    if (extension == "pfm")
+    {
+        return ImageFormat::PFM;
+    }
+    if (extension == "exr")
+    {
+        return ImageFormat::EXR;
+    }
+    return ImageFormat::PNG;
+}
+
+std::string ReplaceExtension(const std::string& filename, const std::string& extension)
+{
+    const size_t dot{ filename.find_last_of('.') };
+    const size_t slash{ filename.find_last_of("/\\") };
+    const bool has_extension{ dot != std::string::npos && (slash == std::string::npos || dot > slash) };
+
+    return (has_extension ? filename.substr(0, dot) : filename) + extension;
+}
+
+void WritePNG(const std::string& filename, unsigned int width, unsigned int height,
+              const std::vector<unsigned char>& raster)
+{
+    // The raster is already flipped, the global stbi flip setting is not thread safe
+    if (!stbi_write_png(filename.c_str(), width, height, 3, raster.data(), 0))
+    {
+        throw std::runtime_error("Error creating PNG image");
+    }
+}
+
+void WritePFM(const std::string& filename, unsigned int width, unsigned int height, const std::vector<float>& raster)
+{
+    std::ofstream file{ filename, std::ios::binary };
+    if (!file.is_open())
+    {
+        throw std::runtime_error("Could not open image file: " + filename);
+    }
+
+    // Negative scale marks little endian data, rows go from the bottom to the top as in the raster
+    file << "PF\n" << width << " " << height << "\n-1.0\n";
+    file.write(reinterpret_cast<const char*>(raster.data()), raster.size() * sizeof(float));
+    if (!file)
+    {
+        throw std::runtime_error("Error writing PFM image: " + filename);
+    }
+}
+
+void WriteEXR(const std::string& filename, unsigned int width, unsigned int height, const std::vector<float>& raster)
+{
+    WriteEXR(filename, CropWindow{ 0, 0, width, height }, width, height, raster);
+}
+
+void WriteEXR(const std::string& filename, const CropWindow& window, unsigned int image_width,
+              unsigned int image_height, const std::vector<float>& raster)
+{
+    const unsigned int width{ window.width };
+    const unsigned int height{ window.height };
+#ifdef RABBIT_HAS_ZLIB
+    const unsigned char compression{ 3 };
+#else
+    const unsigned char compression{ 0 };
+#endif
+    const std::vector<char> header{ EXRHeader(window, image_width, image_height, compression) };
+
+    // Uncompressed files have a block for each row
+    const unsigned int block_rows{ compression != 0 ? EXR_BLOCK_ROWS : 1 };
+    const unsigned int num_blocks{ (height + block_rows - 1) / block_rows };
+    std::vector<std::vector<char>> chunks(num_blocks);
+
+    // Each thread encodes a contiguous range of blocks
+    const unsigned int num_threads{ std::max(1u, std::min(std::thread::hardware_concurrency(), num_blocks)) };
+    std::vector<std::future<void>> encodings;
+    for (unsigned int t = 0; t != num_threads; t++)
+    {
+        encodings.push_back(std::async(std::launch::async,
+                                       [&, t]()
+                                       {
+                                           for (unsigned int b = t * num_blocks / num_threads;
+                                                b != (t + 1) * num_blocks / num_threads; b++)
+                                           {
+                                               chunks[b] = EXRChunk(width, height, raster, b * block_rows,
+                                                                    std::min((b + 1) * block_rows, height),
+                                                                    window.y);
+                                           }
+                                       }));
+    }
+    for (auto& encoding : encodings)
+    {
+        encoding.get();
+    }
+
+    // The offset table after the header gives the position of each chunk in the file
+    std::vector<char> offsets;
+    std::uint64_t offset{ header.size() + num_blocks * sizeof(std::uint64_t) };
+    for (const auto& chunk : chunks)
+    {
+        Append(offsets, offset);
+        offset += chunk.size();
+    }
+
+    std::ofstream file{ filename, std::ios::binary };
+    if (!file.is_open())
+    {
+        throw std::runtime_error("Could not open image file: " + filename);
+    }
+    file.write(header.data(), header.size());
+    file.write(offsets.data(), offsets.size());
+    for (const auto& chunk : chunks)
+    {
+        file.write(chunk.data(), chunk.size());
+    }
+    if (!file)
+    {
+        throw std::runtime_error("Error writing EXR image: " + filename);
+    }
+}
+
+void WriteFilm(const std::string& filename, unsigned int width, unsigned int height,
+               const std::vector<float>& pixel_r, const std::vector<float>& pixel_g,
+               const std::vector<float>& pixel_b, const std::vector<float>& filter_weight)
+{
+    WriteFilm(filename, CropWindow{ 0, 0, width, height }, width, height, pixel_r, pixel_g, pixel_b, filter_weight);
+}
+
+void WriteFilm(const std::string& filename, const CropWindow& window, unsigned int image_width,
+               unsigned int image_height, const std::vector<float>& pixel_r, const std::vector<float>& pixel_g,
+               const std::vector<float>& pixel_b, const std::vector<float>& filter_weight)
+{
+    const unsigned int width{ window.width }, height{ window.height };
+    std::vector<float> hdr(3 * width * height);
+    for (unsigned int i = 0; i != width * height; i++)
+    {
+        const float inv_filter_weight{ filter_weight[i] > 0.f ? 1.f / filter_weight[i] : 0.f };
+        hdr[3 * i] = pixel_r[i] * inv_filter_weight;
+        hdr[3 * i + 1] = pixel_g[i] * inv_filter_weight;
+        hdr[3 * i + 2] = pixel_b[i] * inv_filter_weight;
+    }
+    switch (ImageFormatFromFilename(filename))
+    {
+        case ImageFormat::PNG:
+        {
+            // Gamma and quantise the radiance, the rows are flipped to the image order
+            std::vector<unsigned char> ldr(3 * width * height);
+            for (unsigned int y = 0; y != height; y++)
+            {
+                const float* const film_row{ hdr.data() + 3 * (height - 1 - y) * width };
+                unsigned char* const image_row{ ldr.data() + 3 * y * width };
+                for (unsigned int i = 0; i != 3 * width; i++)
+                {
+                    image_row[i] = static_cast<unsigned char>(std::pow(std::min(film_row[i], 1.f), 2.2f) * 255);
+                }
+            }
+            WritePNG(filename, width, height, ldr);
+            break;
+        }
+        case ImageFormat::PFM:
+            WritePFM(filename, width, height, hdr);
+            break;
+        case ImageFormat::EXR:
+            WriteEXR(filename, window, image_width, image_height, hdr);
+            break;
+    }
+}
+
+} // IO namespace
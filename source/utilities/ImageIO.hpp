@@ -0,0 +1,60 @@
+//
+// Created by Simon on 2019-03-28.
+//
+
+#ifndef RABBIT_IMAGEIO_HPP
+#define RABBIT_IMAGEIO_HPP
+
+#include "CropWindow.hpp"
+
+#include <string>
+#include <vector>
+
+namespace IO
+{
+
+// Output image formats, PNG stores 8 bit gamma encoded values, PFM and EXR store the radiance as 32 bit floats
+enum class ImageFormat
+{
+    PNG,
+    PFM,
+    EXR
+};
+
+// Format selected by the extension of the file name, PNG for unknown extensions
+ImageFormat ImageFormatFromFilename(const std::string& filename);
+
+// File name with the extension replaced by the given one, which includes the dot. A dot in a directory name is not
+// taken as the extension
+std::string ReplaceExtension(const std::string& filename, const std::string& extension);
+
+// Write 8 bit RGB raster with the first row at the top of the image
+void WritePNG(const std::string& filename, unsigned int width, unsigned int height,
+              const std::vector<unsigned char>& raster);
+
+// Write float RGB raster with the first row at the bottom of the image, the order of the film
+void WritePFM(const std::string& filename, unsigned int width, unsigned int height, const std::vector<float>& raster);
+
+// Write float RGB raster with the first row at the bottom of the image as a scanline OpenEXR file. Blocks of 16
+// rows are ZIP compressed in parallel, without zlib the file is stored uncompressed
+void WriteEXR(const std::string& filename, unsigned int width, unsigned int height, const std::vector<float>& raster);
+
+// Write float RGB raster of a window of the image, the data window of the file places it in the display window of the
+// whole image so compositing tools put it back in place
+void WriteEXR(const std::string& filename, const CropWindow& window, unsigned int image_width,
+              unsigned int image_height, const std::vector<float>& raster);
+
+// Write the image from the accumulated radiance and filter weight of a film with the first row at the bottom, the
+// format is selected by the extension of the file name. Pixels without samples are black
+void WriteFilm(const std::string& filename, unsigned int width, unsigned int height,
+               const std::vector<float>& pixel_r, const std::vector<float>& pixel_g,
+               const std::vector<float>& pixel_b, const std::vector<float>& filter_weight);
+
+// Write the image from a film covering a window of the image, .exr files keep the window in place in the whole image
+void WriteFilm(const std::string& filename, const CropWindow& window, unsigned int image_width,
+               unsigned int image_height, const std::vector<float>& pixel_r, const std::vector<float>& pixel_g,
+               const std::vector<float>& pixel_b, const std::vector<float>& filter_weight);
+
+} // IO namespace
+
+#endif //RABBIT_IMAGEIO_HPP